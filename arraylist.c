@@ -1,32 +1,83 @@
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-#include "arraylist.h"
-
-#define INITIAL_SIZE 1024
-
-void ArrayListBuf_init(struct ArrayListBuf* b) {
-    b->buff = (char*)malloc(INITIAL_SIZE);
-    b->capacity = INITIAL_SIZE;
-    b->N = 0;
-}
-
-void ArrayListBuf_free(struct ArrayListBuf* b) {
-    free(b->buff);
-}
-
-void ArrayListBuf_doubleCapacity(struct ArrayListBuf* b) {
-    char* newBuff = (char*)malloc(b->capacity*2);
-    memcpy(newBuff, b->buff, b->capacity);
-    free(b->buff);
-    b->buff = newBuff;
-    b->capacity *= 2;
-}
-
-void ArrayListBuf_push(struct ArrayListBuf* b, char* s, int len) {
-    while (b->N + len > b->capacity) {
-        ArrayListBuf_doubleCapacity(b);
-    }
-    memcpy(b->buff+b->N, s, len);
-    b->N += len;
-}
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include "arraylist.h"
+
+#define INITIAL_SIZE 1024
+
+void ArrayListBuf_init(struct ArrayListBuf* b) {
+    // Storage is allocated on first use
+    b->buff = NULL;
+    b->capacity = 0;
+    b->N = 0;
+}
+
+void ArrayListBuf_free(struct ArrayListBuf* b) {
+    free(b->buff);
+    ArrayListBuf_init(b);
+}
+
+void ArrayListBuf_reserve(struct ArrayListBuf* b, size_t capacity) {
+    if (capacity > b->capacity) {
+        size_t newCapacity = b->capacity > 0 ? b->capacity : INITIAL_SIZE;
+        while (newCapacity < capacity) {
+            newCapacity *= 2;
+        }
+        // realloc only has to move the bytes in use, and often
+        // doesn't have to move anything at all
+        b->buff = (char*)realloc(b->buff, newCapacity);
+        b->capacity = newCapacity;
+    }
+}
+
+void ArrayListBuf_doubleCapacity(struct ArrayListBuf* b) {
+    ArrayListBuf_reserve(b, b->capacity > 0 ? b->capacity*2 : INITIAL_SIZE);
+}
+
+void ArrayListBuf_shrink(struct ArrayListBuf* b) {
+    if (b->N == 0) {
+        ArrayListBuf_free(b);
+    }
+    else if (b->N < b->capacity) {
+        b->buff = (char*)realloc(b->buff, b->N);
+        b->capacity = b->N;
+    }
+}
+
+void ArrayListBuf_clear(struct ArrayListBuf* b) {
+    b->N = 0;
+}
+
+void ArrayListBuf_push(struct ArrayListBuf* b, const char* s, size_t len) {
+    ArrayListBuf_reserve(b, b->N + len);
+    memcpy(b->buff+b->N, s, len);
+    b->N += len;
+}
+
+int ArrayListBuf_appendf(struct ArrayListBuf* b, const char* fmt, ...) {
+    va_list args;
+    // First try to format straight into whatever room is left
+    ArrayListBuf_reserve(b, b->N + 1);
+    va_start(args, fmt);
+    int len = vsnprintf(b->buff + b->N, b->capacity - b->N, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return len;
+    }
+    if (b->N + len + 1 > b->capacity) {
+        // Didn't fit; grow to the exact size needed and format again
+        ArrayListBuf_reserve(b, b->N + len + 1);
+        va_start(args, fmt);
+        vsnprintf(b->buff + b->N, b->capacity - b->N, fmt, args);
+        va_end(args);
+    }
+    b->N += len;
+    return len;
+}
+
+char* ArrayListBuf_cstr(struct ArrayListBuf* b) {
+    ArrayListBuf_reserve(b, b->N + 1);
+    b->buff[b->N] = '\0';
+    return b->buff;
+}
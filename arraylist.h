@@ -1,15 +1,143 @@
-#ifndef ARRAYLIST_H
-#define ARRAYLIST_H
-
-typedef struct ArrayListBuf {
-    char* buff;
-    int capacity;
-    int N;
-} ArrayListBuf;
-
-void ArrayListBuf_init(struct ArrayListBuf* b);
-void ArrayListBuf_free(struct ArrayListBuf* b);
-void ArrayListBuf_doubleCapacity(struct ArrayListBuf* b);
-void ArrayListBuf_push(struct ArrayListBuf* b, char* s, int len);
-
-#endif
+#ifndef ARRAYLIST_H
+#define ARRAYLIST_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A growable byte buffer.  Storage is allocated lazily and kept across
+ * ArrayListBuf_clear() calls, so a buffer that is reused (a line being
+ * typed, a frame being encoded, a line being formatted) stops touching
+ * the allocator once it has reached its working size.
+ */
+typedef struct ArrayListBuf {
+    char* buff;
+    size_t capacity;
+    size_t N;
+} ArrayListBuf;
+
+void ArrayListBuf_init(struct ArrayListBuf* b);
+void ArrayListBuf_free(struct ArrayListBuf* b);
+
+/**
+ * @brief Make sure there's room for at least capacity bytes
+ * without another allocation
+ *
+ * @param b Buffer
+ * @param capacity Total number of bytes needed
+ */
+void ArrayListBuf_reserve(struct ArrayListBuf* b, size_t capacity);
+void ArrayListBuf_doubleCapacity(struct ArrayListBuf* b);
+
+/**
+ * @brief Give back any capacity beyond what's currently in use
+ *
+ * @param b Buffer
+ */
+void ArrayListBuf_shrink(struct ArrayListBuf* b);
+
+/**
+ * @brief Forget the contents but keep the storage for reuse
+ *
+ * @param b Buffer
+ */
+void ArrayListBuf_clear(struct ArrayListBuf* b);
+void ArrayListBuf_push(struct ArrayListBuf* b, const char* s, size_t len);
+
+/**
+ * @brief printf onto the end of the buffer.  The result is null
+ * terminated, but the terminator is not counted in b->N, so further
+ * appends pick up where this one left off
+ *
+ * @param b Buffer
+ * @param fmt printf style format string
+ * @return int Number of bytes appended
+ */
+int ArrayListBuf_appendf(struct ArrayListBuf* b, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Null terminate the buffer (without counting the terminator
+ * in b->N) and return it as a C string
+ *
+ * @param b Buffer
+ * @return char*
+ */
+char* ArrayListBuf_cstr(struct ArrayListBuf* b);
+
+
+/**
+ * @brief Define a typed, growable array named Name holding items of type T,
+ * along with static inline Name_init, Name_free, Name_reserve, Name_shrink,
+ * Name_clear, Name_push, Name_pop, Name_insert and Name_remove.
+ * Items live contiguously in v->data[0..v->N-1]
+ */
+#define ARRAYLIST_DEFINE(Name, T)                                               \
+typedef struct Name {                                                           \
+    T* data;                                                                    \
+    size_t capacity;                                                            \
+    size_t N;                                                                   \
+} Name;                                                                         \
+                                                                                \
+static inline void Name##_init(Name* v) {                                       \
+    v->data = NULL;                                                             \
+    v->capacity = 0;                                                            \
+    v->N = 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline void Name##_free(Name* v) {                                       \
+    free(v->data);                                                              \
+    Name##_init(v);                                                             \
+}                                                                               \
+                                                                                \
+static inline void Name##_reserve(Name* v, size_t capacity) {                   \
+    if (capacity > v->capacity) {                                               \
+        size_t newCapacity = v->capacity > 0 ? v->capacity : 8;                 \
+        while (newCapacity < capacity) {                                        \
+            newCapacity *= 2;                                                   \
+        }                                                                       \
+        v->data = (T*)realloc(v->data, newCapacity*sizeof(T));                  \
+        v->capacity = newCapacity;                                              \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline void Name##_shrink(Name* v) {                                     \
+    if (v->N == 0) {                                                            \
+        Name##_free(v);                                                         \
+    }                                                                           \
+    else if (v->N < v->capacity) {                                              \
+        v->data = (T*)realloc(v->data, v->N*sizeof(T));                         \
+        v->capacity = v->N;                                                     \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+static inline void Name##_clear(Name* v) {                                      \
+    v->N = 0;                                                                   \
+}                                                                               \
+                                                                                \
+static inline void Name##_push(Name* v, T item) {                               \
+    if (v->N == v->capacity) {                                                  \
+        Name##_reserve(v, v->N + 1);                                            \
+    }                                                                           \
+    v->data[v->N++] = item;                                                     \
+}                                                                               \
+                                                                                \
+static inline T Name##_pop(Name* v) {                                           \
+    return v->data[--v->N];                                                     \
+}                                                                               \
+                                                                                \
+static inline void Name##_insert(Name* v, size_t i, T item) {                   \
+    Name##_reserve(v, v->N + 1);                                                \
+    memmove(v->data + i + 1, v->data + i, (v->N - i)*sizeof(T));               \
+    v->data[i] = item;                                                          \
+    v->N++;                                                                     \
+}                                                                               \
+                                                                                \
+static inline T Name##_remove(Name* v, size_t i) {                              \
+    T item = v->data[i];                                                        \
+    memmove(v->data + i, v->data + i + 1, (v->N - i - 1)*sizeof(T));           \
+    v->N--;                                                                     \
+    return item;                                                                \
+}
+
+#endif
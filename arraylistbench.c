@@ -0,0 +1,149 @@
+// Purpose: Benchmarks for the growable buffer and typed arrays
+// in arraylist.h, covering the ways chatter uses them
+//
+// Usage: ./arraylistbench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "arraylist.h"
+#include "frame.h"
+
+#define DEFAULT_ITERATIONS 10000000
+
+ARRAYLIST_DEFINE(PtrArray, void*)
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void report(char* name, long n, double elapsed) {
+    printf("%-32s %8.3f s  %8.1f ns/op\n", name, elapsed, elapsed*1e9/n);
+}
+
+/**
+ * @brief Typing: one byte at a time into a buffer that's reused for every line
+ */
+void benchTypeLines(long n) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        char ch = 'a' + i%26;
+        ArrayListBuf_push(&b, &ch, 1);
+        if (i%80 == 79) {
+            ArrayListBuf_cstr(&b);
+            ArrayListBuf_clear(&b);
+        }
+    }
+    report("push byte (reused line buffer)", n, now() - start);
+    ArrayListBuf_free(&b);
+}
+
+/**
+ * @brief The same workload, allocating a fresh buffer for each line
+ * the way typeLoop() used to
+ */
+void benchTypeLinesFresh(long n) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        char ch = 'a' + i%26;
+        ArrayListBuf_push(&b, &ch, 1);
+        if (i%80 == 79) {
+            ArrayListBuf_cstr(&b);
+            ArrayListBuf_free(&b);
+        }
+    }
+    report("push byte (fresh line buffer)", n, now() - start);
+    ArrayListBuf_free(&b);
+}
+
+/**
+ * @brief Growing one big buffer from empty
+ */
+void benchGrow(long n) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    char chunk[64];
+    memset(chunk, 'x', sizeof(chunk));
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        ArrayListBuf_push(&b, chunk, sizeof(chunk));
+    }
+    report("push 64 bytes (growing)", n, now() - start);
+    ArrayListBuf_free(&b);
+}
+
+/**
+ * @brief Formatting chat lines the way the renderer does
+ */
+void benchAppendf(long n) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        ArrayListBuf_clear(&b);
+        ArrayListBuf_appendf(&b, "%s %i: %s", "Anonymous", (int)(i%65536), "hey, how is it going?");
+    }
+    report("appendf chat line", n, now() - start);
+    ArrayListBuf_free(&b);
+}
+
+/**
+ * @brief Encoding message frames into a reused send buffer
+ */
+void benchFrameEncode(long n) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    char* text = "hey, how is it going?";
+    size_t len = strlen(text);
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        ArrayListBuf_clear(&b);
+        Frame_encode(&b, SEND_MESSAGE, (uint16_t)i, len, text, len);
+    }
+    report("Frame_encode message", n, now() - start);
+    ArrayListBuf_free(&b);
+}
+
+/**
+ * @brief Typed array push and sequential scan
+ */
+void benchArray(long n) {
+    PtrArray v;
+    PtrArray_init(&v);
+    double start = now();
+    for (long i = 0; i < n; i++) {
+        PtrArray_push(&v, (void*)i);
+    }
+    report("typed array push", n, now() - start);
+    start = now();
+    long sum = 0;
+    for (size_t i = 0; i < v.N; i++) {
+        sum += (long)v.data[i];
+    }
+    report("typed array scan", n, now() - start);
+    if (sum == 42) {
+        printf("(unlikely)\n"); // Keep the scan from being optimized out
+    }
+    PtrArray_free(&v);
+}
+
+int main(int argc, char** argv) {
+    long n = DEFAULT_ITERATIONS;
+    if (argc > 1) {
+        n = atol(argv[1]);
+    }
+    benchTypeLines(n);
+    benchTypeLinesFresh(n);
+    benchGrow(n);
+    benchAppendf(n);
+    benchFrameEncode(n);
+    benchArray(n);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arraylist.h"
+
+ARRAYLIST_DEFINE(IntArray, int)
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+int main() {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    ArrayListBuf_push(&b, "chris", 5);
+    ArrayListBuf_push(&b, " tralie", 7);
+    check(b.N == 12 && strncmp(b.buff, "chris tralie", 12) == 0, "push");
+
+    ArrayListBuf_appendf(&b, " %d %s", 42, "meowgi");
+    check(strcmp(ArrayListBuf_cstr(&b), "chris tralie 42 meowgi") == 0, "appendf");
+
+    // Force appendf to grow past the initial capacity
+    char big[5000];
+    memset(big, 'x', sizeof(big)-1);
+    big[sizeof(big)-1] = '\0';
+    size_t before = b.N;
+    ArrayListBuf_appendf(&b, "%s!", big);
+    check(b.N == before + sizeof(big) && b.buff[b.N-1] == '!' && b.buff[b.N] == '\0', "appendf grows");
+
+    char* storage = b.buff;
+    ArrayListBuf_clear(&b);
+    ArrayListBuf_push(&b, "layla", 5);
+    check(b.N == 5 && b.buff == storage, "clear keeps storage");
+
+    ArrayListBuf_shrink(&b);
+    check(b.capacity == 5 && strncmp(b.buff, "layla", 5) == 0, "shrink");
+
+    ArrayListBuf_reserve(&b, 10000);
+    check(b.capacity >= 10000 && strncmp(b.buff, "layla", 5) == 0, "reserve");
+    ArrayListBuf_free(&b);
+
+    IntArray v;
+    IntArray_init(&v);
+    for (int i = 0; i < 1000; i++) {
+        IntArray_push(&v, i);
+    }
+    check(v.N == 1000 && v.data[999] == 999, "vector push");
+    IntArray_insert(&v, 0, -1);
+    check(v.N == 1001 && v.data[0] == -1 && v.data[1] == 0, "vector insert");
+    check(IntArray_remove(&v, 0) == -1 && v.data[0] == 0 && v.N == 1000, "vector remove");
+    check(IntArray_pop(&v) == 999 && v.N == 999, "vector pop");
+    IntArray_clear(&v);
+    IntArray_shrink(&v);
+    check(v.N == 0 && v.data == NULL, "vector shrink to empty");
+    IntArray_free(&v);
+
+    return failures;
+}
@@ -0,0 +1,277 @@
+// Purpose: Memory management for a single chat (one per peer).
+// Kept apart from chatter.c so that tools and benchmarks can
+// create chats without the rest of the program
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "chatter.h"
+
+static atomic_uint nextChatNumber;
+
+_Static_assert(offsetof(struct Chat, timeline) == CHAT_HOT_SIZE, "Hot chat fields should fill exactly the first cache line");
+
+struct Chat* initChat(int sockfd) {
+    debug_print("initChat called\n");
+    struct Chat* chat = (struct Chat*)aligned_alloc(CHAT_HOT_SIZE, sizeof(struct Chat));
+    chat->sockfd = sockfd;
+    chat->outCounter = 0;
+    chat->transferDone = 0;
+    chat->transferTotal = 0;
+    chat->name = chat->shortName;
+    setChatName(chat, "Anonymous", strlen("Anonymous"));
+    pthread_mutex_init(&chat->lock, NULL);
+    pthread_mutex_init(&chat->sendLock, NULL);
+    Timeline_init(&chat->timeline);
+    ArrayListBuf_init(&chat->sendBuf);
+    chat->unread = 0;
+    chat->number = atomic_fetch_add(&nextChatNumber, 1);
+    chat->history = NULL;
+    chat->compactQueued = 0;
+    chat->address = NULL;
+    chat->fileAnswer = 0;
+    chat->receiver = NULL;
+    chat->signatures = NULL;
+    chat->signaturesLen = 0;
+    chat->ids = NULL;
+    chat->idsN = 0;
+    chat->idsCap = 0;
+    atomic_init(&chat->refs, 1);
+    return chat;
+}
+
+void destroyChat(struct Chat* chat) {
+    debug_print("destroyChat called\n");
+    Timeline_free(&chat->timeline);
+    ArrayListBuf_free(&chat->sendBuf);
+    if (chat->history != NULL) {
+        HistoryLog_close(chat->history);
+    }
+    if (chat->name != chat->shortName) {
+        free(chat->name);
+    }
+    free(chat->address);
+    free(chat->signatures);
+    free(chat->ids);
+    close(chat->sockfd);
+    pthread_mutex_destroy(&chat->lock);
+    pthread_mutex_destroy(&chat->sendLock);
+    free(chat);
+}
+
+void retainChat(struct Chat* chat) {
+    atomic_fetch_add(&chat->refs, 1);
+}
+
+void releaseChat(struct Chat* chat) {
+    if (atomic_fetch_sub(&chat->refs, 1) == 1) {
+        destroyChat(chat);
+    }
+}
+
+void setChatName(struct Chat* chat, const char* name, size_t len) {
+    if (chat->name != chat->shortName) {
+        free(chat->name);
+    }
+    if (len < CHAT_INLINE_NAME) {
+        chat->name = chat->shortName;
+    }
+    else {
+        chat->name = (char*)malloc(len + 1);
+    }
+    memcpy(chat->name, name, len);
+    chat->name[len] = '\0';
+    chat->nameLen = (uint16_t)len;
+}
+
+#define ID_GONE UINT64_MAX // An id slot's timestamp once every message with the id is deleted
+
+static uint32_t idKey(uint16_t id, int mine) {
+    return 1 + ((uint32_t)(mine ? 1 : 0) << 16 | id);
+}
+
+/**
+ * @brief Slot a key is in, or the free one it would go in
+ */
+static struct IdSlot* idSlot(struct IdSlot* ids, uint32_t cap, uint32_t key) {
+    uint32_t i = (key*2654435761u) & (cap - 1);
+    while (ids[i].key != 0 && ids[i].key != key) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &ids[i];
+}
+
+/**
+ * @brief Note where the newest message with an id is
+ * 
+ * @param chat Chat
+ * @param key From idKey()
+ * @param timestamp Message's timestamp
+ * @param newer Whether the message is newer than any already noted
+ * (it was added at the end), rather than older (loaded from history)
+ */
+static void noteMessageId(struct Chat* chat, uint32_t key, uint64_t timestamp, int newer) {
+    struct IdSlot* slot = chat->ids != NULL ? idSlot(chat->ids, chat->idsCap, key) : NULL;
+    if (slot == NULL || slot->key == 0) {
+        if ((chat->idsN + 1)*2 > chat->idsCap) {
+            // Kept at most half full
+            uint32_t cap = chat->idsCap > 0 ? chat->idsCap*2 : 64;
+            struct IdSlot* ids = (struct IdSlot*)calloc(cap, sizeof(struct IdSlot));
+            if (ids == NULL && chat->idsN + 1 >= chat->idsCap) {
+                return; // Out of memory, and the table is full
+            }
+            for (uint32_t i = 0; ids != NULL && i < chat->idsCap; i++) {
+                if (chat->ids[i].key != 0) {
+                    *idSlot(ids, cap, chat->ids[i].key) = chat->ids[i];
+                }
+            }
+            if (ids != NULL) {
+                free(chat->ids);
+                chat->ids = ids;
+                chat->idsCap = cap;
+            }
+            slot = idSlot(chat->ids, chat->idsCap, key);
+        }
+        slot->key = key;
+        chat->idsN++;
+    }
+    else if (!newer && slot->timestamp != ID_GONE) {
+        return; // The one already noted is newer
+    }
+    slot->timestamp = timestamp;
+}
+
+void addMessage(struct Chat* chat, struct Message* msg) {
+    size_t N = Timeline_size(&chat->timeline);
+    if (N > 0) {
+        // Two messages can land in the same clock tick, or the clock can step back
+        uint64_t last;
+        uint16_t id, flags;
+        Timeline_header(&chat->timeline, N-1, &last, &id, &flags);
+        if (msg->timestamp <= last) {
+            msg->timestamp = last + 1;
+        }
+    }
+    Timeline_push(&chat->timeline, msg);
+    noteMessageId(chat, idKey(msg->id, msg->flags & MESSAGE_OUTGOING), msg->timestamp, 1);
+    if (chat->history != NULL) {
+        HistoryLog_append(chat->history, msg);
+    }
+}
+
+long findMessage(struct Chat* chat, uint64_t timestamp) {
+    // Timestamps strictly increase along the timeline
+    size_t lo = 0, hi = Timeline_size(&chat->timeline);
+    uint16_t id, flags;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        uint64_t t;
+        Timeline_header(&chat->timeline, mid, &t, &id, &flags);
+        if (t == timestamp) {
+            return (flags & MESSAGE_DELETED) ? -1 : (long)mid;
+        }
+        if (t < timestamp) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Find the newest message going one way with some id the slow
+ * way, by going back through the timeline
+ */
+static long searchMessageById(struct Chat* chat, uint16_t id, int mine) {
+    uint16_t direction = mine ? MESSAGE_OUTGOING : 0;
+    for (size_t i = Timeline_size(&chat->timeline); i > 0; i--) {
+        uint64_t timestamp;
+        uint16_t msgId, flags;
+        Timeline_header(&chat->timeline, i-1, &timestamp, &msgId, &flags);
+        if (msgId == id && (flags & (MESSAGE_OUTGOING | MESSAGE_DELETED)) == direction) {
+            return (long)(i-1);
+        }
+    }
+    return -1;
+}
+
+long findMessageById(struct Chat* chat, uint16_t id, int mine) {
+    if (chat->ids == NULL) {
+        return searchMessageById(chat, id, mine);
+    }
+    struct IdSlot* slot = idSlot(chat->ids, chat->idsCap, idKey(id, mine));
+    if (slot->key == 0 || slot->timestamp == ID_GONE) {
+        return -1;
+    }
+    long index = findMessage(chat, slot->timestamp);
+    if (index == -1) {
+        // It was deleted, but there may be an older one from before the
+        // counter wrapped; whatever's found is noted so this happens once
+        index = searchMessageById(chat, id, mine);
+        uint64_t timestamp = ID_GONE;
+        if (index != -1) {
+            uint16_t msgId, flags;
+            Timeline_header(&chat->timeline, (size_t)index, &timestamp, &msgId, &flags);
+        }
+        slot->timestamp = timestamp;
+    }
+    return index;
+}
+
+void attachHistory(struct Chat* chat, struct HistoryLog* log) {
+    for (size_t i = 0; i < Timeline_size(&chat->timeline); i++) {
+        if (Timeline_isDeleted(&chat->timeline, i)) {
+            continue; // Deleted before there was a log to tell
+        }
+        HistoryLog_append(log, Timeline_get(&chat->timeline, i));
+    }
+    HistoryLog_attach(log, &chat->timeline);
+    chat->history = log;
+}
+
+size_t prependHistory(struct Chat* chat, const uint64_t* refs, size_t count) {
+    struct Timeline* tl = &chat->timeline;
+    if (Timeline_size(tl) > 0) {
+        // Timestamps have to keep increasing along the timeline, so if the
+        // clock has stepped back since, what isn't older stays on disk
+        uint64_t first, last;
+        uint16_t id, flags;
+        Timeline_header(tl, 0, &first, &id, &flags);
+        while (count > 0) {
+            tl->archive->header(tl->archiveCtx, refs[count-1], &last, &id, &flags);
+            if (last < first) {
+                break;
+            }
+            count--;
+        }
+    }
+    Timeline_prependArchived(tl, refs, count);
+    // Newest first, so each id is noted where it was last used
+    for (size_t i = count; i > 0; i--) {
+        uint64_t timestamp;
+        uint16_t id, flags;
+        if (tl->archive->header(tl->archiveCtx, refs[i-1], &timestamp, &id, &flags) == 0) {
+            noteMessageId(chat, idKey(id, flags & MESSAGE_OUTGOING), timestamp, 0);
+        }
+    }
+    return count;
+}
+
+long deleteMessageFromChat(struct Chat* chat, uint16_t id, int mine) {
+    long index = findMessageById(chat, id, mine);
+    if (index != -1) {
+        uint64_t timestamp;
+        uint16_t msgId, flags;
+        Timeline_header(&chat->timeline, (size_t)index, &timestamp, &msgId, &flags);
+        Timeline_delete(&chat->timeline, (size_t)index);
+        if (chat->history != NULL) {
+            HistoryLog_delete(chat->history, timestamp);
+        }
+    }
+    return index;
+}
@@ -0,0 +1,152 @@
+// Purpose: Measure what each idle peer costs in memory, comparing
+// struct Chat against the old layout with a 64KB name embedded in it
+//
+// Usage: ./chatbench [number of peers] [threads]
+// Pass "threads" to also start an idle receive thread per peer, as
+// there used to be before chats were read by a pool of workers
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "linkedlist.h"
+#include "chatter.h"
+
+#define DEFAULT_PEERS 100000
+#define RECEIVE_STACK_SIZE (64*1024) // Stack each chat's receive thread had
+
+// The layout every chat used before the hot/cold split
+struct OldChat {
+    char name[65536];
+    int sockfd;
+    uint16_t outCounter;
+    struct LinkedList* messagesIn;
+    struct LinkedList* messagesOut;
+};
+
+/**
+ * @brief Resident set size of this process, in KB
+ */
+long currentRSSKB() {
+    long pages = 0, resident = 0;
+    FILE* fin = fopen("/proc/self/statm", "r");
+    if (fin != NULL) {
+        if (fscanf(fin, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(fin);
+    }
+    return resident*(sysconf(_SC_PAGESIZE)/1024);
+}
+
+/**
+ * @brief Bytes the allocator has handed out (heap and mmap'd chunks)
+ */
+long allocatedBytes() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+void report(char* name, long N, long rssBefore, long allocBefore) {
+    long rss = currentRSSKB() - rssBefore;
+    long allocated = allocatedBytes() - allocBefore;
+    printf("%-16s %9ld KB RSS  %9.1f B/peer RSS  %9.1f B/peer allocated  (%.0f MB RSS for 100k peers)\n",
+        name, rss, rss*1024.0/N, (double)allocated/N, rss/1024.0*DEFAULT_PEERS/N);
+}
+
+void benchOld(long N) {
+    long rssBefore = currentRSSKB(), allocBefore = allocatedBytes();
+    struct OldChat** chats = (struct OldChat**)malloc(sizeof(struct OldChat*)*N);
+    for (long i = 0; i < N; i++) {
+        chats[i] = (struct OldChat*)malloc(sizeof(struct OldChat));
+        strcpy(chats[i]->name, "Anonymous");
+        chats[i]->sockfd = -1;
+        chats[i]->outCounter = 0;
+        chats[i]->messagesIn = LinkedList_init();
+        chats[i]->messagesOut = LinkedList_init();
+    }
+    report("old struct Chat", N, rssBefore, allocBefore);
+}
+
+void benchNew(long N) {
+    long rssBefore = currentRSSKB(), allocBefore = allocatedBytes();
+    struct Chat** chats = (struct Chat**)malloc(sizeof(struct Chat*)*N);
+    for (long i = 0; i < N; i++) {
+        chats[i] = initChat(-1);
+    }
+    report("struct Chat", N, rssBefore, allocBefore);
+    for (long i = 0; i < N; i++) {
+        destroyChat(chats[i]);
+    }
+    free(chats);
+}
+
+int idleFds[2];
+
+void* idleLoop(void* args) {
+    char c;
+    if (read(idleFds[0], &c, 1) < 0) {
+        perror("read");
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start one idle thread per peer, with the same attributes
+ * setupNewChat() used for receive threads
+ */
+void benchThreads(long N) {
+    long rssBefore = currentRSSKB(), allocBefore = allocatedBytes();
+    if (pipe(idleFds) != 0) {
+        perror("pipe");
+        return;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, RECEIVE_STACK_SIZE);
+    long started = 0;
+    for (; started < N; started++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, idleLoop, NULL) != 0) {
+            printf("(could only start %ld threads)\n", started);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    if (started > 0) {
+        report("receive thread", started, rssBefore, allocBefore);
+    }
+}
+
+void runIsolated(void (*bench)(long), long N) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        bench(N);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char** argv) {
+    long N = DEFAULT_PEERS;
+    if (argc > 1) {
+        N = atol(argv[1]);
+    }
+    if (freopen("/dev/null", "w", stderr) == NULL) {
+        // Debug output just stays on the terminal
+    }
+    printf("%ld idle peers, sizeof(struct Chat) = %zu\n", N, sizeof(struct Chat));
+    runIsolated(benchOld, N);
+    runIsolated(benchNew, N);
+    if (argc > 2 && strcmp(argv[2], "threads") == 0) {
+        runIsolated(benchThreads, N);
+    }
+    return 0;
+}
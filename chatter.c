@@ -1,776 +1,2587 @@
-#include <ncurses.h>
-#include <unistd.h>
-#include <stdint.h>
-#include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <errno.h>
-#include <unistd.h>
-#include <pthread.h>
-#include <netinet/tcp.h>
-#include <time.h>
-#include <sys/stat.h>
-
-#include "linkedlist.h"
-#include "hashmap.h"
-#include "arraylist.h"
-#include "chatter.h"
-
-#define BACKLOG 20
-#define ANNOUNCE_SENDING_FILE 1
-
-///////////////////////////////////////////////////////////
-//       Data Structure Memory Management
-///////////////////////////////////////////////////////////
-
-struct ReceiveData {
-    struct Chatter* chatter;
-    struct Chat* chat;
-};
-
-struct Chat* initChat(int sockfd) {
-    debug_print("initChat called\n");
-    struct Chat* chat = (struct Chat*)malloc(sizeof(struct Chat));
-    chat->messagesIn = LinkedList_init();
-    chat->messagesOut = LinkedList_init();
-    chat->outCounter = 0;
-    chat->sockfd = sockfd;
-    return chat;
-}
-
-void destroyChat(struct Chat* chat) {
-    debug_print("destroyChat called\n");
-    freeMessages(chat->messagesIn);
-    LinkedList_free(chat->messagesIn);
-    freeMessages(chat->messagesOut);
-    LinkedList_free(chat->messagesOut);
-    free(chat);
-}
-
-void freeMessages(struct LinkedList* messages) {
-    debug_print("freeMessages called\n");
-    struct LinkedNode* node = messages->head;
-    while (node != NULL) {
-        struct Message* message = (struct Message*)node->data;
-        free(message->text); // This assumes the message text has been dynamically allocated
-        free(message);
-        node = node->next;
-    }
-}
-
-struct Chatter* initChatter() {
-    debug_print("initChatter called\n");
-    // Dynamically allocate all objects that need allocating
-    struct Chatter* chatter = (struct Chatter*)malloc(sizeof(struct Chatter));
-    chatter->gui = initGUI();
-    strcpy(chatter->myname, "Anonymous");
-    chatter->chats = LinkedList_init();
-    chatter->visibleChat = NULL;
-    pthread_mutex_init(&chatter->lock, NULL);
-    /////////////////////////////////////////
-    // Refresh the GUI thread every so often
-    int res = pthread_create(&chatter->refreshGUIThread, NULL, refreshGUILoop, (void*)chatter);
-    if (res != 0) {
-        fprintf(stderr, "Error setting up refresh daemon for GUI\n");
-    }
-    /////////////////////////////////////////
-    return chatter;
-}
-
-void destroyChatter(struct Chatter* chatter) {
-    debug_print("destroyChatter called\n");
-
-    destroyGUI(chatter->gui);
-    struct LinkedNode* chatNode = chatter->chats->head;
-    while (chatNode != NULL) {
-        struct Chat* chat = (struct Chat*)chatNode->data;
-        destroyChat(chat);
-        chatNode = chatNode->next;
-    }
-    LinkedList_free(chatter->chats);
-    pthread_mutex_destroy(&chatter->lock);
-    free(chatter);
-}
-
-/**
- * @brief Get the first chat object in a list that corresponds
- * to a name
- * (NOTE: This could be done more efficiently with a hash table,
- * but we'll used linked lists for now)
- * 
- * @param name String name
- * @return struct Chat* 
- */
-struct Chat* getChatFromName(struct Chatter* chatter, char* name) {
-    debug_print("getChatFromName called\n");
-
-    struct Chat* chat = NULL;
-    pthread_mutex_lock(&chatter->lock);
-
-    struct LinkedNode* node = chatter->chats->head;
-    int len = strlen(name);
-    while (node != NULL) {
-        struct Chat* thisChat = (struct Chat*)node->data;
-        if (strncmp(name, chat->name, len) == 0) {
-            chat = thisChat;
-            break;
-        }
-        node = node->next;
-    }
-
-    pthread_mutex_unlock(&chatter->lock);
-    return chat;
-}
-
-int _send_loop(int sockfd,char *src,size_t len){
-    int status = STATUS_SUCCESS;
-    ssize_t sent_bytes;
-
-    while (len > 0){
-        sent_bytes = send(sockfd,src,len,0);
-        if(sent_bytes == -1){
-            status = FAILURE_GENERIC;
-            break;
-        }
-        src += sent_bytes;
-        len -= sent_bytes;
-    }
-
-    return status;
-}
-
-int _recv_loop(int sockfd,char *dst,size_t len){
-    int status = STATUS_SUCCESS;
-    ssize_t res;
-
-    while(len > 0){
-        res = recv(sockfd,dst,len,0);
-        if (res <= 0) {
-            perror("recv");
-            debug_print("res: %ld\n",res);
-            status = FAILURE_GENERIC;
-            break;
-        }
-        dst += res;
-        len -= res;
-    }
-
-    return status;
-}
-
-/**
- * @brief Remove a particular chat from the list
- * 
- * @param chatter Chatter object
- * @param chat Chat to remove
- */
-void removeChat(struct Chatter* chatter, struct Chat* chat) {
-    pthread_mutex_lock(&chatter->lock);
-    debug_print("REMOVE CHAT WAS CALLED!!!!\n");
-    LinkedList_remove(chatter->chats, chat);
-    if (chatter->visibleChat == chat) {
-        // Bounce to another chat if there is one
-        chatter->visibleChat = NULL;
-        if (chatter->chats->head != NULL) {
-            chatter->visibleChat = (struct Chat*)chatter->chats->head->data;
-        }
-    }
-    destroyChat(chat);
-    pthread_mutex_unlock(&chatter->lock);
-}
-
-
-///////////////////////////////////////////////////////////
-//             Chat Session Messages In
-///////////////////////////////////////////////////////////
-
-/**
- * @brief Continually loop and receive info on a particular chat
- * 
- * @param pargs 
- * @return void* 
- */
-void* receiveLoop(void* pargs) {
-    struct ReceiveData* param = (struct ReceiveData*)pargs;
-    struct Chat* chat = param->chat;
-    struct Chatter* chatter = param->chatter;
-    free(param);
-
-    int continue_server_loop = 1, status = STATUS_SUCCESS, res;
-    char *msg_text, *filename, buf[1024];
-    struct Message *msg_obj;
-    uint16_t incoming_short;
-    uint32_t incoming_long;
-    size_t bytes_written;
-    FILE *file;
-
-    while(continue_server_loop){
-        // Loop until the connection closes
-        struct header_generic msg_header;
-        
-        status = _recv_loop(chat->sockfd,(char*)&msg_header,sizeof(struct header_generic));
-        if (status != STATUS_SUCCESS) {
-            debug_print("RECV FAILURE!!\n");
-            break;
-        }
-
-        // Be sure to lock variables as appropriate for thread safety
-        switch(msg_header.magic){
-            case INDICATE_NAME:
-                debug_print("NAME recvd\n");
-
-                incoming_short = ntohs(msg_header.shortInt);
-
-                status = _recv_loop(chat->sockfd,chat->name,incoming_short);
-                chat->name[incoming_short] = '\0';
-
-                if(status != STATUS_SUCCESS){
-                    continue_server_loop = 0;
-                }
-                break;
-
-            case SEND_MESSAGE:
-                debug_print("MESSAGE recvd\n");
-
-                msg_obj = malloc(sizeof(struct Message));
-                incoming_short = ntohs(msg_header.shortInt);
-                incoming_long = ntohl(msg_header.longInt);
-                msg_text = malloc((uint64_t)incoming_long+1);
-
-                status = _recv_loop(chat->sockfd,msg_text,incoming_long);
-                msg_text[incoming_long] = '\0';
-                if(status != STATUS_SUCCESS){
-                    continue_server_loop = 0;
-                }
-
-                msg_obj->id = incoming_short;
-                msg_obj->timestamp = time(NULL);
-                msg_obj->text = msg_text;
-                LinkedList_addFirst(chat->messagesIn,msg_obj);
-                break;
-
-            case DELETE_MESSAGE:
-                debug_print("DELETE NAME recvd\n");
-                
-                incoming_short = ntohs(msg_header.shortInt);
-                deleteMessageFromChat(chat,incoming_short);
-                break;
-
-            case SEND_FILE:
-                debug_print("FILE recvd\n");
-
-                incoming_short = ntohs(msg_header.shortInt);
-                incoming_long = ntohs(msg_header.shortInt);
-                filename = malloc((uint32_t)incoming_short+1);
-
-                status = _recv_loop(chat->sockfd,filename,incoming_short);
-                filename[incoming_short] = '\0';
-                if(status != STATUS_SUCCESS){
-                    continue_server_loop = 0;
-                }
-
-                file = fopen(filename,"rb");
-                free(filename);
-                if(file == NULL){
-                    continue_server_loop = 0;
-                }
-                else{
-                    while(incoming_long > 0){
-                        res = recv(chat->sockfd,buf,incoming_long<1024 ? incoming_long : 1024,0);
-                        if (res <= 0) {
-                            continue_server_loop = 0;
-                            break;
-                        }
-                        bytes_written = fwrite(buf,sizeof(char),res,file);
-                        if (bytes_written < res) {
-                            continue_server_loop = 0;
-                            break;
-                        }
-                        incoming_long -= res;
-                    }
-                    fclose(file);
-                }
-
-                break;
-
-            case END_CHAT:
-                debug_print("END CHAT recvd\n");
-
-                removeChat(chatter,chat);
-                break;
-
-            default:
-                debug_print("Unknown magic number %d received",msg_header.magic);
-                break;
-        }
-        reprintUsernameWindow(chatter);
-        reprintChatWindow(chatter);
-    }
-    debug_print("ENDING RECEIVE LOOP!\n");
-    removeChat(chatter, chat);
-    pthread_exit(NULL); // Clean up thread
-    return NULL;
-}
-
-
-
-///////////////////////////////////////////////////////////
-//             Chat Session Messages Out
-///////////////////////////////////////////////////////////
-
-
-/**
- * @brief Send a message in the visible chat
- * 
- * @param chatter Data about the current chat session
- * @param message 
- */
-int sendMessage(struct Chatter* chatter, char* message) {
-    int status = STATUS_SUCCESS;
-    pthread_mutex_lock(&chatter->lock);
-    
-    if (chatter->visibleChat == NULL){
-        status = FAILURE_GENERIC;
-    }
-    else{
-        // Handle adding the message locally
-        struct Message *msg_obj = malloc(sizeof(struct Message));
-        uint16_t msg_id = chatter->visibleChat->outCounter++;
-        uint32_t remaining_len = strlen(message);
-        char *msg_text = malloc((uint64_t)remaining_len+1);
-        strcpy(msg_text,message);
-        msg_obj->id = msg_id;
-        msg_obj->timestamp = time(NULL);
-        msg_obj->text = msg_text;
-        LinkedList_addFirst(chatter->visibleChat->messagesOut,msg_obj);
-
-        // Handle sending message
-        struct header_generic msg_header;
-        msg_header.magic = SEND_MESSAGE;
-        msg_header.shortInt = htons(msg_id);
-        msg_header.longInt = htonl(remaining_len);
-        
-        status = _send_loop(chatter->visibleChat->sockfd,(char*)&msg_header,sizeof(struct header_generic));
-        if(status == STATUS_SUCCESS){
-            status = _send_loop(chatter->visibleChat->sockfd,message,remaining_len);
-        }
-    }
-    
-    pthread_mutex_unlock(&chatter->lock);
-    return status;
-}
-
-/**
- * @brief Delete message in the visible chat
- * 
- * @param chatter Data about the current chat session
- * @param id ID of message to delete
- */
-int deleteMessage(struct Chatter* chatter, uint16_t id) {
-    pthread_mutex_lock(&chatter->lock);
-
-    // Locally remove the message
-    int status = deleteMessageFromChat(chatter->visibleChat,id);
-
-    // Send to remove the message on the remote connection
-    struct header_generic msg_header;
-    msg_header.magic = DELETE_MESSAGE;
-    msg_header.shortInt = htons(id);
-
-    status = _send_loop(chatter->visibleChat->sockfd,(char*)&msg_header,sizeof(struct header_generic));
-
-    pthread_mutex_unlock(&chatter->lock);
-    return status;
-}
-
-int deleteMessageFromChat(struct Chat *chat, uint16_t id){
-    int status = FAILURE_GENERIC;
-    struct LinkedList *messagesOut = chat->messagesOut;
-    for(struct LinkedNode *node = messagesOut->head; node != NULL; node=node->next){
-        struct Message *message = (struct Message*)node->data;
-        if(message->id == id){
-            free(message->text);
-            LinkedList_remove(messagesOut,message);
-            free(message);
-            status = STATUS_SUCCESS;
-            break;
-        }
-    }
-    return status;
-}
-
-/**
- * @brief Send a file in the visible chat
- * 
- * @param chatter Data about the current chat session
- * @param filename Path to file
- */
-int sendFile(struct Chatter* chatter, char* filename) {
-    int status = STATUS_SUCCESS;
-    if(ANNOUNCE_SENDING_FILE){
-        char *announce_msg = malloc(strlen(filename)+1+17);
-        sprintf(announce_msg,"(Sending file '%s')",filename);
-        sendMessage(chatter,announce_msg);
-        free(announce_msg);
-    }
-    pthread_mutex_lock(&chatter->lock);
-
-    struct stat file_stat;
-    if(stat(filename,&file_stat) == -1){
-        status = FAILURE_GENERIC;
-    }
-    else{
-        uint16_t remaining_fn_length = strlen(filename);
-        uint32_t remaining_file_length = file_stat.st_size;
-        struct header_generic msg_header;
-        msg_header.magic = SEND_FILE;
-        msg_header.shortInt = htons(remaining_fn_length);
-        msg_header.longInt = htonl(remaining_file_length);
-
-        FILE *file = fopen(filename,"rb");
-        if(file == NULL){
-            status = FAILURE_GENERIC;
-        }
-        else{
-            status = _send_loop(chatter->visibleChat->sockfd,(char*)&msg_header,sizeof(struct header_generic));
-            if(status == STATUS_SUCCESS){
-                ssize_t sent_bytes;
-                size_t remaining_in_buffer = 0;
-
-                status = _send_loop(chatter->visibleChat->sockfd,filename,remaining_fn_length);
-
-                char buf[1024];
-                while(remaining_file_length > 0){
-                    if(remaining_in_buffer == 0){
-                        remaining_in_buffer = fread(buf,sizeof(char),1024,file);
-                        if(remaining_in_buffer < 1024 && ferror(file)){
-                            status = FAILURE_GENERIC;
-                            break;
-                        }
-                    }
-                    sent_bytes = send(chatter->visibleChat->sockfd,buf,remaining_in_buffer,0);
-                    if(sent_bytes == -1){
-                        status = FAILURE_GENERIC;
-                        break;
-                    }
-                    remaining_in_buffer -= sent_bytes;
-                    remaining_file_length -= sent_bytes;
-                    if(remaining_in_buffer > 0){
-                        memmove(buf,buf+sent_bytes,remaining_in_buffer);
-                    }
-                }
-            }
-            
-            fclose(file);
-        }
-    }
-
-    pthread_mutex_unlock(&chatter->lock);
-    return status;
-}
-
-/**
- * @brief Broadcast my name to all visible connections
- * NOTE: Name is held in chatter->myname
- * 
- * @param chatter Data about the current chat session
- */
-int broadcastMyName(struct Chatter* chatter) {
-    int status = STATUS_SUCCESS;
-    pthread_mutex_lock(&chatter->lock);
-
-    debug_print("Hello from broadcast myname!\n");
-    debug_print("Broadcast name, chatter*: %p\n",(void*)chatter);
-    
-    size_t remaining_len = strlen(chatter->myname);
-    struct header_generic msg_header;
-    msg_header.magic = INDICATE_NAME;
-    msg_header.shortInt = htons((uint16_t)remaining_len);
-
-    debug_print("Hello from after header creation!\n");
-
-    for(struct LinkedNode *curr_node = chatter->chats->head; curr_node != NULL; curr_node = curr_node->next){
-        debug_print("Hello from inside the loop!\n");
-        struct Chat *curr_chat = (struct Chat*)curr_node->data;
-        if(send(curr_chat->sockfd,(char*)&msg_header,sizeof(struct header_generic),0) == -1){
-            status = FAILURE_GENERIC;
-        }
-        else{
-            char *message = chatter->myname;
-            ssize_t sent_bytes;
-            while (remaining_len > 0){
-                sent_bytes = send(curr_chat->sockfd,message,remaining_len,0);
-                if(sent_bytes == -1){
-                    status = FAILURE_GENERIC;
-                    break;
-                }
-                message += sent_bytes;
-                remaining_len -= sent_bytes;
-            }
-        }
-    }
-
-    pthread_mutex_unlock(&chatter->lock);
-    debug_print("Hello from after the unlock!\n");
-    return status;
-}
-
-/**
- * @brief Close chat with someone
- * 
- * @param chatter Data about the current chat session
- * @param name Close connection with this person
- */
-int closeChat(struct Chatter* chatter, char* name) {
-    debug_print("closeChat called\n");
-
-    int status = STATUS_SUCCESS;
-    
-    struct Chat *selected_chat = getChatFromName(chatter,name);
-
-    struct header_generic msg_header;
-    msg_header.magic = END_CHAT;
-
-    if(send(selected_chat->sockfd,(char*)&msg_header,sizeof(struct header_generic),0) == -1){
-        status = FAILURE_GENERIC;
-    }
-    removeChat(chatter,selected_chat);
-
-    return status;
-}
-
-
-/**
- * @brief Switch the visible chat
- * 
- * @param chatter Data about the current chat session
- * @param name Switch chat to be with this person
- */
-int switchTo(struct Chatter* chatter, char* name) {
-    int status = STATUS_SUCCESS;
-    struct Chat* chat = getChatFromName(chatter, name);
-    pthread_mutex_lock(&chatter->lock);
-    if (chat == NULL) {
-        status = CHAT_DOESNT_EXIST;
-    }
-    else {
-        chatter->visibleChat = chat;
-    }
-    pthread_mutex_unlock(&chatter->lock);
-    return status;
-}
-
-
-
-///////////////////////////////////////////////////////////
-//               Connection Management
-///////////////////////////////////////////////////////////
-
-/**
- * @brief Print out a socket error, pause, and then exit
- * 
- * @param chatter 
- * @param fmt 
- */
-void socketErrorAndExit(struct Chatter* chatter, char* fmt) {
-    char* error = (char*)malloc(strlen(fmt) + 100);
-    sprintf(error, fmt, errno);
-    printErrorGUI(chatter->gui, error);
-    free(error);
-    sleep(5);
-    destroyChatter(chatter);
-    exit(errno);
-}
-
-
-/**
- * @brief Setup a chat on a socket, regardless of whether it came from
- * a client or server
- * 
- * @param chatter Chatter object
- * @param sockfd A socket that's already been connected to a stream
- */
-int setupNewChat(struct Chatter* chatter, int sockfd) {
-    // Step 0: Disable Nagle's algorithm on this socket
-    int yes = 1;
-    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
-    // Step 1: Setup a new chat object and add to the list
-    struct Chat* chat = initChat(sockfd);
-    strcpy(chat->name, "Anonymous");
-    pthread_mutex_lock(&chatter->lock);
-    LinkedList_addFirst(chatter->chats, (void*)chat);
-    debug_print("In setup new chat, chat list head: %p\n",(void*)chatter->chats->head);
-    debug_print("In setup new chat, sockfd: %d\n",sockfd);
-    // Step 2: Start a thread for a loop that receives data
-    struct ReceiveData* param = (struct ReceiveData*)malloc(sizeof(struct ReceiveData));
-    param->chat = chat;
-    param->chatter = chatter;
-    pthread_t receiveThread;
-    int res = pthread_create(&receiveThread, NULL, receiveLoop, (void*)param);
-    int status = STATUS_SUCCESS;
-    if (res != 0) {
-        // Print out error information
-        char* fmt = "Error %i opening new connection";
-        char* error = (char*)malloc(strlen(fmt) + 100);
-        sprintf(error, fmt, errno);
-        printErrorGUI(chatter->gui, error);
-        free(error);
-        // Remove dynamically allocated stuff
-        LinkedList_removeFirst(chatter->chats);
-        status = ERR_THREADCREATE;
-    }
-    else if (chatter->chats->head->next == NULL) {
-        // This is the first chat; make it visible
-        chatter->visibleChat = chat;
-    }
-    pthread_mutex_unlock(&chatter->lock);
-    if (status != STATUS_SUCCESS) {
-        debug_print("ISSUE OCCURRED IN SETUP, DESTROYING CHAT!!");
-        destroyChat(chat);
-    }
-    debug_print("Setup new chat about to return, chat list head: %p\n",(void*)chatter->chats->head);
-    debug_print("Setup new chat, chatter*: %p\n",(void*)chatter);
-    return status;
-}
-
-
-/**
- * @brief Establish a chat as a client connecting to an IP/port
- * 
- * @param chatter Data about the current chat session
- * @param IP IP address in human readable form
- * @param port Port on which to establish connection
- */
-int connectChat(struct Chatter* chatter, char* IP, char* port) {
-    // Step 1: Get address information for a host
-    struct addrinfo hints;
-    struct addrinfo* node;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC; // Use either IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; // Use TCP
-    int ret = getaddrinfo(IP, port, &hints, &node);
-    if (ret != 0) {
-        printErrorGUI(chatter->gui, "Error getting address info");
-        freeaddrinfo(node);
-        return ERR_GETADDRINFO;
-    }
-    int sockfd = -1;
-    // Step 1b: Try all possible connection types in the link list
-    // it gives me until I find one that works
-    while (node != NULL) {
-        sockfd = socket(node->ai_family, node->ai_socktype, node->ai_protocol);
-        if (sockfd != -1) {
-            break;
-        }
-        else {
-            node = node->ai_next;
-        }
-    }
-    // Step 1c: Make sure we got a valid socket file descriptor
-    // after going through all of the options
-    if (sockfd == -1) {
-        printErrorGUI(chatter->gui, "Error opening socket");
-        freeaddrinfo(node);
-        return ERR_OPENSOCKET;
-    }
-    // Step 2: Setup stream on socket and connect
-    ret = connect(sockfd, node->ai_addr, node->ai_addrlen);
-    freeaddrinfo(node);
-    if (ret == -1) {
-        printErrorGUI(chatter->gui, "Error opening socket");
-        return ERR_OPENSOCKET;
-    }
-    ret = setupNewChat(chatter, sockfd);
-    debug_print("in connectChat before return... chats*: %p, chats head: %p\n",(void*)chatter->chats,(void*)chatter->chats->head);
-    return ret;
-}
-
-/**
- * @brief Continually loop through and accept new connections
- * 
- * @param pargs Pointer to the chatter data
- */
-void* serverLoop(void* pargs) {
-    struct Chatter* chatter = (struct Chatter*)pargs;
-    while (1) { // TODO: Finish terminating thread when appropriate
-        struct sockaddr_storage their_addr;
-        socklen_t len = sizeof(their_addr);
-        int sockfd = accept(chatter->serversock, (struct sockaddr*)&their_addr, &len);
-        if (sockfd != -1) {
-            int result = setupNewChat(chatter, sockfd);
-            if (result != STATUS_SUCCESS) {
-                printErrorGUI(chatter->gui, "Error receiving new connection");
-            }
-            else {
-                reprintUsernameWindow(chatter);
-                reprintChatWindow(chatter);
-            }
-        }
-        else {
-            printErrorGUI(chatter->gui, "Error receiving new connection");
-        }
-    }
-}
-
-
-int main(int argc, char *argv[]) {
-    char* port = "60000";
-    if (argc > 1) {
-        port = argv[1];
-    }
-    // Step 1: Initialize chatter object and setup server to listen for incoming connections
-    struct Chatter* chatter = initChatter();
-    struct GUI* gui = chatter->gui;
-    // Step 1a: Parse Parameters and initialize variables
-    struct addrinfo hints;
-    struct addrinfo* info;
-    // Step 1b: Find address information of domain and attempt to open socket
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC; // OK to use either IPv4 or IPv6
-    hints.ai_socktype = SOCK_STREAM; //Using TCP
-    hints.ai_flags = AI_PASSIVE; // Use my IP (extremely important!!)
-    getaddrinfo(NULL, port, &hints, &info);
-    chatter->serversock = -1;
-    struct addrinfo* node = info;
-    while (node != NULL && chatter->serversock == -1) {
-        chatter->serversock = socket(node->ai_family, node->ai_socktype, node->ai_protocol); // NOTE: Not bound to port yet
-        if (chatter->serversock == -1) {
-            printErrorGUI(gui, "Error on socket...trying another one\n");
-            node = node->ai_next;
-        }
-        int yes = 1;
-        if (setsockopt(chatter->serversock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-            freeaddrinfo(info);
-            socketErrorAndExit(chatter, "Error number %i setting socket options\n");
-        }
-        else if (bind(chatter->serversock, node->ai_addr, node->ai_addrlen) == -1) {
-            freeaddrinfo(info);
-            socketErrorAndExit(chatter, "Error number %i binding socket\n");
-        }
-    }
-    freeaddrinfo(info);
-    // Step 1c: Service requests (single threaded for now)
-    if (chatter->serversock == -1 || node == NULL) {
-        socketErrorAndExit(chatter, "ERROR: Error number %i on opening socket\n");
-    }
-    if (listen(chatter->serversock, BACKLOG) == -1) {
-        socketErrorAndExit(chatter, "Error number %i listening on socket\n");
-    }
-    pthread_t serverThread;
-    int res = pthread_create(&serverThread, NULL, serverLoop, (void*)chatter);
-    if (res != 0) {
-        socketErrorAndExit(chatter, "Error number %i creating server thread\n");
-        destroyChatter(chatter);
-        exit(res);
-    }
-
-    // Step 2: Begin the input loop on the client side
-    typeLoop(chatter);
-    // TODO: Cleanup server thread
-
-    // Step 3: Clean everything up when it's over
-    destroyChatter(chatter);
+#include <ncurses.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "linkedlist.h"
+#include "hashmap.h"
+#include "arraylist.h"
+#include "chatter.h"
+#include "headless.h"
+#include "snapshot.h"
+#include "delta.h"
+#include "pipeline.h"
+
+#define BACKLOG 20
+#define ANNOUNCE_SENDING_FILE 1
+#define PROGRESS_INTERVAL (256*1024) // Bytes received between transfer progress events
+#define SEARCH_RESULTS 20 // Most messages a search shows
+#define MEMORY_BUDGET (256ULL*1024*1024) // Default memory for messages across all chats (see trimMemory())
+#define CHAT_MEMORY_BUDGET (64ULL*1024*1024) // Default memory for one chat's messages
+#define SPILL_DRAIN_BATCH 64 // Most messages moved out of an old spill file per chat each time memory is trimmed
+#define SNAPSHOT_INTERVAL 10 // Seconds between session snapshots
+#define SNAPSHOT_MESSAGES 100 // Most recent messages of each chat kept in a snapshot
+#define RECONNECT_TIMEOUT_MS 2000 // Longest a restore waits for peers to answer
+#define FILE_QUERY_TIMEOUT_MS 2000 // Longest to wait for a peer to say whether it has a file before sending it anyway
+#define RECEIVE_BUDGET (1024*1024) // Most bytes read from one chat before its worker lets other chats have a turn
+#define MAX_SIGNATURES (16*1024*1024) // Most bytes of signatures taken from a peer (a 4GB file needs under 1MB)
+#define CONCURRENT_TRANSFERS 3 // Default most files sent at once, across all chats
+#define CONCURRENT_REPLIES 2 // Most answers to peers' file offers sent at once, across all chats
+#define SENDING_RECORD_MS 500 // Least time between records of a file being sent's progress (headless)
+#define SEND_BUFFERS 3 // Parts of a file between the stages sending it (see sendWhole())
+
+static void freeReceiver(struct Receiver* rx);
+static void historyLoaded(void* ctx, struct HistoryLog* log, const struct HistoryBatch* batch);
+static long millisecondsSince(const struct timespec* start);
+
+///////////////////////////////////////////////////////////
+//       Data Structure Memory Management
+///////////////////////////////////////////////////////////
+
+struct Chatter* initChatter(int headless, const char* historyDir) {
+    debug_print("initChatter called\n");
+    // Dynamically allocate all objects that need allocating
+    struct Chatter* chatter = (struct Chatter*)malloc(sizeof(struct Chatter));
+    chatter->gui = headless ? NULL : initGUI();
+    chatter->myname = strdup("Anonymous");
+    ChatArray_init(&chatter->chats);
+    chatter->visibleChat = NULL;
+    chatter->visibleIndex = 0;
+    pthread_mutex_init(&chatter->lock, NULL);
+    atomic_store(&chatter->stopping, 0);
+    chatter->events = EventQueue_init();
+    chatter->search = SearchIndex_init();
+    chatter->history = NULL;
+    chatter->memoryBudget = MEMORY_BUDGET;
+    chatter->chatMemoryBudget = CHAT_MEMORY_BUDGET;
+    chatter->files = NULL;
+    chatter->workers = NULL;
+    chatter->transfers = NULL;
+    chatter->replies = NULL;
+    pthread_cond_init(&chatter->fileAnswered, NULL);
+    chatter->sessionPath = NULL;
+    pthread_cond_init(&chatter->snapshotStop, NULL);
+    chatter->snapshotStopping = 0;
+    if (historyDir != NULL) {
+        chatter->history = History_init(historyDir, historyLoaded, chatter);
+        if (chatter->history == NULL) {
+            fprintf(stderr, "Couldn't keep history in %s; carrying on without it\n", historyDir);
+        }
+    }
+    /////////////////////////////////////////
+    // Only the GUI thread should see terminal resizes, so block SIGWINCH
+    // here and let every thread started from now on inherit that
+    sigset_t winch;
+    sigemptyset(&winch);
+    sigaddset(&winch, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &winch, NULL);
+    // Apply events as they come in, refreshing the GUI (if there is one)
+    void* (*eventLoop)(void*) = headless ? headlessEventLoop : refreshGUILoop;
+    int res = pthread_create(&chatter->eventThread, NULL, eventLoop, (void*)chatter);
+    if (res != 0) {
+        fprintf(stderr, "Error setting up event thread\n");
+    }
+    /////////////////////////////////////////
+    return chatter;
+}
+
+void destroyChatter(struct Chatter* chatter) {
+    debug_print("destroyChatter called\n");
+
+    if (chatter->transfers != NULL) {
+        // Files still going out are given up on (and their peers told),
+        // including any waiting to hear whether the peer has them
+        TransferQueue_cancelAll(chatter->transfers);
+        pthread_mutex_lock(&chatter->lock);
+        pthread_cond_broadcast(&chatter->fileAnswered);
+        pthread_mutex_unlock(&chatter->lock);
+        TransferQueue_free(chatter->transfers);
+    }
+    if (chatter->workers != NULL) {
+        // Nothing more is read from peers once the workers have stopped
+        WorkerPool_free(chatter->workers);
+    }
+    if (chatter->replies != NULL) {
+        // The workers queue replies, so they're stopped first
+        TransferQueue_cancelAll(chatter->replies);
+        TransferQueue_free(chatter->replies);
+    }
+    // Nothing can be freed while the event thread might still be applying
+    // an event (and the GUI thread gives the terminal back as it stops)
+    atomic_store(&chatter->stopping, 1);
+    EventQueue_wake(chatter->events);
+    pthread_join(chatter->eventThread, NULL);
+    if (chatter->gui != NULL) {
+        destroyGUI(chatter->gui);
+    }
+    if (chatter->sessionPath != NULL) {
+        pthread_mutex_lock(&chatter->lock);
+        chatter->snapshotStopping = 1;
+        pthread_cond_signal(&chatter->snapshotStop);
+        pthread_mutex_unlock(&chatter->lock);
+        pthread_join(chatter->snapshotThread, NULL);
+        // The last snapshot, while every chat is still open
+        if (saveSession(chatter, chatter->sessionPath) != STATUS_SUCCESS) {
+            fprintf(stderr, "Couldn't save the session to %s\n", chatter->sessionPath);
+        }
+        free(chatter->sessionPath);
+    }
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        struct Chat* chat = chatter->chats.data[i];
+        if (chat->receiver != NULL) {
+            freeReceiver(chat->receiver);
+        }
+        releaseChat(chat);
+    }
+    ChatArray_free(&chatter->chats);
+    if (chatter->history != NULL) {
+        History_free(chatter->history);
+    }
+    SearchIndex_free(chatter->search);
+    if (chatter->files != NULL) {
+        FileStore_free(chatter->files);
+    }
+    pthread_cond_destroy(&chatter->fileAnswered);
+    pthread_mutex_destroy(&chatter->lock);
+    pthread_cond_destroy(&chatter->snapshotStop);
+    EventQueue_free(chatter->events);
+    free(chatter->myname);
+    free(chatter);
+}
+
+/**
+ * @brief Get the first chat whose name starts with name
+ * (NOTE: Caller must hold chatter->lock)
+ * 
+ * @param name String name
+ * @param index Set to where it is in the list (NULL if that isn't wanted)
+ * @return struct Chat*, or NULL if there's none
+ */
+static struct Chat* findChat(struct Chatter* chatter, const char* name, size_t* index) {
+    size_t len = strlen(name);
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        struct Chat* chat = chatter->chats.data[i];
+        if (strncmp(name, chat->name, len) == 0) {
+            if (index != NULL) {
+                *index = i;
+            }
+            return chat;
+        }
+    }
+    return NULL;
+}
+
+struct Chat* getChatFromName(struct Chatter* chatter, char* name) {
+    debug_print("getChatFromName called\n");
+
+    pthread_mutex_lock(&chatter->lock);
+    struct Chat* chat = findChat(chatter, name, NULL);
+    if (chat != NULL) {
+        retainChat(chat);
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    return chat;
+}
+
+/**
+ * @brief Take a reference to every chat, so that they can be gone
+ * through without holding the registry lock
+ * (NOTE: Caller must hold chatter->lock)
+ * 
+ * @param chatter Chatter object
+ * @param chats Filled with the chats, in order (release them with releaseChats())
+ */
+static void retainChats(struct Chatter* chatter, ChatArray* chats) {
+    ChatArray_init(chats);
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        retainChat(chatter->chats.data[i]);
+        ChatArray_push(chats, chatter->chats.data[i]);
+    }
+}
+
+static void releaseChats(ChatArray* chats) {
+    for (size_t i = 0; i < chats->N; i++) {
+        releaseChat(chats->data[i]);
+    }
+    ChatArray_free(chats);
+}
+
+struct Chat* lockVisibleChat(struct Chatter* chatter) {
+    pthread_mutex_lock(&chatter->lock);
+    struct Chat* chat = chatter->visibleChat;
+    if (chat != NULL) {
+        pthread_mutex_lock(&chat->lock);
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    return chat;
+}
+
+int _send_loop(int sockfd,char *src,size_t len){
+    int status = STATUS_SUCCESS;
+    ssize_t sent_bytes;
+
+    while (len > 0){
+        sent_bytes = send(sockfd,src,len,0);
+        if(sent_bytes == -1){
+            status = FAILURE_GENERIC;
+            break;
+        }
+        src += sent_bytes;
+        len -= sent_bytes;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Send everything that's been encoded into a chat's send buffer,
+ * then empty the buffer for the next frame
+ * (NOTE: Caller must hold chat->sendLock)
+ *
+ * @param chat Chat whose sendBuf holds the frame(s)
+ */
+int _send_frames(struct Chat* chat){
+    int status = _send_loop(chat->sockfd,chat->sendBuf.buff,chat->sendBuf.N);
+    ArrayListBuf_clear(&chat->sendBuf);
+    return status;
+}
+
+int _recv_loop(int sockfd,char *dst,size_t len){
+    int status = STATUS_SUCCESS;
+    ssize_t res;
+
+    while(len > 0){
+        res = recv(sockfd,dst,len,0);
+        if (res <= 0) {
+            perror("recv");
+            debug_print("res: %ld\n",res);
+            status = FAILURE_GENERIC;
+            break;
+        }
+        dst += res;
+        len -= res;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Remove a particular chat from the list, and drop the list's
+ * reference to it once whoever holds its locks is done
+ * 
+ * @param chatter Chatter object
+ * @param chat Chat to remove
+ */
+void removeChat(struct Chatter* chatter, struct Chat* chat) {
+    pthread_mutex_lock(&chatter->lock);
+    debug_print("REMOVE CHAT WAS CALLED!!!!\n");
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        if (chatter->chats.data[i] == chat) {
+            ChatArray_remove(&chatter->chats, i);
+            if (i < chatter->visibleIndex) {
+                chatter->visibleIndex--; // The visible chat moved up a row
+            }
+            break;
+        }
+    }
+    invalidateChatWindow(chatter->gui);
+    if (chatter->visibleChat == chat) {
+        // Bounce to another chat if there is one
+        chatter->visibleChat = NULL;
+        chatter->visibleIndex = 0;
+        if (chatter->chats.N > 0) {
+            chatter->visibleChat = chatter->chats.data[0];
+        }
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    // Nobody can find it any more, but someone who did may still hold
+    // its lock without a reference (see lockVisibleChat()); wait them out
+    pthread_mutex_lock(&chat->lock);
+    pthread_mutex_unlock(&chat->lock);
+    releaseChat(chat);
+}
+
+
+///////////////////////////////////////////////////////////
+//             Chat Session Messages In
+///////////////////////////////////////////////////////////
+
+/**
+ * @brief Where to put a file a peer sent: the last part of the name it
+ * gave, in the current directory, so that a peer can't write anywhere else
+ * 
+ * @param name Name the peer gave
+ * @return const char* Points into name (or is a fixed name if nothing's left of it)
+ */
+static const char* receivedFileName(const char* name) {
+    const char* base = strrchr(name, '/');
+    base = base == NULL ? name : base + 1;
+    if (*base == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+        return "received";
+    }
+    return base;
+}
+
+/**
+ * @brief Open my older copy of a file a peer offered, if it's worth
+ * having the peer send just the changes to it
+ * 
+ * @param name Where the file would go (see receivedFileName())
+ * @param size Size of the file offered
+ * @return int The older copy, open for reading (-1 if there isn't one)
+ */
+static int openOlderCopy(const char* name, uint32_t size) {
+    if (size < DELTA_MIN_BLOCK) {
+        return -1;
+    }
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd != -1 && (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < DELTA_MIN_BLOCK)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * A file being rebuilt from an older copy and the changes a peer sent
+ */
+struct Rebuild {
+    struct FileStoreWriter writer;
+    uint64_t done; // Bytes of the file so far
+};
+
+static int writeRebuilt(void* ctx, const char* data, size_t len) {
+    struct Rebuild* rebuild = (struct Rebuild*)ctx;
+    rebuild->done += len;
+    return FileStore_write(&rebuild->writer, data, len);
+}
+
+enum ReceivePhase {
+    RECEIVE_HEADER = 0, // Reading a frame's header
+    RECEIVE_PAYLOAD = 1 // Reading the part of a frame's payload that's needed before it can be handled
+};
+
+/**
+ * Where a chat's incoming stream is up to.  A worker reads whatever has
+ * arrived each time the socket is readable, which can stop part way
+ * through a frame, so everything about the frame being read is kept
+ * here between runs rather than on a thread's stack.  Only the worker
+ * running the chat touches it (see WorkerPool_rearm())
+ */
+struct Receiver {
+    int phase;
+    struct header_generic header;
+    struct Frame frame;
+    size_t have, need; // Bytes of the header or payload read so far, and of the payload in all
+    char* into; // Where the payload goes: payload, or the text of message
+    char* payload;
+    size_t capacity; // Of payload
+    struct Message* message; // SEND_MESSAGE being read
+    // A sent file, whose contents come in FILE_DATA frames
+    int receivingFile; // Whether one is part way in
+    FILE* file; // NULL if the file goes into the store
+    struct FileStoreWriter writer;
+    char* filename;
+    uint32_t fileLength, fileLeft, lastProgress;
+    // Sending just the changes to my older copy of a file (see delta.h)
+    int basis, rebuilding;
+    uint32_t basisBlock, deltaLength;
+    uint64_t deltaProgress;
+    uint8_t expectedHash[FILESTORE_HASH_SIZE];
+    struct Rebuild rebuild;
+    char* deltaName;
+};
+
+static struct Receiver* initReceiver() {
+    struct Receiver* rx = (struct Receiver*)calloc(1, sizeof(struct Receiver));
+    rx->phase = RECEIVE_HEADER;
+    rx->basis = -1;
+    return rx;
+}
+
+/**
+ * @brief Give up on a file a chat was part way through receiving, whole
+ * or as changes.  What's been written of it is thrown away
+ */
+static void dropFile(struct Receiver* rx) {
+    if (rx->receivingFile) {
+        rx->receivingFile = 0;
+        if (rx->file != NULL) {
+            fclose(rx->file);
+            rx->file = NULL;
+            unlink(receivedFileName(rx->filename));
+        }
+        else {
+            FileStore_abort(&rx->writer);
+        }
+    }
+    if (rx->rebuilding) {
+        rx->rebuilding = 0;
+        FileStore_abort(&rx->rebuild.writer);
+    }
+    if (rx->basis != -1) {
+        close(rx->basis);
+        rx->basis = -1;
+    }
+}
+
+/**
+ * @brief Give up on whatever a chat was part way through receiving, and
+ * free its receiver
+ */
+static void freeReceiver(struct Receiver* rx) {
+    dropFile(rx);
+    if (rx->message != NULL) {
+        Message_free(rx->message);
+    }
+    free(rx->payload);
+    free(rx->filename);
+    free(rx->deltaName);
+    free(rx);
+}
+
+/**
+ * @brief Work out how much of a frame's payload has to be read before
+ * it's handled, and where to put it
+ * 
+ * @return int 0 on success, -1 if the frame is too big to be believed
+ * (or there's no memory for it)
+ */
+static int beginPayload(struct Receiver* rx) {
+    struct Frame* frame = &rx->frame;
+    size_t need = 0;
+    switch (frame->magic) {
+        case INDICATE_NAME:
+        case SEND_FILE:
+        case SEND_DELTA:
+            need = frame->shortInt;
+            break;
+        case SEND_MESSAGE:
+            need = frame->longInt;
+            break;
+        case QUERY_FILE:
+            need = FILESTORE_HASH_SIZE + frame->shortInt;
+            break;
+        case SIGNATURES:
+            if (frame->longInt > MAX_SIGNATURES) {
+                return -1;
+            }
+            need = frame->longInt;
+            break;
+        case DELTA_DATA:
+            if (frame->longInt > DELTA_CHUNK) {
+                return -1;
+            }
+            need = frame->longInt;
+            break;
+        case FILE_DATA:
+            if (frame->longInt > FILE_CHUNK) {
+                return -1;
+            }
+            need = frame->longInt;
+            break;
+    }
+    if (frame->magic == SEND_MESSAGE) {
+        // Straight into the message, saving a copy
+        rx->message = Message_alloc(frame->shortInt, frame->longInt);
+        if (rx->message == NULL) {
+            return -1; // No memory for it (or a length no one would send)
+        }
+        rx->into = Message_text(rx->message);
+    }
+    else {
+        if (need + 1 > rx->capacity) {
+            free(rx->payload);
+            rx->capacity = need + 1;
+            rx->payload = (char*)malloc(rx->capacity);
+        }
+        rx->into = rx->payload;
+    }
+    rx->phase = RECEIVE_PAYLOAD;
+    rx->have = 0;
+    rx->need = need;
+    return 0;
+}
+
+/**
+ * @brief Handle part of a sent file's contents
+ * 
+ * @return int 1 to keep reading, 0 to end the chat
+ */
+static int receiveFileData(struct Chatter* chatter, struct Chat* chat, struct Receiver* rx, const char* data, size_t len) {
+    size_t written;
+    if (rx->file == NULL) {
+        written = FileStore_write(&rx->writer, data, len) == 0 ? len : 0;
+    }
+    else {
+        written = fwrite(data, sizeof(char), len, rx->file);
+    }
+    if (written < len) {
+        return 0;
+    }
+    rx->fileLeft -= len;
+    if (len > 0 && (rx->lastProgress - rx->fileLeft >= PROGRESS_INTERVAL || rx->fileLeft == 0)) {
+        rx->lastProgress = rx->fileLeft;
+        struct Event* event = Event_init(EVENT_TRANSFER_PROGRESS, chat);
+        event->done = rx->fileLength - rx->fileLeft;
+        event->total = rx->fileLength;
+        EventQueue_push(chatter->events, event);
+    }
+    if (rx->fileLeft == 0) {
+        rx->receivingFile = 0;
+        uint8_t hash[FILESTORE_HASH_SIZE];
+        if (rx->file != NULL) {
+            fclose(rx->file);
+            rx->file = NULL;
+        }
+        else if (FileStore_commit(&rx->writer, hash) == -1 || FileStore_link(chatter->files, hash, receivedFileName(rx->filename)) == -1) {
+            reportError(chatter, "Error storing a file that was sent");
+        }
+    }
+    return 1;
+}
+
+/**
+ * A reply to a file the peer offered, on one of chatter->replies' threads
+ */
+struct Reply {
+    int sign; // Whether to send signatures of basis, rather than an answer
+    uint16_t answer; // FILE_ANSWER to send
+    int basis; // My older copy (-1 if there isn't one, or it couldn't be kept; the reply closes it)
+    uint32_t blockSize; // Block size to sign it with
+};
+
+/**
+ * @brief Send a reply queued by queueReply() (one per chat at a time, in
+ * the order they were queued)
+ *
+ * @param ctx Chatter object
+ * @param transfer Transfer, whose key is the chat (a reference is held
+ * to it) and whose item is the Reply
+ */
+static void runReply(void* ctx, struct Transfer* transfer) {
+    (void)ctx;
+    struct Chat* chat = (struct Chat*)transfer->key;
+    struct Reply* reply = (struct Reply*)transfer->item;
+    // One cancelled before it started only has to be cleaned up
+    if (!atomic_load(&transfer->cancelled)) {
+        // Reading the whole copy can take a while, so it's done here rather
+        // than on the worker reading the chat (the peer waits for it)
+        struct ArrayListBuf signatures;
+        ArrayListBuf_init(&signatures);
+        if (reply->basis != -1) {
+            Delta_sign(reply->basis, reply->blockSize, &signatures); // Covers what could be read, even on failure
+        }
+        pthread_mutex_lock(&chat->sendLock);
+        if (reply->sign) {
+            Frame_encode(&chat->sendBuf, SIGNATURES, 0, signatures.N, signatures.buff, signatures.N);
+        }
+        else {
+            Frame_encode(&chat->sendBuf, FILE_ANSWER, reply->answer, 0, NULL, 0);
+        }
+        _send_frames(chat);
+        pthread_mutex_unlock(&chat->sendLock);
+        ArrayListBuf_free(&signatures);
+    }
+    if (reply->basis != -1) {
+        close(reply->basis);
+    }
+    releaseChat(chat);
+    free(reply);
+}
+
+/**
+ * @brief Have a reply to the peer's file offer sent from chatter->replies,
+ * rather than from the worker reading the chat (which would stop reading
+ * while the peer may be sending to it) or the event thread (which would
+ * stop drawing)
+ *
+ * @param sign Whether to send signatures of basis, rather than an answer
+ * @param answer FILE_ANSWER
+ * @param basis Older copy to sign, read from the start, which the reply
+ * takes (-1 if there isn't one; the signatures are then empty)
+ * @param blockSize Block size to sign it with
+ */
+static void queueReply(struct Chatter* chatter, struct Chat* chat, int sign, uint16_t answer, int basis, uint32_t blockSize) {
+    struct Reply* reply = (struct Reply*)malloc(sizeof(struct Reply));
+    reply->sign = sign;
+    reply->answer = answer;
+    reply->basis = basis;
+    reply->blockSize = blockSize;
+    retainChat(chat);
+    TransferQueue_add(chatter->replies, chat, sign ? "signatures" : "answer", 0, reply);
+}
+
+/**
+ * @brief Act on a frame that's been read (as much of it as is needed)
+ * 
+ * @return int 1 to keep reading, 0 to end the chat
+ */
+static int handleFrame(struct Chatter* chatter, struct Chat* chat, struct Receiver* rx) {
+    struct Frame* frame = &rx->frame;
+    char* payload = rx->payload;
+    struct Event* event;
+    uint8_t hash[FILESTORE_HASH_SIZE];
+    int answer;
+    rx->phase = RECEIVE_HEADER;
+    rx->have = 0;
+    if (frame->magic != SEND_MESSAGE) {
+        payload[rx->need] = '\0';
+    }
+
+    switch(frame->magic){
+        case INDICATE_NAME:
+            debug_print("NAME recvd\n");
+
+            event = Event_init(EVENT_NAME_CHANGED,chat);
+            event->name = strdup(payload);
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case SEND_MESSAGE:
+            debug_print("MESSAGE recvd\n");
+
+            event = Event_init(EVENT_MESSAGE_ARRIVED,chat);
+            event->message = rx->message;
+            rx->message = NULL;
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case DELETE_MESSAGE:
+            debug_print("DELETE NAME recvd\n");
+
+            event = Event_init(EVENT_MESSAGE_DELETED,chat);
+            event->id = frame->shortInt;
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case SEND_FILE:
+            debug_print("FILE recvd\n");
+
+            dropFile(rx); // Whatever came before it won't be finished
+            free(rx->filename);
+            rx->filename = strdup(payload);
+            // Into the file store if there is one, hashing on the way,
+            // and from there under the name the peer gave
+            rx->file = NULL;
+            if (chatter->files == NULL || FileStore_begin(chatter->files,&rx->writer) == -1) {
+                rx->file = fopen(receivedFileName(rx->filename),"wb");
+                if (rx->file == NULL) {
+                    return 0;
+                }
+            }
+            rx->fileLength = frame->longInt;
+            rx->fileLeft = frame->longInt;
+            rx->lastProgress = frame->longInt;
+            rx->receivingFile = 1;
+            if (rx->fileLeft == 0) {
+                return receiveFileData(chatter,chat,rx,NULL,0);
+            }
+            break;
+
+        case FILE_DATA:
+            if (!rx->receivingFile) {
+                break; // What's left of a file I gave up on
+            }
+            if (rx->need > rx->fileLeft) {
+                return 0;
+            }
+            return receiveFileData(chatter,chat,rx,payload,rx->need);
+
+        case CANCEL_FILE:
+            debug_print("CANCEL FILE recvd\n");
+
+            dropFile(rx);
+            // Clears the bytes still to come from the name window
+            event = Event_init(EVENT_TRANSFER_PROGRESS,chat);
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case QUERY_FILE:
+            debug_print("QUERY FILE recvd\n");
+
+            // If I have it, it's put in place now; the answer goes
+            // out from chatter->replies, so that this never waits to send
+            answer = chatter->files != NULL
+                && FileStore_has(chatter->files,(uint8_t*)payload,frame->longInt)
+                && FileStore_link(chatter->files,(uint8_t*)payload,receivedFileName(payload+FILESTORE_HASH_SIZE)) == 0;
+            dropFile(rx); // A new offer means the last file won't be finished
+            if (!answer && chatter->files != NULL) {
+                // If I have an older copy, only what changed need be sent
+                rx->basis = openOlderCopy(receivedFileName(payload+FILESTORE_HASH_SIZE),frame->longInt);
+                answer = rx->basis == -1 ? 0 : 2;
+            }
+            queueReply(chatter,chat,0,answer,-1,0);
+            if (answer == 1) {
+                event = Event_init(EVENT_FILE_QUERIED,chat);
+                event->done = frame->longInt;
+                event->total = frame->longInt;
+                EventQueue_push(chatter->events,event);
+            }
+            if (answer == 2) {
+                // Answered first so that the peer knows to wait while the
+                // replies queue reads the whole copy.  It signs a copy of the
+                // descriptor, as this one goes if the offer's dropped, and
+                // rebuilding only reads it with pread()
+                memcpy(rx->expectedHash,payload,FILESTORE_HASH_SIZE);
+                rx->basisBlock = Delta_blockSize(lseek(rx->basis,0,SEEK_END));
+                lseek(rx->basis,0,SEEK_SET);
+                queueReply(chatter,chat,1,0,dup(rx->basis),rx->basisBlock);
+            }
+            break;
+
+        case FILE_ANSWER:
+            debug_print("FILE ANSWER recvd\n");
+
+            event = Event_init(EVENT_FILE_ANSWERED,chat);
+            event->id = frame->shortInt;
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case SIGNATURES:
+            debug_print("SIGNATURES recvd\n");
+
+            // The buffer goes with the event
+            event = Event_init(EVENT_SIGNATURES_ARRIVED,chat);
+            event->data = payload;
+            event->len = rx->need;
+            rx->payload = NULL;
+            rx->capacity = 0;
+            EventQueue_push(chatter->events,event);
+            break;
+
+        case SEND_DELTA:
+            debug_print("SEND DELTA recvd\n");
+
+            free(rx->deltaName);
+            rx->deltaName = strdup(payload);
+            if (rx->rebuilding) {
+                FileStore_abort(&rx->rebuild.writer);
+            }
+            // Without an older copy to apply them to, the changes are read and dropped
+            rx->rebuilding = rx->basis != -1 && FileStore_begin(chatter->files,&rx->rebuild.writer) == 0;
+            rx->rebuild.done = 0;
+            rx->deltaLength = frame->longInt;
+            rx->deltaProgress = 0;
+            break;
+
+        case DELTA_DATA:
+            if (rx->rebuilding && Delta_apply(payload,rx->need,rx->basis,rx->basisBlock,writeRebuilt,&rx->rebuild) == -1) {
+                FileStore_abort(&rx->rebuild.writer);
+                rx->rebuilding = 0;
+                reportError(chatter, "Error rebuilding a file from the changes sent");
+            }
+            if (rx->rebuilding && rx->rebuild.done - rx->deltaProgress >= PROGRESS_INTERVAL && rx->rebuild.done < rx->deltaLength) {
+                rx->deltaProgress = rx->rebuild.done;
+                event = Event_init(EVENT_TRANSFER_PROGRESS,chat);
+                event->done = rx->rebuild.done;
+                event->total = rx->deltaLength;
+                EventQueue_push(chatter->events,event);
+            }
+            break;
+
+        case DELTA_END:
+            debug_print("DELTA END recvd\n");
+
+            if (rx->rebuilding) {
+                rx->rebuilding = 0;
+                // The blocks' hashes are only 64 bits, so the whole file is checked too
+                if (FileStore_commit(&rx->rebuild.writer,hash) == -1 || memcmp(hash,rx->expectedHash,FILESTORE_HASH_SIZE) != 0) {
+                    reportError(chatter, "A file sent as changes didn't come out right");
+                }
+                else if (FileStore_link(chatter->files,hash,receivedFileName(rx->deltaName == NULL ? "" : rx->deltaName)) == -1) {
+                    reportError(chatter, "Error storing a file that was sent");
+                }
+                event = Event_init(EVENT_TRANSFER_PROGRESS,chat);
+                event->done = rx->deltaLength;
+                event->total = rx->deltaLength;
+                EventQueue_push(chatter->events,event);
+            }
+            if (rx->basis != -1) {
+                close(rx->basis);
+                rx->basis = -1;
+            }
+            break;
+
+        case END_CHAT:
+            debug_print("END CHAT recvd\n");
+            return 0;
+
+        default:
+            debug_print("Unknown magic number %d received",frame->magic);
+            break;
+    }
+    return 1;
+}
+
+/**
+ * @brief Take in bytes that were just read into wherever the receiver
+ * asked for them
+ * 
+ * @return int 1 to keep reading, 0 to end the chat
+ */
+static int received(struct Chatter* chatter, struct Chat* chat, struct Receiver* rx, size_t len) {
+    rx->have += len;
+    if (rx->phase == RECEIVE_HEADER) {
+        if (rx->have < sizeof(rx->header)) {
+            return 1;
+        }
+        Frame_decode(&rx->header, &rx->frame);
+        if (beginPayload(rx) == -1) {
+            return 0;
+        }
+        return rx->need == 0 ? handleFrame(chatter, chat, rx) : 1;
+    }
+    return rx->have < rx->need ? 1 : handleFrame(chatter, chat, rx);
+}
+
+/**
+ * @brief Read whatever has arrived on a chat, and handle every frame
+ * that completes (run on a worker each time the chat's socket is
+ * readable).  Nothing here touches the GUI or shared chat state;
+ * everything that arrives is published to chatter->events for the
+ * event thread to apply
+ * 
+ * @param ctx Chatter object
+ * @param item Chat
+ */
+static void receiveReady(void* ctx, void* item) {
+    struct Chatter* chatter = (struct Chatter*)ctx;
+    struct Chat* chat = (struct Chat*)item;
+    struct Receiver* rx = chat->receiver;
+    size_t budget = RECEIVE_BUDGET;
+    int open = 1;
+    while (open && budget > 0) {
+        char* into;
+        size_t want;
+        if (rx->phase == RECEIVE_HEADER) {
+            into = (char*)&rx->header + rx->have;
+            want = sizeof(rx->header) - rx->have;
+        }
+        else {
+            into = rx->into + rx->have;
+            want = rx->need - rx->have;
+        }
+        // The socket stays blocking for sends; only reads here mustn't wait
+        ssize_t n = recv(chat->sockfd, into, want, MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break; // Everything that's arrived has been read
+        }
+        if (n <= 0) {
+            debug_print("RECV FAILURE!!\n");
+            open = 0;
+            break;
+        }
+        budget -= (size_t)n < budget ? (size_t)n : budget;
+        open = received(chatter, chat, rx, (size_t)n);
+    }
+    // If more has arrived (or the budget ran out), the chat is run again
+    // once the chats queued ahead of it have had a turn
+    if (open && WorkerPool_rearm(chatter->workers, chat->sockfd, chat) == 0) {
+        return;
+    }
+    debug_print("ENDING RECEIVE LOOP!\n");
+    WorkerPool_unwatch(chatter->workers, chat->sockfd);
+    freeReceiver(rx);
+    chat->receiver = NULL;
+    // This is the last event about this chat, and the last time a worker
+    // touches it; the event thread removes and frees it
+    EventQueue_push(chatter->events,Event_init(EVENT_CHAT_CLOSED,chat));
+}
+
+/**
+ * @brief Have a chat's tombstones cleared out by the event thread, off
+ * the delete path, once there are enough of them
+ * (NOTE: Caller must hold chat->lock)
+ */
+static void compactLater(struct Chatter* chatter, struct Chat* chat) {
+    if (!chat->compactQueued && Timeline_needsCompaction(&chat->timeline)) {
+        chat->compactQueued = 1;
+        EventQueue_push(chatter->events, Event_init(EVENT_COMPACT, chat));
+    }
+}
+
+struct CompactContext {
+    struct GUI* gui;
+    struct Chat* chat;
+};
+
+static void tombstoneRemoved(void* ctx, size_t index) {
+    struct CompactContext* compact = (struct CompactContext*)ctx;
+    messageRemovedGUI(compact->gui, compact->chat, index);
+}
+
+/**
+ * @brief Whether a chat is still open (NOTE: Caller must hold chatter->lock)
+ */
+static int chatIsOpen(struct Chatter* chatter, struct Chat* chat) {
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        if (chatter->chats.data[i] == chat) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Index a batch of a chat's history for searching, and hand it
+ * to the event thread to put in the chat (on the history's worker thread)
+ *
+ * @param ctx Chatter object
+ * @param log Chat's history; its owner is the chat's number
+ * @param batch Messages loaded
+ */
+static void historyLoaded(void* ctx, struct HistoryLog* log, const struct HistoryBatch* batch) {
+    struct Chatter* chatter = (struct Chatter*)ctx;
+    uint32_t number = (uint32_t)log->owner;
+    // Each batch is older than everything indexed so far, so newest first
+    for (size_t i = batch->N; i > 0; i--) {
+        const struct HistoryEntry* entry = &batch->entries[i-1];
+        struct SearchDoc doc = {entry->timestamp, number, entry->id, entry->flags};
+        SearchIndex_addOlder(chatter->search, &doc, batch->texts[i-1], entry->len);
+    }
+    if (batch->N > 0) {
+        struct Event* event = Event_init(EVENT_HISTORY_LOADED, NULL);
+        event->number = number;
+        event->data = (char*)malloc(batch->N*sizeof(uint64_t));
+        memcpy(event->data, batch->refs, batch->N*sizeof(uint64_t));
+        event->len = batch->N;
+        EventQueue_push(chatter->events, event);
+    }
+}
+
+/**
+ * @brief Apply something that happened on a worker
+ * (NOTE: Only called from the thread consuming chatter->events)
+ * 
+ * @param chatter Chatter object
+ * @param event Event to apply; freed here
+ */
+void handleEvent(struct Chatter* chatter, struct Event* event) {
+    struct Chat* chat = event->chat;
+    if (event->type == EVENT_CHAT_CLOSED) {
+        removeChat(chatter, chat);
+        scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT);
+        pthread_cond_broadcast(&chatter->fileAnswered); // In case a file was being offered on it
+        free(event);
+        return;
+    }
+    long index;
+    struct HistoryLog* log = NULL;
+    if (event->type == EVENT_NAME_CHANGED && chatter->history != NULL && chat->history == NULL) {
+        // Now that we know who this is, bring back what we said before.
+        // Opening only makes sure the directory's there; the messages
+        // come from the history's worker (see historyLoaded()).  Only
+        // this thread sets chat->history, so it can be read without the lock
+        log = History_open(chatter->history, event->name, chat->number);
+        if (log == NULL && chatter->gui != NULL) {
+            // Most likely another chat (or chatter) already has a peer of that name
+            struct ArrayListBuf text;
+            ArrayListBuf_init(&text);
+            ArrayListBuf_appendf(&text, "Not keeping history for %s: it's open elsewhere, or can't be written", event->name);
+            printNoticeGUI(chatter, ArrayListBuf_cstr(&text));
+            ArrayListBuf_free(&text);
+        }
+    }
+    // Each case takes only the locks it needs, so one chat's events don't
+    // wait on anything another chat is doing
+    switch (event->type) {
+        case EVENT_CHAT_OPENED:
+            scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT);
+            break;
+        case EVENT_MESSAGE_ARRIVED:
+            pthread_mutex_lock(&chat->lock);
+            addMessage(chat, event->message);
+            SearchIndex_add(chatter->search, chat->number, event->message);
+            if (chat == chatter->visibleChat) {
+                scheduleRepaint(chatter, REPAINT_CHAT);
+            }
+            else {
+                chat->unread++;
+                scheduleRepaint(chatter, REPAINT_NAMES);
+            }
+            trimMemory(chatter, chat);
+            pthread_mutex_unlock(&chat->lock);
+            break;
+        case EVENT_MESSAGE_DELETED:
+            pthread_mutex_lock(&chat->lock);
+            index = deleteMessageFromChat(chat, event->id, 0);
+            if (index >= 0) {
+                messageDeletedGUI(chatter->gui, chat);
+                scheduleRepaint(chatter, REPAINT_CHAT);
+                compactLater(chatter, chat);
+            }
+            pthread_mutex_unlock(&chat->lock);
+            break;
+        case EVENT_COMPACT:
+            // Pushed from here rather than a worker, so the chat
+            // may have closed since
+            pthread_mutex_lock(&chatter->lock);
+            if (!chatIsOpen(chatter, chat)) {
+                pthread_mutex_unlock(&chatter->lock);
+                break;
+            }
+            pthread_mutex_lock(&chat->lock);
+            pthread_mutex_unlock(&chatter->lock);
+            struct CompactContext compact = {chatter->gui, chat};
+            chat->compactQueued = 0;
+            Timeline_compact(&chat->timeline, tombstoneRemoved, &compact);
+            pthread_mutex_unlock(&chat->lock);
+            break;
+        case EVENT_NAME_CHANGED:
+            // Names are read under either lock, so they're changed under both
+            pthread_mutex_lock(&chatter->lock);
+            pthread_mutex_lock(&chat->lock);
+            setChatName(chat, event->name, strlen(event->name));
+            pthread_mutex_unlock(&chatter->lock);
+            if (log != NULL) {
+                attachHistory(chat, log);
+            }
+            if (chat == chatter->visibleChat) {
+                invalidateChatWindow(chatter->gui); // The name is part of every line
+            }
+            pthread_mutex_unlock(&chat->lock);
+            scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT);
+            free(event->name);
+            break;
+        case EVENT_FILE_ANSWERED:
+            pthread_mutex_lock(&chatter->lock);
+            chat->fileAnswer = event->id <= 2 ? event->id : 0;
+            pthread_cond_broadcast(&chatter->fileAnswered);
+            pthread_mutex_unlock(&chatter->lock);
+            break;
+        case EVENT_SIGNATURES_ARRIVED:
+            pthread_mutex_lock(&chatter->lock);
+            free(chat->signatures);
+            chat->signatures = event->data;
+            chat->signaturesLen = event->len;
+            pthread_cond_broadcast(&chatter->fileAnswered);
+            pthread_mutex_unlock(&chatter->lock);
+            break;
+        case EVENT_TRANSFER_PROGRESS:
+            pthread_mutex_lock(&chat->lock);
+            chat->transferDone = event->done;
+            chat->transferTotal = event->done < event->total ? event->total : 0;
+            pthread_mutex_unlock(&chat->lock);
+            scheduleRepaint(chatter, REPAINT_NAMES);
+            break;
+        case EVENT_HISTORY_LOADED:
+            // The worker that loaded it holds no reference to the chat,
+            // so it's looked up by number in case it's closed since
+            pthread_mutex_lock(&chatter->lock);
+            chat = NULL;
+            for (size_t i = 0; i < chatter->chats.N && chat == NULL; i++) {
+                if (chatter->chats.data[i]->number == event->number) {
+                    chat = chatter->chats.data[i];
+                }
+            }
+            if (chat == NULL) {
+                pthread_mutex_unlock(&chatter->lock);
+                free(event->data);
+                break;
+            }
+            pthread_mutex_lock(&chat->lock);
+            pthread_mutex_unlock(&chatter->lock);
+            messagesInsertedGUI(chatter->gui, chat, 0, prependHistory(chat, (const uint64_t*)event->data, event->len));
+            if (chat == chatter->visibleChat) {
+                scheduleRepaint(chatter, REPAINT_CHAT);
+            }
+            pthread_mutex_unlock(&chat->lock);
+            free(event->data);
+            break;
+    }
+    free(event);
+}
+
+
+
+///////////////////////////////////////////////////////////
+//             Chat Session Messages Out
+///////////////////////////////////////////////////////////
+
+
+/**
+ * @brief Send a message in a chat, letting go of its lock
+ * (NOTE: Caller must hold chat->lock, and no other lock)
+ * 
+ * @param chatter Data about the current chat session
+ * @param chat Chat to send it in
+ * @param message 
+ */
+static int sendMessageIn(struct Chatter* chatter, struct Chat* chat, char* message) {
+    // Handle adding the message locally
+    uint16_t msg_id = chat->outCounter++;
+    uint32_t remaining_len = strlen(message);
+    struct Message *msg_obj = Message_init(msg_id,message,remaining_len);
+    if (msg_obj == NULL) {
+        chat->outCounter--;
+        pthread_mutex_unlock(&chat->lock);
+        return FAILURE_GENERIC;
+    }
+    msg_obj->flags |= MESSAGE_OUTGOING;
+    addMessage(chat,msg_obj);
+    SearchIndex_add(chatter->search,chat->number,msg_obj);
+    trimMemory(chatter,chat);
+
+    // Handle sending message (header and text go out in one send).  The
+    // chat's lock is let go first, so that drawing the chat doesn't wait
+    // on the send (or on a file being sent ahead of it)
+    retainChat(chat);
+    pthread_mutex_unlock(&chat->lock);
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf,SEND_MESSAGE,msg_id,remaining_len,message,remaining_len);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    releaseChat(chat);
+    return status;
+}
+
+/**
+ * @brief Send a message in the visible chat
+ * 
+ * @param chatter Data about the current chat session
+ * @param message 
+ */
+int sendMessage(struct Chatter* chatter, char* message) {
+    struct Chat* chat = lockVisibleChat(chatter);
+    if (chat == NULL){
+        return FAILURE_GENERIC;
+    }
+    return sendMessageIn(chatter, chat, message);
+}
+
+/**
+ * @brief Delete message in the visible chat
+ * 
+ * @param chatter Data about the current chat session
+ * @param id ID of message to delete
+ */
+int deleteMessage(struct Chatter* chatter, uint16_t id) {
+    struct Chat* chat = lockVisibleChat(chatter);
+    if (chat == NULL) {
+        return CHAT_DOESNT_EXIST;
+    }
+
+    // Locally remove the message
+    long index = deleteMessageFromChat(chat,id,1);
+    if (index >= 0) {
+        messageDeletedGUI(chatter->gui, chat);
+        compactLater(chatter, chat);
+    }
+
+    // Send to remove the message on the remote connection
+    retainChat(chat);
+    pthread_mutex_unlock(&chat->lock);
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf,DELETE_MESSAGE,id,0,NULL,0);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    releaseChat(chat);
+    return status;
+}
+
+/**
+ * @brief Ask the peer in a chat whether it already has a file, before
+ * sending it.  The chat may close, or the transfer be cancelled, while
+ * waiting for the answer
+ * (NOTE: Caller must hold a reference to the chat, and no locks)
+ * 
+ * @param chatter Data about the current chat session
+ * @param chat Chat to send the file in
+ * @param filename Name to give the file
+ * @param hash The file's hash
+ * @param size The file's size
+ * @param transfer Transfer sending the file
+ * @return int 1 if the peer has it (and has put it in place), 0 if it has to be sent, 2 if just the
+ * changes to the peer's older copy have to be sent (its signatures are then in chat->signatures),
+ * -1 if the chat closed or the transfer was cancelled
+ */
+static int offerFile(struct Chatter* chatter, struct Chat* chat, const char* filename, const uint8_t* hash, uint32_t size, struct Transfer* transfer) {
+    size_t nameLen = strlen(filename);
+    char* payload = (char*)malloc(FILESTORE_HASH_SIZE + nameLen);
+    memcpy(payload, hash, FILESTORE_HASH_SIZE);
+    memcpy(payload + FILESTORE_HASH_SIZE, filename, nameLen);
+    pthread_mutex_lock(&chatter->lock);
+    chat->fileAnswer = -1;
+    free(chat->signatures);
+    chat->signatures = NULL;
+    pthread_mutex_unlock(&chatter->lock);
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf, QUERY_FILE, (uint16_t)nameLen, size, payload, FILESTORE_HASH_SIZE + nameLen);
+    int sent = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    free(payload);
+    if (sent != STATUS_SUCCESS) {
+        return 0; // Sending the file itself fails too, and says so
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (FILE_QUERY_TIMEOUT_MS % 1000)*1000000L;
+    deadline.tv_sec += FILE_QUERY_TIMEOUT_MS/1000 + deadline.tv_nsec/1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    // Once the peer says it has an older copy, it's reading the whole
+    // copy to take signatures, which can take longer than the timeout.
+    // cancelTransfer() wakes this up too
+    int res = 0, open = 1, cancelled;
+    pthread_mutex_lock(&chatter->lock);
+    while (!(cancelled = atomic_load(&transfer->cancelled)) && (open = chatIsOpen(chatter, chat))
+        && ((chat->fileAnswer == -1 && res != ETIMEDOUT) || (chat->fileAnswer == 2 && chat->signatures == NULL))) {
+        if (chat->fileAnswer == -1) {
+            res = pthread_cond_timedwait(&chatter->fileAnswered, &chatter->lock, &deadline);
+        }
+        else {
+            pthread_cond_wait(&chatter->fileAnswered, &chatter->lock);
+        }
+    }
+    int answer = cancelled || !open ? -1 : chat->fileAnswer == -1 ? 0 : chat->fileAnswer; // No answer; send it anyway
+    pthread_mutex_unlock(&chatter->lock);
+    return answer;
+}
+
+/**
+ * A file being sent, on one of chatter->transfers' threads
+ */
+struct Sending {
+    struct Chatter* chatter;
+    struct Chat* chat; // A reference is held to it
+    struct Transfer* transfer;
+    const char* filename;
+    int fd; // The file, while the changes to it are being worked out
+    struct timespec lastRecord; // When progress was last written out (headless)
+    char summary[192]; // How it went, once it's done (see sendDelta() and sendWhole(); empty if there's nothing to say)
+};
+
+/**
+ * @brief Write out a record of how a file being sent is getting on, if
+ * headless (the GUI draws the transfers itself)
+ * 
+ * @param sending File being sent
+ * @param state running, done, failed or cancelled (a done record has the summary)
+ */
+static void recordSending(struct Sending* sending, const char* state) {
+    if (sending->chatter->gui != NULL) {
+        return;
+    }
+    struct ArrayListBuf record;
+    ArrayListBuf_init(&record);
+    formatTransferRecord(&record, sending->transfer, state,
+        strcmp(state, "done") == 0 && sending->summary[0] != '\0' ? sending->summary : NULL);
+    printRecords(&record);
+    ArrayListBuf_free(&record);
+    clock_gettime(CLOCK_MONOTONIC, &sending->lastRecord);
+}
+
+/**
+ * @brief Note how much of a file has been sent, and have it shown
+ */
+static void sendingProgress(struct Sending* sending, uint64_t done) {
+    atomic_store(&sending->transfer->done, done);
+    scheduleRepaint(sending->chatter, REPAINT_TRANSFERS);
+    if (millisecondsSince(&sending->lastRecord) >= SENDING_RECORD_MS) {
+        recordSending(sending, "running");
+    }
+}
+
+static int emitDelta(void* ctx, const char* data, size_t len) {
+    struct Sending* sending = (struct Sending*)ctx;
+    struct Chat* chat = sending->chat;
+    if (atomic_load(&sending->transfer->cancelled)) {
+        return -1;
+    }
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf, DELTA_DATA, 0, len, data, len);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    // The file is read from start to end, so how far it's been read is how far along this is
+    off_t at = lseek(sending->fd, 0, SEEK_CUR);
+    if (at > 0) {
+        sendingProgress(sending, (uint64_t)at);
+    }
+    return status == STATUS_SUCCESS ? 0 : -1;
+}
+
+/**
+ * @brief Send a file as the changes to the peer's older copy of it.  The
+ * socket's lock is only held for a frame at a time, so that messages
+ * go out in between (NOTE: Caller must hold no locks)
+ * 
+ * @param sending File being sent
+ * @param index Signatures of the peer's older copy
+ * @param size The file's size
+ */
+static int sendDelta(struct Sending* sending, struct DeltaIndex* index, uint32_t size) {
+    struct Chat* chat = sending->chat;
+    const char* filename = sending->filename;
+    sending->fd = open(filename, O_RDONLY);
+    if (sending->fd == -1) {
+        return FAILURE_GENERIC;
+    }
+    uint16_t nameLen = strlen(filename);
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf, SEND_DELTA, nameLen, size, filename, nameLen);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    struct DeltaStats stats;
+    if (status == STATUS_SUCCESS && Delta_encode(index, sending->fd, emitDelta, sending, &stats) == -1) {
+        status = FAILURE_GENERIC;
+    }
+    if (status == STATUS_SUCCESS) {
+        pthread_mutex_lock(&chat->sendLock);
+        Frame_encode(&chat->sendBuf, DELTA_END, 0, 0, NULL, 0);
+        status = _send_frames(chat);
+        pthread_mutex_unlock(&chat->sendLock);
+        snprintf(sending->summary, sizeof(sending->summary), "%llu bytes of changes (%llu literal, %llu copied)",
+            (unsigned long long)stats.encodedBytes, (unsigned long long)stats.literalBytes, (unsigned long long)stats.copiedBytes);
+    }
+    close(sending->fd);
+    sending->fd = -1;
+    return status;
+}
+
+/**
+ * A file being sent whole, as it goes through the stages of sendWhole()'s
+ * pipeline.  Each stage keeps to its own fields
+ */
+struct WholeFile {
+    struct Sending* sending;
+    uint32_t size;
+    FILE* file; // Reading
+    uint32_t read;
+    const uint8_t* hash; // Checking: what it was offered as (NULL if it couldn't be hashed)
+    struct Sha256 sha;
+    uint32_t checked;
+    uint32_t sent; // Sending
+};
+
+/**
+ * @brief Read the next part of the file (first stage)
+ */
+static int readWhole(void* ctx, struct PipelineBuffer* buffer) {
+    struct WholeFile* whole = (struct WholeFile*)ctx;
+    if (atomic_load(&whole->sending->transfer->cancelled)) {
+        return -1;
+    }
+    uint32_t left = whole->size - whole->read;
+    size_t want = left < buffer->capacity ? left : buffer->capacity;
+    if (want > 0 && fread(buffer->data, 1, want, whole->file) < want) {
+        return -1; // Couldn't be read, or got shorter
+    }
+    whole->read += want;
+    buffer->len = want;
+    return 0;
+}
+
+/**
+ * @brief Hash the file again as it goes, and hold its last part back if
+ * it isn't what was offered, having changed since it was hashed.  The
+ * peer throws away what it got on CANCEL_FILE, rather than keeping a
+ * file that's part old and part new (middle stage)
+ */
+static int checkWhole(void* ctx, struct PipelineBuffer* buffer) {
+    struct WholeFile* whole = (struct WholeFile*)ctx;
+    Sha256_update(&whole->sha, buffer->data, buffer->len);
+    whole->checked += buffer->len;
+    if (whole->checked == whole->size) {
+        uint8_t hash[FILESTORE_HASH_SIZE];
+        Sha256_final(&whole->sha, hash);
+        if (memcmp(hash, whole->hash, FILESTORE_HASH_SIZE) != 0) {
+            debug_print("%s changed while it was being sent\n", whole->sending->filename);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Send the next part of the file as a frame (last stage)
+ */
+static int sendWholePart(void* ctx, struct PipelineBuffer* buffer) {
+    struct WholeFile* whole = (struct WholeFile*)ctx;
+    struct Chat* chat = whole->sending->chat;
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf, FILE_DATA, 0, buffer->len, buffer->data, buffer->len);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    if (status != STATUS_SUCCESS) {
+        return -1;
+    }
+    whole->sent += buffer->len;
+    sendingProgress(whole->sending, whole->sent);
+    return 0;
+}
+
+/**
+ * @brief Send a file whole, FILE_CHUNK bytes to a frame.  Reading it,
+ * checking it against its hash and sending it each run on a thread of
+ * their own, SEND_BUFFERS parts of it between them, so the disk, the
+ * hashing and the network all keep going at once.  The socket's lock is
+ * only held for a frame at a time, so that messages go out in between
+ * (NOTE: Caller must hold no locks)
+ * 
+ * @param sending File being sent
+ * @param size The file's size
+ * @param hash What it was offered as, or NULL if it couldn't be hashed
+ * (then it isn't checked)
+ */
+static int sendWhole(struct Sending* sending, uint32_t size, const uint8_t* hash) {
+    struct Chat* chat = sending->chat;
+    struct WholeFile whole;
+    memset(&whole, 0, sizeof(whole));
+    whole.sending = sending;
+    whole.size = size;
+    whole.hash = hash;
+    whole.file = fopen(sending->filename, "rb");
+    if (whole.file == NULL) {
+        return FAILURE_GENERIC;
+    }
+    uint16_t nameLen = strlen(sending->filename);
+    pthread_mutex_lock(&chat->sendLock);
+    Frame_encode(&chat->sendBuf, SEND_FILE, nameLen, size, sending->filename, nameLen);
+    int status = _send_frames(chat);
+    pthread_mutex_unlock(&chat->sendLock);
+    if (status == STATUS_SUCCESS) {
+        struct Pipeline* pipeline = Pipeline_init(SEND_BUFFERS, FILE_CHUNK);
+        Pipeline_addStage(pipeline, "read", readWhole, &whole);
+        if (hash != NULL) {
+            Sha256_init(&whole.sha);
+            Pipeline_addStage(pipeline, "hash", checkWhole, &whole);
+        }
+        Pipeline_addStage(pipeline, "send", sendWholePart, &whole);
+        if (Pipeline_run(pipeline) == -1) {
+            status = FAILURE_GENERIC;
+        }
+        else {
+            char report[128];
+            Pipeline_report(pipeline, report, sizeof(report));
+            snprintf(sending->summary, sizeof(sending->summary), "whole in %.2f s (%s busy)", pipeline->elapsed, report);
+        }
+        Pipeline_free(pipeline);
+    }
+    fclose(whole.file);
+    return status;
+}
+
+/**
+ * @brief Send a file: hash it, offer it to the peer, then send it whole,
+ * as the changes to the peer's older copy, or not at all
+ * (NOTE: Caller must hold a reference to the chat, and no locks)
+ * 
+ * @param sending File being sent
+ * @return int STATUS_SUCCESS, CANCELLED, or FAILURE_GENERIC
+ */
+static int sendFileNow(struct Sending* sending) {
+    struct Chatter* chatter = sending->chatter;
+    struct Chat* chat = sending->chat;
+    struct Transfer* transfer = sending->transfer;
+    struct stat file_stat;
+    if (stat(sending->filename, &file_stat) == -1) {
+        return FAILURE_GENERIC;
+    }
+    uint32_t size = file_stat.st_size;
+    atomic_store(&transfer->total, size); // In case it changed while queued
+    uint8_t hash[FILESTORE_HASH_SIZE];
+    TransferQueue_note(chatter->transfers, transfer, "hashing");
+    int hashed = FileStore_hashFile(sending->filename, hash) == 0;
+    if (atomic_load(&transfer->cancelled)) {
+        return CANCELLED; // While it was being hashed
+    }
+    TransferQueue_note(chatter->transfers, transfer, "asking the peer");
+    int had = hashed ? offerFile(chatter, chat, sending->filename, hash, size, transfer) : 0;
+    TransferQueue_note(chatter->transfers, transfer, NULL);
+    if (had == -1) {
+        return atomic_load(&transfer->cancelled) ? CANCELLED : FAILURE_GENERIC;
+    }
+    if (had == 1) {
+        sendingProgress(sending, size); // Nothing to send
+        snprintf(sending->summary, sizeof(sending->summary), "the peer had it already");
+        return STATUS_SUCCESS;
+    }
+    struct DeltaIndex* index = NULL;
+    if (had == 2) {
+        pthread_mutex_lock(&chatter->lock);
+        char* signatures = chat->signatures;
+        size_t signaturesLen = chat->signaturesLen;
+        chat->signatures = NULL;
+        pthread_mutex_unlock(&chatter->lock);
+        index = DeltaIndex_init(signatures, signaturesLen);
+        free(signatures);
+    }
+    // Signatures that don't make sense mean sending it whole
+    int status = index != NULL ? sendDelta(sending, index, size) : sendWhole(sending, size, hashed ? hash : NULL);
+    if (index != NULL) {
+        DeltaIndex_free(index);
+    }
+    if (status != STATUS_SUCCESS) {
+        // Have the peer throw away what it got of it
+        pthread_mutex_lock(&chat->sendLock);
+        Frame_encode(&chat->sendBuf, CANCEL_FILE, 0, 0, NULL, 0);
+        _send_frames(chat);
+        pthread_mutex_unlock(&chat->sendLock);
+    }
+    return atomic_load(&transfer->cancelled) ? CANCELLED : status;
+}
+
+/**
+ * @brief Send a file queued by sendFile() (run on one of
+ * chatter->transfers' threads, one file per chat at a time)
+ * 
+ * @param ctx Chatter object
+ * @param transfer Transfer, whose key is the chat (a reference is held
+ * to it) and whose item is the path to the file
+ */
+static void runTransfer(void* ctx, struct Transfer* transfer) {
+    struct Sending sending;
+    sending.chatter = (struct Chatter*)ctx;
+    sending.chat = (struct Chat*)transfer->key;
+    sending.transfer = transfer;
+    sending.filename = (const char*)transfer->item;
+    sending.fd = -1;
+    sending.summary[0] = '\0';
+    int status = CANCELLED;
+    // One cancelled before it started only has to be cleaned up
+    if (!atomic_load(&transfer->cancelled)) {
+        recordSending(&sending, "running");
+        status = sendFileNow(&sending);
+    }
+    recordSending(&sending, status == STATUS_SUCCESS ? "done" : status == CANCELLED ? "cancelled" : "failed");
+    if (status == STATUS_SUCCESS && sending.chatter->gui != NULL && sending.summary[0] != '\0') {
+        // The row goes once it's done, so say how it went instead
+        char* notice = (char*)malloc(strlen(transfer->name) + sizeof(sending.summary) + 16);
+        sprintf(notice, "Sent %s: %s", transfer->name, sending.summary);
+        printNoticeGUI(sending.chatter, notice);
+        free(notice);
+    }
+    if (status == FAILURE_GENERIC) {
+        char* error = (char*)malloc(strlen(transfer->name) + 32);
+        sprintf(error, "Couldn't send %s", transfer->name);
+        reportError(sending.chatter, error);
+        free(error);
+    }
+    releaseChat(sending.chat);
+    free(transfer->item);
+}
+
+/**
+ * @brief Have the GUI show the transfers again, after one was added,
+ * started or finished
+ */
+static void transfersChanged(void* ctx) {
+    scheduleRepaint((struct Chatter*)ctx, REPAINT_TRANSFERS);
+}
+
+int sendFile(struct Chatter* chatter, char* filename) {
+    struct stat file_stat;
+    if (stat(filename, &file_stat) == -1 || !S_ISREG(file_stat.st_mode)) {
+        reportError(chatter, "No such file");
+        return FAILURE_GENERIC;
+    }
+    // The chat is looked up once, so that the announcement and the file
+    // go to the same peer even if another chat is switched to meanwhile,
+    // and kept by a reference until the file has gone
+    struct Chat* chat = lockVisibleChat(chatter);
+    if(chat == NULL){
+        return FAILURE_GENERIC;
+    }
+    retainChat(chat);
+    char* name = (char*)malloc(strlen(filename) + chat->nameLen + 5);
+    sprintf(name,"%s to %s",filename,chat->name);
+    if(ANNOUNCE_SENDING_FILE){
+        char *announce_msg = malloc(strlen(filename)+1+17);
+        sprintf(announce_msg,"(Sending file '%s')",filename);
+        sendMessageIn(chatter,chat,announce_msg); // Lets go of the chat's lock
+        free(announce_msg);
+    }
+    else{
+        pthread_mutex_unlock(&chat->lock);
+    }
+    TransferQueue_add(chatter->transfers,chat,name,file_stat.st_size,strdup(filename));
+    free(name);
+    return STATUS_SUCCESS;
+}
+
+int cancelTransfer(struct Chatter* chatter, uint32_t id) {
+    if (TransferQueue_cancel(chatter->transfers, id) == -1) {
+        reportError(chatter, "No transfer with that id");
+        return FAILURE_GENERIC;
+    }
+    // In case it's waiting to hear whether the peer has the file
+    pthread_mutex_lock(&chatter->lock);
+    pthread_cond_broadcast(&chatter->fileAnswered);
+    pthread_mutex_unlock(&chatter->lock);
+    return STATUS_SUCCESS;
+}
+
+struct ShowTransfers {
+    struct Chatter* chatter;
+    struct ArrayListBuf out;
+};
+
+static void showTransfer(void* ctx, const struct Transfer* transfer) {
+    struct ShowTransfers* show = (struct ShowTransfers*)ctx;
+    if (show->chatter->gui == NULL) {
+        formatTransferRecord(&show->out, transfer, transfer->state == TRANSFER_QUEUED ? "queued" : "running", NULL);
+    }
+    else {
+        char row[256];
+        formatTransferRow(row, sizeof(row), transfer);
+        ArrayListBuf_appendf(&show->out, "%s\n", row);
+    }
+}
+
+int showTransfers(struct Chatter* chatter) {
+    struct ShowTransfers show;
+    show.chatter = chatter;
+    ArrayListBuf_init(&show.out);
+    size_t N = TransferQueue_each(chatter->transfers, showTransfer, &show);
+    if (chatter->gui == NULL) {
+        ArrayListBuf_appendf(&show.out, "{\"event\":\"transfers\",\"count\":%zu}\n", N);
+        printRecords(&show.out);
+    }
+    else {
+        printNoticeGUI(chatter, N == 0 ? "No files being sent" : ArrayListBuf_cstr(&show.out));
+    }
+    ArrayListBuf_free(&show.out);
+    return STATUS_SUCCESS;
+}
+
+/**
+ * @brief Change my name (the caller then broadcasts it)
+ * 
+ * @param chatter Data about the current chat session
+ * @param name New name
+ */
+void setMyName(struct Chatter* chatter, char* name) {
+    size_t len = strlen(name);
+    if (len > UINT16_MAX) {
+        len = UINT16_MAX; // Longest name the protocol can carry
+    }
+    pthread_mutex_lock(&chatter->lock);
+    free(chatter->myname);
+    chatter->myname = strndup(name, len);
+    pthread_mutex_unlock(&chatter->lock);
+}
+
+/**
+ * @brief Broadcast my name to all visible connections
+ * NOTE: Name is held in chatter->myname
+ * 
+ * @param chatter Data about the current chat session
+ */
+int broadcastMyName(struct Chatter* chatter) {
+    int status = STATUS_SUCCESS;
+    pthread_mutex_lock(&chatter->lock);
+
+    debug_print("Hello from broadcast myname!\n");
+    debug_print("Broadcast name, chatter*: %p\n",(void*)chatter);
+    
+    // Encode the frame once and send the same bytes to everyone
+    size_t len = strlen(chatter->myname);
+    struct ArrayListBuf frame;
+    ArrayListBuf_init(&frame);
+    Frame_encode(&frame,INDICATE_NAME,(uint16_t)len,0,chatter->myname,len);
+    // A chat busy sending a file holds up only its own copy of the frame
+    ChatArray chats;
+    retainChats(chatter,&chats);
+    pthread_mutex_unlock(&chatter->lock);
+    debug_print("Hello from after the unlock!\n");
+
+    for(size_t i = 0; i < chats.N; i++){
+        struct Chat *curr_chat = chats.data[i];
+        pthread_mutex_lock(&curr_chat->sendLock);
+        if(_send_loop(curr_chat->sockfd,frame.buff,frame.N) != STATUS_SUCCESS){
+            status = FAILURE_GENERIC;
+        }
+        pthread_mutex_unlock(&curr_chat->sendLock);
+    }
+    releaseChats(&chats);
+    ArrayListBuf_free(&frame);
+    return status;
+}
+
+/**
+ * @brief Close chat with someone
+ * 
+ * @param chatter Data about the current chat session
+ * @param name Close connection with this person
+ */
+int closeChat(struct Chatter* chatter, char* name) {
+    debug_print("closeChat called\n");
+
+    int status = STATUS_SUCCESS;
+
+    struct Chat *selected_chat = getChatFromName(chatter,name);
+
+    if(selected_chat == NULL){
+        return CHAT_DOESNT_EXIST;
+    }
+
+    pthread_mutex_lock(&selected_chat->sendLock);
+    Frame_encode(&selected_chat->sendBuf,END_CHAT,0,0,NULL,0);
+    status = _send_frames(selected_chat);
+    // Wake up the worker reading it, which then publishes EVENT_CHAT_CLOSED
+    // so that the chat is removed in exactly one place
+    shutdown(selected_chat->sockfd,SHUT_RDWR);
+    pthread_mutex_unlock(&selected_chat->sendLock);
+    releaseChat(selected_chat);
+
+    return status;
+}
+
+
+/**
+ * @brief Switch the visible chat
+ * 
+ * @param chatter Data about the current chat session
+ * @param name Switch chat to be with this person
+ */
+int switchTo(struct Chatter* chatter, char* name) {
+    int status = STATUS_SUCCESS;
+    pthread_mutex_lock(&chatter->lock);
+    size_t index;
+    struct Chat* chat = findChat(chatter, name, &index);
+    if (chat == NULL) {
+        status = CHAT_DOESNT_EXIST;
+    }
+    else {
+        // Under the chat's lock too, so that a message arriving on it is
+        // either counted before this or seen as arriving in the visible chat
+        pthread_mutex_lock(&chat->lock);
+        chatter->visibleChat = chat;
+        chatter->visibleIndex = index;
+        chat->unread = 0;
+        pthread_mutex_unlock(&chat->lock);
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    return status;
+}
+
+struct SearchContext {
+    struct Chatter* chatter;
+    struct ArrayListBuf out; // Results, formatted for the GUI or as records
+};
+
+/**
+ * @brief Turn a message the index found back into the message, if it's
+ * still around, and write it out (NOTE: Caller must hold chatter->lock;
+ * the chat's lock is taken here)
+ *
+ * @return int 1 if it's still there, 0 if not
+ */
+static int showResult(struct SearchContext* search, const struct SearchDoc* doc) {
+    struct Chatter* chatter = search->chatter;
+    for (size_t i = 0; i < chatter->chats.N; i++) {
+        struct Chat* chat = chatter->chats.data[i];
+        if (chat->number == doc->chat) {
+            pthread_mutex_lock(&chat->lock);
+            long index = findMessage(chat, doc->timestamp);
+            if (index >= 0) {
+                struct Message* msg = Timeline_get(&chat->timeline, (size_t)index);
+                if (chatter->gui == NULL) {
+                    formatResultRecord(&search->out, chat, msg);
+                }
+                else {
+                    ArrayListBuf_appendf(&search->out, "\n(%s) %s %i: %s", chat->name,
+                        (msg->flags & MESSAGE_OUTGOING) ? "Me" : chat->name, msg->id, Message_text(msg));
+                }
+            }
+            pthread_mutex_unlock(&chat->lock);
+            return index >= 0; // Or deleted since
+        }
+    }
+    return 0; // The chat has closed
+}
+
+int searchChats(struct Chatter* chatter, char* query) {
+    query += strspn(query, " \t");
+    struct SearchContext search;
+    search.chatter = chatter;
+    ArrayListBuf_init(&search.out);
+    // A page of matches at a time, looked up once the index's lock has
+    // been let go (chats add to the index under their own locks)
+    struct SearchDoc docs[SEARCH_RESULTS];
+    uint32_t cursor = SEARCH_NEWEST;
+    size_t found = 0;
+    while (found < SEARCH_RESULTS) {
+        size_t n = SearchIndex_query(chatter->search, query, SEARCH_RESULTS - found, &cursor, docs);
+        if (n == 0) {
+            break;
+        }
+        pthread_mutex_lock(&chatter->lock);
+        for (size_t i = 0; i < n; i++) {
+            found += showResult(&search, &docs[i]);
+        }
+        pthread_mutex_unlock(&chatter->lock);
+    }
+    trimMemory(chatter, NULL); // Results may have been read back from the spill file
+    if (chatter->gui == NULL) {
+        formatSearchedRecord(&search.out, query, found);
+        printRecords(&search.out);
+    }
+    else {
+        struct ArrayListBuf text;
+        ArrayListBuf_init(&text);
+        ArrayListBuf_appendf(&text, "%zu%s messages with \"%s\" (newest first)", found, found == SEARCH_RESULTS ? "+" : "", query);
+        ArrayListBuf_push(&text, search.out.buff, search.out.N);
+        printNoticeGUI(chatter, ArrayListBuf_cstr(&text));
+        ArrayListBuf_free(&text);
+    }
+    ArrayListBuf_free(&search.out);
+    return STATUS_SUCCESS;
+}
+
+
+
+void trimMemory(struct Chatter* chatter, struct Chat* chat) {
+    uint64_t chatBudget = chatter->chatMemoryBudget;
+    if (chat != NULL && chatBudget > 0 && chat->timeline.residentBytes > chatBudget) {
+        Timeline_evict(&chat->timeline, chat->timeline.residentBytes - chatBudget/8*7);
+    }
+    uint64_t resident = Timeline_totalResident();
+    int over = chatter->memoryBudget > 0 && resident > chatter->memoryBudget;
+    int draining = Timeline_spillDraining();
+    if ((over || draining) && pthread_mutex_trylock(&chatter->lock) == 0) {
+        uint64_t excess = over ? resident - chatter->memoryBudget/8*7 : 0;
+        for (size_t i = 0; i < chatter->chats.N; i++) {
+            struct Chat* other = chatter->chats.data[i];
+            if (other != chat && pthread_mutex_trylock(&other->lock) != 0) {
+                continue; // Busy; it'll be trimmed another time
+            }
+            struct Timeline* timeline = &other->timeline;
+            if (over) {
+                Timeline_evict(timeline, (uint64_t)((double)excess*timeline->residentBytes/resident) + 1);
+            }
+            if (draining) {
+                Timeline_drain(timeline, SPILL_DRAIN_BATCH);
+            }
+            if (other != chat) {
+                pthread_mutex_unlock(&other->lock);
+            }
+        }
+        pthread_mutex_unlock(&chatter->lock);
+    }
+}
+
+int showStats(struct Chatter* chatter) {
+    struct ArrayListBuf out;
+    ArrayListBuf_init(&out);
+    ChatArray chats;
+    pthread_mutex_lock(&chatter->lock);
+    retainChats(chatter, &chats);
+    pthread_mutex_unlock(&chatter->lock);
+    if (chatter->gui == NULL) {
+        for (size_t i = 0; i < chats.N; i++) {
+            struct Chat* chat = chats.data[i];
+            pthread_mutex_lock(&chat->lock);
+            formatChatStatsRecord(&out, chat);
+            pthread_mutex_unlock(&chat->lock);
+        }
+        formatMemoryRecord(&out, chatter->memoryBudget, chatter->chatMemoryBudget);
+    }
+    else {
+        char resident[BYTES_TEXT_SIZE], budget[BYTES_TEXT_SIZE], spillFile[BYTES_TEXT_SIZE];
+        formatBytes(resident, sizeof(resident), Timeline_totalResident());
+        formatBytes(budget, sizeof(budget), chatter->memoryBudget);
+        formatBytes(spillFile, sizeof(spillFile), Timeline_spillFileBytes());
+        ArrayListBuf_appendf(&out, "Messages take up %s of %s; %llu spilled to disk (spill file %s)", resident,
+            chatter->memoryBudget > 0 ? budget : "no limit", (unsigned long long)Timeline_totalSpilled(), spillFile);
+        for (size_t i = 0; i < chats.N; i++) {
+            struct Chat* chat = chats.data[i];
+            pthread_mutex_lock(&chat->lock);
+            size_t messages = Timeline_size(&chat->timeline);
+            formatBytes(resident, sizeof(resident), chat->timeline.residentBytes);
+            ArrayListBuf_appendf(&out, "\n(%s) %zu messages: %zu in memory (%s), %zu spilled, %zu not read from history yet", chat->name,
+                messages, messages - chat->timeline.spilled - chat->timeline.archived, resident, chat->timeline.spilled, chat->timeline.archived);
+            pthread_mutex_unlock(&chat->lock);
+        }
+    }
+    releaseChats(&chats);
+    if (chatter->gui == NULL) {
+        printRecords(&out);
+    }
+    else {
+        printNoticeGUI(chatter, ArrayListBuf_cstr(&out));
+    }
+    ArrayListBuf_free(&out);
+    return STATUS_SUCCESS;
+}
+
+
+
+///////////////////////////////////////////////////////////
+//               Connection Management
+///////////////////////////////////////////////////////////
+
+/**
+ * @brief Print out a socket error, pause, and then exit
+ * 
+ * @param chatter 
+ * @param fmt 
+ */
+void reportError(struct Chatter* chatter, char* error) {
+    if (chatter->gui != NULL) {
+        printErrorGUI(chatter, error);
+    }
+    else {
+        printErrorRecord(error);
+    }
+}
+
+void socketErrorAndExit(struct Chatter* chatter, char* fmt) {
+    char* error = (char*)malloc(strlen(fmt) + 100);
+    sprintf(error, fmt, errno);
+    reportError(chatter, error);
+    free(error);
+    if (chatter->gui != NULL) {
+        sleep(5); // Leave the error up long enough to read
+    }
+    destroyChatter(chatter);
+    exit(errno);
+}
+
+
+/**
+ * @brief Add a chat to the list and have the workers read from it.  If
+ * that fails, the chat is closed (and then removed by the event thread)
+ * 
+ * @param chatter Chatter object
+ * @param chat Chat, from initChat()
+ * @return int STATUS_SUCCESS or ERR_WATCH
+ */
+static int startChat(struct Chatter* chatter, struct Chat* chat) {
+    pthread_mutex_lock(&chatter->lock);
+    ChatArray_push(&chatter->chats, chat);
+    debug_print("In setup new chat, number of chats: %zu\n",chatter->chats.N);
+    debug_print("In setup new chat, sockfd: %d\n",chat->sockfd);
+    if (chatter->chats.N == 1) {
+        // This is the first chat; make it visible
+        chatter->visibleChat = chat;
+        chatter->visibleIndex = 0;
+    }
+    // Step 2: Have the workers read from it whenever something arrives.
+    // Published first so that it's sure to come out before anything else on this chat
+    chat->receiver = initReceiver();
+    EventQueue_push(chatter->events, Event_init(EVENT_CHAT_OPENED, chat));
+    int status = STATUS_SUCCESS;
+    if (WorkerPool_watch(chatter->workers, chat->sockfd, chat) == -1) {
+        // Print out error information
+        char* fmt = "Error %i opening new connection";
+        char* error = (char*)malloc(strlen(fmt) + 100);
+        sprintf(error, fmt, errno);
+        reportError(chatter, error);
+        free(error);
+        // Closed the way every chat is, so that it's removed in exactly one place
+        freeReceiver(chat->receiver);
+        chat->receiver = NULL;
+        EventQueue_push(chatter->events, Event_init(EVENT_CHAT_CLOSED, chat));
+        status = ERR_WATCH;
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    debug_print("Setup new chat, chatter*: %p\n",(void*)chatter);
+    return status;
+}
+/**
+ * @brief Start a chat on a connected socket
+ * 
+ * @param chatter Chatter object
+ * @param sockfd Socket
+ * @param address "host port" if I connected to the peer, or NULL if they connected to me
+ * @return int STATUS_SUCCESS or ERR_WATCH
+ */
+int setupNewChat(struct Chatter* chatter, int sockfd, const char* address) {
+    // Step 0: Disable Nagle's algorithm on this socket
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+    // Step 1: Setup a new chat object and add to the list
+    struct Chat* chat = initChat(sockfd);
+    if (address != NULL) {
+        chat->address = strdup(address);
+    }
+    return startChat(chatter, chat);
+}
+
+
+/**
+ * @brief Establish a chat as a client connecting to an IP/port
+ * 
+ * @param chatter Data about the current chat session
+ * @param IP IP address in human readable form
+ * @param port Port on which to establish connection
+ */
+int connectChat(struct Chatter* chatter, char* IP, char* port) {
+    // Step 1: Get address information for a host
+    struct addrinfo hints;
+    struct addrinfo* node;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC; // Use either IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM; // Use TCP
+    int ret = getaddrinfo(IP, port, &hints, &node);
+    if (ret != 0) {
+        reportError(chatter, "Error getting address info");
+        freeaddrinfo(node);
+        return ERR_GETADDRINFO;
+    }
+    int sockfd = -1;
+    // Step 1b: Try all possible connection types in the link list
+    // it gives me until I find one that works
+    while (node != NULL) {
+        sockfd = socket(node->ai_family, node->ai_socktype, node->ai_protocol);
+        if (sockfd != -1) {
+            break;
+        }
+        else {
+            node = node->ai_next;
+        }
+    }
+    // Step 1c: Make sure we got a valid socket file descriptor
+    // after going through all of the options
+    if (sockfd == -1) {
+        reportError(chatter, "Error opening socket");
+        freeaddrinfo(node);
+        return ERR_OPENSOCKET;
+    }
+    // Step 2: Setup stream on socket and connect
+    ret = connect(sockfd, node->ai_addr, node->ai_addrlen);
+    freeaddrinfo(node);
+    if (ret == -1) {
+        reportError(chatter, "Error opening socket");
+        return ERR_OPENSOCKET;
+    }
+    char* address = (char*)malloc(strlen(IP) + strlen(port) + 2);
+    sprintf(address, "%s %s", IP, port);
+    ret = setupNewChat(chatter, sockfd, address);
+    free(address);
+    return ret;
+}
+
+/**
+ * @brief Continually loop through and accept new connections
+ * 
+ * @param pargs Pointer to the chatter data
+ */
+void* serverLoop(void* pargs) {
+    struct Chatter* chatter = (struct Chatter*)pargs;
+    while (1) { // TODO: Finish terminating thread when appropriate
+        struct sockaddr_storage their_addr;
+        socklen_t len = sizeof(their_addr);
+        int sockfd = accept(chatter->serversock, (struct sockaddr*)&their_addr, &len);
+        if (sockfd != -1) {
+            int result = setupNewChat(chatter, sockfd, NULL);
+            if (result != STATUS_SUCCESS) {
+                reportError(chatter, "Error receiving new connection");
+            }
+        }
+        else {
+            reportError(chatter, "Error receiving new connection");
+        }
+    }
+}
+
+
+
+
+///////////////////////////////////////////////////////////
+//             Session Snapshots
+///////////////////////////////////////////////////////////
+
+/**
+ * @brief Put a snapshot of the session together in memory.  The
+ * registry lock is only held while the chats are listed, and each
+ * chat's lock while its messages are copied
+ * 
+ * @param chatter Chatter object
+ * @param b Buffer to write it into
+ */
+static void buildSnapshot(struct Chatter* chatter, struct ArrayListBuf* b) {
+    uint32_t visible = SNAPSHOT_NONE, count = 0;
+    ChatArray chats;
+    pthread_mutex_lock(&chatter->lock);
+    retainChats(chatter, &chats);
+    for (size_t i = 0; i < chats.N; i++) {
+        struct Chat* chat = chats.data[i];
+        if (chat->address != NULL) {
+            if (chat == chatter->visibleChat) {
+                visible = count;
+            }
+            count++;
+        }
+    }
+    Snapshot_begin(b, chatter->myname, visible);
+    pthread_mutex_unlock(&chatter->lock);
+    for (size_t i = 0; i < chats.N; i++) {
+        struct Chat* chat = chats.data[i];
+        if (chat->address == NULL) {
+            continue;
+        }
+        // Find where the most recent messages that aren't deleted start
+        pthread_mutex_lock(&chat->lock);
+        struct Timeline* tl = &chat->timeline;
+        size_t first = Timeline_size(tl);
+        uint32_t messages = 0;
+        while (first > 0 && messages < SNAPSHOT_MESSAGES) {
+            first--;
+            if (!Timeline_isDeleted(tl, first)) {
+                messages++;
+            }
+        }
+        Snapshot_addChat(b, chat->address, chat->name, chat->outCounter, messages);
+        for (size_t j = first; j < Timeline_size(tl); j++) {
+            if (!Timeline_isDeleted(tl, j)) {
+                Snapshot_addMessage(b, Timeline_get(tl, j));
+            }
+        }
+        pthread_mutex_unlock(&chat->lock);
+    }
+    releaseChats(&chats);
+}
+int saveSession(struct Chatter* chatter, const char* path) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    buildSnapshot(chatter, &b);
+    int res = Snapshot_write(&b, path);
+    ArrayListBuf_free(&b);
+    return res == 0 ? STATUS_SUCCESS : FAILURE_GENERIC;
+}
+/**
+ * @brief Snapshot the session every SNAPSHOT_INTERVAL seconds until
+ * told to stop.  A snapshot that's the same as the last one written
+ * isn't written again, so an idle session doesn't touch the disk
+ * 
+ * @param args Chatter object
+ * @return void* 
+ */
+static void* snapshotLoop(void* args) {
+    struct Chatter* chatter = (struct Chatter*)args;
+    struct ArrayListBuf b, written;
+    ArrayListBuf_init(&b);
+    ArrayListBuf_init(&written);
+    pthread_mutex_lock(&chatter->lock);
+    while (!chatter->snapshotStopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SNAPSHOT_INTERVAL;
+        int res = 0;
+        while (!chatter->snapshotStopping && res != ETIMEDOUT) {
+            res = pthread_cond_timedwait(&chatter->snapshotStop, &chatter->lock, &deadline);
+        }
+        if (chatter->snapshotStopping) {
+            break;
+        }
+        pthread_mutex_unlock(&chatter->lock);
+        buildSnapshot(chatter, &b);
+        if (b.N != written.N || memcmp(b.buff, written.buff, b.N) != 0) {
+            if (Snapshot_write(&b, chatter->sessionPath) == 0) {
+                struct ArrayListBuf last = written;
+                written = b;
+                b = last;
+            }
+            else {
+                reportError(chatter, "Error saving the session");
+            }
+        }
+        pthread_mutex_lock(&chatter->lock);
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    ArrayListBuf_free(&b);
+    ArrayListBuf_free(&written);
+    return NULL;
+}
+void startSnapshots(struct Chatter* chatter, const char* path) {
+    chatter->sessionPath = strdup(path);
+    // Make sure the directory it goes in is there
+    char* dir = strdup(path);
+    char* slash = strrchr(dir, '/');
+    if (slash != NULL && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0700);
+    }
+    free(dir);
+    if (pthread_create(&chatter->snapshotThread, NULL, snapshotLoop, (void*)chatter) != 0) {
+        reportError(chatter, "Error starting the snapshot thread");
+        free(chatter->sessionPath);
+        chatter->sessionPath = NULL;
+    }
+}
+/**
+ * @brief Start connecting to a peer without waiting for it to answer
+ * 
+ * @param address "host port"
+ * @return int Non-blocking socket, or -1 if the connection couldn't be started
+ */
+static int startConnecting(const char* address) {
+    char* host = strdup(address);
+    char* port = strrchr(host, ' ');
+    int sockfd = -1;
+    if (port != NULL) {
+        *port++ = '\0';
+        struct addrinfo hints;
+        struct addrinfo* info;
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, port, &hints, &info) == 0) {
+            sockfd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK, info->ai_protocol);
+            if (sockfd != -1 && connect(sockfd, info->ai_addr, info->ai_addrlen) == -1 && errno != EINPROGRESS) {
+                close(sockfd);
+                sockfd = -1;
+            }
+            freeaddrinfo(info);
+        }
+    }
+    free(host);
+    return sockfd;
+}
+/**
+ * @brief Start a chat on a socket reconnected to a peer from a snapshot,
+ * with its name, id counter and messages put back first
+ * 
+ * @param chatter Chatter object
+ * @param sockfd Connected socket
+ * @param saved The chat as it was in the snapshot (its address and messages are taken over)
+ * @return struct Chat* with a reference for the caller (it may close at any time), or NULL if the chat couldn't be started
+ */
+static struct Chat* restoreChat(struct Chatter* chatter, int sockfd, struct SnapshotChat* saved) {
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK); // Receive threads block
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+    // Nothing else can see the chat until it's started, so there's no need to lock
+    struct Chat* chat = initChat(sockfd);
+    chat->address = saved->address;
+    saved->address = NULL;
+    setChatName(chat, saved->name, strlen(saved->name));
+    chat->outCounter = saved->outCounter;
+    // History has everything the snapshot does, and more
+    int history = chatter->history != NULL && strcmp(saved->name, "Anonymous") != 0;
+    if (!history) {
+        for (size_t i = 0; i < saved->messages.N; i++) {
+            SearchIndex_add(chatter->search, chat->number, saved->messages.data[i]);
+            addMessage(chat, saved->messages.data[i]);
+        }
+        MessageArray_clear(&saved->messages);
+    }
+    trimMemory(chatter, chat);
+    retainChat(chat);
+    if (startChat(chatter, chat) != STATUS_SUCCESS) {
+        releaseChat(chat);
+        return NULL;
+    }
+    if (history) {
+        // The event thread opens it as it would for a peer that's just said
+        // who it is, now that the chat can be found when the history's
+        // worker hands back what it's loaded (see historyLoaded())
+        struct Event* event = Event_init(EVENT_NAME_CHANGED, chat);
+        event->name = strdup(saved->name);
+        EventQueue_push(chatter->events, event);
+    }
+    return chat;
+}
+static long millisecondsSince(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)*1000 + (now.tv_nsec - start->tv_nsec)/1000000;
+}
+int restoreSession(struct Chatter* chatter, const char* path) {
+    struct Snapshot snapshot;
+    if (Snapshot_read(path, &snapshot) == -1) {
+        return FAILURE_GENERIC;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    setMyName(chatter, snapshot.myname);
+    size_t N = snapshot.chats.N;
+    struct pollfd* fds = (struct pollfd*)malloc((N + 1)*sizeof(struct pollfd));
+    int* sockets = (int*)malloc((N + 1)*sizeof(int));
+    int* connected = (int*)calloc(N + 1, sizeof(int));
+    // Step 1: Start connecting to every peer at once
+    size_t waiting = 0;
+    for (size_t c = 0; c < N; c++) {
+        sockets[c] = startConnecting(snapshot.chats.data[c].address);
+        fds[c].fd = sockets[c];
+        fds[c].events = POLLOUT;
+        fds[c].revents = 0;
+        if (sockets[c] != -1) {
+            waiting++;
+        }
+    }
+    // Step 2: Wait for all of them together (poll() passes over the
+    // negative descriptors of the ones already done)
+    while (waiting > 0) {
+        long left = RECONNECT_TIMEOUT_MS - millisecondsSince(&start);
+        if (left <= 0) {
+            break;
+        }
+        int ready = poll(fds, N, (int)left);
+        if (ready == -1 && errno != EINTR) {
+            break;
+        }
+        for (size_t c = 0; ready > 0 && c < N; c++) {
+            if (fds[c].fd >= 0 && fds[c].revents != 0) {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(fds[c].fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                connected[c] = error == 0;
+                fds[c].fd = -1;
+                waiting--;
+                ready--;
+            }
+        }
+    }
+    // Step 3: Open a chat for every peer that answered
+    struct Chat* visible = NULL;
+    ChatArray restored;
+    ChatArray_init(&restored);
+    for (size_t c = 0; c < N; c++) {
+        struct SnapshotChat* saved = &snapshot.chats.data[c];
+        struct Chat* chat = NULL;
+        if (connected[c]) {
+            chat = restoreChat(chatter, sockets[c], saved);
+        }
+        else {
+            if (sockets[c] != -1) {
+                close(sockets[c]);
+            }
+            char* error = (char*)malloc(strlen(saved->name) + strlen(saved->address) + 100);
+            sprintf(error, "Couldn't reconnect to %s (%s)", saved->name, saved->address);
+            reportError(chatter, error);
+            free(error);
+        }
+        if (chat != NULL) {
+            ChatArray_push(&restored, chat);
+            if (c == snapshot.visible) {
+                visible = chat;
+            }
+        }
+    }
+    pthread_mutex_lock(&chatter->lock);
+    for (size_t i = 0; visible != NULL && i < chatter->chats.N; i++) {
+        if (chatter->chats.data[i] == visible) {
+            chatter->visibleChat = visible;
+            chatter->visibleIndex = i;
+            invalidateChatWindow(chatter->gui);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&chatter->lock);
+    scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT);
+    if (restored.N > 0) {
+        broadcastMyName(chatter);
+    }
+    debug_print("Restored %zu of %zu chats in %ld ms\n", restored.N, N, millisecondsSince(&start));
+    releaseChats(&restored);
+    free(fds);
+    free(sockets);
+    free(connected);
+    Snapshot_free(&snapshot);
+    return STATUS_SUCCESS;
+}
+/**
+ * Usage: chatter [port] [--headless | --fifo path | --socket path] [options]
+ *
+ * Nothing about a session is kept on disk unless asked for:
+ *   --keep-session      Snapshot the open chats to ~/.chatter/session-<port>
+ *                       and reopen them next time (--session FILE to keep
+ *                       it elsewhere, --no-session to turn it back off)
+ *   --keep-history      Keep every message in ~/.chatter/history, by peer,
+ *                       and bring it back when the peer connects again
+ *                       (--history DIR, --no-history)
+ *   --keep-files        Keep files peers send in ~/.chatter/files, by
+ *                       content, so that one I already have isn't sent
+ *                       again and one I have an older copy of is sent as
+ *                       just what changed (--files DIR, --no-file-store;
+ *                       otherwise they're only written where they're sent)
+ */
+int main(int argc, char *argv[]) {
+    char* port = "60000";
+    int headless = 0;
+    char* fifo = NULL;
+    char* socketPath = NULL;
+    char* historyDir = NULL;
+    int keepHistory = 0; // Only if asked for, as it's everything said
+    char* sessionPath = NULL;
+    int keepSession = 0; // Only if asked for, as it remembers who I talked to
+    char* filesDir = NULL;
+    int keepFiles = 0; // Only if asked for, as it keeps every file sent
+    uint64_t memoryBudget = MEMORY_BUDGET; // Megabytes on the command line; 0 for no limit
+    uint64_t chatMemoryBudget = CHAT_MEMORY_BUDGET;
+    size_t workers = 0; // One per core
+    size_t transfers = CONCURRENT_TRANSFERS;
+    char* home = getenv("HOME");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        }
+        else if (strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            headless = 1;
+            fifo = argv[++i];
+        }
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            headless = 1;
+            socketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            historyDir = argv[++i];
+            keepHistory = 1;
+        }
+        else if (strcmp(argv[i], "--keep-history") == 0) {
+            keepHistory = 1;
+        }
+        else if (strcmp(argv[i], "--no-history") == 0) {
+            keepHistory = 0;
+        }
+        else if (strcmp(argv[i], "--session") == 0 && i + 1 < argc) {
+            sessionPath = argv[++i];
+            keepSession = 1;
+        }
+        else if (strcmp(argv[i], "--keep-session") == 0) {
+            keepSession = 1;
+        }
+        else if (strcmp(argv[i], "--no-session") == 0) {
+            keepSession = 0;
+        }
+        else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+            filesDir = argv[++i];
+            keepFiles = 1;
+        }
+        else if (strcmp(argv[i], "--keep-files") == 0) {
+            keepFiles = 1;
+        }
+        else if (strcmp(argv[i], "--no-file-store") == 0) {
+            keepFiles = 0;
+        }
+        else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+            memoryBudget = strtoull(argv[++i], NULL, 10)*1024*1024;
+        }
+        else if (strcmp(argv[i], "--chat-memory") == 0 && i + 1 < argc) {
+            chatMemoryBudget = strtoull(argv[++i], NULL, 10)*1024*1024;
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--transfers") == 0 && i + 1 < argc) {
+            transfers = strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            port = argv[i];
+        }
+    }
+    // The session is kept per port, since only one chatter can listen on each
+    char defaultSession[4096];
+    if (!keepSession) {
+        sessionPath = NULL;
+    }
+    else if (sessionPath == NULL && home != NULL) {
+        snprintf(defaultSession, sizeof(defaultSession), "%s/.chatter/session-%s", home, port);
+        sessionPath = defaultSession;
+    }
+    char defaultHistory[4096];
+    if (!keepHistory) {
+        historyDir = NULL;
+    }
+    else if (historyDir == NULL && home != NULL) {
+        snprintf(defaultHistory, sizeof(defaultHistory), "%s/.chatter/history", home);
+        historyDir = defaultHistory;
+    }
+    char defaultFiles[4096];
+    if (!keepFiles) {
+        filesDir = NULL;
+    }
+    else if (filesDir == NULL && home != NULL) {
+        snprintf(defaultFiles, sizeof(defaultFiles), "%s/.chatter/files", home);
+        filesDir = defaultFiles;
+    }
+    // Step 1: Initialize chatter object and setup server to listen for incoming connections
+    struct Chatter* chatter = initChatter(headless, historyDir);
+    chatter->memoryBudget = memoryBudget;
+    chatter->chatMemoryBudget = chatMemoryBudget;
+    if (filesDir != NULL) {
+        chatter->files = FileStore_init(filesDir);
+        if (chatter->files == NULL) {
+            fprintf(stderr, "Couldn't keep files in %s; writing them where they're sent instead\n", filesDir);
+        }
+    }
+    chatter->workers = WorkerPool_init(workers, receiveReady, chatter);
+    if (chatter->workers == NULL) {
+        socketErrorAndExit(chatter, "Error number %i starting worker threads\n");
+    }
+    chatter->transfers = TransferQueue_init(transfers, runTransfer, transfersChanged, chatter);
+    chatter->replies = TransferQueue_init(CONCURRENT_REPLIES, runReply, NULL, chatter);
+    if (chatter->transfers == NULL || chatter->replies == NULL) {
+        socketErrorAndExit(chatter, "Error number %i starting transfer threads\n");
+    }
+    // Step 1a: Parse Parameters and initialize variables
+    struct addrinfo hints;
+    struct addrinfo* info;
+    // Step 1b: Find address information of domain and attempt to open socket
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC; // OK to use either IPv4 or IPv6
+    hints.ai_socktype = SOCK_STREAM; //Using TCP
+    hints.ai_flags = AI_PASSIVE; // Use my IP (extremely important!!)
+    getaddrinfo(NULL, port, &hints, &info);
+    chatter->serversock = -1;
+    struct addrinfo* node = info;
+    while (node != NULL && chatter->serversock == -1) {
+        chatter->serversock = socket(node->ai_family, node->ai_socktype, node->ai_protocol); // NOTE: Not bound to port yet
+        if (chatter->serversock == -1) {
+            reportError(chatter, "Error on socket...trying another one\n");
+            node = node->ai_next;
+        }
+        int yes = 1;
+        if (setsockopt(chatter->serversock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
+            freeaddrinfo(info);
+            socketErrorAndExit(chatter, "Error number %i setting socket options\n");
+        }
+        else if (bind(chatter->serversock, node->ai_addr, node->ai_addrlen) == -1) {
+            freeaddrinfo(info);
+            socketErrorAndExit(chatter, "Error number %i binding socket\n");
+        }
+    }
+    freeaddrinfo(info);
+    // Step 1c: Service requests (single threaded for now)
+    if (chatter->serversock == -1 || node == NULL) {
+        socketErrorAndExit(chatter, "ERROR: Error number %i on opening socket\n");
+    }
+    if (listen(chatter->serversock, BACKLOG) == -1) {
+        socketErrorAndExit(chatter, "Error number %i listening on socket\n");
+    }
+    pthread_t serverThread;
+    int res = pthread_create(&serverThread, NULL, serverLoop, (void*)chatter);
+    if (res != 0) {
+        socketErrorAndExit(chatter, "Error number %i creating server thread\n");
+        destroyChatter(chatter);
+        exit(res);
+    }
+    // Step 1d: Pick up where the last session left off, and keep snapshots of this one
+    if (sessionPath != NULL) {
+        restoreSession(chatter, sessionPath);
+        startSnapshots(chatter, sessionPath);
+    }
+
+    // Step 2: Begin the input loop on the client side
+    if (headless) {
+        headlessLoop(chatter, fifo, socketPath);
+    }
+    else {
+        typeLoop(chatter);
+    }
+    // TODO: Cleanup server thread
+
+    // Step 3: Clean everything up when it's over
+    destroyChatter(chatter);
 }
\ No newline at end of file
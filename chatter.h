@@ -6,6 +6,18 @@
 #include <pthread.h>
 #include "linkedlist.h"
 #include "hashmap.h"
+#include "message.h"
+#include "arraylist.h"
+#include "frame.h"
+#include "eventqueue.h"
+#include "chatview.h"
+#include "lineeditor.h"
+#include "history.h"
+#include "timeline.h"
+#include "search.h"
+#include "filestore.h"
+#include "workerpool.h"
+#include "transfer.h"
 
 #define DEBUG 1
 #define debug_print(fmt, ...) \
@@ -20,70 +32,523 @@ enum ChatStatusCodes {
     CHAT_DOESNT_EXIST = 5,
     ERR_GETADDRINFO = 6,
     ERR_OPENSOCKET = 7,
-    ERR_THREADCREATE = 8
+    ERR_THREADCREATE = 8,
+    ERR_WATCH = 9,
+    CANCELLED = 10
 };
 
-enum Magic {
-    INDICATE_NAME = 0,
-    SEND_MESSAGE = 1,
-    DELETE_MESSAGE = 2,
-    SEND_FILE = 3,
-    END_CHAT = 4
-};
-
-struct __attribute__((__packed__))  header_generic {
-    uint8_t magic;
-    uint16_t shortInt; // Because @bonelesspi said so
-    uint32_t longInt; // Because @thekacefiles said it was too archaic
-};
+struct Chat;
+struct Receiver;
+struct Chatter;
+ARRAYLIST_DEFINE(ChatArray, struct Chat*)
 
+/**
+ * The terminal belongs to a single thread, the GUI thread (see
+ * refreshGUILoop()): it reads the keyboard, applies events, and is the
+ * only thread that makes curses calls.  Other threads ask it for
+ * repaints with scheduleRepaint() and hand it errors to show with
+ * printErrorGUI(); lines the user types go the other way, to
+ * typeLoop().  The shown chat's lock and viewLock are held only while
+ * drawing into curses' off-screen windows, never while writing to the
+ * terminal.
+ */
 struct GUI {
+    // GUI thread only
     int W, H; // Width, height of terminal
     int CH; // Chat height
     int CW; // Chat width
     WINDOW* chatWindow;
-    pthread_mutex_t chatWindowLock;
     WINDOW* inputWindow;
     WINDOW* nameWindow;
-    pthread_mutex_t nameWindowLock;
+    WINDOW* transferWindow; // Files being sent, in rows along the bottom of the chat window
+    int TH; // Rows the transfer window takes (0 when nothing's being sent)
+    struct LineEditor editor; // Line being typed
+    size_t inputStart; // Offset of the first character of the line shown in inputWindow
+    int pasting; // Whether a bracketed paste is coming in
+    struct ArrayListBuf paste; // What's been pasted so far
+    char* nameRows; // What each row of the name window shows (ADDR_WIDTH+1 bytes per row)
+    size_t namesTop; // Index of the chat shown in the name window's top row
+    // Guarded by viewLock
+    pthread_mutex_t viewLock;
+    struct ChatView view; // Draws shownChat's timeline into chatWindow (the CH - TH rows above the transfers), and where it's scrolled to
+    struct Chat* shownChat; // Chat drawn in the chat window (a reference is held to it)
+    int chatDirty; // Whether the chat window has to be redrawn from scratch
+    // Shared
+    atomic_int repaintPending; // RepaintFlags for windows that need repainting
+    atomic_int frameIntervalMs; // Least time between repaints
+    _Atomic(char*) notice; // Error or search results waiting to be shown (dynamically allocated)
+    pthread_mutex_t inputLock;
+    pthread_cond_t inputReady;
+    StringArray inputLines; // Lines typed but not yet run (dynamically allocated, guarded by inputLock)
 };
+
+/**
+ * @brief Allocate the GUI.  The terminal isn't touched until the GUI
+ * thread starts
+ * 
+ * @return struct GUI*
+ */
 struct GUI* initGUI();
+
+/**
+ * @brief Free the GUI, once the GUI thread has exited
+ * 
+ * @param gui GUI
+ */
 void destroyGUI(struct GUI* gui);
-void printErrorGUI(struct GUI* gui, char* error);
 
-struct Message {
-    uint16_t id;
-    time_t timestamp; // Time at which this message was added to the data structure
-    char* text;
+/**
+ * @brief Show an error in the chat window at the next repaint.  Safe to
+ * call from any thread, with or without chatter->lock held
+ * 
+ * @param chatter Chatter object
+ * @param error Error message (copied)
+ */
+void printErrorGUI(struct Chatter* chatter, char* error);
+
+/**
+ * @brief Show some text over the chat window until it's next redrawn
+ * (e.g. search results).  Safe to call from any thread, with or without
+ * chatter->lock held
+ * 
+ * @param chatter Chatter object
+ * @param text Text, which may span several lines (copied)
+ */
+void printNoticeGUI(struct Chatter* chatter, const char* text);
+
+#define BYTES_TEXT_SIZE 24 // Room for anything formatBytes() writes, terminator and all
+
+/**
+ * @brief Write a number of bytes short enough for the name window,
+ * e.g. 512K or 40M
+ * 
+ * @param out Where to write it
+ * @param size Room in out (BYTES_TEXT_SIZE to be sure it all fits)
+ * @param bytes Number of bytes
+ */
+void formatBytes(char* out, size_t size, uint64_t bytes);
+
+/**
+ * @brief Write one line about a file being sent: its id, name, how far
+ * along it is, its throughput and how long it has left
+ * 
+ * @param row Where to write it
+ * @param size Room in row
+ * @param transfer Transfer (NOTE: Caller must hold the transfer queue's lock)
+ */
+void formatTransferRow(char* row, size_t size, const struct Transfer* transfer);
+
+/**
+ * @brief Lay the windows out again for the terminal's current size
+ * and have everything repainted (e.g. after a KEY_RESIZE)
+ * 
+ * @param chatter Chatter object
+ */
+void resizeGUI(struct Chatter* chatter);
+
+/**
+ * @brief Have the chat window redrawn from scratch on the next repaint,
+ * for changes that can't be drawn by scrolling in new messages
+ * 
+ * @param gui GUI
+ */
+void invalidateChatWindow(struct GUI* gui);
+
+/**
+ * @brief Forget what the name window shows, so that every row is drawn
+ * again on the next repaint (GUI thread only)
+ * 
+ * @param gui GUI
+ */
+void invalidateNameWindow(struct GUI* gui);
+
+/**
+ * @brief Let the GUI know a message in a chat's timeline was deleted
+ * (and is now a tombstone) (NOTE: Caller must hold the chat's lock)
+ * 
+ * @param gui GUI
+ * @param chat Chat
+ */
+void messageDeletedGUI(struct GUI* gui, struct Chat* chat);
+
+/**
+ * @brief Let the GUI know a message (or tombstone) was taken out of a
+ * chat's timeline (NOTE: Caller must hold the chat's lock)
+ * 
+ * @param gui GUI
+ * @param chat Chat
+ * @param index Index the message had in the timeline
+ */
+void messageRemovedGUI(struct GUI* gui, struct Chat* chat, size_t index);
+
+/**
+ * @brief Let the GUI know messages were put into a chat's timeline
+ * somewhere other than the end (NOTE: Caller must hold the chat's lock)
+ * 
+ * @param gui GUI
+ * @param chat Chat
+ * @param index Index of the first message put in
+ * @param count Number of messages put in
+ */
+void messagesInsertedGUI(struct GUI* gui, struct Chat* chat, size_t index, size_t count);
+
+#define CHAT_HOT_SIZE 64 // One cache line
+#define CHAT_INLINE_NAME 32 // Names shorter than this are stored inside the chat
+
+/**
+ * A slot in a chat's table of the newest message with each id going
+ * each way.  It's found by timestamp rather than index, since
+ * compaction and history loading move indices but never timestamps
+ */
+struct IdSlot {
+    uint32_t key; // 1 + (outgoing << 16 | id), or 0 if the slot is free
+    uint64_t timestamp; // UINT64_MAX if every message with the id has been deleted
 };
-void freeMessages(struct LinkedList* messages);
 
+/**
+ * One of these exists per peer, so it's kept small: the socket,
+ * counters and (short) name that every frame touches share the first
+ * cache line, and everything else follows.  Long names live on the heap.
+ */
 struct Chat {
-    char name[65536]; // Name of the person we're talking to
+    // Hot
     int sockfd; // Socket associated to this chat
     uint16_t outCounter; // How many messages sent out on this chat
-    struct LinkedList* messagesIn;
-    struct LinkedList* messagesOut;
-};
-struct Chat* initChat(int sockfd);
-void destroyChat(struct Chat* chat);
+    uint16_t nameLen;
+    uint64_t transferDone, transferTotal; // Progress of an incoming file (total is 0 if none; guarded by lock)
+    char* name; // Name of the person we're talking to (points at shortName if it fits; changed under lock and chatter->lock, so either is enough to read it)
+    char shortName[CHAT_INLINE_NAME];
+    // Cold
+    struct Timeline timeline; // Messages both ways in the order they were added, oldest first (owned; some may be spilled; guarded by lock)
+    pthread_mutex_t lock; // Guards the timeline, counters and name (see "Locking" below)
+    pthread_mutex_t sendLock; // Guards the socket's sending side and sendBuf
+    struct ArrayListBuf sendBuf; // Outgoing frames are encoded here (guarded by sendLock)
+    uint32_t unread; // Messages that arrived while the chat wasn't visible (guarded by lock)
+    uint32_t number; // Unique for the life of the process (the search index refers to chats by it)
+    struct HistoryLog* history; // Where messages are kept on disk (NULL until the peer's name is known, or if history is off)
+    int compactQueued; // Whether an EVENT_COMPACT for this chat is waiting to be applied (guarded by lock)
+    char* address; // "host port" I connected to, so the chat can be reopened after a restart (NULL if the peer connected to me)
+    int fileAnswer; // Whether the peer has the file I last offered it: 1 yes, 0 no, 2 an older copy, -1 waiting to hear (guarded by chatter->lock)
+    struct Receiver* receiver; // Where its incoming stream is up to (only touched by the worker reading it; NULL once it's closed)
+    char* signatures; // Signatures of the peer's older copy, once they arrive after a fileAnswer of 2 (guarded by chatter->lock)
+    size_t signaturesLen;
+    struct IdSlot* ids; // Open addressing table of the newest message with each id (guarded by lock; NULL until there's a message)
+    uint32_t idsN, idsCap; // Slots in use, and the size of the table (a power of 2)
+    atomic_uint refs; // References to it: the chat list's, and those of whoever is using it outside the registry lock
+} __attribute__((aligned(CHAT_HOT_SIZE)));
+struct Chat* initChat(int sockfd); // With one reference, the caller's
+void destroyChat(struct Chat* chat); // Frees it outright, whatever references are left
+
+/**
+ * @brief Take a reference to a chat, so that it isn't freed while it's
+ * being used, even if it's closed and removed in the meantime
+ * 
+ * @param chat Chat
+ */
+void retainChat(struct Chat* chat);
+
+/**
+ * @brief Let go of a reference to a chat.  The chat (and its socket) is
+ * freed when the last reference goes
+ * 
+ * @param chat Chat
+ */
+void releaseChat(struct Chat* chat);
+
+/**
+ * @brief Add a message to the end of a chat's timeline, which takes
+ * ownership of it.  Its timestamp is nudged forward if need be so that
+ * timestamps strictly increase along the timeline
+ * 
+ * @param chat Chat
+ * @param msg Message (MESSAGE_OUTGOING set if I sent it)
+ */
+void addMessage(struct Chat* chat, struct Message* msg);
+
+/**
+ * @brief Find a message in a chat's timeline by its timestamp
+ * 
+ * @param chat Chat
+ * @param timestamp Timestamp
+ * @return long Index in the timeline, or -1 if it isn't there (or was deleted)
+ */
+long findMessage(struct Chat* chat, uint64_t timestamp);
+
+/**
+ * @brief Find the newest message going one way with some id, without
+ * reading the timeline back in
+ * 
+ * @param chat Chat
+ * @param id Message id
+ * @param mine 1 for a message I sent, 0 for one the other person sent
+ * @return long Index in the timeline, or -1 if there's no such message (or it was deleted)
+ */
+long findMessageById(struct Chat* chat, uint16_t id, int mine);
+
+/**
+ * @brief Delete the newest message going one way with some id from a
+ * chat.  The message is freed, but a tombstone keeps its place in the
+ * timeline until the timeline is compacted, and one is added to the
+ * chat's history so it stays deleted there too
+ * 
+ * @param chat Chat
+ * @param id Message id
+ * @param mine 1 for a message I sent, 0 for one the other person sent
+ * @return long Index of the message's tombstone in the chat's timeline, or -1 if there's no such message
+ */
+long deleteMessageFromChat(struct Chat* chat, uint16_t id, int mine);
+
+/**
+ * @brief Change the name associated with a chat
+ * 
+ * @param chat Chat
+ * @param name New name (need not be null terminated)
+ * @param len Length of the name
+ */
+void setChatName(struct Chat* chat, const char* name, size_t len);
+
+/**
+ * @brief Start keeping a chat's messages on disk.  The messages already
+ * in the timeline are appended to the log, and the ones the log loads
+ * go in front of them as they come (see prependHistory())
+ * 
+ * @param chat Chat
+ * @param log Peer's history, from History_open()
+ */
+void attachHistory(struct Chat* chat, struct HistoryLog* log);
+
+/**
+ * @brief Put a batch of messages loaded from a chat's history in front
+ * of its timeline, by reference; they're read in when they're shown
+ * 
+ * @param chat Chat (its history attached)
+ * @param refs References from the batch, oldest first
+ * @param count Number of references
+ * @return size_t Number put in front of the timeline
+ */
+size_t prependHistory(struct Chat* chat, const uint64_t* refs, size_t count);
 void* refreshGUILoop(void* args);
 
+/**
+ * Locking.  chatter->lock is the registry lock: it guards the list of
+ * chats, the visible chat, my name, and the answers to files I offer.
+ * Each chat has locks of its own, so that traffic on one chat never
+ * waits on another: chat->lock for its timeline and counters, and
+ * chat->sendLock for its socket, which is held for one frame at a time
+ * (a file goes out a part per frame, so messages get in between) without
+ * holding up drawing or receiving on the chat.  When more than one is
+ * held they're taken in this order,
+ * with at most one chat's lock at a time:
+ *
+ *     chatter->lock -> chat->lock -> gui->viewLock
+ *
+ * The search index's lock (chatter->search->lock) comes after all of
+ * them: messages are added to the index under a chat's lock, so nothing
+ * is looked up in a chat while it's held (see searchChats()).  So do
+ * the history's locks, which are taken to append to a chat's log and to
+ * read its messages back; the history's worker hands what it loads to
+ * the event thread rather than taking a chat's lock itself (see
+ * historyLoaded()).
+ *
+ * chat->sendLock is only ever taken on its own, so a send that's held
+ * up waits with no other lock held.
+ *
+ * A chat is found under the registry lock, and its own lock is taken
+ * before the registry lock is let go (see lockVisibleChat()), or else a
+ * reference to it is (see retainChat()).  The list holds a reference to
+ * every chat; removeChat() drops it once it has waited out whoever
+ * holds the chat's lock, and the chat is freed when the last reference
+ * goes, so whoever still has one (a file being sent, the chat window)
+ * finds it intact, just no longer in the list.  Only the event thread
+ * removes chats, and the worker reading a chat has finished with it by
+ * then, so neither needs a reference of its own.  The one exception to
+ * the order is trimMemory(), which only tries the locks it would have
+ * to wait for.
+ */
 struct Chatter {
     struct GUI* gui;
-    struct LinkedList* chats;
-    char myname[65536];
-    struct Chat* visibleChat; // Linked node for the visible chat
+    ChatArray chats;
+    char* myname; // Dynamically allocated
+    struct Chat* _Atomic visibleChat; // Set under lock, and read by the event thread holding only a chat's lock
+    size_t visibleIndex; // Where visibleChat is in chats, so the name window needn't look for it (guarded by lock; 0 while there's none)
     int serversock; // File descriptor for the socket listening for incoming connections
-    pthread_mutex_t lock;
-    pthread_t refreshGUIThread;
+    pthread_mutex_t lock; // The registry lock (see above)
+    struct EventQueue* events; // Network threads -> GUI thread
+    pthread_t eventThread; // Applies events (see refreshGUILoop() and headlessEventLoop())
+    atomic_int stopping; // Set to have the event thread stop (giving the terminal back, if there's a GUI)
+    struct History* history; // Messages kept on disk (NULL if they aren't)
+    struct SearchIndex* search; // Every message in every chat, by word
+    uint64_t memoryBudget; // Most memory messages may take up across all chats before old ones are spilled (0 for no limit)
+    uint64_t chatMemoryBudget; // The same for each chat on its own
+    struct WorkerPool* workers; // Read every chat's socket as data arrives (see receiveReady())
+    struct FileStore* files; // Where received files are kept, by content (NULL to write them straight to the names peers give)
+    struct TransferQueue* transfers; // Files being sent in the background (see sendFile())
+    struct TransferQueue* replies; // Answers to files peers offer, sent in the background (not shown with the transfers)
+    pthread_cond_t fileAnswered; // A peer answered whether it has a file I offered (see sendFile())
+    char* sessionPath; // Where the session snapshot is kept (NULL if it isn't; see startSnapshots())
+    pthread_t snapshotThread;
+    pthread_cond_t snapshotStop; // Signalled to have snapshotThread stop (with snapshotStopping set, under lock)
+    int snapshotStopping; // (guarded by lock)
 };
-struct Chatter* initChatter();
+
+/**
+ * @brief Set up a chat session
+ * 
+ * @param headless 1 to run without a terminal (gui is then NULL; see headless.h)
+ * @param historyDir Directory to keep message history in, or NULL not to keep any
+ * @return struct Chatter*
+ */
+struct Chatter* initChatter(int headless, const char* historyDir);
+
+/**
+ * @brief Write a snapshot of the session every SNAPSHOT_INTERVAL seconds
+ * (if anything changed), and once more when the chatter is destroyed,
+ * so that restoreSession() can pick up where this session leaves off
+ * 
+ * @param chatter Chatter object
+ * @param path File to keep the snapshot in
+ */
+void startSnapshots(struct Chatter* chatter, const char* path);
+
+/**
+ * @brief Write a snapshot of the session now: my name, the visible chat,
+ * and the address, name, id counter and most recent messages of every
+ * chat I connected to (chats the peer started can't be reopened from
+ * this end).  Locks are only held while the snapshot is put together
+ * in memory, not while it's written
+ * 
+ * @param chatter Chatter object
+ * @param path File to write it to
+ * @return int STATUS_SUCCESS, or FAILURE_GENERIC if it couldn't be written
+ */
+int saveSession(struct Chatter* chatter, const char* path);
+
+/**
+ * @brief Reopen the chats in a session snapshot.  Every peer is
+ * connected to at once, with non-blocking sockets, so the whole thing
+ * takes about as long as the slowest peer to answer rather than the
+ * sum of all of them (and at most RECONNECT_TIMEOUT_MS).  Names, id
+ * counters and the visible chat are put back; messages come from
+ * history if it's kept, otherwise from the snapshot.  My name is then
+ * broadcast so that peers know who's back
+ * 
+ * @param chatter Chatter object
+ * @param path File the snapshot is in
+ * @return int STATUS_SUCCESS, or FAILURE_GENERIC if there was no snapshot to restore
+ */
+int restoreSession(struct Chatter* chatter, const char* path);
 void destroyChatter(struct Chatter* chatter);
+
+/**
+ * @brief Find a chat by (the start of) its name
+ * 
+ * @param chatter Chatter object
+ * @param name Name
+ * @return struct Chat* The first chat whose name starts with name, with a reference taken
+ * to it (the caller releases it with releaseChat()), or NULL if there's none
+ */
 struct Chat* getChatFromName(struct Chatter* chatter, char* name);
 
-void reprintUsernameWindow(struct Chatter* chatter); // NOTE: This method locks chat
-void reprintChatWindow(struct Chatter* chatter); // NOTE: This method locks chat
+/**
+ * @brief Lock the visible chat, handing over from the registry lock so
+ * that it can't be removed in between
+ * 
+ * @param chatter Chatter object
+ * @return struct Chat* The visible chat with its lock held (the caller unlocks it), or NULL if there isn't one
+ */
+struct Chat* lockVisibleChat(struct Chatter* chatter);
+void handleEvent(struct Chatter* chatter, struct Event* event);
+
+/**
+ * @brief Let the user know something went wrong, in the chat window
+ * or as an error record when headless
+ * 
+ * @param chatter Chatter object
+ * @param error Error message
+ */
+void reportError(struct Chatter* chatter, char* error);
+
+/**
+ * @brief Carry out a command (the same ones whether typed or headless)
+ * 
+ * @param chatter Chatter object
+ * @param input Command (modified)
+ * @return int READY_TO_EXIT if the command was exit, otherwise KEEP_GOING
+ */
+int parseInput(struct Chatter* chatter, char* input);
+
+/**
+ * @brief Spill a chat's oldest, least looked at messages to disk if it's
+ * over its memory budget, then spill from every chat in proportion to
+ * what it holds if all of them together are over theirs.  Spilling
+ * goes down to 7/8 of a budget, so that it isn't needed again for a
+ * while.  While an old spill file is being replaced, some of every
+ * chat's messages are moved out of it too (see Timeline_drain()).  Going from the chat to the others is against the lock order,
+ * so the registry and the other chats are only tried, and any that are
+ * busy are passed over until next time (NOTE: Caller must hold the
+ * chat's lock and no other)
+ * 
+ * @param chatter Chatter object
+ * @param chat Chat that just grew, or NULL
+ */
+void trimMemory(struct Chatter* chatter, struct Chat* chat);
+
+enum RepaintFlags {
+    REPAINT_NAMES = 1,
+    REPAINT_CHAT = 2,
+    REPAINT_NOTICE = 4,
+    REPAINT_TRANSFERS = 8
+};
+
+/**
+ * @brief Ask for windows to be repainted.  Requests are coalesced and
+ * carried out by the GUI thread at the next frame, so this is cheap to
+ * call after every change.  Safe to call from any thread
+ * 
+ * @param chatter Chatter object
+ * @param what RepaintFlags for the windows that changed
+ */
+void scheduleRepaint(struct Chatter* chatter, int what);
+
+/**
+ * @brief Set the most times per second the screen is repainted
+ * 
+ * @param gui GUI
+ * @param fps Frames per second
+ */
+void setFrameRate(struct GUI* gui, int fps);
+
+
+/**
+ * @brief Bring the name window up to date, touching only rows whose
+ * text has changed.  Only the rows on screen are looked at, so the cost
+ * doesn't grow with the number of chats; the window scrolls to keep the
+ * visible chat on screen when there are more chats than rows
+ * (NOTE: This method takes the registry lock, and the lock of each
+ * chat shown in turn)
+ * 
+ * @param chatter Chatter object
+ */
+void reprintUsernameWindow(struct Chatter* chatter);
+void reprintChatWindow(struct Chatter* chatter); // NOTE: This method locks the visible chat
+void readKeys(struct Chatter* chatter); // NOTE: GUI thread only
+
+/**
+ * @brief Apply a key the user pressed to the line being typed, handing
+ * the line to typeLoop() on Enter (GUI thread only)
+ * 
+ * @param chatter Chatter object
+ * @param ch Key, as returned by wgetch()
+ */
+void handleKey(struct Chatter* chatter, int ch);
+
+/**
+ * @brief Run the lines the user types as commands until one of them
+ * is exit.  Commands can take a while (e.g. sending a file), so they
+ * run here rather than on the GUI thread
+ * 
+ * @param chatter Chatter object
+ */
 void typeLoop(struct Chatter* chatter);
 
 
@@ -116,16 +581,76 @@ int sendMessage(struct Chatter* chatter, char* message);
  */
 int deleteMessage(struct Chatter* chatter, uint16_t id);
 
-int deleteMessageFromChat(struct Chat *chat, uint16_t id);
 
 /**
- * @brief Send a file in the visible chat
+ * @brief Scroll the visible chat back (positive) or forward (negative)
+ * 
+ * @param chatter Data about the current chat session
+ * @param rows Rows to scroll
+ */
+void scrollChat(struct Chatter* chatter, long rows);
+
+/**
+ * @brief Scroll the visible chat to the newest message with an id
+ * 
+ * @param chatter Data about the current chat session
+ * @param id Message id
+ */
+int gotoMessage(struct Chatter* chatter, uint16_t id);
+
+/**
+ * @brief Show the newest messages, across all chats, that contain every
+ * word of a query
+ * 
+ * @param chatter Data about the current chat session
+ * @param query Words to look for
+ */
+int searchChats(struct Chatter* chatter, char* query);
+
+/**
+ * @brief Show how many messages each chat has in memory and spilled to
+ * disk, and how much memory they take up
+ * 
+ * @param chatter Data about the current chat session
+ */
+int showStats(struct Chatter* chatter);
+
+/**
+ * @brief Send a file in the visible chat, in the background.  It's queued
+ * on chatter->transfers, which sends a few files at once across chats and
+ * one at a time in each, so this returns straight away.  When its turn
+ * comes the file is hashed and offered to the peer, and only sent if the
+ * peer's file store doesn't have it already (or the peer doesn't answer
+ * within FILE_QUERY_TIMEOUT_MS).  If the peer has an older copy under the
+ * same name, only the changes to it are sent (see delta.h).  It goes out
+ * a frame at a time, so messages can be sent in the chat meanwhile.  A
+ * file sent whole is read, checked against its hash and sent by a
+ * pipeline of threads (see pipeline.h), and held back from the peer if
+ * it changed since it was offered
  * 
  * @param chatter Data about the current chat session
  * @param filename Path to file
+ * @return int STATUS_SUCCESS once it's queued, FAILURE_GENERIC if there's no such file or no chat
  */
 int sendFile(struct Chatter* chatter, char* filename);
 
+/**
+ * @brief Stop sending a file, or take it out of the queue.  The peer
+ * throws away what it got of it
+ * 
+ * @param chatter Data about the current chat session
+ * @param id Transfer's id, as shown with its progress
+ */
+int cancelTransfer(struct Chatter* chatter, uint32_t id);
+
+/**
+ * @brief Show every file being sent or waiting to be, with its progress,
+ * throughput and time left
+ * 
+ * @param chatter Data about the current chat session
+ */
+int showTransfers(struct Chatter* chatter);
+
 /**
  * @brief Broadcast my name to all visible connections
  * NOTE: Name is held in chatter->myname
@@ -134,6 +659,14 @@ int sendFile(struct Chatter* chatter, char* filename);
  */
 int broadcastMyName(struct Chatter* chatter);
 
+/**
+ * @brief Change my name (without broadcasting it)
+ * 
+ * @param chatter Data about the current chat session
+ * @param name New name
+ */
+void setMyName(struct Chatter* chatter, char* name);
+
 /**
  * @brief Close chat with someone
  * 
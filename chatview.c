@@ -0,0 +1,358 @@
+#include <string.h>
+#include <stdlib.h>
+#include "chatview.h"
+
+void ChatView_init(struct ChatView* view, WINDOW* win, int H, int W, ChatView_PrefixFn formatPrefix, void* ctx) {
+    view->win = win;
+    view->H = H;
+    view->W = W;
+    view->formatPrefix = formatPrefix;
+    view->ctx = ctx;
+    ArrayListBuf_init(&view->prefix);
+    OffsetArray_init(&view->scratch);
+    view->following = 1;
+    view->bottom = 0;
+    view->bottomSkip = 0;
+    view->shown = 0;
+}
+
+void ChatView_free(struct ChatView* view) {
+    ArrayListBuf_free(&view->prefix);
+    OffsetArray_free(&view->scratch);
+}
+
+void ChatView_resize(struct ChatView* view, int H, int W) {
+    view->H = H;
+    view->W = W;
+}
+
+/**
+ * @brief Character at offset i of prefix+text
+ */
+static inline char charAt(const char* prefix, uint32_t prefixLen, const char* text, uint32_t i) {
+    return i < prefixLen ? prefix[i] : text[i - prefixLen];
+}
+
+uint32_t ChatView_wrap(int W, const char* prefix, int prefixLen, const char* text, uint32_t len, OffsetArray* breaks) {
+    uint32_t total = prefixLen + len;
+    uint32_t pos = 0; // Where the current row starts
+    uint32_t rows = 1;
+    OffsetArray_clear(breaks);
+    while (1) {
+        uint32_t end = total - pos < (uint32_t)W ? total : pos + W;
+        uint32_t next = end;
+        // A newline in the text always ends the row, even one just past the end
+        uint32_t from = pos > (uint32_t)prefixLen ? pos : (uint32_t)prefixLen;
+        uint32_t scanEnd = end < total ? end + 1 : end;
+        const char* newline = from < scanEnd ? memchr(text + from - prefixLen, '\n', scanEnd - from) : NULL;
+        if (newline != NULL) {
+            next = (uint32_t)(newline - text) + prefixLen + 1;
+        }
+        else if (end == total) {
+            break; // The rest fits on this row
+        }
+        else {
+            // Break after the last space that fits (which may be the one
+            // just past the end of the row, or the one ending the prefix)
+            uint32_t lowest = pos + 1;
+            if (prefixLen > 0 && (uint32_t)prefixLen - 1 > lowest) {
+                lowest = prefixLen - 1;
+            }
+            for (uint32_t j = end; j >= lowest; j--) {
+                if (charAt(prefix, prefixLen, text, j) == ' ') {
+                    next = j + 1;
+                    break;
+                }
+            }
+        }
+        if (next >= total) {
+            break;
+        }
+        OffsetArray_push(breaks, next);
+        pos = next;
+        rows++;
+    }
+    return rows;
+}
+
+void ChatView_layout(struct ChatView* view, struct Message* msg, struct LineLayout* layout) {
+    if (msg->flags & MESSAGE_DELETED) {
+        // Tombstones take up no room at all
+        layout->rows = 0;
+        layout->breaks = NULL;
+        return;
+    }
+    ArrayListBuf_clear(&view->prefix);
+    view->formatPrefix(view->ctx, msg, &view->prefix);
+    const char* prefix = ArrayListBuf_cstr(&view->prefix);
+    int prefixLen = (int)view->prefix.N;
+    if (!(msg->flags & MESSAGE_HEAP_TEXT)) {
+        // Short enough that wrapping it costs about as much as looking it up
+        layout->rows = ChatView_wrap(view->W, prefix, prefixLen, msg->text.small, msg->len, &view->scratch);
+        layout->breaks = view->scratch.data;
+        return;
+    }
+    if (msg->text.heap.width != view->W || msg->text.heap.prefix != prefixLen) {
+        uint32_t rows = ChatView_wrap(view->W, prefix, prefixLen, msg->text.heap.text, msg->len, &view->scratch);
+        free(msg->text.heap.breaks);
+        msg->text.heap.breaks = NULL;
+        if (rows > 1) {
+            msg->text.heap.breaks = (uint32_t*)malloc(sizeof(uint32_t)*(rows - 1));
+            memcpy(msg->text.heap.breaks, view->scratch.data, sizeof(uint32_t)*(rows - 1));
+        }
+        msg->text.heap.rows = rows;
+        msg->text.heap.width = (uint16_t)view->W;
+        msg->text.heap.prefix = (uint16_t)prefixLen;
+    }
+    layout->rows = msg->text.heap.rows;
+    layout->breaks = msg->text.heap.breaks;
+}
+
+/**
+ * @brief Write part of prefix+text at the cursor, in at most two calls
+ */
+static void addSpan(WINDOW* win, const char* prefix, uint32_t prefixLen, const char* text, uint32_t start, uint32_t end) {
+    if (start < prefixLen) {
+        uint32_t prefixEnd = end < prefixLen ? end : prefixLen;
+        waddnstr(win, prefix + start, prefixEnd - start);
+        start = prefixEnd;
+    }
+    if (start < end) {
+        waddnstr(win, text + start - prefixLen, end - start);
+    }
+}
+
+/**
+ * @brief Draw a message, laid out by the last ChatView_layout(), with
+ * its first row at some row of the window.  Only rows that land inside
+ * the window are touched, so row may be negative to show just the end
+ * of a long message
+ */
+static void ChatView_draw(struct ChatView* view, int row, struct Message* msg, const struct LineLayout* layout) {
+    const char* prefix = view->prefix.buff;
+    uint32_t prefixLen = (uint32_t)view->prefix.N;
+    const char* text = Message_text(msg);
+    uint32_t total = prefixLen + msg->len;
+    // Skip straight to the first row inside the window
+    uint32_t first = row < 0 ? (uint32_t)(-row) : 0;
+    for (uint32_t i = first; i < layout->rows && row + (long)i < view->H; i++) {
+        uint32_t start = i == 0 ? 0 : layout->breaks[i-1];
+        uint32_t end = i + 1 < layout->rows ? layout->breaks[i] : total;
+        if (end - start > (uint32_t)view->W) {
+            end = start + view->W; // Drops the space the row broke at
+        }
+        if (end > start && charAt(prefix, prefixLen, text, end - 1) == '\n') {
+            end--;
+        }
+        wmove(view->win, row + i, 0);
+        addSpan(view->win, prefix, prefixLen, text, start, end);
+        if (end - start < (uint32_t)view->W) {
+            wclrtoeol(view->win);
+        }
+    }
+}
+
+/**
+ * @brief Scroll the window up just far enough to fit a message at the
+ * bottom, and draw it there
+ */
+static void ChatView_append(struct ChatView* view, struct Message* msg) {
+    struct LineLayout layout;
+    ChatView_layout(view, msg, &layout);
+    int rows = layout.rows < (uint32_t)view->H ? (int)layout.rows : view->H;
+    if (rows == view->H) {
+        // Takes up the whole window
+        werase(view->win);
+    }
+    else {
+        wscrl(view->win, rows);
+    }
+    ChatView_draw(view, view->H - (int)layout.rows, msg, &layout);
+}
+
+static uint32_t ChatView_rows(struct ChatView* view, struct Timeline* timeline, size_t i) {
+    struct LineLayout layout;
+    ChatView_layout(view, Timeline_get(timeline, i), &layout);
+    return layout.rows;
+}
+
+void ChatView_follow(struct ChatView* view) {
+    view->following = 1;
+    view->shown = 0;
+}
+
+void ChatView_redraw(struct ChatView* view, struct Timeline* timeline) {
+    werase(view->win);
+    view->shown = Timeline_size(timeline);
+    if (Timeline_size(timeline) == 0) {
+        view->following = 1;
+        return;
+    }
+    if (view->following || view->bottom >= Timeline_size(timeline)) {
+        view->bottom = Timeline_size(timeline) - 1;
+        view->bottomSkip = 0;
+    }
+    if (Timeline_isDeleted(timeline, view->bottom)) {
+        view->bottomSkip = 0;
+    }
+    // Work up from the bottom until the window is full, taking runs of
+    // tombstones (which have no rows) in one step
+    long row = view->H;
+    size_t i = Timeline_skipDeletedBack(timeline, view->bottom + 1);
+    while (row > 0 && i > 0) {
+        i--;
+        struct LineLayout layout;
+        ChatView_layout(view, Timeline_get(timeline, i), &layout);
+        if (i == view->bottom) {
+            if (view->bottomSkip >= layout.rows) {
+                view->bottomSkip = layout.rows > 0 ? layout.rows - 1 : 0; // The window got wider
+            }
+            row += view->bottomSkip;
+        }
+        row -= layout.rows;
+        ChatView_draw(view, (int)row, Timeline_get(timeline, i), &layout);
+        i = Timeline_skipDeletedBack(timeline, i);
+    }
+}
+
+void ChatView_update(struct ChatView* view, struct Timeline* timeline) {
+    if (!view->following) {
+        return;
+    }
+    if (Timeline_size(timeline) < view->shown || Timeline_size(timeline) - view->shown > (size_t)view->H) {
+        // So much is new that there's nothing on screen worth keeping
+        ChatView_redraw(view, timeline);
+        return;
+    }
+    for (size_t i = view->shown; i < Timeline_size(timeline); i++) {
+        ChatView_append(view, Timeline_get(timeline, i));
+    }
+    view->shown = Timeline_size(timeline);
+}
+
+/**
+ * @brief Move the bottom of the viewport forward through the timeline
+ */
+static void ChatView_scrollDown(struct ChatView* view, struct Timeline* timeline, uint64_t rows) {
+    while (rows > 0) {
+        if (view->bottomSkip >= rows) {
+            view->bottomSkip -= rows;
+            rows = 0;
+        }
+        else {
+            rows -= view->bottomSkip;
+            view->bottomSkip = 0;
+            if (view->bottom + 1 >= Timeline_size(timeline)) {
+                break;
+            }
+            // The next message starts out completely below the window
+            // (tombstones have no rows, so a run of them goes by at once)
+            view->bottom = Timeline_skipDeleted(timeline, view->bottom + 1);
+            if (view->bottom >= Timeline_size(timeline)) {
+                view->bottom = Timeline_size(timeline) - 1;
+            }
+            view->bottomSkip = ChatView_rows(view, timeline, view->bottom);
+        }
+    }
+    if (view->bottom + 1 >= Timeline_size(timeline) && view->bottomSkip == 0) {
+        view->following = 1;
+    }
+}
+
+/**
+ * @brief Move the bottom of the viewport back through the timeline,
+ * stopping once the first message is at the top of the window
+ */
+static void ChatView_scrollUp(struct ChatView* view, struct Timeline* timeline, uint64_t rows) {
+    while (rows > 0) {
+        uint32_t r = ChatView_rows(view, timeline, view->bottom);
+        if (view->bottomSkip + rows < r) {
+            view->bottomSkip += rows;
+            rows = 0;
+        }
+        else if (view->bottom == 0) {
+            view->bottomSkip = r > 0 ? r - 1 : 0;
+            break;
+        }
+        else {
+            rows -= r - view->bottomSkip;
+            // Tombstones have no rows, so a run of them goes by at once
+            size_t end = Timeline_skipDeletedBack(timeline, view->bottom);
+            view->bottom = end > 0 ? end - 1 : 0;
+            view->bottomSkip = 0;
+        }
+    }
+    // Don't leave blank rows at the top of the window
+    uint64_t filled = ChatView_rows(view, timeline, view->bottom) - view->bottomSkip;
+    for (size_t i = Timeline_skipDeletedBack(timeline, view->bottom); filled < (uint64_t)view->H && i > 0; i = Timeline_skipDeletedBack(timeline, i - 1)) {
+        filled += ChatView_rows(view, timeline, i - 1);
+    }
+    if (filled < (uint64_t)view->H) {
+        ChatView_scrollDown(view, timeline, view->H - filled);
+    }
+}
+
+/**
+ * @brief Stop following the newest message, keeping it where it is
+ */
+static void ChatView_unfollow(struct ChatView* view, struct Timeline* timeline) {
+    if (view->following) {
+        view->following = 0;
+        view->bottom = Timeline_size(timeline) - 1;
+        view->bottomSkip = 0;
+    }
+}
+
+void ChatView_scroll(struct ChatView* view, struct Timeline* timeline, long rows) {
+    if (Timeline_size(timeline) == 0) {
+        return;
+    }
+    ChatView_unfollow(view, timeline);
+    if (rows > 0) {
+        ChatView_scrollUp(view, timeline, (uint64_t)rows);
+    }
+    else {
+        ChatView_scrollDown(view, timeline, (uint64_t)(-rows));
+    }
+}
+
+void ChatView_scrollTo(struct ChatView* view, struct Timeline* timeline, size_t index) {
+    if (index >= Timeline_size(timeline)) {
+        return;
+    }
+    ChatView_unfollow(view, timeline);
+    view->bottom = index;
+    view->bottomSkip = 0;
+    uint32_t r = ChatView_rows(view, timeline, index);
+    if (r >= (uint32_t)view->H) {
+        view->bottomSkip = r - view->H;
+    }
+    else {
+        // Bring in what came after until the message reaches the top
+        ChatView_scrollDown(view, timeline, view->H - r);
+    }
+}
+
+void ChatView_inserted(struct ChatView* view, size_t index, size_t count) {
+    if (index < view->shown) {
+        view->shown += count;
+    }
+    if (!view->following && index <= view->bottom) {
+        view->bottom += count;
+    }
+}
+
+void ChatView_removed(struct ChatView* view, size_t index) {
+    if (index < view->shown) {
+        view->shown--;
+    }
+    if (!view->following) {
+        if (index < view->bottom) {
+            view->bottom--;
+        }
+        else if (index == view->bottom) {
+            // The next message takes its place
+            view->bottomSkip = 0;
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef CHATVIEW_H
+#define CHATVIEW_H
+
+#include <stdint.h>
+#include <ncurses.h>
+#include "arraylist.h"
+#include "message.h"
+#include "timeline.h"
+
+ARRAYLIST_DEFINE(OffsetArray, uint32_t)
+
+/**
+ * @brief Write the prefix a message is shown with (e.g. "name id: ")
+ * 
+ * @param ctx Whatever was given to ChatView_init()
+ * @param msg Message
+ * @param prefix Buffer to append the prefix to (already cleared)
+ */
+typedef void (*ChatView_PrefixFn)(void* ctx, struct Message* msg, struct ArrayListBuf* prefix);
+
+/**
+ * Drawing for the chat window.  A line on screen is a short prefix
+ * followed by a message's text, word wrapped at the window width.
+ * Where the rows break is worked out once per message and width (see
+ * ChatView_layout()), so drawing only ever touches the rows that are
+ * actually visible, and each row goes out as whole strings.
+ *
+ * The view shows a window onto a timeline of messages (oldest first).
+ * Normally it follows the newest message, and new ones are added by
+ * scrolling the window rather than repainting it; once scrolled back,
+ * it stays put at a message index, and every redraw or scroll costs
+ * time in proportion to what's on screen, however long the timeline.
+ */
+struct ChatView {
+    WINDOW* win; // Must have scrollok() set
+    int H, W; // Size of the window
+    ChatView_PrefixFn formatPrefix;
+    void* ctx;
+    struct ArrayListBuf prefix; // Prefix of the message being drawn
+    OffsetArray scratch; // Layout of the last message too short to cache one
+    // Viewport
+    int following; // Whether the newest message is kept at the bottom
+    size_t bottom; // Otherwise, index of the message at the bottom of the window...
+    uint32_t bottomSkip; // ...and how many of its rows are scrolled off below it
+    size_t shown; // Messages at the front of the timeline already drawn (when following)
+};
+
+/**
+ * How a line wraps: breaks[i] is the offset into prefix+text at which
+ * row i+1 starts (so there are rows-1 of them)
+ */
+struct LineLayout {
+    uint32_t rows;
+    const uint32_t* breaks;
+};
+
+void ChatView_init(struct ChatView* view, WINDOW* win, int H, int W, ChatView_PrefixFn formatPrefix, void* ctx);
+void ChatView_free(struct ChatView* view);
+
+/**
+ * @brief Let the view know the window has a new size.  Cached layouts
+ * for the old width are recomputed as they're next needed
+ * 
+ * @param view View
+ * @param H New height
+ * @param W New width
+ */
+void ChatView_resize(struct ChatView* view, int H, int W);
+
+/**
+ * @brief Word wrap prefix+text at width W.  Rows break after the last
+ * space that fits (never inside the prefix), after newlines, or else
+ * wherever the row is full
+ * 
+ * @param W Width
+ * @param prefix Prefix
+ * @param prefixLen Length of the prefix
+ * @param text Text
+ * @param len Length of the text
+ * @param breaks Filled with the offset each row after the first starts at
+ * @return uint32_t Number of rows
+ */
+uint32_t ChatView_wrap(int W, const char* prefix, int prefixLen, const char* text, uint32_t len, OffsetArray* breaks);
+
+/**
+ * @brief Format a message's prefix into view->prefix and find out how
+ * the line wraps in this view.  Long messages keep their layout until
+ * the width or prefix length changes; short ones are wrapped into the
+ * view's scratch space, which stays valid until the next call.
+ * Tombstones (MESSAGE_DELETED) take up no rows
+ * 
+ * @param view View
+ * @param msg Message
+ * @param layout Filled with the layout
+ */
+void ChatView_layout(struct ChatView* view, struct Message* msg, struct LineLayout* layout);
+
+/**
+ * @brief Go back to following the newest message (e.g. when a
+ * different timeline is about to be shown)
+ * 
+ * @param view View
+ */
+void ChatView_follow(struct ChatView* view);
+
+/**
+ * @brief Draw the window from scratch
+ * 
+ * @param view View
+ * @param timeline Messages, oldest first
+ */
+void ChatView_redraw(struct ChatView* view, struct Timeline* timeline);
+
+/**
+ * @brief Scroll messages added to the end of the timeline since it was
+ * last drawn into the bottom of the window, without touching what's
+ * already there.  Does nothing while scrolled back
+ * 
+ * @param view View
+ * @param timeline Messages, oldest first
+ */
+void ChatView_update(struct ChatView* view, struct Timeline* timeline);
+
+/**
+ * @brief Move the viewport some number of rows back (positive) or
+ * forward (negative) through the timeline.  Reaching the end starts
+ * following the newest message again.  Redraw afterwards
+ * 
+ * @param view View
+ * @param timeline Messages, oldest first
+ * @param rows Rows to scroll
+ */
+void ChatView_scroll(struct ChatView* view, struct Timeline* timeline, long rows);
+
+/**
+ * @brief Move the viewport so that a message starts at the top of the
+ * window (or as near as the end of the timeline allows).  Redraw afterwards
+ * 
+ * @param view View
+ * @param timeline Messages, oldest first
+ * @param index Index of the message
+ */
+void ChatView_scrollTo(struct ChatView* view, struct Timeline* timeline, size_t index);
+
+/**
+ * @brief Let the view know that a message was taken out of the timeline,
+ * so the viewport stays on the same messages.  Redraw afterwards
+ * 
+ * @param view View
+ * @param index Index the message had
+ */
+void ChatView_removed(struct ChatView* view, size_t index);
+
+/**
+ * @brief Let the view know that messages were put into the timeline
+ * somewhere other than the end (e.g. history loaded from disk), so the
+ * viewport stays on the same messages.  Redraw afterwards
+ * 
+ * @param view View
+ * @param index Index of the first message put in
+ * @param count Number of messages put in
+ */
+void ChatView_inserted(struct ChatView* view, size_t index, size_t count);
+
+#endif
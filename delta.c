@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "delta.h"
+
+#define DELTA_READ_SIZE (4*1024*1024) // Bytes read at a time
+#define DELTA_LITERAL_HEADER 5 // Op byte and length
+#define DELTA_COPY_SIZE 9 // Op byte, first block and count
+
+uint32_t Delta_blockSize(uint64_t size) {
+    // Integer square root, by Newton's method
+    uint64_t root = size, next = (size + 1)/2;
+    while (next < root) {
+        root = next;
+        next = (root + size/root)/2;
+    }
+    uint32_t blockSize = root > DELTA_MAX_BLOCK ? DELTA_MAX_BLOCK : (uint32_t)root & ~7u;
+    return blockSize < DELTA_MIN_BLOCK ? DELTA_MIN_BLOCK : blockSize;
+}
+
+/**
+ * @brief rsync's weak checksum of a block, as its two halves
+ */
+static void Delta_weak(const unsigned char* p, uint32_t len, uint32_t* a, uint32_t* b) {
+    uint32_t s1 = 0, s2 = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        s1 += p[i];
+        s2 += (len - i)*(uint32_t)p[i];
+    }
+    *a = s1 & 0xffff;
+    *b = s2 & 0xffff;
+}
+
+/**
+ * @brief A 64 bit hash of a block, 8 bytes at a time
+ */
+static uint64_t Delta_strong(const unsigned char* p, uint32_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    uint32_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h ^= w*0x87c37b91114253d5ull;
+        h = ((h << 31) | (h >> 33))*0x4cf5ad432745937full;
+    }
+    for (; i < len; i++) {
+        h = (h ^ p[i])*0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief read() until len bytes are in or the file ends
+ */
+static ssize_t Delta_readFull(int fd, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static void Delta_push32(struct ArrayListBuf* b, uint32_t x) {
+    x = htonl(x);
+    ArrayListBuf_push(b, (const char*)&x, sizeof(x));
+}
+
+int Delta_sign(int fd, uint32_t blockSize, struct ArrayListBuf* out) {
+    size_t headerAt = out->N;
+    struct DeltaSignatureHeader header = {0, 0, 0};
+    ArrayListBuf_push(out, (const char*)&header, sizeof(header)); // Filled in at the end
+    size_t perRead = DELTA_READ_SIZE/blockSize*blockSize;
+    char* buf = (char*)malloc(perRead);
+    uint32_t blocks = 0, lastBlock = 0;
+    ssize_t n;
+    while ((n = Delta_readFull(fd, buf, perRead)) > 0) {
+        for (size_t off = 0; off < (size_t)n; off += blockSize) {
+            uint32_t len = (size_t)n - off < blockSize ? (uint32_t)((size_t)n - off) : blockSize;
+            uint32_t a, b;
+            Delta_weak((const unsigned char*)buf + off, len, &a, &b);
+            uint64_t strong = Delta_strong((const unsigned char*)buf + off, len);
+            Delta_push32(out, a | b << 16);
+            Delta_push32(out, (uint32_t)(strong >> 32));
+            Delta_push32(out, (uint32_t)strong);
+            blocks++;
+            lastBlock = len;
+        }
+        if ((size_t)n < perRead) {
+            break;
+        }
+    }
+    free(buf);
+    header.blockSize = htonl(blockSize);
+    header.blocks = htonl(blocks);
+    header.lastBlock = htonl(lastBlock);
+    memcpy(out->buff + headerAt, &header, sizeof(header));
+    return n == -1 ? -1 : 0;
+}
+
+static uint32_t Delta_bucket(const struct DeltaIndex* index, uint32_t weak) {
+    return (weak*2654435761u >> 7) & index->mask;
+}
+
+struct DeltaIndex* DeltaIndex_init(const char* signatures, size_t len) {
+    struct DeltaSignatureHeader header;
+    if (len < sizeof(header)) {
+        return NULL;
+    }
+    memcpy(&header, signatures, sizeof(header));
+    uint32_t blockSize = ntohl(header.blockSize), blocks = ntohl(header.blocks), lastBlock = ntohl(header.lastBlock);
+    if (blockSize < DELTA_MIN_BLOCK || blockSize > DELTA_MAX_BLOCK || lastBlock > blockSize
+        || (blocks > 0 && lastBlock == 0) || len != sizeof(header) + (size_t)blocks*sizeof(struct DeltaBlock)) {
+        return NULL;
+    }
+    struct DeltaIndex* index = (struct DeltaIndex*)malloc(sizeof(struct DeltaIndex));
+    index->blockSize = blockSize;
+    index->blocks = blocks;
+    index->lastBlock = lastBlock;
+    uint32_t buckets = 16;
+    while (buckets < 2*(uint64_t)blocks) {
+        buckets *= 2;
+    }
+    index->mask = buckets - 1;
+    index->weak = (uint32_t*)malloc((blocks + 1)*sizeof(uint32_t));
+    index->strong = (uint64_t*)malloc((blocks + 1)*sizeof(uint64_t));
+    index->next = (uint32_t*)malloc((blocks + 1)*sizeof(uint32_t));
+    index->buckets = (uint32_t*)calloc(buckets, sizeof(uint32_t));
+    const char* p = signatures + sizeof(header);
+    // Added last to first, so that each bucket lists blocks in file order
+    for (uint32_t i = blocks; i-- > 0;) {
+        struct DeltaBlock block;
+        memcpy(&block, p + (size_t)i*sizeof(block), sizeof(block));
+        index->weak[i] = ntohl(block.weak);
+        index->strong[i] = (uint64_t)ntohl(block.strongHigh) << 32 | ntohl(block.strongLow);
+        uint32_t bucket = Delta_bucket(index, index->weak[i]);
+        index->next[i] = index->buckets[bucket];
+        index->buckets[bucket] = i + 1;
+    }
+    return index;
+}
+
+void DeltaIndex_free(struct DeltaIndex* index) {
+    free(index->weak);
+    free(index->strong);
+    free(index->next);
+    free(index->buckets);
+    free(index);
+}
+
+/**
+ * Where Delta_encode() is up to
+ */
+struct DeltaEncoder {
+    struct DeltaIndex* index;
+    struct ArrayListBuf ops; // Instructions not yet emitted
+    uint32_t runFirst, runCount; // Blocks to copy that haven't been written as an instruction yet
+    Delta_EmitFn emit;
+    void* ctx;
+    struct DeltaStats stats;
+    int failed;
+};
+
+/**
+ * @brief Make room for an instruction, emitting what's there if it won't fit
+ */
+static void Delta_room(struct DeltaEncoder* enc, size_t len) {
+    if (enc->ops.N > 0 && enc->ops.N + len > DELTA_CHUNK) {
+        if (!enc->failed && enc->emit(enc->ctx, enc->ops.buff, enc->ops.N) == -1) {
+            enc->failed = 1;
+        }
+        enc->stats.encodedBytes += enc->ops.N;
+        ArrayListBuf_clear(&enc->ops);
+    }
+}
+
+static void Delta_flushRun(struct DeltaEncoder* enc) {
+    if (enc->runCount > 0) {
+        Delta_room(enc, DELTA_COPY_SIZE);
+        char op = DELTA_COPY;
+        ArrayListBuf_push(&enc->ops, &op, 1);
+        Delta_push32(&enc->ops, enc->runFirst);
+        Delta_push32(&enc->ops, enc->runCount);
+        enc->runCount = 0;
+    }
+}
+
+static void Delta_copy(struct DeltaEncoder* enc, uint32_t block) {
+    if (enc->runCount > 0 && block == enc->runFirst + enc->runCount) {
+        enc->runCount++;
+    }
+    else {
+        Delta_flushRun(enc);
+        enc->runFirst = block;
+        enc->runCount = 1;
+    }
+    enc->stats.copiedBytes += block == enc->index->blocks - 1 ? enc->index->lastBlock : enc->index->blockSize;
+}
+
+static void Delta_literal(struct DeltaEncoder* enc, const char* data, size_t len) {
+    if (len > 0) {
+        Delta_flushRun(enc);
+        enc->stats.literalBytes += len;
+    }
+    while (len > 0) {
+        size_t piece = len < DELTA_CHUNK - DELTA_LITERAL_HEADER ? len : DELTA_CHUNK - DELTA_LITERAL_HEADER;
+        Delta_room(enc, DELTA_LITERAL_HEADER + piece);
+        char op = DELTA_LITERAL;
+        ArrayListBuf_push(&enc->ops, &op, 1);
+        Delta_push32(&enc->ops, (uint32_t)piece);
+        ArrayListBuf_push(&enc->ops, data, piece);
+        data += piece;
+        len -= piece;
+    }
+}
+
+/**
+ * @brief Find a block of the receiver's with the same contents as the
+ * window, trying the block after the last one matched first
+ *
+ * @return long The block, or -1 if there isn't one
+ */
+static long Delta_find(struct DeltaIndex* index, uint32_t weak, const unsigned char* window, uint32_t len, uint32_t expected) {
+    uint64_t strong = 0;
+    int hashed = 0;
+    if (expected < index->blocks && index->weak[expected] == weak && (expected + 1 < index->blocks || index->lastBlock == len)) {
+        strong = Delta_strong(window, len);
+        hashed = 1;
+        if (index->strong[expected] == strong) {
+            return expected;
+        }
+    }
+    for (uint32_t i = index->buckets[Delta_bucket(index, weak)]; i != 0; i = index->next[i - 1]) {
+        uint32_t block = i - 1;
+        if (index->weak[block] != weak || (block == index->blocks - 1 && index->lastBlock != len)) {
+            continue;
+        }
+        if (!hashed) {
+            strong = Delta_strong(window, len);
+            hashed = 1;
+        }
+        if (index->strong[block] == strong) {
+            return block;
+        }
+    }
+    return -1;
+}
+
+int Delta_encode(struct DeltaIndex* index, int fd, Delta_EmitFn emit, void* ctx, struct DeltaStats* stats) {
+    struct DeltaEncoder enc;
+    enc.index = index;
+    ArrayListBuf_init(&enc.ops);
+    enc.runCount = 0;
+    enc.emit = emit;
+    enc.ctx = ctx;
+    memset(&enc.stats, 0, sizeof(enc.stats));
+    enc.failed = 0;
+
+    uint32_t B = index->blockSize;
+    size_t capacity = DELTA_READ_SIZE > 2*(size_t)B ? DELTA_READ_SIZE : 2*(size_t)B;
+    unsigned char* buf = (unsigned char*)malloc(capacity);
+    size_t filled = 0, pos = 0, literalStart = 0;
+    int eof = 0, rolling = 0, error = 0;
+    uint32_t a = 0, b = 0, expected = 0;
+    while (!enc.failed) {
+        if (filled - pos < B && !eof) {
+            // Window runs off the end of what's been read: keep what's
+            // left and read more after it
+            Delta_literal(&enc, (const char*)buf + literalStart, pos - literalStart);
+            memmove(buf, buf + pos, filled - pos);
+            filled -= pos;
+            pos = 0;
+            literalStart = 0;
+            ssize_t n = Delta_readFull(fd, (char*)buf + filled, capacity - filled);
+            if (n == -1) {
+                error = 1;
+                break;
+            }
+            eof = filled + (size_t)n < capacity;
+            filled += (size_t)n;
+            continue;
+        }
+        size_t avail = filled - pos;
+        if (avail < B) {
+            // The end of the file can only match the receiver's last block
+            if (avail > 0 && index->blocks > 0 && avail == index->lastBlock) {
+                Delta_weak(buf + pos, (uint32_t)avail, &a, &b);
+                long block = Delta_find(index, a | b << 16, buf + pos, (uint32_t)avail, index->blocks - 1);
+                if (block == (long)index->blocks - 1) {
+                    Delta_literal(&enc, (const char*)buf + literalStart, pos - literalStart);
+                    Delta_copy(&enc, (uint32_t)block);
+                    pos += avail;
+                    literalStart = pos;
+                }
+            }
+            break;
+        }
+        if (!rolling) {
+            Delta_weak(buf + pos, B, &a, &b);
+            rolling = 1;
+        }
+        long block = index->blocks > 0 ? Delta_find(index, a | b << 16, buf + pos, B, expected) : -1;
+        if (block >= 0) {
+            Delta_literal(&enc, (const char*)buf + literalStart, pos - literalStart);
+            Delta_copy(&enc, (uint32_t)block);
+            pos += B;
+            literalStart = pos;
+            expected = (uint32_t)block + 1;
+            rolling = 0;
+        }
+        else if (pos + B < filled) {
+            // Slide the window along a byte
+            a = (a - buf[pos] + buf[pos + B]) & 0xffff;
+            b = (b - B*(uint32_t)buf[pos] + a) & 0xffff;
+            pos++;
+        }
+        else {
+            pos++;
+            rolling = 0;
+        }
+    }
+    Delta_literal(&enc, (const char*)buf + literalStart, filled - literalStart);
+    Delta_flushRun(&enc);
+    if (enc.ops.N > 0) {
+        if (!enc.failed && emit(ctx, enc.ops.buff, enc.ops.N) == -1) {
+            enc.failed = 1;
+        }
+        enc.stats.encodedBytes += enc.ops.N;
+    }
+    free(buf);
+    ArrayListBuf_free(&enc.ops);
+    if (stats != NULL) {
+        *stats = enc.stats;
+    }
+    return error || enc.failed ? -1 : 0;
+}
+
+static uint32_t Delta_read32(const char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return ntohl(x);
+}
+
+int Delta_apply(const char* ops, size_t len, int basis, uint32_t blockSize, Delta_EmitFn write, void* ctx) {
+    const char* p = ops;
+    const char* end = ops + len;
+    char* buf = NULL;
+    int res = 0;
+    while (res == 0 && p < end) {
+        if (*p == DELTA_LITERAL && end - p >= DELTA_LITERAL_HEADER) {
+            uint32_t n = Delta_read32(p + 1);
+            p += DELTA_LITERAL_HEADER;
+            if ((size_t)(end - p) < n) {
+                res = -1;
+            }
+            else {
+                res = write(ctx, p, n);
+                p += n;
+            }
+        }
+        else if (*p == DELTA_COPY && end - p >= DELTA_COPY_SIZE) {
+            uint64_t offset = (uint64_t)Delta_read32(p + 1)*blockSize;
+            uint64_t total = (uint64_t)Delta_read32(p + 5)*blockSize;
+            p += DELTA_COPY_SIZE;
+            if (buf == NULL) {
+                buf = (char*)malloc(DELTA_READ_SIZE);
+            }
+            for (uint64_t done = 0; res == 0 && done < total;) {
+                size_t want = total - done < DELTA_READ_SIZE ? (size_t)(total - done) : DELTA_READ_SIZE;
+                ssize_t n = pread(basis, buf, want, (off_t)(offset + done));
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    // Only the basis' last block can be cut short
+                    res = n == 0 && total - done < blockSize && done % blockSize != 0 ? 0 : -1;
+                    break;
+                }
+                res = write(ctx, buf, (size_t)n);
+                done += (uint64_t)n;
+            }
+        }
+        else {
+            res = -1;
+        }
+    }
+    free(buf);
+    return res;
+}
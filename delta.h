@@ -0,0 +1,131 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "arraylist.h"
+
+#define DELTA_MIN_BLOCK 1024 // Smallest block size signatures are taken over
+#define DELTA_MAX_BLOCK (128*1024) // Largest
+#define DELTA_CHUNK (256*1024) // Most bytes of instructions handed over at once by Delta_encode()
+
+/**
+ * rsync's algorithm, for sending a file to a peer that has an older
+ * copy of it.  The receiver splits its copy into blocks and sends a
+ * signature of each (Delta_sign()): a weak checksum that can be rolled
+ * along a byte at a time, and a strong hash to confirm a match.  The
+ * sender slides a window over the new file, looks the weak checksum
+ * up at every offset, and turns the file into instructions
+ * (Delta_encode()): copy these blocks from your copy, or here are some
+ * literal bytes.  The receiver follows them (Delta_apply()) to rebuild
+ * the new file.  Data that moved still matches, since the window
+ * checks every offset, not just block boundaries.
+ *
+ * The strong hash is only 64 bits, so whoever rebuilds the file should
+ * check it against a hash of the whole file (the SHA-256 the file
+ * store uses) before trusting it.
+ *
+ * On the wire, everything is in network byte order.  Signatures are a
+ * struct DeltaSignatureHeader followed by a struct DeltaBlock per
+ * block; instructions are a byte saying which (DeltaOp) followed by
+ *
+ *     DELTA_LITERAL: uint32_t length, then that many bytes
+ *     DELTA_COPY: uint32_t first block, uint32_t number of blocks
+ *
+ * and a chunk of instructions never ends part way through one.
+ */
+struct __attribute__((__packed__)) DeltaSignatureHeader {
+    uint32_t blockSize;
+    uint32_t blocks;
+    uint32_t lastBlock; // Size of the last block, which can be short
+};
+
+struct __attribute__((__packed__)) DeltaBlock {
+    uint32_t weak;
+    uint32_t strongHigh, strongLow;
+};
+
+enum DeltaOp {
+    DELTA_LITERAL = 0,
+    DELTA_COPY = 1
+};
+
+/**
+ * The receiver's signatures, indexed by weak checksum for the sender
+ */
+struct DeltaIndex {
+    uint32_t blockSize;
+    uint32_t blocks;
+    uint32_t lastBlock;
+    uint32_t* weak; // Per block
+    uint64_t* strong; // Per block
+    uint32_t* buckets; // Hash table of weak checksums: 1 + first block with it, or 0
+    uint32_t* next; // 1 + next block in the same bucket, or 0
+    uint32_t mask; // Number of buckets - 1
+};
+
+struct DeltaStats {
+    uint64_t literalBytes; // Bytes of the new file sent as they are
+    uint64_t copiedBytes; // Bytes of the new file found in the receiver's copy
+    uint64_t encodedBytes; // Bytes of instructions (what goes over the wire)
+};
+
+/**
+ * @brief Block size to use for a file, about its square root (as
+ * rsync does), so that signatures and instructions both stay small
+ *
+ * @param size Size of the receiver's copy
+ * @return uint32_t
+ */
+uint32_t Delta_blockSize(uint64_t size);
+
+/**
+ * @brief Take signatures of a file (the receiver's side)
+ *
+ * @param fd File, read from the start
+ * @param blockSize From Delta_blockSize()
+ * @param out Signatures are appended here
+ * @return int 0 on success, -1 if the file couldn't be read
+ */
+int Delta_sign(int fd, uint32_t blockSize, struct ArrayListBuf* out);
+
+/**
+ * @brief Index signatures a peer sent (the sender's side)
+ *
+ * @param signatures Signatures, from Delta_sign()
+ * @param len Their length
+ * @return struct DeltaIndex*, or NULL if they're malformed
+ */
+struct DeltaIndex* DeltaIndex_init(const char* signatures, size_t len);
+void DeltaIndex_free(struct DeltaIndex* index);
+
+typedef int (*Delta_EmitFn)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Turn a file into instructions for rebuilding it from the
+ * copy the signatures were taken of (the sender's side).  The
+ * instructions come out in chunks of at most about DELTA_CHUNK bytes
+ *
+ * @param index The peer's signatures (may have no blocks, in which case everything is literal)
+ * @param fd File to send, read from the start
+ * @param emit Called with each chunk of instructions; stops encoding if it returns -1
+ * @param ctx Passed to emit
+ * @param stats Filled in, if not NULL
+ * @return int 0 on success, -1 if the file couldn't be read or emit failed
+ */
+int Delta_encode(struct DeltaIndex* index, int fd, Delta_EmitFn emit, void* ctx, struct DeltaStats* stats);
+
+/**
+ * @brief Follow a chunk of instructions (the receiver's side)
+ *
+ * @param ops Instructions
+ * @param len Their length
+ * @param basis The receiver's copy of the file
+ * @param blockSize Block size its signatures were taken with
+ * @param write Called with each piece of the new file, in order; stops if it returns -1
+ * @param ctx Passed to write
+ * @return int 0 on success, -1 if the instructions are malformed or refer past the end of basis
+ */
+int Delta_apply(const char* ops, size_t len, int basis, uint32_t blockSize, Delta_EmitFn write, void* ctx);
+
+#endif
@@ -0,0 +1,216 @@
+// Purpose: Measure what a delta transfer sends, and how long each side
+// takes, for a big file of which a small part changed, against sending
+// the whole file again
+//
+// Usage: ./deltabench [file size in MB] [percent changed] [directory]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "delta.h"
+
+#define DEFAULT_MB 1024
+#define DEFAULT_PERCENT 1.0
+#define EDITS 200 // Places the file is changed in
+#define CHUNK (4*1024*1024)
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+uint64_t rng = 88172645463325252ull;
+
+uint64_t xorshift() {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+void fillRandom(char* buf, size_t len) {
+    for (size_t i = 0; i + 8 <= len; i += 8) {
+        uint64_t x = xorshift();
+        memcpy(buf + i, &x, 8);
+    }
+}
+
+int writeAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Edits are made as the file is written: at each, some bytes are
+ * overwritten, and every other one also puts a few bytes in or takes
+ * a few out, so that everything after it moves
+ */
+struct Edit {
+    uint64_t at;
+    uint32_t overwrite;
+    int shift; // Bytes put in (positive) or taken out (negative)
+};
+
+int compareEdits(const void* a, const void* b) {
+    uint64_t x = ((const struct Edit*)a)->at, y = ((const struct Edit*)b)->at;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Write the old file, and the new one with the edits made to it
+ */
+int makeFiles(const char* oldPath, const char* newPath, uint64_t size, double percent) {
+    struct Edit edits[EDITS];
+    uint32_t perEdit = (uint32_t)(size*percent/100/EDITS);
+    for (int i = 0; i < EDITS; i++) {
+        edits[i].at = xorshift() % (size - perEdit - 64);
+        edits[i].overwrite = perEdit;
+        edits[i].shift = i % 2 == 0 ? 0 : (i % 4 == 1 ? 17 : -23);
+    }
+    qsort(edits, EDITS, sizeof(struct Edit), compareEdits);
+    int oldFd = open(oldPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int newFd = open(newPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char* buf = (char*)malloc(CHUNK);
+    char junk[64];
+    int e = 0, res = 0;
+    for (uint64_t off = 0; res == 0 && off < size; off += CHUNK) {
+        size_t len = size - off < CHUNK ? (size_t)(size - off) : CHUNK;
+        fillRandom(buf, len);
+        res = writeAll(oldFd, buf, len);
+        // The new file is the same, apart from edits starting in this chunk
+        size_t from = 0;
+        for (; res == 0 && e < EDITS && edits[e].at < off + len; e++) {
+            size_t at = (size_t)(edits[e].at - off);
+            if (at < from) {
+                continue; // Overlaps the last edit
+            }
+            res = writeAll(newFd, buf + from, at - from);
+            fillRandom(junk, sizeof(junk));
+            size_t overwrite = edits[e].overwrite < len - at ? edits[e].overwrite : len - at;
+            for (size_t i = 0; i < overwrite; i++) {
+                buf[at + i] ^= junk[i % sizeof(junk)] | 1;
+            }
+            from = at;
+            if (edits[e].shift > 0) {
+                res = writeAll(newFd, junk, (size_t)edits[e].shift);
+            }
+            else if ((size_t)-edits[e].shift < len - at) {
+                from = at - edits[e].shift;
+            }
+        }
+        if (res == 0) {
+            res = writeAll(newFd, buf + from, len - from);
+        }
+    }
+    free(buf);
+    close(oldFd);
+    close(newFd);
+    return res;
+}
+
+int keep(void* ctx, const char* data, size_t len) {
+    ArrayListBuf_push((struct ArrayListBuf*)ctx, data, len);
+    return 0;
+}
+
+int writeOut(void* ctx, const char* data, size_t len) {
+    return writeAll(*(int*)ctx, data, len);
+}
+
+/**
+ * @brief Whether two files have the same contents
+ */
+int sameFiles(const char* a, const char* b) {
+    int fa = open(a, O_RDONLY), fb = open(b, O_RDONLY);
+    char* x = (char*)malloc(CHUNK);
+    char* y = (char*)malloc(CHUNK);
+    int same = fa != -1 && fb != -1;
+    while (same) {
+        ssize_t n = read(fa, x, CHUNK), m = read(fb, y, CHUNK);
+        same = n == m && n >= 0 && memcmp(x, y, (size_t)n) == 0;
+        if (n <= 0) {
+            break;
+        }
+    }
+    free(x);
+    free(y);
+    close(fa);
+    close(fb);
+    return same;
+}
+
+int main(int argc, char** argv) {
+    uint64_t mb = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_MB;
+    double percent = argc > 2 ? atof(argv[2]) : DEFAULT_PERCENT;
+    const char* dir = argc > 3 ? argv[3] : "/tmp";
+    uint64_t size = mb*1024*1024;
+    char oldPath[4096], newPath[4096], rebuiltPath[4096];
+    snprintf(oldPath, sizeof(oldPath), "%s/deltabench.old", dir);
+    snprintf(newPath, sizeof(newPath), "%s/deltabench.new", dir);
+    snprintf(rebuiltPath, sizeof(rebuiltPath), "%s/deltabench.rebuilt", dir);
+    printf("%llu MB file, %.2f%% of it changed in %d places (half of them moving what follows)\n",
+        (unsigned long long)mb, percent, EDITS);
+    if (makeFiles(oldPath, newPath, size, percent) == -1) {
+        printf("couldn't write the files in %s\n", dir);
+        return 1;
+    }
+
+    // Receiver: signatures of its old copy
+    double start = now();
+    int oldFd = open(oldPath, O_RDONLY);
+    uint32_t blockSize = Delta_blockSize(size);
+    struct ArrayListBuf signatures;
+    ArrayListBuf_init(&signatures);
+    Delta_sign(oldFd, blockSize, &signatures);
+    double signTime = now() - start;
+
+    // Sender: instructions
+    start = now();
+    struct DeltaIndex* index = DeltaIndex_init(signatures.buff, signatures.N);
+    int newFd = open(newPath, O_RDONLY);
+    struct ArrayListBuf ops;
+    ArrayListBuf_init(&ops);
+    struct DeltaStats stats;
+    Delta_encode(index, newFd, keep, &ops, &stats);
+    double encodeTime = now() - start;
+    close(newFd);
+
+    // Receiver: the new file, rebuilt
+    start = now();
+    int rebuiltFd = open(rebuiltPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int applied = Delta_apply(ops.buff, ops.N, oldFd, blockSize, writeOut, &rebuiltFd);
+    close(rebuiltFd);
+    double applyTime = now() - start;
+    close(oldFd);
+
+    int same = applied == 0 && sameFiles(newPath, rebuiltPath);
+    uint64_t newSize = stats.literalBytes + stats.copiedBytes;
+    uint64_t sent = signatures.N + ops.N;
+    printf("%-24s %u bytes\n", "block size", blockSize);
+    printf("%-24s %10.2f MB   %8.3f s  (receiver)\n", "signatures", signatures.N/1048576.0, signTime);
+    printf("%-24s %10.2f MB   %8.3f s  (sender; %.2f MB literal, %.2f MB copied)\n", "instructions", ops.N/1048576.0, encodeTime,
+        stats.literalBytes/1048576.0, stats.copiedBytes/1048576.0);
+    printf("%-24s %10s      %8.3f s  (receiver)\n", "rebuild", "", applyTime);
+    printf("%-24s %10.2f MB   %.2f%% of sending it whole (%.2f MB)\n", "transferred", sent/1048576.0, 100.0*sent/newSize, newSize/1048576.0);
+    printf("rebuilt file %s\n", same ? "matches" : "DOES NOT MATCH");
+
+    DeltaIndex_free(index);
+    ArrayListBuf_free(&signatures);
+    ArrayListBuf_free(&ops);
+    unlink(oldPath);
+    unlink(newPath);
+    unlink(rebuiltPath);
+    return same ? 0 : 1;
+}
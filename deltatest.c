@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "delta.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+/**
+ * @brief An open file holding some bytes, positioned at the start
+ */
+int fileOf(const char* data, size_t len) {
+    FILE* f = tmpfile();
+    if (len > 0 && fwrite(data, 1, len, f) != len) {
+        return -1;
+    }
+    fflush(f);
+    int fd = dup(fileno(f));
+    fclose(f);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+int append(void* ctx, const char* data, size_t len) {
+    ArrayListBuf_push((struct ArrayListBuf*)ctx, data, len);
+    return 0;
+}
+
+/**
+ * @brief Send a file to a peer that has basis, and check that it comes out right
+ *
+ * @return int Whether it did
+ */
+int roundTrip(const char* basis, size_t basisLen, const char* data, size_t len, struct DeltaStats* stats) {
+    struct ArrayListBuf signatures, ops, rebuilt;
+    ArrayListBuf_init(&signatures);
+    ArrayListBuf_init(&ops);
+    ArrayListBuf_init(&rebuilt);
+    int basisFd = fileOf(basis, basisLen), fd = fileOf(data, len);
+    uint32_t blockSize = Delta_blockSize(basisLen);
+    Delta_sign(basisFd, blockSize, &signatures);
+    struct DeltaIndex* index = DeltaIndex_init(signatures.buff, signatures.N);
+    int ok = index != NULL && Delta_encode(index, fd, append, &ops, stats) == 0
+        && Delta_apply(ops.buff, ops.N, basisFd, blockSize, append, &rebuilt) == 0
+        && rebuilt.N == len && memcmp(rebuilt.buff, data, len) == 0 && stats->encodedBytes == ops.N;
+    if (index != NULL) {
+        DeltaIndex_free(index);
+    }
+    close(basisFd);
+    close(fd);
+    ArrayListBuf_free(&signatures);
+    ArrayListBuf_free(&ops);
+    ArrayListBuf_free(&rebuilt);
+    return ok;
+}
+
+int main() {
+    check(Delta_blockSize(0) == DELTA_MIN_BLOCK && Delta_blockSize(1 << 30) == 32768 && Delta_blockSize(1ull << 40) == DELTA_MAX_BLOCK,
+        "blocks are about the square root of the file");
+
+    size_t N = 3000000;
+    char* old = (char*)malloc(N);
+    char* data = (char*)malloc(N + 10000);
+    srand(7);
+    for (size_t i = 0; i < N; i++) {
+        old[i] = (char)rand();
+    }
+    struct DeltaStats stats;
+    check(roundTrip(old, N, old, N, &stats) && stats.literalBytes == 0 && stats.copiedBytes == N && stats.encodedBytes < 100,
+        "an unchanged file is all copies");
+
+    memcpy(data, old, N);
+    data[N/2] ^= 1;
+    uint32_t blockSize = Delta_blockSize(N);
+    check(roundTrip(old, N, data, N, &stats) && stats.literalBytes == blockSize, "a changed byte costs a block");
+
+    // Bytes put in or taken out shift everything after them
+    memcpy(data, old, 1000);
+    memcpy(data + 1000, "inserted", 8);
+    memcpy(data + 1008, old + 1000, N - 1000);
+    check(roundTrip(old, N, data, N + 8, &stats) && stats.literalBytes < 2*blockSize, "an insertion doesn't resend what follows it");
+    memcpy(data, old, 5000);
+    memcpy(data + 5000, old + 5100, N - 5100);
+    check(roundTrip(old, N, data, N - 100, &stats) && stats.literalBytes < 2*blockSize, "nor does a deletion");
+
+    // Reordered blocks, growing, shrinking
+    memcpy(data, old + N/2, N - N/2);
+    memcpy(data + (N - N/2), old, N/2);
+    check(roundTrip(old, N, data, N, &stats) && stats.literalBytes < 2*blockSize, "moved data is found");
+    memcpy(data, old, N);
+    memcpy(data + N, "appended", 8);
+    check(roundTrip(old, N, data, N + 8, &stats) && stats.literalBytes < blockSize + 8, "appending");
+    check(roundTrip(old, N, old, N - 12345, &stats) && stats.literalBytes < blockSize, "truncating");
+    check(roundTrip(old, 777, old, 777, &stats) && stats.literalBytes == 0, "a file smaller than a block");
+
+    // Nothing in common
+    for (size_t i = 0; i < N; i++) {
+        data[i] = (char)rand();
+    }
+    check(roundTrip(old, N, data, N, &stats) && stats.copiedBytes == 0 && stats.literalBytes == N, "a different file is all literals");
+    check(roundTrip(old, 0, data, N, &stats) && stats.literalBytes == N, "an empty copy");
+    check(roundTrip(old, N, data, 0, &stats) && stats.encodedBytes == 0, "an empty file");
+
+    // Damage
+    struct ArrayListBuf signatures;
+    ArrayListBuf_init(&signatures);
+    int fd = fileOf(old, N);
+    Delta_sign(fd, blockSize, &signatures);
+    check(DeltaIndex_init(signatures.buff, signatures.N - 1) == NULL && DeltaIndex_init(signatures.buff, 5) == NULL, "bad signatures are refused");
+    char ops[9] = {DELTA_COPY, 0, 0, 0x10, 0, 0, 0, 0, 1}; // Block 4096, past the end
+    struct ArrayListBuf out;
+    ArrayListBuf_init(&out);
+    check(Delta_apply(ops, sizeof(ops), fd, blockSize, append, &out) == -1, "copying past the end is refused");
+    char literal[5] = {DELTA_LITERAL, 0, 0, 1, 0}; // 256 bytes that aren't there
+    check(Delta_apply(literal, sizeof(literal), fd, blockSize, append, &out) == -1, "so is a literal cut short");
+    close(fd);
+    ArrayListBuf_free(&signatures);
+    ArrayListBuf_free(&out);
+
+    free(old);
+    free(data);
+    return failures;
+}
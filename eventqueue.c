@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include "eventqueue.h"
+
+struct EventQueue* EventQueue_init() {
+    struct EventQueue* queue = (struct EventQueue*)malloc(sizeof(struct EventQueue));
+    atomic_store(&queue->stub.next, NULL);
+    atomic_store(&queue->head, &queue->stub);
+    queue->tail = &queue->stub;
+    atomic_store(&queue->sleeping, 0);
+    if (pipe(queue->wakeFds) == 0) {
+        // Neither end may ever block: a full pipe already means a wakeup is pending
+        fcntl(queue->wakeFds[0], F_SETFL, O_NONBLOCK);
+        fcntl(queue->wakeFds[1], F_SETFL, O_NONBLOCK);
+    }
+    return queue;
+}
+
+void EventQueue_free(struct EventQueue* queue) {
+    struct Event* event;
+    while ((event = EventQueue_pop(queue)) != NULL) {
+        free(event);
+    }
+    close(queue->wakeFds[0]);
+    close(queue->wakeFds[1]);
+    free(queue);
+}
+
+struct Event* Event_init(int type, struct Chat* chat) {
+    struct Event* event = (struct Event*)calloc(1, sizeof(struct Event));
+    event->type = type;
+    event->chat = chat;
+    return event;
+}
+
+/**
+ * @brief Link an event onto the head of the list.  A single atomic
+ * exchange claims the slot; the previous head is then pointed at
+ * the new event
+ */
+static void EventQueue_link(struct EventQueue* queue, struct Event* event) {
+    atomic_store(&event->next, NULL);
+    struct Event* prev = atomic_exchange(&queue->head, event);
+    atomic_store(&prev->next, event);
+}
+
+/**
+ * @brief Write a byte down the self-pipe.  It stays there until the
+ * consumer next waits, so a wakeup can't be lost
+ */
+static void EventQueue_signal(struct EventQueue* queue) {
+    char wake = 1;
+    if (write(queue->wakeFds[1], &wake, 1) < 0) {
+        // Pipe is full, so the consumer is going to wake up anyway
+    }
+}
+
+void EventQueue_push(struct EventQueue* queue, struct Event* event) {
+    EventQueue_link(queue, event);
+    if (atomic_exchange(&queue->sleeping, 0)) {
+        EventQueue_signal(queue);
+    }
+}
+
+void EventQueue_wake(struct EventQueue* queue) {
+    // The consumer can't check for whatever changed before it goes to
+    // sleep the way it checks for events, so always leave a byte behind
+    EventQueue_signal(queue);
+}
+
+struct Event* EventQueue_pop(struct EventQueue* queue) {
+    struct Event* tail = queue->tail;
+    struct Event* next = atomic_load(&tail->next);
+    if (tail == &queue->stub) {
+        // Skip over the stub
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = atomic_load(&tail->next);
+    }
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load(&queue->head)) {
+        // A producer has claimed the head but hasn't linked it in yet
+        return NULL;
+    }
+    // tail is the last event; put the stub back behind it so it can be handed out
+    EventQueue_link(queue, &queue->stub);
+    next = atomic_load(&tail->next);
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Whether there's definitely nothing to pop (consumer thread only)
+ */
+static int EventQueue_isEmpty(struct EventQueue* queue) {
+    return queue->tail == &queue->stub && atomic_load(&queue->head) == &queue->stub;
+}
+
+int EventQueue_wait(struct EventQueue* queue, int fd, int timeoutMs) {
+    struct pollfd pfds[2];
+    pfds[0].fd = queue->wakeFds[0];
+    pfds[0].events = POLLIN;
+    pfds[1].fd = fd; // poll() ignores negative descriptors
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+    int ready = 0;
+    // Announce that we're about to sleep before the final check, so that
+    // any push that the check misses is guaranteed to write to the pipe
+    atomic_store(&queue->sleeping, 1);
+    if (EventQueue_isEmpty(queue)) {
+        if (poll(pfds, 2, timeoutMs) == -1 && errno == EINTR) {
+            ready = 1;
+        }
+    }
+    else if (fd >= 0) {
+        // Don't sleep, but still say whether fd has anything
+        poll(pfds + 1, 1, 0);
+    }
+    atomic_store(&queue->sleeping, 0);
+    char drain[64];
+    while (read(queue->wakeFds[0], drain, sizeof(drain)) > 0);
+    return ready || (pfds[1].revents & (POLLIN | POLLHUP)) != 0;
+}
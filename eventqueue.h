@@ -0,0 +1,105 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct Chat;
+struct Message;
+
+enum EventType {
+    EVENT_CHAT_OPENED = 0,
+    EVENT_MESSAGE_ARRIVED = 1,
+    EVENT_MESSAGE_DELETED = 2,
+    EVENT_NAME_CHANGED = 3,
+    EVENT_TRANSFER_PROGRESS = 4,
+    EVENT_CHAT_CLOSED = 5,
+    EVENT_COMPACT = 6, // A chat's timeline has enough tombstones to be compacted (not from the network)
+    EVENT_FILE_QUERIED = 7, // The peer offered a file I already had, so it won't be sent (the answer has gone out already)
+    EVENT_FILE_ANSWERED = 8, // The peer answered whether it has a file I offered
+    EVENT_SIGNATURES_ARRIVED = 9, // The peer sent signatures of its older copy of a file I offered
+    EVENT_HISTORY_LOADED = 10 // Some of a chat's history has been loaded from disk (not from the network)
+};
+
+/**
+ * Something that happened on a network thread that the UI needs to
+ * apply.  Ownership of the event (and of message/name) passes to the
+ * queue on EventQueue_push(), and then to whoever pops it.
+ * Events from any one producer come out in the order they went in.
+ */
+struct Event {
+    struct Event* _Atomic next; // Link used by the queue
+    int type;
+    struct Chat* chat; // Chat the event happened on
+    struct Message* message; // EVENT_MESSAGE_ARRIVED
+    char* name; // EVENT_NAME_CHANGED (dynamically allocated)
+    uint16_t id; // EVENT_MESSAGE_DELETED; the FILE_ANSWER (1 had it, 0 didn't, 2 has an older copy) for EVENT_FILE_ANSWERED
+    uint64_t done, total; // EVENT_TRANSFER_PROGRESS: bytes so far and in all (EVENT_FILE_QUERIED: the file's length, in both)
+    char* data; // EVENT_SIGNATURES_ARRIVED; the uint64_t references for EVENT_HISTORY_LOADED (dynamically allocated)
+    size_t len; // Length of data (EVENT_HISTORY_LOADED: number of references)
+    uint32_t number; // EVENT_HISTORY_LOADED: number of the chat, which may have closed (chat is NULL)
+};
+
+/**
+ * Lock-free multi-producer single-consumer queue (Vyukov's intrusive
+ * design).  Any number of threads may push without ever blocking; a
+ * single consumer pops, and can sleep until something is pushed.
+ */
+struct EventQueue {
+    struct Event* _Atomic head; // Most recently pushed event (producers)
+    struct Event* tail; // Next event to pop (consumer only)
+    struct Event stub; // Keeps the list non-empty
+    atomic_int sleeping; // Whether the consumer needs to be woken up
+    int wakeFds[2]; // Self-pipe for waking the consumer
+};
+
+struct EventQueue* EventQueue_init();
+void EventQueue_free(struct EventQueue* queue);
+
+/**
+ * @brief Allocate a zeroed event of some type
+ *
+ * @param type EventType
+ * @param chat Chat the event happened on
+ * @return struct Event*
+ */
+struct Event* Event_init(int type, struct Chat* chat);
+
+/**
+ * @brief Add an event to the queue, waking up the consumer if it's
+ * waiting.  Safe to call from any thread; never blocks
+ *
+ * @param queue
+ * @param event
+ */
+void EventQueue_push(struct EventQueue* queue, struct Event* event);
+
+/**
+ * @brief Wake the consumer up if it's waiting, without giving it an
+ * event (e.g. because some other state it watches has changed).
+ * Safe to call from any thread; never blocks
+ *
+ * @param queue
+ */
+void EventQueue_wake(struct EventQueue* queue);
+
+/**
+ * @brief Take the oldest event off the queue (consumer thread only)
+ *
+ * @param queue
+ * @return struct Event* Event, or NULL if there's nothing (yet)
+ */
+struct Event* EventQueue_pop(struct EventQueue* queue);
+
+/**
+ * @brief Sleep until there's something to pop, some other file
+ * descriptor is readable, or the timeout passes (consumer thread only)
+ *
+ * @param queue
+ * @param fd File descriptor to watch as well (e.g. the terminal), or -1
+ * @param timeoutMs Milliseconds to wait, or -1 to wait indefinitely
+ * @return int 1 if fd is readable or the wait was interrupted by a signal, otherwise 0
+ */
+int EventQueue_wait(struct EventQueue* queue, int fd, int timeoutMs);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "eventqueue.h"
+
+#define PRODUCERS 8
+#define EVENTS_PER_PRODUCER 200000
+
+struct EventQueue* queue;
+
+void* produce(void* args) {
+    long producer = (long)args;
+    for (uint64_t i = 0; i < EVENTS_PER_PRODUCER; i++) {
+        struct Event* event = Event_init(EVENT_TRANSFER_PROGRESS, NULL);
+        event->id = (uint16_t)producer;
+        event->done = i;
+        EventQueue_push(queue, event);
+    }
+    return NULL;
+}
+
+int main() {
+    queue = EventQueue_init();
+    pthread_t threads[PRODUCERS];
+    for (long i = 0; i < PRODUCERS; i++) {
+        pthread_create(&threads[i], NULL, produce, (void*)i);
+    }
+
+    // Every producer's events have to come out complete and in order
+    uint64_t next[PRODUCERS] = {0};
+    long received = 0, outOfOrder = 0;
+    while (received < PRODUCERS*EVENTS_PER_PRODUCER) {
+        EventQueue_wait(queue, -1, 1000);
+        struct Event* event;
+        while ((event = EventQueue_pop(queue)) != NULL) {
+            if (event->done != next[event->id]) {
+                outOfOrder++;
+            }
+            next[event->id] = event->done + 1;
+            received++;
+            free(event);
+        }
+    }
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int empty = EventQueue_pop(queue) == NULL;
+
+    // Waiting on another descriptor as well, as the GUI does with the terminal
+    int fds[2];
+    int watched = pipe(fds) == 0;
+    watched = watched && EventQueue_wait(queue, fds[0], 10) == 0;
+    watched = watched && write(fds[1], "k", 1) == 1 && EventQueue_wait(queue, fds[0], 1000) == 1;
+    close(fds[0]);
+    close(fds[1]);
+    EventQueue_free(queue);
+
+    printf("%ld events received, %ld out of order, queue %s, %s\n", received, outOfOrder,
+        empty ? "empty" : "NOT EMPTY", watched ? "other descriptor watched" : "OTHER DESCRIPTOR MISSED");
+    return (outOfOrder == 0 && empty && watched) ? 0 : 1;
+}
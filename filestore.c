@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "filestore.h"
+
+#define FILESTORE_CHUNK (64*1024) // Bytes read at a time when hashing or copying
+
+static const uint32_t Sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t Sha256_rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void Sha256_block(struct Sha256* sha, const uint8_t* p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 | (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = Sha256_rotr(w[i-15], 7) ^ Sha256_rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = Sha256_rotr(w[i-2], 17) ^ Sha256_rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+    uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+    uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (Sha256_rotr(e, 6) ^ Sha256_rotr(e, 11) ^ Sha256_rotr(e, 25)) + ((e & f) ^ (~e & g)) + Sha256_k[i] + w[i];
+        uint32_t t2 = (Sha256_rotr(a, 2) ^ Sha256_rotr(a, 13) ^ Sha256_rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    sha->state[0] += a;
+    sha->state[1] += b;
+    sha->state[2] += c;
+    sha->state[3] += d;
+    sha->state[4] += e;
+    sha->state[5] += f;
+    sha->state[6] += g;
+    sha->state[7] += h;
+}
+
+void Sha256_init(struct Sha256* sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used = 0;
+}
+
+void Sha256_update(struct Sha256* sha, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    sha->length += len;
+    if (sha->used > 0) {
+        size_t take = 64 - sha->used < len ? 64 - sha->used : len;
+        memcpy(sha->block + sha->used, p, take);
+        sha->used += take;
+        p += take;
+        len -= take;
+        if (sha->used < 64) {
+            return;
+        }
+        Sha256_block(sha, sha->block);
+        sha->used = 0;
+    }
+    // Whole blocks straight from the caller's buffer
+    for (; len >= 64; p += 64, len -= 64) {
+        Sha256_block(sha, p);
+    }
+    memcpy(sha->block, p, len);
+    sha->used = len;
+}
+
+void Sha256_final(struct Sha256* sha, uint8_t hash[FILESTORE_HASH_SIZE]) {
+    uint64_t bits = sha->length*8;
+    uint8_t pad[72] = {0x80};
+    size_t padLen = (sha->used < 56 ? 56 : 120) - sha->used;
+    for (int i = 0; i < 8; i++) {
+        pad[padLen + i] = (uint8_t)(bits >> (56 - 8*i));
+    }
+    Sha256_update(sha, pad, padLen + 8);
+    for (int i = 0; i < 8; i++) {
+        hash[4*i] = (uint8_t)(sha->state[i] >> 24);
+        hash[4*i+1] = (uint8_t)(sha->state[i] >> 16);
+        hash[4*i+2] = (uint8_t)(sha->state[i] >> 8);
+        hash[4*i+3] = (uint8_t)sha->state[i];
+    }
+}
+
+/**
+ * @brief mkdir -p
+ */
+static int FileStore_mkdirs(const char* dir) {
+    char* path = strdup(dir);
+    int res = 0;
+    for (char* p = path + 1; res == 0; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+                res = -1;
+            }
+            *p = c;
+            if (c == '\0') {
+                break;
+            }
+        }
+    }
+    free(path);
+    return res;
+}
+
+static int FileStore_writeAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Where an object lives, and the directory it goes in (the
+ * first two hex digits of its hash) if dir isn't NULL
+ */
+static char* FileStore_objectPath(struct FileStore* store, const uint8_t hash[FILESTORE_HASH_SIZE], char** dir) {
+    char hex[FILESTORE_HEX_SIZE];
+    FileStore_hex(hash, hex);
+    char* path = (char*)malloc(strlen(store->dir) + FILESTORE_HEX_SIZE + 20);
+    sprintf(path, "%s/objects/%.2s", store->dir, hex);
+    if (dir != NULL) {
+        *dir = strdup(path);
+    }
+    sprintf(path + strlen(path), "/%s", hex + 2);
+    return path;
+}
+
+struct FileStore* FileStore_init(const char* dir) {
+    char* incoming = (char*)malloc(strlen(dir) + 20);
+    sprintf(incoming, "%s/incoming", dir);
+    int res = FileStore_mkdirs(incoming);
+    if (res == 0) {
+        sprintf(incoming, "%s/objects", dir);
+        res = FileStore_mkdirs(incoming);
+    }
+    free(incoming);
+    if (res == -1) {
+        return NULL;
+    }
+    struct FileStore* store = (struct FileStore*)malloc(sizeof(struct FileStore));
+    store->dir = strdup(dir);
+    return store;
+}
+
+void FileStore_free(struct FileStore* store) {
+    free(store->dir);
+    free(store);
+}
+
+void FileStore_hex(const uint8_t hash[FILESTORE_HASH_SIZE], char* hex) {
+    for (int i = 0; i < FILESTORE_HASH_SIZE; i++) {
+        sprintf(hex + 2*i, "%02x", hash[i]);
+    }
+}
+
+int FileStore_hashFile(const char* path, uint8_t hash[FILESTORE_HASH_SIZE]) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    struct Sha256 sha;
+    Sha256_init(&sha);
+    char* buf = (char*)malloc(FILESTORE_CHUNK);
+    ssize_t n;
+    while ((n = read(fd, buf, FILESTORE_CHUNK)) != 0) {
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            break;
+        }
+        Sha256_update(&sha, buf, (size_t)n);
+    }
+    free(buf);
+    close(fd);
+    Sha256_final(&sha, hash);
+    return n == 0 ? 0 : -1;
+}
+
+int FileStore_has(struct FileStore* store, const uint8_t hash[FILESTORE_HASH_SIZE], uint64_t size) {
+    char* path = FileStore_objectPath(store, hash, NULL);
+    struct stat st;
+    int has = stat(path, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size == size;
+    free(path);
+    return has;
+}
+
+/**
+ * @brief Copy one open file into another, for when neither kind of link can be made
+ */
+static int FileStore_copy(int from, int to) {
+    char* buf = (char*)malloc(FILESTORE_CHUNK);
+    ssize_t n;
+    int res = 0;
+    while (res == 0 && (n = read(from, buf, FILESTORE_CHUNK)) != 0) {
+        if (n == -1) {
+            res = errno == EINTR ? 0 : -1;
+        }
+        else {
+            res = FileStore_writeAll(to, buf, (size_t)n);
+        }
+    }
+    free(buf);
+    return res;
+}
+
+int FileStore_link(struct FileStore* store, const uint8_t hash[FILESTORE_HASH_SIZE], const char* path) {
+    char* object = FileStore_objectPath(store, hash, NULL);
+    int res = -1;
+    int from = open(object, O_RDONLY);
+    if (from != -1) {
+        unlink(path);
+        int to = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (to != -1) {
+#ifdef FICLONE
+            // A reflink shares the blocks but is a file of its own
+            res = ioctl(to, FICLONE, from);
+#endif
+            if (res == -1) {
+                close(to);
+                to = -1;
+                unlink(path);
+                res = link(object, path);
+            }
+            if (res == -1) {
+                to = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                res = to == -1 ? -1 : FileStore_copy(from, to);
+            }
+            if (to != -1) {
+                close(to);
+            }
+        }
+        close(from);
+    }
+    free(object);
+    return res;
+}
+
+int FileStore_begin(struct FileStore* store, struct FileStoreWriter* writer) {
+    writer->store = store;
+    writer->tmpPath = (char*)malloc(strlen(store->dir) + 30);
+    sprintf(writer->tmpPath, "%s/incoming/XXXXXX", store->dir);
+    writer->fd = mkstemp(writer->tmpPath);
+    if (writer->fd == -1) {
+        free(writer->tmpPath);
+        return -1;
+    }
+    Sha256_init(&writer->sha);
+    return 0;
+}
+
+int FileStore_write(struct FileStoreWriter* writer, const char* data, size_t len) {
+    Sha256_update(&writer->sha, data, len);
+    return FileStore_writeAll(writer->fd, data, len);
+}
+
+int FileStore_commit(struct FileStoreWriter* writer, uint8_t hash[FILESTORE_HASH_SIZE]) {
+    Sha256_final(&writer->sha, hash);
+    char* dir;
+    char* object = FileStore_objectPath(writer->store, hash, &dir);
+    int res = -1;
+    if (access(object, F_OK) == 0) {
+        res = 0; // A duplicate
+    }
+    else if ((mkdir(dir, 0700) == 0 || errno == EEXIST) && fchmod(writer->fd, 0444) == 0 && rename(writer->tmpPath, object) == 0) {
+        res = 1;
+    }
+    close(writer->fd);
+    if (res != 1) {
+        unlink(writer->tmpPath);
+    }
+    free(writer->tmpPath);
+    free(object);
+    free(dir);
+    return res;
+}
+
+void FileStore_abort(struct FileStoreWriter* writer) {
+    close(writer->fd);
+    unlink(writer->tmpPath);
+    free(writer->tmpPath);
+}
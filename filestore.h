@@ -0,0 +1,132 @@
+#ifndef FILESTORE_H
+#define FILESTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILESTORE_HASH_SIZE 32 // SHA-256
+#define FILESTORE_HEX_SIZE (2*FILESTORE_HASH_SIZE + 1)
+
+/**
+ * SHA-256, fed a piece at a time so that a file can be hashed as it
+ * streams past
+ */
+struct Sha256 {
+    uint32_t state[8];
+    uint64_t length; // Bytes hashed so far
+    uint8_t block[64]; // Partial block
+    size_t used; // Bytes in block
+};
+
+void Sha256_init(struct Sha256* sha);
+void Sha256_update(struct Sha256* sha, const void* data, size_t len);
+void Sha256_final(struct Sha256* sha, uint8_t hash[FILESTORE_HASH_SIZE]);
+
+/**
+ * Received files, kept once each by content.  Every file lives at
+ * objects/xx/<rest of its SHA-256 in hex> under the store's directory;
+ * the name a peer asked for is only ever a link to it (a reflink where
+ * the filesystem can make one, otherwise a hard link, otherwise a
+ * copy), so receiving the same file again costs no more space.  Objects
+ * are read only, so that a hard linked file can't be edited in place
+ * and change what the store hands out next time.
+ *
+ * Files come in through a FileStoreWriter, which hashes them as they're
+ * written to a temporary file under incoming/ and renames them into
+ * place at the end.  Renames are atomic, so any number of threads can
+ * write to the store at once.
+ */
+struct FileStore {
+    char* dir;
+};
+
+struct FileStoreWriter {
+    struct FileStore* store;
+    int fd; // Temporary file
+    char* tmpPath;
+    struct Sha256 sha;
+};
+
+/**
+ * @brief Keep files under a directory (created if need be)
+ *
+ * @param dir Directory
+ * @return struct FileStore*, or NULL if the directory can't be created
+ */
+struct FileStore* FileStore_init(const char* dir);
+void FileStore_free(struct FileStore* store);
+
+/**
+ * @brief Write a hash in hex
+ *
+ * @param hash Hash
+ * @param hex Where to write it (FILESTORE_HEX_SIZE bytes, null terminated)
+ */
+void FileStore_hex(const uint8_t hash[FILESTORE_HASH_SIZE], char* hex);
+
+/**
+ * @brief Hash a file, reading it from start to end
+ *
+ * @param path File
+ * @param hash Where to put the hash
+ * @return int 0 on success, -1 if the file couldn't be read
+ */
+int FileStore_hashFile(const char* path, uint8_t hash[FILESTORE_HASH_SIZE]);
+
+/**
+ * @brief Whether the store has a file
+ *
+ * @param store
+ * @param hash The file's hash
+ * @param size The file's size, which has to match as well
+ * @return int 1 if it does, 0 if it doesn't
+ */
+int FileStore_has(struct FileStore* store, const uint8_t hash[FILESTORE_HASH_SIZE], uint64_t size);
+
+/**
+ * @brief Put a file from the store at a path, replacing whatever is there
+ *
+ * @param store
+ * @param hash The file's hash
+ * @param path Where it should appear
+ * @return int 0 on success, -1 on failure
+ */
+int FileStore_link(struct FileStore* store, const uint8_t hash[FILESTORE_HASH_SIZE], const char* path);
+
+/**
+ * @brief Start adding a file to the store
+ *
+ * @param store
+ * @param writer Set up here
+ * @return int 0 on success, -1 if the temporary file couldn't be made
+ */
+int FileStore_begin(struct FileStore* store, struct FileStoreWriter* writer);
+
+/**
+ * @brief Write the next piece of a file being added
+ *
+ * @param writer
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return int 0 on success, -1 on a write error
+ */
+int FileStore_write(struct FileStoreWriter* writer, const char* data, size_t len);
+
+/**
+ * @brief Finish adding a file.  If the store had it already, the copy
+ * just written is thrown away
+ *
+ * @param writer
+ * @param hash Where to put the file's hash
+ * @return int 1 if the file was new, 0 if the store had it already, -1 on failure
+ */
+int FileStore_commit(struct FileStoreWriter* writer, uint8_t hash[FILESTORE_HASH_SIZE]);
+
+/**
+ * @brief Give up on a file being added (e.g. the connection dropped)
+ *
+ * @param writer
+ */
+void FileStore_abort(struct FileStoreWriter* writer);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "filestore.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+/**
+ * @brief Hash of some bytes, in hex, fed in pieces of a given size
+ */
+void hexOf(const char* data, size_t len, size_t piece, char* hex) {
+    struct Sha256 sha;
+    uint8_t hash[FILESTORE_HASH_SIZE];
+    Sha256_init(&sha);
+    for (size_t i = 0; i < len; i += piece) {
+        Sha256_update(&sha, data + i, len - i < piece ? len - i : piece);
+    }
+    Sha256_final(&sha, hash);
+    FileStore_hex(hash, hex);
+}
+
+/**
+ * @brief Add some bytes to the store the way a receive thread does
+ */
+int receive(struct FileStore* store, const char* data, size_t len, uint8_t* hash) {
+    struct FileStoreWriter writer;
+    if (FileStore_begin(store, &writer) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i += 1000) {
+        FileStore_write(&writer, data + i, len - i < 1000 ? len - i : 1000);
+    }
+    return FileStore_commit(&writer, hash);
+}
+
+int sameContents(const char* path, const char* data, size_t len) {
+    char* buf = (char*)malloc(len + 1);
+    int fd = open(path, O_RDONLY);
+    ssize_t n = fd == -1 ? -1 : read(fd, buf, len + 1);
+    if (fd != -1) {
+        close(fd);
+    }
+    int same = n == (ssize_t)len && memcmp(buf, data, len) == 0;
+    free(buf);
+    return same;
+}
+
+int main() {
+    char hex[FILESTORE_HEX_SIZE];
+    hexOf("", 0, 1, hex);
+    check(strcmp(hex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") == 0, "sha256 of nothing");
+    hexOf("abc", 3, 1, hex);
+    check(strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0, "sha256 of abc");
+    const char* two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    hexOf(two, strlen(two), 7, hex);
+    check(strcmp(hex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1") == 0, "sha256 of two blocks, fed in pieces");
+    size_t big = 1000000;
+    char* a = (char*)malloc(big);
+    memset(a, 'a', big);
+    hexOf(a, big, 4096, hex);
+    check(strcmp(hex, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0, "sha256 of a million a's");
+
+    char dir[] = "/tmp/filestoretestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        return 1;
+    }
+    char path[200], other[200];
+    sprintf(path, "%s/store", dir);
+    struct FileStore* store = FileStore_init(path);
+    check(store != NULL, "init");
+
+    for (size_t i = 0; i < big; i++) {
+        a[i] = (char)(i*7 + i/1000);
+    }
+    uint8_t hash[FILESTORE_HASH_SIZE], again[FILESTORE_HASH_SIZE], sent[FILESTORE_HASH_SIZE];
+    check(receive(store, a, big, hash) == 1 && FileStore_has(store, hash, big) && !FileStore_has(store, hash, big - 1), "a new file is kept");
+    sprintf(path, "%s/first", dir);
+    check(FileStore_link(store, hash, path) == 0 && sameContents(path, a, big), "and put where it was sent");
+
+    check(receive(store, a, big, again) == 0 && memcmp(hash, again, sizeof(hash)) == 0, "the same file again is a duplicate");
+    sprintf(other, "%s/second", dir);
+    FileStore_link(store, hash, other);
+    struct stat first, second;
+    stat(path, &first);
+    stat(other, &second);
+    check(sameContents(other, a, big) && (first.st_ino == second.st_ino || first.st_blocks + second.st_blocks > 0), "both names have it");
+    printf("      %s\n", first.st_ino == second.st_ino ? "hard linked" : "reflinked or copied");
+
+    // The sender hashes from the file itself
+    check(FileStore_hashFile(path, sent) == 0 && memcmp(hash, sent, sizeof(hash)) == 0, "the sender's hash matches the receiver's");
+
+    // A link can't be used to change what the store hands out next time
+    check(first.st_ino != second.st_ino || (first.st_mode & 0222) == 0, "stored files are read only");
+    FileStore_link(store, hash, path); // Replaces what's there
+    check(sameContents(path, a, big), "linking again over an existing file");
+
+    // Giving up part way leaves nothing behind
+    struct FileStoreWriter writer;
+    FileStore_begin(store, &writer);
+    FileStore_write(&writer, "partial", 7);
+    FileStore_abort(&writer);
+    sprintf(path, "%s/store/incoming", dir);
+    char command[300];
+    sprintf(command, "test -z \"$(ls -A %s)\"", path);
+    check(system(command) == 0, "an abandoned file is cleaned up");
+
+    FileStore_free(store);
+    free(a);
+    sprintf(command, "chmod -R u+w %s && rm -r %s", dir, dir);
+    if (system(command) != 0) {
+        printf("couldn't remove %s\n", dir);
+    }
+    return failures;
+}
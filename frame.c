@@ -0,0 +1,20 @@
+#include <arpa/inet.h>
+#include "frame.h"
+
+void Frame_encode(struct ArrayListBuf* b, uint8_t magic, uint16_t shortInt, uint32_t longInt, const char* payload, size_t len) {
+    struct header_generic header;
+    header.magic = magic;
+    header.shortInt = htons(shortInt);
+    header.longInt = htonl(longInt);
+    ArrayListBuf_reserve(b, b->N + sizeof(struct header_generic) + len);
+    ArrayListBuf_push(b, (char*)&header, sizeof(struct header_generic));
+    if (len > 0) {
+        ArrayListBuf_push(b, payload, len);
+    }
+}
+
+void Frame_decode(const struct header_generic* header, struct Frame* frame) {
+    frame->magic = header->magic;
+    frame->shortInt = ntohs(header->shortInt);
+    frame->longInt = ntohl(header->longInt);
+}
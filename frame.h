@@ -0,0 +1,60 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include "arraylist.h"
+
+enum Magic {
+    INDICATE_NAME = 0,
+    SEND_MESSAGE = 1,
+    DELETE_MESSAGE = 2,
+    SEND_FILE = 3, // shortInt: name length, longInt: file length, payload: name.  The contents follow in FILE_DATA frames
+    END_CHAT = 4,
+    QUERY_FILE = 5, // Do you have this file?  shortInt: name length, longInt: file length, payload: SHA-256 then name
+    FILE_ANSWER = 6, // shortInt: 1 if I had it (and put it under the name asked for), 0 to have it sent, 2 to have the changes to an older copy sent
+    SIGNATURES = 7, // Signatures of my older copy (see delta.h), after FILE_ANSWER 2.  longInt: payload length
+    SEND_DELTA = 8, // The file asked about, as changes to the peer's older copy.  shortInt: name length, longInt: file length, payload: name
+    DELTA_DATA = 9, // Instructions for rebuilding the file (see delta.h), after SEND_DELTA.  longInt: payload length (at most DELTA_CHUNK)
+    DELTA_END = 10, // Every instruction has been sent
+    FILE_DATA = 11, // The next part of a file, after SEND_FILE.  longInt: payload length (at most FILE_CHUNK)
+    CANCEL_FILE = 12 // The file being sent (whole or as changes) won't be finished; drop what's come of it
+};
+
+#define FILE_CHUNK (64*1024) // Most bytes of a file in one FILE_DATA frame, so other frames can go out in between
+
+// What goes over the wire, in network byte order
+struct __attribute__((__packed__))  header_generic {
+    uint8_t magic;
+    uint16_t shortInt; // Because @bonelesspi said so
+    uint32_t longInt; // Because @thekacefiles said it was too archaic
+};
+
+// A decoded header, in host byte order
+struct Frame {
+    uint8_t magic;
+    uint16_t shortInt;
+    uint32_t longInt;
+};
+
+/**
+ * @brief Append a frame (header followed by payload) to a buffer so
+ * that it can go out in a single send
+ *
+ * @param b Buffer to append to
+ * @param magic Frame type
+ * @param shortInt Short header field (host byte order)
+ * @param longInt Long header field (host byte order)
+ * @param payload Bytes to follow the header (may be NULL if len is 0)
+ * @param len Number of payload bytes
+ */
+void Frame_encode(struct ArrayListBuf* b, uint8_t magic, uint16_t shortInt, uint32_t longInt, const char* payload, size_t len);
+
+/**
+ * @brief Decode a header that came off the wire
+ *
+ * @param header Raw header
+ * @param frame Decoded header
+ */
+void Frame_decode(const struct header_generic* header, struct Frame* frame);
+
+#endif
@@ -4,48 +4,135 @@
 
 #include "chatter.h"
 #include "arraylist.h"
+#include "chatview.h"
+#include "lineeditor.h"
 #include <ncurses.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <signal.h>
 
 #define TYPE_SIZE 4
 #define ADDR_WIDTH 10
-char NULLTERM = '\0';
+#define DEFAULT_FPS 30 // Most repaints per second
+#define TRANSFER_ROWS 3 // Most rows of the chat window given over to files being sent
+#define KEY_PASTE_BEGIN (KEY_MAX + 1) // Bracketed paste markers, see openWindows()
+#define KEY_PASTE_END (KEY_MAX + 2)
+#define CTRL(c) ((c) & 0x1f)
+
+/**
+ * @brief Format the "name id: " prefix a message is shown with in
+ * the chat window
+ * 
+ * @param ctx GUI
+ * @param msg Message, from gui->shownChat
+ * @param prefix Buffer to write the prefix to
+ */
+static void formatPrefix(void* ctx, struct Message* msg, struct ArrayListBuf* prefix) {
+    struct GUI* gui = (struct GUI*)ctx;
+    if (msg->flags & MESSAGE_OUTGOING) {
+        ArrayListBuf_appendf(prefix, "Me %i: ", msg->id);
+    }
+    else {
+        ArrayListBuf_appendf(prefix, "%s %i: ", gui->shownChat->name, msg->id);
+    }
+}
 
 struct GUI* initGUI() {
-    // Setup 3 windows
+    struct GUI* gui = (struct GUI*)malloc(sizeof(struct GUI));
+    pthread_mutex_init(&gui->viewLock, NULL);
+    gui->shownChat = NULL;
+    gui->chatDirty = 0;
+    gui->transferWindow = NULL;
+    gui->TH = 0;
+    gui->inputStart = 0;
+    gui->pasting = 0;
+    LineEditor_init(&gui->editor);
+    ArrayListBuf_init(&gui->paste);
+    gui->nameRows = NULL;
+    gui->namesTop = 0;
+    atomic_store(&gui->repaintPending, 0);
+    atomic_store(&gui->frameIntervalMs, 1000/DEFAULT_FPS);
+    atomic_store(&gui->notice, NULL);
+    pthread_mutex_init(&gui->inputLock, NULL);
+    pthread_cond_init(&gui->inputReady, NULL);
+    StringArray_init(&gui->inputLines);
+    return gui;
+}
+
+void destroyGUI(struct GUI* gui) {
+    if (gui->shownChat != NULL) {
+        releaseChat(gui->shownChat);
+    }
+    LineEditor_free(&gui->editor);
+    ArrayListBuf_free(&gui->paste);
+    free(gui->nameRows);
+    free(atomic_load(&gui->notice));
+    pthread_mutex_destroy(&gui->viewLock);
+    pthread_mutex_destroy(&gui->inputLock);
+    pthread_cond_destroy(&gui->inputReady);
+    for (size_t i = 0; i < gui->inputLines.N; i++) {
+        free(gui->inputLines.data[i]);
+    }
+    StringArray_free(&gui->inputLines);
+    free(gui);
+}
+
+/**
+ * @brief Take over the terminal and set up the 3 windows (GUI thread only)
+ * 
+ * @param gui GUI
+ */
+static void openWindows(struct GUI* gui) {
     initscr();
     noecho();
     keypad(stdscr, TRUE);
-    struct GUI* gui = (struct GUI*)malloc(sizeof(struct GUI));
     getmaxyx(stdscr, gui->H, gui->W);
     gui->CH = gui->H - TYPE_SIZE;
     gui->CW = gui->W - ADDR_WIDTH;
     curs_set(TRUE);
     gui->chatWindow = newwin(gui->CH, gui->CW, 0, 0);
-    //pthread_mutex_init(&gui->chatWindowLock, NULL);
+    scrollok(gui->chatWindow, TRUE); // New messages scroll in at the bottom
+    idlok(gui->chatWindow, TRUE);
+    ChatView_init(&gui->view, gui->chatWindow, gui->CH, gui->CW, formatPrefix, gui);
     gui->inputWindow = newwin(TYPE_SIZE, gui->W, gui->CH, 0);
+    keypad(gui->inputWindow, TRUE); // Arrow keys, PageUp/PageDown, resizes
+    nodelay(gui->inputWindow, TRUE); // Keys are read when poll() says there are some
+    // Have the terminal mark pastes, so they can be inserted in one go
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    printf("\033[?2004h");
+    fflush(stdout);
     gui->nameWindow  = newwin(gui->CH, ADDR_WIDTH, 0, gui->CW);
-    //pthread_mutex_init(&gui->nameWindowLock, NULL);
 
     char* s = "Hello!  Chats will go here!";
     mvwprintw(gui->chatWindow, 0, 0, "%s", s); 
-    wrefresh(gui->chatWindow);
+    wnoutrefresh(gui->chatWindow);
     mvwprintw(gui->nameWindow, 0, 0, "Usernames\nGo\nHere!"); 
-    wrefresh(gui->nameWindow);
-    return gui;
+    wnoutrefresh(gui->nameWindow);
+    invalidateNameWindow(gui);
+    wnoutrefresh(gui->inputWindow);
+    doupdate();
 }
 
-void destroyGUI(struct GUI* gui) {
+/**
+ * @brief Give the terminal back (GUI thread only)
+ * 
+ * @param gui GUI
+ */
+static void closeWindows(struct GUI* gui) {
     delwin(gui->chatWindow);
-    pthread_mutex_destroy(&gui->chatWindowLock);
     delwin(gui->inputWindow);
     delwin(gui->nameWindow);
-    pthread_mutex_destroy(&gui->nameWindowLock);
+    if (gui->transferWindow != NULL) {
+        delwin(gui->transferWindow);
+    }
+    ChatView_free(&gui->view);
+    printf("\033[?2004l");
+    fflush(stdout);
     endwin();
-    free(gui);
 }
 
 
@@ -55,104 +142,512 @@ void destroyGUI(struct GUI* gui) {
 //       See: https://linux.die.net/man/3/mvprintw
 ///////////////////////////////////////////////////////////
 
-void printErrorGUI(struct GUI* gui, char* error) {
-    //pthread_mutex_lock(&gui->chatWindowLock);
-    wclear(gui->chatWindow);
-    mvwprintw(gui->chatWindow, 0, 0, "%s", error);
-    wrefresh(gui->chatWindow);
-    //pthread_mutex_unlock(&gui->chatWindowLock);
+void printNoticeGUI(struct Chatter* chatter, const char* text) {
+    struct GUI* gui = chatter->gui;
+    // Only the latest one is worth showing
+    free(atomic_exchange(&gui->notice, strdup(text)));
+    scheduleRepaint(chatter, REPAINT_NOTICE);
+}
+
+void printErrorGUI(struct Chatter* chatter, char* error) {
+    printNoticeGUI(chatter, error);
+}
+
+/**
+ * @brief Draw the latest notice over the chat window (GUI thread only)
+ * 
+ * @param chatter Chatter object
+ */
+static void reprintNotice(struct Chatter* chatter) {
+    struct GUI* gui = chatter->gui;
+    char* notice = atomic_exchange(&gui->notice, NULL);
+    if (notice != NULL) {
+        werase(gui->chatWindow);
+        mvwaddstr(gui->chatWindow, 0, 0, notice);
+        wnoutrefresh(gui->chatWindow);
+        free(notice);
+        invalidateChatWindow(gui); // Put the chat back on the next repaint
+    }
+}
+
+/**
+ * @brief Write a byte count in at most 5 characters (e.g. "512K")
+ */
+void formatBytes(char* out, size_t size, uint64_t bytes) {
+    const char* units = "BKMGT";
+    while (bytes >= 10000 && units[1] != '\0') {
+        bytes /= 1024;
+        units++;
+    }
+    snprintf(out, size, "%llu%c", (unsigned long long)bytes, *units);
+}
+
+/**
+ * @brief Format one row of the name window: the name (cut short if it
+ * has to be), an asterix if the chat is visible, and then the number of
+ * unread messages and the bytes of a file still to come, right aligned
+ * 
+ * @param row Where to put the row (ADDR_WIDTH+1 bytes)
+ * @param chat Chat, or NULL for an empty row
+ * @param active Whether chat is the visible chat
+ */
+static void formatNameRow(char* row, struct Chat* chat, int active) {
+    if (chat == NULL) {
+        row[0] = '\0';
+        return;
+    }
+    char counters[ADDR_WIDTH + 1] = "";
+    size_t n = 0;
+    if (chat->unread > 0) {
+        n += snprintf(counters + n, sizeof(counters) - n, " %u", chat->unread);
+    }
+    if (chat->transferTotal > 0 && n < sizeof(counters)) {
+        char left[BYTES_TEXT_SIZE];
+        formatBytes(left, sizeof(left), chat->transferTotal - chat->transferDone);
+        n += snprintf(counters + n, sizeof(counters) - n, " %s", left);
+    }
+    if (n > ADDR_WIDTH - 2) {
+        n = ADDR_WIDTH - 2; // Always leave room for some of the name
+        counters[n] = '\0';
+    }
+    size_t room = ADDR_WIDTH - 1 - n; // Name and asterix
+    size_t len = chat->nameLen < room ? chat->nameLen : room;
+    memcpy(row, chat->name, len);
+    row[len++] = active ? '*' : ' ';
+    if (n > 0) {
+        memset(row + len, ' ', ADDR_WIDTH - n - len);
+        memcpy(row + ADDR_WIDTH - n, counters, n);
+        len = ADDR_WIDTH;
+    }
+    row[len] = '\0';
+}
+
+void invalidateNameWindow(struct GUI* gui) {
+    gui->nameRows = (char*)realloc(gui->nameRows, (size_t)gui->CH*(ADDR_WIDTH + 1));
+    for (int i = 0; i < gui->CH; i++) {
+        // Can't match any formatted row
+        gui->nameRows[i*(ADDR_WIDTH + 1)] = '\n';
+    }
 }
 
 void reprintUsernameWindow(struct Chatter* chatter) {
     struct GUI* gui = chatter->gui;
+    size_t rows = (size_t)gui->CH;
+    char row[ADDR_WIDTH + 1];
     pthread_mutex_lock(&chatter->lock);
-    //pthread_mutex_lock(&gui->nameWindowLock);
-    wclear(gui->nameWindow);
-    struct LinkedNode* node = chatter->chats->head;
-    int row = 0;
-    while (node != NULL && row < gui->CH) {
-        struct Chat* chat = (struct Chat*)node->data;
-        char special = ' ';
-        if (chat == chatter->visibleChat) {
-            special = '*'; // Put an asterix next to the active chat
+    size_t N = chatter->chats.N;
+    // Stay as far down as there are chats to fill the window...
+    if (gui->namesTop + rows > N) {
+        gui->namesTop = N > rows ? N - rows : 0;
+    }
+    // ...and keep the visible chat in it
+    if (chatter->visibleChat != NULL) {
+        size_t i = chatter->visibleIndex;
+        if (i < gui->namesTop) {
+            gui->namesTop = i;
+        }
+        else if (i >= gui->namesTop + rows) {
+            gui->namesTop = i + 1 - rows;
+        }
+    }
+    for (size_t r = 0; r < rows; r++) {
+        size_t i = gui->namesTop + r;
+        struct Chat* chat = i < N ? chatter->chats.data[i] : NULL;
+        if (chat != NULL) {
+            pthread_mutex_lock(&chat->lock);
+        }
+        formatNameRow(row, chat, chat != NULL && chat == chatter->visibleChat);
+        if (chat != NULL) {
+            pthread_mutex_unlock(&chat->lock);
+        }
+        char* shown = gui->nameRows + r*(ADDR_WIDTH + 1);
+        if (strcmp(row, shown) != 0) {
+            strcpy(shown, row);
+            wmove(gui->nameWindow, (int)r, 0);
+            wclrtoeol(gui->nameWindow);
+            waddnstr(gui->nameWindow, row, ADDR_WIDTH);
         }
-        mvwprintw(gui->nameWindow, row, 0, "%s%c", chat->name, special);
-        row++;
-        node = node->next;
     }
-    wrefresh(gui->nameWindow);
-    //pthread_mutex_unlock(&gui->nameWindowLock);
     pthread_mutex_unlock(&chatter->lock);
+    wnoutrefresh(gui->nameWindow);
 }
 
-void printLineToChat(struct GUI* gui, char* str, int len, int* row) {
-    int col = 0;
-    for (int i = 0; i < len; i++) {
-        mvwprintw(gui->chatWindow, *row, col, "%c", str[i]);
-        col++;
-        if (col == gui->W) {
-            col = 0;
-            (*row)--;
-        }
+void invalidateChatWindow(struct GUI* gui) {
+    if (gui != NULL) {
+        pthread_mutex_lock(&gui->viewLock);
+        gui->chatDirty = 1;
+        pthread_mutex_unlock(&gui->viewLock);
     }
 }
 
+void messagesInsertedGUI(struct GUI* gui, struct Chat* chat, size_t index, size_t count) {
+    if (gui == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&gui->viewLock);
+    if (chat == gui->shownChat && count > 0) {
+        ChatView_inserted(&gui->view, index, count);
+        gui->chatDirty = 1;
+    }
+    pthread_mutex_unlock(&gui->viewLock);
+}
+
+void messageDeletedGUI(struct GUI* gui, struct Chat* chat) {
+    if (gui == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&gui->viewLock);
+    if (chat == gui->shownChat) {
+        gui->chatDirty = 1;
+    }
+    pthread_mutex_unlock(&gui->viewLock);
+}
+
+void messageRemovedGUI(struct GUI* gui, struct Chat* chat, size_t index) {
+    if (gui == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&gui->viewLock);
+    if (chat == gui->shownChat) {
+        ChatView_removed(&gui->view, index);
+        gui->chatDirty = 1;
+    }
+    pthread_mutex_unlock(&gui->viewLock);
+}
+
+/**
+ * @brief Show a different chat in the chat window, following its newest
+ * messages (NOTE: Caller must hold chat's lock and gui->viewLock)
+ * 
+ * @param gui GUI
+ * @param chat Chat to show, or NULL
+ * @return struct Chat* The chat shown until now, whose reference the caller releases once it's let go of the locks
+ */
+static struct Chat* showChat(struct GUI* gui, struct Chat* chat) {
+    struct Chat* shown = gui->shownChat;
+    if (chat != NULL) {
+        retainChat(chat);
+    }
+    gui->shownChat = chat;
+    ChatView_follow(&gui->view);
+    gui->chatDirty = 1;
+    return shown;
+}
+
+/**
+ * @brief Bring the chat window up to date.  Usually that just means
+ * scrolling in whatever arrived since the last time; it's only
+ * redrawn from scratch when the chat window was invalidated
+ * (e.g. a different chat became visible or a message was deleted)
+ * 
+ * @param chatter Chatter object
+ */
 void reprintChatWindow(struct Chatter* chatter) {
     struct GUI* gui = chatter->gui;
-    pthread_mutex_lock(&chatter->lock);
-    //pthread_mutex_lock(&gui->chatWindowLock);
-    wclear(gui->chatWindow);
-    if (chatter->visibleChat != NULL) {
-        struct Chat* chat = chatter->visibleChat;
-        // Print out chats in order of most recent
-        int row = gui->CH - 1;
-        struct LinkedNode* inNode = chat->messagesIn->head;
-        struct LinkedNode* outNode = chat->messagesOut->head;
-        while (row >= 0 && (inNode != NULL || outNode != NULL)) {
-            int printOut = 0;
-            if (inNode == NULL) {
-                printOut = 1;
-            }
-            else if (outNode != NULL) {
-                struct Message* msgIn = (struct Message*)inNode->data;
-                struct Message* msgOut = (struct Message*)outNode->data;
-                if (msgOut->timestamp > msgIn->timestamp) {
-                    printOut = 1;
-                }
-            }
-            if (printOut == 1) {
-                // Print my message
-                struct Message* msg = (struct Message*)outNode->data;
-                char* str = (char*)malloc(strlen("Me : ") + strlen(msg->text) + 100);
-                sprintf(str, "Me %i: %s", msg->id, msg->text);
-                printLineToChat(gui, str, strlen(str), &row);
-                free(str);
-                outNode = outNode->next;
-            }
-            else {
-                // Print other message
-                struct Message* msg = (struct Message*)inNode->data;
-                char* str = (char*)malloc(strlen(chat->name) + strlen(msg->text) + 100);
-                sprintf(str, "%s %i: %s", chat->name, msg->id, msg->text);
-                printLineToChat(gui, str, strlen(str), &row);
-                free(str);
-                inNode = inNode->next;
-            }
-            row--;
+    struct Chat* chat = lockVisibleChat(chatter);
+    struct Chat* hidden = NULL;
+    pthread_mutex_lock(&gui->viewLock);
+    if (gui->shownChat != chat) {
+        hidden = showChat(gui, chat);
+    }
+    if (gui->shownChat == NULL) {
+        if (gui->chatDirty) {
+            werase(gui->chatWindow);
         }
     }
-    wrefresh(gui->chatWindow);
-    //pthread_mutex_unlock(&gui->chatWindowLock);
-    pthread_mutex_unlock(&chatter->lock);
+    else if (gui->chatDirty) {
+        ChatView_redraw(&gui->view, &gui->shownChat->timeline);
+    }
+    else {
+        ChatView_update(&gui->view, &gui->shownChat->timeline);
+    }
+    gui->chatDirty = 0;
+    wnoutrefresh(gui->chatWindow);
+    pthread_mutex_unlock(&gui->viewLock);
+    if (chat != NULL) {
+        trimMemory(chatter, chat); // Drawing may have read messages back from the spill file
+        pthread_mutex_unlock(&chat->lock);
+    }
+    if (hidden != NULL) {
+        releaseChat(hidden); // Frees it if it was closed
+    }
 }
 
-void* refreshGUILoop(void* args) {
-    struct Chatter* chatter = (struct Chatter*)args;
-    while (1) {
-        sleep(5);
+void scrollChat(struct Chatter* chatter, long rows) {
+    struct GUI* gui = chatter->gui;
+    struct Chat* chat = lockVisibleChat(chatter);
+    if (chat != NULL) {
+        pthread_mutex_lock(&gui->viewLock);
+        if (chat == gui->shownChat) {
+            ChatView_scroll(&gui->view, &chat->timeline, rows);
+            gui->chatDirty = 1;
+        }
+        pthread_mutex_unlock(&gui->viewLock);
+        pthread_mutex_unlock(&chat->lock);
+    }
+    scheduleRepaint(chatter, REPAINT_CHAT);
+}
+
+int gotoMessage(struct Chatter* chatter, uint16_t id) {
+    struct GUI* gui = chatter->gui;
+    int status = FAILURE_GENERIC;
+    if (gui == NULL) {
+        return status; // Nothing to scroll when headless
+    }
+    struct Chat* chat = lockVisibleChat(chatter);
+    struct Chat* hidden = NULL;
+    if (chat == NULL) {
+        return CHAT_DOESNT_EXIST;
+    }
+    // Whichever way it went, the newer one
+    long mine = findMessageById(chat, id, 1);
+    long theirs = findMessageById(chat, id, 0);
+    long index = mine > theirs ? mine : theirs;
+    if (index != -1) {
+        pthread_mutex_lock(&gui->viewLock);
+        if (gui->shownChat != chat) {
+            hidden = showChat(gui, chat);
+        }
+        ChatView_scrollTo(&gui->view, &chat->timeline, (size_t)index);
+        gui->chatDirty = 1;
+        pthread_mutex_unlock(&gui->viewLock);
+        status = STATUS_SUCCESS;
+    }
+    pthread_mutex_unlock(&chat->lock);
+    if (hidden != NULL) {
+        releaseChat(hidden);
+    }
+    return status;
+}
+
+/**
+ * @brief Fit the chat window into the rows the transfer window leaves
+ * it, with the transfer window under it (GUI thread only; NOTE: Caller
+ * must hold gui->viewLock)
+ * 
+ * @param gui GUI, with CH, CW and TH as they're to be
+ */
+static void placeChatWindows(struct GUI* gui) {
+    if (gui->TH > gui->CH - 1) {
+        gui->TH = gui->CH > 1 ? gui->CH - 1 : 0; // Always leave the chat a row
+    }
+    int rows = gui->CH - gui->TH;
+    wresize(gui->chatWindow, rows, gui->CW);
+    if (gui->transferWindow != NULL) {
+        delwin(gui->transferWindow);
+        gui->transferWindow = NULL;
+    }
+    if (gui->TH > 0) {
+        gui->transferWindow = newwin(gui->TH, gui->CW, rows, 0);
+        wbkgd(gui->transferWindow, A_REVERSE);
+    }
+    // Messages wrap differently now; their layouts get redone as they're drawn
+    ChatView_resize(&gui->view, rows, gui->CW);
+    gui->chatDirty = 1;
+}
+
+void formatTransferRow(char* row, size_t size, const struct Transfer* transfer) {
+    int n = snprintf(row, size, "#%u %s: ", transfer->id, transfer->name);
+    if (n < 0 || (size_t)n >= size) {
+        return;
+    }
+    if (atomic_load(&transfer->cancelled)) {
+        snprintf(row + n, size - n, "cancelling");
+        return;
+    }
+    const char* note = atomic_load(&transfer->note);
+    if (transfer->state == TRANSFER_QUEUED || note != NULL) {
+        snprintf(row + n, size - n, "%s", note != NULL ? note : "queued");
+        return;
+    }
+    uint64_t done = atomic_load(&transfer->done), total = atomic_load(&transfer->total);
+    double rate, left;
+    Transfer_rate(transfer, &rate, &left);
+    char bytes[BYTES_TEXT_SIZE];
+    formatBytes(bytes, sizeof(bytes), total);
+    n += snprintf(row + n, size - n, "%d%% of %s", total > 0 ? (int)(100*done/total) : 100, bytes);
+    if (rate > 0 && (size_t)n < size) {
+        formatBytes(bytes, sizeof(bytes), (uint64_t)rate);
+        n += snprintf(row + n, size - n, ", %s/s", bytes);
+    }
+    if (left >= 0 && (size_t)n < size) {
+        long seconds = (long)(left + 0.5);
+        if (seconds >= 3600) {
+            snprintf(row + n, size - n, ", %ld:%02ld:%02ld left", seconds/3600, seconds/60 % 60, seconds % 60);
+        }
+        else {
+            snprintf(row + n, size - n, ", %ld:%02ld left", seconds/60, seconds % 60);
+        }
+    }
+}
+
+/**
+ * The rows the transfer window shows
+ */
+struct TransferRows {
+    char rows[TRANSFER_ROWS][256];
+    size_t N; // Transfers in all, which may be more than there are rows
+};
+
+static void addTransferRow(void* ctx, const struct Transfer* transfer) {
+    struct TransferRows* rows = (struct TransferRows*)ctx;
+    if (rows->N < TRANSFER_ROWS) {
+        formatTransferRow(rows->rows[rows->N], sizeof(rows->rows[0]), transfer);
+    }
+    rows->N++;
+}
+
+/**
+ * @brief Bring the rows showing files being sent up to date, taking rows
+ * from the chat window or giving them back as files come and go
+ * (GUI thread only)
+ * 
+ * @param chatter Chatter object
+ * @return int Whether the chat window changed size, and so has to be redrawn
+ */
+static int reprintTransfers(struct Chatter* chatter) {
+    struct GUI* gui = chatter->gui;
+    struct TransferRows rows;
+    rows.N = 0;
+    if (chatter->transfers != NULL) {
+        TransferQueue_each(chatter->transfers, addTransferRow, &rows);
+    }
+    int TH = rows.N < TRANSFER_ROWS ? (int)rows.N : TRANSFER_ROWS;
+    if (rows.N > TRANSFER_ROWS) {
+        snprintf(rows.rows[TRANSFER_ROWS - 1], sizeof(rows.rows[0]), "...and %zu more (see transfers)", rows.N - (TRANSFER_ROWS - 1));
+    }
+    int resized = 0;
+    pthread_mutex_lock(&gui->viewLock);
+    if (TH != gui->TH) {
+        gui->TH = TH;
+        placeChatWindows(gui);
+        resized = 1;
+    }
+    pthread_mutex_unlock(&gui->viewLock);
+    if (gui->transferWindow != NULL) {
+        werase(gui->transferWindow);
+        for (int r = 0; r < gui->TH; r++) {
+            mvwaddnstr(gui->transferWindow, r, 0, rows.rows[r], gui->CW);
+        }
+        wnoutrefresh(gui->transferWindow);
+    }
+    return resized;
+}
+
+void resizeGUI(struct Chatter* chatter) {
+    struct GUI* gui = chatter->gui;
+    pthread_mutex_lock(&gui->viewLock);
+    getmaxyx(stdscr, gui->H, gui->W);
+    gui->CH = gui->H - TYPE_SIZE;
+    gui->CW = gui->W - ADDR_WIDTH;
+    if (gui->CH < 1) {
+        gui->CH = 1;
+    }
+    if (gui->CW < 1) {
+        gui->CW = 1;
+    }
+    placeChatWindows(gui);
+    wresize(gui->inputWindow, TYPE_SIZE, gui->W);
+    mvwin(gui->inputWindow, gui->CH, 0);
+    wresize(gui->nameWindow, gui->CH, ADDR_WIDTH);
+    mvwin(gui->nameWindow, 0, gui->CW);
+    pthread_mutex_unlock(&gui->viewLock);
+    invalidateNameWindow(gui);
+    clearok(curscr, TRUE);
+    werase(gui->inputWindow);
+    gui->inputStart = 0;
+    gui->editor.dirty = 0;
+    scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT | REPAINT_TRANSFERS);
+}
+
+void scheduleRepaint(struct Chatter* chatter, int what) {
+    struct GUI* gui = chatter->gui;
+    if (gui == NULL) {
+        return; // Headless
+    }
+    if (atomic_fetch_or(&gui->repaintPending, what) == 0) {
+        // Nothing was pending, so the GUI thread may be asleep
+        EventQueue_wake(chatter->events);
+    }
+}
+
+void setFrameRate(struct GUI* gui, int fps) {
+    if (gui != NULL && fps > 0) {
+        atomic_store(&gui->frameIntervalMs, 1000/fps);
+    }
+}
+
+static long nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/**
+ * @brief Repaint whatever has been scheduled since the last frame,
+ * and push it all to the terminal in one go
+ * 
+ * @param chatter Chatter object
+ */
+static void flushRepaint(struct Chatter* chatter) {
+    struct GUI* gui = chatter->gui;
+    int what = atomic_exchange(&gui->repaintPending, 0);
+    if ((what & REPAINT_TRANSFERS) && reprintTransfers(chatter)) {
+        what |= REPAINT_CHAT;
+    }
+    if (what & REPAINT_NAMES) {
         reprintUsernameWindow(chatter);
+    }
+    if (what & REPAINT_CHAT) {
         reprintChatWindow(chatter);
     }
+    if (what & REPAINT_NOTICE) {
+        reprintNotice(chatter);
+    }
+    wnoutrefresh(gui->inputWindow); // Leave the cursor where the user is typing
+    doupdate();
+}
+
+/**
+ * @brief Read the keyboard, apply events published by the network
+ * threads as they come in, and repaint what they changed.  This is
+ * the only thread that touches the terminal.  However many updates
+ * arrive, repaints are coalesced to at most one per frame, and with
+ * nothing to do the thread sleeps without a timeout
+ * 
+ * @param args Chatter object
+ */
+void* refreshGUILoop(void* args) {
+    struct Chatter* chatter = (struct Chatter*)args;
+    struct GUI* gui = chatter->gui;
+    openWindows(gui);
+    // Other threads are started with SIGWINCH blocked (see initChatter()),
+    // so it interrupts this thread's poll() and the resize is seen at once
+    sigset_t winch;
+    sigemptyset(&winch);
+    sigaddset(&winch, SIGWINCH);
+    pthread_sigmask(SIG_UNBLOCK, &winch, NULL);
+    long lastFrame = 0;
+    while (!atomic_load(&chatter->stopping)) {
+        int timeout = -1;
+        if (atomic_load(&gui->repaintPending) != 0) {
+            long wait = lastFrame + atomic_load(&gui->frameIntervalMs) - nowMs();
+            timeout = wait > 0 ? (int)wait : 0;
+        }
+        if (EventQueue_wait(chatter->events, STDIN_FILENO, timeout)) {
+            readKeys(chatter);
+        }
+        struct Event* event;
+        while ((event = EventQueue_pop(chatter->events)) != NULL) {
+            handleEvent(chatter, event);
+        }
+        if (atomic_load(&gui->repaintPending) != 0 && nowMs() - lastFrame >= atomic_load(&gui->frameIntervalMs)) {
+            flushRepaint(chatter);
+            lastFrame = nowMs();
+        }
+    }
+    closeWindows(gui);
+    return NULL;
 }
 
 ///////////////////////////////////////////////////////////
@@ -160,6 +655,21 @@ void* refreshGUILoop(void* args) {
 ///////////////////////////////////////////////////////////
 
 
+/**
+ * @brief Pick out the word following the command at the start of
+ * the input, like sscanf's %s but in place rather than copying into
+ * a fixed size buffer on the stack
+ * 
+ * @param input String that the user just inputted (modified)
+ * @return char* The word, or an empty string if there isn't one
+ */
+static char* commandArg(char* input) {
+    char* arg = input + strcspn(input, " \t");
+    arg += strspn(arg, " \t");
+    arg[strcspn(arg, " \t")] = '\0';
+    return arg;
+}
+
 /**
  * @brief Incorporate something that the user typed into
  * the chat session
@@ -179,7 +689,7 @@ int parseInput(struct Chatter* chatter, char* input) {
         sscanf(input, "connect %39s %5s", IP, port);
         if (strstr(IP, ".") == NULL) {
             status = IP_FORMAT_ERROR;
-            printErrorGUI(gui, "Please put a dot in your IP address!");
+            reportError(chatter, "Please put a dot in your IP address!");
         }
         else {
             status = connectChat(chatter, IP, port);
@@ -187,14 +697,36 @@ int parseInput(struct Chatter* chatter, char* input) {
     }
     else if (strncmp(input, "myname", strlen("myname")) == 0) {
         // Change my name
-        sscanf(input, "myname %65535s", chatter->myname);
+        setMyName(chatter, commandArg(input));
         status = broadcastMyName(chatter);
     }
     else if (strncmp(input, "sendfile", strlen("sendfile")) == 0) {
         // Send the following file message in the visible conversation
-        char filename[65536];
-        sscanf(input, "sendfile %65535s", filename);
-        status = sendFile(chatter, filename);
+        status = sendFile(chatter, commandArg(input));
+    }
+    else if (strncmp(input, "transfers", strlen("transfers")) == 0) {
+        // Show the files being sent, with how far along they are
+        showTransfers(chatter);
+        return finishedStatus;
+    }
+    else if (strncmp(input, "cancel", strlen("cancel")) == 0) {
+        // Stop sending the file with this id
+        unsigned int id;
+        if (sscanf(input, "cancel %u", &id) != 1) {
+            reportError(chatter, "Which transfer? (see transfers)");
+            return finishedStatus;
+        }
+        status = cancelTransfer(chatter, id);
+    }
+    else if (strncmp(input, "search", strlen("search")) == 0) {
+        // Look for messages with these words in every conversation
+        searchChats(chatter, input + strlen("search"));
+        return finishedStatus;
+    }
+    else if (strncmp(input, "stats", strlen("stats")) == 0) {
+        // Show how many messages are in memory and how many spilled to disk
+        showStats(chatter);
+        return finishedStatus;
     }
     else if (strncmp(input, "send", strlen("send")) == 0) {
         // Send the following text message in the visible conversation
@@ -203,9 +735,7 @@ int parseInput(struct Chatter* chatter, char* input) {
     }
     else if (strncmp(input, "talkto", strlen("talkto")) == 0) {
         // Switch the visible chat window to someone else
-        char name[65536];
-        sscanf(input, "talkto %65535s", name);
-        status = switchTo(chatter, name);
+        status = switchTo(chatter, commandArg(input));
     }
     else if (strncmp(input, "delete", strlen("delete")) == 0) {
         // Delete the message with this id in the visible conversation
@@ -213,71 +743,207 @@ int parseInput(struct Chatter* chatter, char* input) {
         sscanf(input, "delete %hu", &id);
         status = deleteMessage(chatter, id);
     }
+    else if (strncmp(input, "goto", strlen("goto")) == 0) {
+        // Scroll back to the message with this id in the visible conversation
+        uint16_t id;
+        if (sscanf(input, "goto %hu", &id) != 1 || gotoMessage(chatter, id) != STATUS_SUCCESS) {
+            reportError(chatter, "No message with that id");
+            return finishedStatus;
+        }
+        scheduleRepaint(chatter, REPAINT_CHAT);
+        return finishedStatus;
+    }
     else if (strncmp(input, "close", strlen("close")) == 0) {
         // Close the connection with someone
-        char name[65536];
-        sscanf(input, "close %65535s", name);
-        status = closeChat(chatter, name);
+        status = closeChat(chatter, commandArg(input));
+    }
+    else if (strncmp(input, "fps", strlen("fps")) == 0) {
+        // Change the most times per second the screen is repainted
+        setFrameRate(gui, atoi(commandArg(input)));
     }
     else if (strncmp(input, "exit", strlen("exit")) == 0) {
         finishedStatus = READY_TO_EXIT;
     }
     else {
-        char* fmt = "Unrecognized command %s;  (use connect, myname, send, sendfile, delete, close, talkto, exit)";
-        char command[65536];
-        sscanf(input, "%65535s", command);
+        char* fmt = "Unrecognized command %s;  (use connect, myname, send, sendfile, transfers, cancel, delete, goto, search, stats, close, talkto, fps, exit)";
+        char* command = input + strspn(input, " \t");
+        command[strcspn(command, " \t")] = '\0';
         char* error = (char*)malloc(strlen(fmt) + strlen(command) + 1);
         sprintf(error, fmt, command);
-        printErrorGUI(gui, error);
+        reportError(chatter, error);
         free(error);
         return finishedStatus;
     }
     if (status == STATUS_SUCCESS) {
         debug_print("gui.c parseInput: success and repainting\n");
-        reprintUsernameWindow(chatter);
-        reprintChatWindow(chatter);
+        scheduleRepaint(chatter, REPAINT_NAMES | REPAINT_CHAT);
     }
 
     return finishedStatus;
 }
 
+/**
+ * @brief Bring the input window up to date with the line being typed.
+ * Only what changed since the last time is drawn (so typing at the end
+ * of the line draws one character), unless the line had to scroll to
+ * keep the cursor in view
+ * 
+ * @param gui GUI
+ * @param ed Line being typed
+ */
+static void drawInput(struct GUI* gui, struct LineEditor* ed) {
+    size_t W = gui->W;
+    size_t shown = (size_t)TYPE_SIZE*W; // Characters that fit in the window
+    // Keep the cursor in view, scrolling by whole rows
+    size_t start = gui->inputStart;
+    if (ed->cursor < start) {
+        start = ed->cursor - ed->cursor%W;
+    }
+    else if (ed->cursor >= start + shown) {
+        start = (ed->cursor/W - (TYPE_SIZE - 1))*W;
+    }
+    if (start != gui->inputStart) {
+        gui->inputStart = start;
+        ed->dirty = 0;
+    }
+    size_t end = ed->line.N < start + shown ? ed->line.N : start + shown;
+    size_t from = ed->dirty > start ? ed->dirty : start;
+    if (from <= end) {
+        wmove(gui->inputWindow, (from - start)/W, (from - start)%W);
+        while (from < end) {
+            // Write runs of printable characters in one go; anything else shows up as a space
+            size_t run = from;
+            while (run < end && (unsigned char)ed->line.buff[run] >= ' ') {
+                run++;
+            }
+            waddnstr(gui->inputWindow, ed->line.buff + from, run - from);
+            if (run < end) {
+                waddch(gui->inputWindow, ' ');
+                run++;
+            }
+            from = run;
+        }
+        if (end - start < shown) {
+            wclrtobot(gui->inputWindow);
+        }
+    }
+    LineEditor_clean(ed);
+    wmove(gui->inputWindow, (ed->cursor - start)/W, (ed->cursor - start)%W);
+}
+
+/**
+ * @brief Hand a finished line over to typeLoop()
+ * 
+ * @param gui GUI
+ * @param line Line (copied)
+ */
+static void submitLine(struct GUI* gui, const char* line) {
+    pthread_mutex_lock(&gui->inputLock);
+    StringArray_push(&gui->inputLines, strdup(line));
+    pthread_cond_signal(&gui->inputReady);
+    pthread_mutex_unlock(&gui->inputLock);
+}
+
+void handleKey(struct Chatter* chatter, int ch) {
+    struct GUI* gui = chatter->gui;
+    struct LineEditor* ed = &gui->editor;
+    if (gui->pasting) {
+        // Everything up to the end marker goes into the line in one go
+        if (ch == KEY_PASTE_END) {
+            gui->pasting = 0;
+            LineEditor_insert(ed, gui->paste.buff, gui->paste.N);
+        }
+        else if (ch < KEY_MIN) {
+            char c = ch == '\r' ? '\n' : (char)ch;
+            ArrayListBuf_push(&gui->paste, &c, 1);
+        }
+    }
+    else if (ch == KEY_RESIZE) {
+        // The terminal changed size (ncurses turns SIGWINCH into this)
+        resizeGUI(chatter);
+    }
+    else if (ch == KEY_UP) {
+        scrollChat(chatter, 1);
+    }
+    else if (ch == KEY_DOWN) {
+        scrollChat(chatter, -1);
+    }
+    else if (ch == KEY_PPAGE) {
+        int rows = gui->CH - gui->TH;
+        scrollChat(chatter, rows > 1 ? rows - 1 : 1);
+    }
+    else if (ch == KEY_NPAGE) {
+        int rows = gui->CH - gui->TH;
+        scrollChat(chatter, rows > 1 ? 1 - rows : -1);
+    }
+    else if (ch == KEY_PASTE_BEGIN) {
+        gui->pasting = 1;
+        ArrayListBuf_clear(&gui->paste);
+    }
+    else if (ch == KEY_LEFT) {
+        LineEditor_move(ed, -1);
+    }
+    else if (ch == KEY_RIGHT) {
+        LineEditor_move(ed, 1);
+    }
+    else if (ch == KEY_HOME || ch == CTRL('a')) {
+        LineEditor_moveTo(ed, 0);
+    }
+    else if (ch == KEY_END || ch == CTRL('e')) {
+        LineEditor_moveTo(ed, ed->line.N);
+    }
+    else if (ch == CTRL('p')) {
+        LineEditor_history(ed, -1);
+    }
+    else if (ch == CTRL('n')) {
+        LineEditor_history(ed, 1);
+    }
+    else if (ch == CTRL('u')) {
+        LineEditor_clear(ed);
+    }
+    else if (ch == KEY_BACKSPACE || ch == 127 || ch == CTRL('h')) {
+        LineEditor_backspace(ed);
+    }
+    else if (ch == KEY_DC) {
+        LineEditor_delete(ed);
+    }
+    else if (ch == '\n' || ch == KEY_ENTER) {
+        submitLine(gui, LineEditor_commit(ed));
+    }
+    else if (ch >= ' ' && ch < KEY_MIN) {
+        char c = (char)ch;
+        LineEditor_insert(ed, &c, 1);
+    }
+}
+
+/**
+ * @brief Read whatever keys have been pressed, without waiting
+ * (GUI thread only)
+ * 
+ * @param chatter Chatter object
+ */
+void readKeys(struct Chatter* chatter) {
+    struct GUI* gui = chatter->gui;
+    int ch;
+    while ((ch = wgetch(gui->inputWindow)) != ERR) {
+        handleKey(chatter, ch);
+    }
+    drawInput(gui, &gui->editor);
+    wnoutrefresh(gui->inputWindow);
+    doupdate();
+}
+
 void typeLoop(struct Chatter* chatter) {
     struct GUI* gui = chatter->gui;
-    ArrayListBuf buf;
     int finishedStatus = KEEP_GOING;
     while (finishedStatus == KEEP_GOING) {
-        wclear(gui->inputWindow);
-        // Input loop
-        ArrayListBuf_init(&buf);
-        int ch = 0;
-        do {
-            ch = wgetch(gui->inputWindow);
-            if (ch == KEY_UP) {
-                // TODO: Scroll up in current conversation
-            }
-            else if (ch == KEY_DOWN) {
-                // TODO: Scroll down in current conversation
-            }
-            else if (ch == KEY_BACKSPACE || ch == KEY_DC || ch == 127) {
-                // Handle deletes in the buffer
-                if (buf.N > 0) {
-                    buf.buff[buf.N-1] = '\0';
-                    buf.N--;
-                }
-            }
-            else if(ch != '\n') {
-                // Accumulate current character
-                ArrayListBuf_push(&buf, (char*)&ch, 1);
-            }
-            wclear(gui->inputWindow);
-            for (int i = 0; i < buf.N; i++) {
-                mvwprintw(gui->inputWindow, i/gui->W, i%gui->W, "%c", buf.buff[i]);
-            }
+        pthread_mutex_lock(&gui->inputLock);
+        while (gui->inputLines.N == 0) {
+            pthread_cond_wait(&gui->inputReady, &gui->inputLock);
         }
-        while (ch != '\n');
-        ArrayListBuf_push(&buf, &NULLTERM, 1);
-        char* input = buf.buff;
+        char* input = StringArray_remove(&gui->inputLines, 0);
+        pthread_mutex_unlock(&gui->inputLock);
         finishedStatus = parseInput(chatter, input);
-        ArrayListBuf_free(&buf);
+        free(input);
     }
 }
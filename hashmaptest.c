@@ -1,20 +1,36 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "hashmap.h"
-
-int main() {
-    struct HashMap* map = HashMap_init();
-
-    HashMap_put(map, "Chris", "CoolDude");
-    HashMap_put(map, "Layla", "K00l Kat");
-    HashMap_put(map, "Celia", "Cool lady");
-    HashMap_put(map, "Hudson M0", "Yeeetman");
-    HashMap_put(map, "Chris", "Danowtch");
-    HashMap_put(map, "Layla", "My baby");
-
-    HashMap_print(map);
-
-    printf("%s\n", (char*)HashMap_get(map, "Chris"));
-
-    HashMap_free(map);
-}
+#include <stdio.h>
+#include <stdlib.h>
+#include "hashmap.h"
+
+int main() {
+    struct HashMap* map = HashMap_init();
+
+    HashMap_put(map, "Chris", "CoolDude");
+    HashMap_put(map, "Layla", "K00l Kat");
+    HashMap_put(map, "Celia", "Cool lady");
+    HashMap_put(map, "Hudson M0", "Yeeetman");
+    HashMap_put(map, "Chris", "Danowtch");
+    HashMap_put(map, "Layla", "My baby");
+
+    HashMap_print(map);
+
+    printf("%s\n", (char*)HashMap_get(map, "Chris"));
+
+    HashMap_free(map);
+
+    // Lots of keys, so the map has to grow
+    map = HashMap_init();
+    int N = 100000;
+    char* keys = (char*)malloc(N*16);
+    for (int i = 0; i < N; i++) {
+        sprintf(keys + i*16, "key%i", i);
+        HashMap_put(map, keys + i*16, keys + i*16);
+    }
+    int found = 0;
+    for (int i = 0; i < N; i++) {
+        found += HashMap_get(map, keys + i*16) == keys + i*16;
+    }
+    printf("%i of %i keys found, %i buckets\n", found, N, map->NBuckets);
+    HashMap_free(map);
+    free(keys);
+}
@@ -0,0 +1,277 @@
+// Purpose: Drive chatter from a pipe instead of a terminal, with
+// events written out as line delimited records
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "chatter.h"
+#include "headless.h"
+
+/**
+ * @brief Append a string as a quoted JSON string
+ */
+static void appendJSONString(struct ArrayListBuf* b, const char* s, size_t len) {
+    ArrayListBuf_push(b, "\"", 1);
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= ' ' && c != '"' && c != '\\') {
+            continue;
+        }
+        // Copy everything that doesn't need escaping in one go
+        ArrayListBuf_push(b, s + start, i - start);
+        start = i + 1;
+        if (c == '"' || c == '\\') {
+            ArrayListBuf_appendf(b, "\\%c", c);
+        }
+        else if (c == '\n') {
+            ArrayListBuf_push(b, "\\n", 2);
+        }
+        else if (c == '\t') {
+            ArrayListBuf_push(b, "\\t", 2);
+        }
+        else {
+            ArrayListBuf_appendf(b, "\\u%04x", c);
+        }
+    }
+    ArrayListBuf_push(b, s + start, len - start);
+    ArrayListBuf_push(b, "\"", 1);
+}
+
+/**
+ * @brief Start a record for an event on a chat
+ */
+static void beginRecord(struct ArrayListBuf* b, const char* event, struct Chat* chat) {
+    ArrayListBuf_appendf(b, "{\"event\":\"%s\"", event);
+    if (chat != NULL) {
+        ArrayListBuf_push(b, ",\"chat\":", 8);
+        appendJSONString(b, chat->name, chat->nameLen);
+    }
+}
+
+/**
+ * @brief Write the record for an event, before it's applied (the chat
+ * may not be around afterwards)
+ */
+static void formatEvent(struct ArrayListBuf* b, struct Event* event) {
+    struct Chat* chat = event->chat;
+    if (event->type == EVENT_COMPACT || event->type == EVENT_FILE_ANSWERED || event->type == EVENT_SIGNATURES_ARRIVED
+        || event->type == EVENT_HISTORY_LOADED) {
+        return; // Housekeeping; nothing to report
+    }
+    switch (event->type) {
+        case EVENT_CHAT_OPENED:
+            beginRecord(b, "opened", chat);
+            break;
+        case EVENT_MESSAGE_ARRIVED:
+            beginRecord(b, "message", chat);
+            ArrayListBuf_appendf(b, ",\"id\":%u,\"text\":", event->message->id);
+            appendJSONString(b, Message_text(event->message), event->message->len);
+            break;
+        case EVENT_MESSAGE_DELETED:
+            beginRecord(b, "deleted", chat);
+            ArrayListBuf_appendf(b, ",\"id\":%u", event->id);
+            break;
+        case EVENT_NAME_CHANGED:
+            beginRecord(b, "name", chat);
+            ArrayListBuf_push(b, ",\"name\":", 8);
+            appendJSONString(b, event->name, strlen(event->name));
+            break;
+        case EVENT_TRANSFER_PROGRESS:
+            beginRecord(b, "transfer", chat);
+            ArrayListBuf_appendf(b, ",\"done\":%llu,\"total\":%llu",
+                (unsigned long long)event->done, (unsigned long long)event->total);
+            break;
+        case EVENT_FILE_QUERIED:
+            // Offered a file I already had, so it wasn't sent again
+            beginRecord(b, "transfer", chat);
+            ArrayListBuf_appendf(b, ",\"done\":%llu,\"total\":%llu,\"duplicate\":true",
+                (unsigned long long)event->done, (unsigned long long)event->total);
+            break;
+        case EVENT_CHAT_CLOSED:
+            beginRecord(b, "closed", chat);
+            break;
+    }
+    ArrayListBuf_push(b, "}\n", 2);
+}
+
+void* headlessEventLoop(void* args) {
+    struct Chatter* chatter = (struct Chatter*)args;
+    struct ArrayListBuf records;
+    ArrayListBuf_init(&records);
+    while (1) {
+        EventQueue_wait(chatter->events, -1, -1);
+        if (atomic_load(&chatter->stopping)) {
+            break;
+        }
+        // Write out everything that came in together with one write
+        ArrayListBuf_clear(&records);
+        struct Event* event;
+        while ((event = EventQueue_pop(chatter->events)) != NULL) {
+            formatEvent(&records, event);
+            handleEvent(chatter, event);
+        }
+        if (records.N > 0) {
+            printRecords(&records);
+        }
+    }
+    ArrayListBuf_free(&records);
+    return NULL;
+}
+
+void printRecords(struct ArrayListBuf* b) {
+    flockfile(stdout);
+    fwrite(b->buff, 1, b->N, stdout);
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+void printErrorRecord(const char* error) {
+    struct ArrayListBuf record;
+    ArrayListBuf_init(&record);
+    beginRecord(&record, "error", NULL);
+    ArrayListBuf_push(&record, ",\"text\":", 8);
+    appendJSONString(&record, error, strlen(error));
+    ArrayListBuf_push(&record, "}\n", 2);
+    printRecords(&record);
+    ArrayListBuf_free(&record);
+}
+
+void formatResultRecord(struct ArrayListBuf* b, struct Chat* chat, struct Message* msg) {
+    beginRecord(b, "result", chat);
+    ArrayListBuf_appendf(b, ",\"id\":%u,\"mine\":%s,\"text\":", msg->id, (msg->flags & MESSAGE_OUTGOING) ? "true" : "false");
+    appendJSONString(b, Message_text(msg), msg->len);
+    ArrayListBuf_push(b, "}\n", 2);
+}
+
+void formatSearchedRecord(struct ArrayListBuf* b, const char* query, size_t results) {
+    beginRecord(b, "searched", NULL);
+    ArrayListBuf_push(b, ",\"query\":", 9);
+    appendJSONString(b, query, strlen(query));
+    ArrayListBuf_appendf(b, ",\"results\":%zu}\n", results);
+}
+
+void formatChatStatsRecord(struct ArrayListBuf* b, struct Chat* chat) {
+    size_t messages = Timeline_size(&chat->timeline);
+    beginRecord(b, "stats", chat);
+    ArrayListBuf_appendf(b, ",\"messages\":%zu,\"resident\":%zu,\"residentBytes\":%llu,\"spilled\":%zu,\"archived\":%zu}\n",
+        messages, messages - chat->timeline.spilled - chat->timeline.archived, (unsigned long long)chat->timeline.residentBytes,
+        chat->timeline.spilled, chat->timeline.archived);
+}
+
+void formatMemoryRecord(struct ArrayListBuf* b, uint64_t budget, uint64_t chatBudget) {
+    beginRecord(b, "memory", NULL);
+    ArrayListBuf_appendf(b, ",\"residentBytes\":%llu,\"budget\":%llu,\"chatBudget\":%llu,\"spilled\":%llu,\"spillFileBytes\":%llu}\n",
+        (unsigned long long)Timeline_totalResident(), (unsigned long long)budget, (unsigned long long)chatBudget,
+        (unsigned long long)Timeline_totalSpilled(), (unsigned long long)Timeline_spillFileBytes());
+}
+
+void formatTransferRecord(struct ArrayListBuf* b, const struct Transfer* transfer, const char* state, const char* summary) {
+    double rate, left;
+    Transfer_rate(transfer, &rate, &left);
+    beginRecord(b, "sending", NULL);
+    ArrayListBuf_appendf(b, ",\"id\":%u,\"name\":", transfer->id);
+    appendJSONString(b, transfer->name, strlen(transfer->name));
+    const char* note = atomic_load(&transfer->note);
+    if (note != NULL) {
+        ArrayListBuf_appendf(b, ",\"note\":\"%s\"", note);
+    }
+    ArrayListBuf_appendf(b, ",\"state\":\"%s\",\"done\":%llu,\"total\":%llu,\"bytesPerSecond\":%.0f,\"secondsLeft\":%.0f",
+        state, (unsigned long long)atomic_load(&transfer->done), (unsigned long long)atomic_load(&transfer->total), rate, left);
+    if (summary != NULL) {
+        ArrayListBuf_push(b, ",\"summary\":", 11);
+        appendJSONString(b, summary, strlen(summary));
+    }
+    ArrayListBuf_push(b, "}\n", 2);
+}
+
+/**
+ * @brief Run each line of a stream as a command
+ * 
+ * @return int READY_TO_EXIT if a command said to exit, otherwise KEEP_GOING at end of file
+ */
+static int runCommands(struct Chatter* chatter, FILE* in) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int finishedStatus = KEEP_GOING;
+    while (finishedStatus == KEEP_GOING && (len = getline(&line, &capacity, in)) != -1) {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            finishedStatus = parseInput(chatter, line);
+        }
+    }
+    free(line);
+    return finishedStatus;
+}
+
+static void commandsFromFIFO(struct Chatter* chatter, const char* fifo) {
+    if (mkfifo(fifo, 0600) == -1 && errno != EEXIST) {
+        printErrorRecord("Error creating command FIFO");
+        return;
+    }
+    int finishedStatus = KEEP_GOING;
+    while (finishedStatus == KEEP_GOING) {
+        // Blocks until something opens the FIFO to write
+        FILE* in = fopen(fifo, "r");
+        if (in == NULL) {
+            printErrorRecord("Error opening command FIFO");
+            return;
+        }
+        finishedStatus = runCommands(chatter, in);
+        fclose(in);
+    }
+}
+
+static void commandsFromSocket(struct Chatter* chatter, const char* socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        printErrorRecord("Command socket path is too long");
+        return;
+    }
+    strcpy(addr.sun_path, socketPath);
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (sockfd == -1 || bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sockfd, 1) == -1) {
+        printErrorRecord("Error opening command socket");
+        if (sockfd != -1) {
+            close(sockfd);
+        }
+        return;
+    }
+    int finishedStatus = KEEP_GOING;
+    while (finishedStatus == KEEP_GOING) {
+        int client = accept(sockfd, NULL, NULL);
+        if (client == -1) {
+            continue;
+        }
+        FILE* in = fdopen(client, "r");
+        finishedStatus = runCommands(chatter, in);
+        fclose(in);
+    }
+    close(sockfd);
+    unlink(socketPath);
+}
+
+void headlessLoop(struct Chatter* chatter, const char* fifo, const char* socketPath) {
+    if (fifo != NULL) {
+        commandsFromFIFO(chatter, fifo);
+    }
+    else if (socketPath != NULL) {
+        commandsFromSocket(chatter, socketPath);
+    }
+    else {
+        runCommands(chatter, stdin);
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct Chatter;
+struct Chat;
+
+/**
+ * Running without a terminal (e.g. as a bot, a relay endpoint, or one
+ * of many instances in a load test).  Commands are the same ones typed
+ * into the GUI, one per line; everything that happens is written to
+ * stdout as one JSON object per line, e.g.
+ *
+ *   {"event":"message","chat":"bob","id":3,"text":"hi"}
+ *
+ * with "event" one of opened, message, deleted, name, transfer,
+ * sending, closed or error.  A transfer record with "duplicate":true is a file
+ * that was already in the file store, so it wasn't sent again.  A
+ * sending record is a file I'm sending, as it starts, every so often
+ * while it goes, and when it's done, failed or cancelled; transfers
+ * writes one for each file being sent, then a transfers record.  A search writes a result record for each message
+ * found, then a searched record; stats writes a stats record for each
+ * chat, then a memory record.
+ */
+
+/**
+ * @brief Apply events published by the network threads and write a
+ * record for each (the headless counterpart of refreshGUILoop())
+ * 
+ * @param args Chatter object
+ */
+void* headlessEventLoop(void* args);
+
+/**
+ * @brief Write an error record
+ * 
+ * @param error Error message
+ */
+void printErrorRecord(const char* error);
+
+struct ArrayListBuf;
+struct Message;
+
+/**
+ * @brief Add a record for a message a search found to a buffer
+ * 
+ * @param b Buffer
+ * @param chat Chat the message is in
+ * @param msg Message
+ */
+void formatResultRecord(struct ArrayListBuf* b, struct Chat* chat, struct Message* msg);
+
+/**
+ * @brief Add the record that ends a search's results to a buffer
+ * 
+ * @param b Buffer
+ * @param query What was searched for
+ * @param results How many results there were
+ */
+void formatSearchedRecord(struct ArrayListBuf* b, const char* query, size_t results);
+
+/**
+ * @brief Add a record of how many of a chat's messages are in memory,
+ * how many are spilled to disk and how many are still only in its
+ * history to a buffer
+ * 
+ * @param b Buffer
+ * @param chat Chat
+ */
+void formatChatStatsRecord(struct ArrayListBuf* b, struct Chat* chat);
+
+/**
+ * @brief Add the record that ends the stats: memory held by messages
+ * across all chats, the budgets, and the spill file
+ * 
+ * @param b Buffer
+ * @param budget Memory budget for all chats (0 if none)
+ * @param chatBudget Memory budget for each chat (0 if none)
+ */
+void formatMemoryRecord(struct ArrayListBuf* b, uint64_t budget, uint64_t chatBudget);
+
+struct Transfer;
+
+/**
+ * @brief Add a record of how a file being sent is getting on to a buffer
+ * 
+ * @param b Buffer
+ * @param transfer Transfer sending it
+ * @param state queued, running, done, failed or cancelled
+ * @param summary How it went, e.g. how busy each stage sending it was (NULL to leave out)
+ */
+void formatTransferRecord(struct ArrayListBuf* b, const struct Transfer* transfer, const char* state, const char* summary);
+
+/**
+ * @brief Write out records all at once
+ * 
+ * @param b Records
+ */
+void printRecords(struct ArrayListBuf* b);
+
+/**
+ * @brief Run commands until one of them is exit.  Commands come from
+ * stdin (until end of file) unless a FIFO or a Unix socket is given;
+ * a FIFO is created if need be and reopened whenever its writer goes
+ * away, and clients of a socket are served one at a time
+ * 
+ * @param chatter Chatter object
+ * @param fifo Path of a FIFO to read commands from, or NULL
+ * @param socketPath Path of a Unix socket to accept commands on, or NULL
+ */
+void headlessLoop(struct Chatter* chatter, const char* fifo, const char* socketPath);
+
+#endif
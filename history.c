@@ -0,0 +1,907 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "history.h"
+
+#define HISTORY_ALIGN 8 // Records start on 8 byte boundaries
+
+ARRAYLIST_DEFINE(TextArray, const char*)
+
+static uint64_t History_padded(uint32_t len) {
+    return ((uint64_t)len + HISTORY_ALIGN - 1) & ~(uint64_t)(HISTORY_ALIGN - 1);
+}
+
+/**
+ * @brief FNV-1a over the header (after the checksum itself) and the text
+ */
+static uint32_t History_checksum(const struct HistoryRecord* record, const char* text) {
+    uint32_t h = 2166136261u;
+    const unsigned char* p = (const unsigned char*)record + sizeof(record->check);
+    for (size_t i = sizeof(record->check); i < sizeof(struct HistoryRecord); i++) {
+        h = (h ^ *p++)*16777619u;
+    }
+    p = (const unsigned char*)text;
+    for (uint32_t i = 0; i < record->len; i++) {
+        h = (h ^ p[i])*16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief mkdir -p
+ */
+static int History_mkdirs(const char* dir) {
+    char* path = strdup(dir);
+    int res = 0;
+    for (char* p = path + 1; res == 0; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+                res = -1;
+            }
+            *p = c;
+            if (c == '\0') {
+                break;
+            }
+        }
+    }
+    free(path);
+    return res;
+}
+
+/**
+ * @brief Directory for a peer's segments.  Anything in the name that
+ * isn't safe in a file name is written as %XX
+ */
+static char* History_peerDir(struct History* history, const char* peer) {
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    ArrayListBuf_appendf(&b, "%s/", history->dir);
+    for (const unsigned char* p = (const unsigned char*)peer; *p != '\0'; p++) {
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_' || *p == '-') {
+            ArrayListBuf_push(&b, (const char*)p, 1);
+        }
+        else {
+            ArrayListBuf_appendf(&b, "%%%02X", *p);
+        }
+    }
+    char* dir = strdup(ArrayListBuf_cstr(&b));
+    ArrayListBuf_free(&b);
+    return dir;
+}
+
+static char* History_segmentPath(const char* dir, uint32_t segment) {
+    char* path = (char*)malloc(strlen(dir) + 20);
+    sprintf(path, "%s/%08u.log", dir, segment);
+    return path;
+}
+
+/**
+ * @brief Number of segments in a peer's directory (they're numbered from 0)
+ */
+static uint32_t History_countSegments(const char* dir) {
+    uint32_t count = 0;
+    DIR* d = opendir(dir);
+    if (d != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            unsigned int n;
+            char ext[8];
+            if (sscanf(entry->d_name, "%8u.%3s", &n, ext) == 2 && strcmp(ext, "log") == 0 && n + 1 > count) {
+                count = n + 1;
+            }
+        }
+        closedir(d);
+    }
+    return count;
+}
+
+/**
+ * @brief Map a whole segment into memory to read
+ *
+ * @return const char* Start of it, or NULL if it's empty or can't be mapped
+ */
+static const char* History_map(int fd, uint64_t size) {
+    if (fd == -1 || size == 0) {
+        return NULL;
+    }
+    const char* base = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    madvise((void*)base, size, MADV_SEQUENTIAL);
+    return base;
+}
+
+/**
+ * @brief Walk the records of a mapped segment, noting where each
+ * message is and the timestamps of its tombstones
+ *
+ * @param entries Messages are added here (may be NULL)
+ * @param texts Where each message's text is in the mapping is added here (if entries isn't NULL)
+ * @param deleted Tombstones' timestamps are added here
+ * @return uint64_t Bytes of whole, intact records at the start of the segment
+ */
+static uint64_t History_walk(const char* base, uint64_t size, HistoryEntryArray* entries, TextArray* texts, TimestampArray* deleted) {
+    uint64_t off = 0;
+    while (base != NULL && size - off >= sizeof(struct HistoryRecord)) {
+        const struct HistoryRecord* record = (const struct HistoryRecord*)(base + off);
+        const char* text = base + off + sizeof(struct HistoryRecord);
+        uint64_t end = off + sizeof(struct HistoryRecord) + History_padded(record->len);
+        if (end > size || record->check != History_checksum(record, text)) {
+            break; // Torn write; nothing after it can be trusted
+        }
+        if (record->flags & MESSAGE_DELETED) {
+            TimestampArray_push(deleted, record->timestamp);
+        }
+        else if (entries != NULL) {
+            struct HistoryEntry entry = {off, record->timestamp, record->id, (uint16_t)(record->flags & MESSAGE_OUTGOING), record->len};
+            HistoryEntryArray_push(entries, entry);
+            TextArray_push(texts, text);
+        }
+        off = end;
+    }
+    return off;
+}
+
+static int History_compareTimestamps(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Whether a timestamp is in a sorted array
+ */
+static int History_isDeleted(const TimestampArray* deleted, uint64_t timestamp) {
+    size_t lo = 0, hi = deleted->N;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if (deleted->data[mid] == timestamp) {
+            return 1;
+        }
+        if (deleted->data[mid] < timestamp) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether a log has enough tombstones to be worth compacting
+ * (NOTE: Caller must hold history->lock)
+ */
+static int HistoryLog_dueForCompaction(struct HistoryLog* log) {
+    return log->tombstones >= HISTORY_COMPACT_MIN && log->tombstones*HISTORY_COMPACT_RATIO >= log->records;
+}
+
+/**
+ * @brief Write a whole buffer, however many calls it takes
+ */
+static int History_writeAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write out a log's records and sync them (flusher, or the
+ * closer once the flusher can no longer see the log)
+ */
+static void HistoryLog_write(struct HistoryLog* log, struct ArrayListBuf* records) {
+    if (records->N == 0 || log->fd == -1) {
+        return;
+    }
+    if (log->size > 0 && log->size + records->N > log->history->segmentSize) {
+        // Start the next segment; the full one is never written again
+        char* path = History_segmentPath(log->dir, log->segment + 1);
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        free(path);
+        if (fd != -1) {
+            close(log->fd);
+            log->fd = fd;
+            log->segment++;
+            log->size = 0;
+        }
+    }
+    if (History_writeAll(log->fd, records->buff, records->N) == -1 || fdatasync(log->fd) == -1) {
+        fprintf(stderr, "Error %i writing history to %s\n", errno, log->dir);
+    }
+    log->size += records->N;
+    ArrayListBuf_clear(records);
+}
+
+/**
+ * @brief Write out whatever's been appended, gathering appends for a
+ * little while first so that they share one sync
+ */
+static void* History_flushLoop(void* args) {
+    struct History* history = (struct History*)args;
+    pthread_mutex_lock(&history->lock);
+    while (!history->stopping || history->dirty) {
+        if (!history->dirty) {
+            pthread_cond_wait(&history->changed, &history->lock);
+            continue;
+        }
+        if (!history->stopping) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += HISTORY_COMMIT_MS*1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!history->stopping && pthread_cond_timedwait(&history->changed, &history->lock, &deadline) != ETIMEDOUT);
+        }
+        // Take everything pending and write it without the lock held
+        HistoryLogArray_clear(&history->flushing);
+        for (size_t i = 0; i < history->logs.N; i++) {
+            struct HistoryLog* log = history->logs.data[i];
+            if (log->pending.N > 0 && !log->busy && log->fd != -1) {
+                // (A log the worker has is left for it to hand back, and
+                // one it hasn't opened yet for it to open)
+                struct ArrayListBuf swap = log->writing;
+                log->writing = log->pending;
+                log->pending = swap;
+                log->busy = 1;
+                HistoryLogArray_push(&history->flushing, log);
+            }
+        }
+        history->dirty = 0;
+        pthread_mutex_unlock(&history->lock);
+        for (size_t i = 0; i < history->flushing.N; i++) {
+            struct HistoryLog* log = history->flushing.data[i];
+            HistoryLog_write(log, &log->writing);
+        }
+        pthread_mutex_lock(&history->lock);
+        for (size_t i = 0; i < history->flushing.N; i++) {
+            history->flushing.data[i]->busy = 0;
+        }
+        pthread_cond_broadcast(&history->idle);
+    }
+    pthread_mutex_unlock(&history->lock);
+    return NULL;
+}
+
+/**
+ * @brief Move a compacted segment's index over to where its messages
+ * are now (NOTE: Caller must hold log->indexLock)
+ *
+ * @param moves Old and new offset of each message kept, in pairs, in order
+ * @param N Number of pairs
+ */
+static void HistoryLog_reindex(struct HistoryLog* log, uint32_t segment, const uint64_t* moves, size_t N) {
+    if (segment >= log->segments.N) {
+        return; // Appended since the log was opened, so nothing refers to it
+    }
+    struct HistorySegment* seg = &log->segments.data[segment];
+    if (seg->fd != -1) {
+        close(seg->fd); // Still the old file
+        seg->fd = -1;
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < seg->entries.N; i++) {
+        struct HistoryEntry* entry = &seg->entries.data[i];
+        if (entry->offset == HISTORY_GONE) {
+            continue;
+        }
+        while (j < N && moves[2*j] < entry->offset) {
+            j++;
+        }
+        entry->offset = j < N && moves[2*j] == entry->offset ? moves[2*j + 1] : HISTORY_GONE;
+    }
+}
+
+/**
+ * @brief Rewrite one finished segment without some records
+ *
+ * @param log Log it's in (busy)
+ * @param segment Segment's number
+ * @param deleted Timestamps of deleted messages, sorted
+ * @param droppedMessages Increased by the number of deleted messages taken out
+ * @param droppedTombstones Increased by the number of tombstones taken out
+ */
+static void History_compactSegment(struct HistoryLog* log, uint32_t segment, const TimestampArray* deleted, uint64_t* droppedMessages, uint64_t* droppedTombstones) {
+    char* path = History_segmentPath(log->dir, segment);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        free(path);
+        return;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    const char* base = History_map(fd, size);
+    close(fd);
+    if (base == NULL) {
+        free(path);
+        return;
+    }
+    struct ArrayListBuf kept;
+    ArrayListBuf_init(&kept);
+    TimestampArray moves; // Where each message that's kept goes
+    TimestampArray_init(&moves);
+    uint64_t messages = 0, tombstones = 0;
+    uint64_t off = 0;
+    while (size - off >= sizeof(struct HistoryRecord)) {
+        const struct HistoryRecord* record = (const struct HistoryRecord*)(base + off);
+        uint64_t end = off + sizeof(struct HistoryRecord) + History_padded(record->len);
+        if (end > size) {
+            break;
+        }
+        if (record->flags & MESSAGE_DELETED) {
+            tombstones++;
+        }
+        else if (History_isDeleted(deleted, record->timestamp)) {
+            messages++;
+        }
+        else {
+            TimestampArray_push(&moves, off);
+            TimestampArray_push(&moves, kept.N);
+            ArrayListBuf_push(&kept, base + off, end - off); // Already checksummed and padded
+        }
+        off = end;
+    }
+    munmap((void*)base, size);
+    if (messages + tombstones > 0) {
+        if (kept.N == 0) {
+            pthread_mutex_lock(&log->indexLock);
+            unlink(path);
+            HistoryLog_reindex(log, segment, NULL, 0);
+            pthread_mutex_unlock(&log->indexLock);
+        }
+        else {
+            // Write the new segment beside the old one (as NNNNNNNN.tmp,
+            // which loading ignores), then swap it in; messages are only
+            // read back under the index lock, so none is read from the
+            // new file at an old offset
+            char* tmpPath = strdup(path);
+            strcpy(tmpPath + strlen(tmpPath) - 3, "tmp");
+            fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+            int res = fd == -1 || History_writeAll(fd, kept.buff, kept.N) == -1 || fdatasync(fd) == -1 ? -1 : 0;
+            if (res == 0) {
+                pthread_mutex_lock(&log->indexLock);
+                res = rename(tmpPath, path);
+                if (res == 0) {
+                    HistoryLog_reindex(log, segment, moves.data, moves.N/2);
+                }
+                pthread_mutex_unlock(&log->indexLock);
+            }
+            if (res == -1) {
+                fprintf(stderr, "Error %i compacting %s\n", errno, path);
+                unlink(tmpPath);
+                messages = tombstones = 0;
+            }
+            if (fd != -1) {
+                close(fd);
+            }
+            free(tmpPath);
+        }
+        *droppedMessages += messages;
+        *droppedTombstones += tombstones;
+    }
+    TimestampArray_free(&moves);
+    ArrayListBuf_free(&kept);
+    free(path);
+}
+
+/**
+ * @brief Hand back a log the worker was busy with
+ * (NOTE: Caller must hold history->lock)
+ */
+static void HistoryLog_release(struct HistoryLog* log) {
+    struct History* history = log->history;
+    log->busy = 0;
+    if (log->pending.N > 0 && !history->dirty) {
+        // Appended to while the flusher had to leave it alone
+        history->dirty = 1;
+        pthread_cond_signal(&history->changed);
+    }
+    pthread_cond_broadcast(&history->idle);
+}
+
+/**
+ * @brief Compact a log the caller has marked busy, then hand it back
+ */
+static void HistoryLog_compactBusy(struct HistoryLog* log) {
+    struct History* history = log->history;
+    // Write out what's pending so its tombstones count too, then start
+    // a new segment so that every one with records in is finished
+    struct ArrayListBuf pending;
+    ArrayListBuf_init(&pending);
+    pthread_mutex_lock(&history->lock);
+    struct ArrayListBuf swap = log->pending;
+    log->pending = pending;
+    pending = swap;
+    pthread_mutex_unlock(&history->lock);
+    HistoryLog_write(log, &pending);
+    ArrayListBuf_free(&pending);
+    if (log->size > 0) {
+        char* path = History_segmentPath(log->dir, log->segment + 1);
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        free(path);
+        if (fd != -1) {
+            close(log->fd);
+            log->fd = fd;
+            log->segment++;
+            log->size = 0;
+        }
+    }
+    // Tombstones only ever come after the message they delete, so all
+    // of them in finished segments can go along with their messages
+    TimestampArray deleted;
+    TimestampArray_init(&deleted);
+    for (uint32_t segment = 0; segment < log->segment; segment++) {
+        char* path = History_segmentPath(log->dir, segment);
+        int fd = open(path, O_RDONLY);
+        free(path);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0) {
+            const char* base = History_map(fd, (uint64_t)st.st_size);
+            History_walk(base, (uint64_t)st.st_size, NULL, NULL, &deleted);
+            if (base != NULL) {
+                munmap((void*)base, (uint64_t)st.st_size);
+            }
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    uint64_t droppedMessages = 0, droppedTombstones = 0;
+    if (deleted.N > 0) {
+        qsort(deleted.data, deleted.N, sizeof(uint64_t), History_compareTimestamps);
+        for (uint32_t segment = 0; segment < log->segment; segment++) {
+            History_compactSegment(log, segment, &deleted, &droppedMessages, &droppedTombstones);
+        }
+        int dirfd = open(log->dir, O_RDONLY | O_DIRECTORY);
+        if (dirfd != -1) {
+            fsync(dirfd); // Make the renames stick
+            close(dirfd);
+        }
+    }
+    TimestampArray_free(&deleted);
+    pthread_mutex_lock(&history->lock);
+    log->records -= droppedMessages;
+    log->tombstones -= droppedTombstones;
+    HistoryLog_release(log);
+    pthread_mutex_unlock(&history->lock);
+}
+
+/**
+ * @brief Load the next segment of a log the caller has marked busy,
+ * newest first, then hand it back.  The first time round, that's
+ * finding the segment being appended to and cutting off anything torn
+ * at its end
+ *
+ * @param deliver Whether to hand the messages to the History's loadedFn
+ */
+static void HistoryLog_loadNext(struct HistoryLog* log, int deliver) {
+    struct History* history = log->history;
+    int opening = log->fd == -1;
+    uint32_t segment;
+    int fd;
+    if (opening) {
+        uint32_t segments = History_countSegments(log->dir);
+        segment = segments > 0 ? segments - 1 : 0;
+        char* path = History_segmentPath(log->dir, segment);
+        fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+        free(path);
+        if (fd == -1) {
+            fprintf(stderr, "Error %i opening history in %s\n", errno, log->dir);
+        }
+        pthread_mutex_lock(&log->indexLock);
+        while (log->segments.N <= segment) {
+            struct HistorySegment empty;
+            HistoryEntryArray_init(&empty.entries);
+            empty.fd = -1;
+            HistorySegmentArray_push(&log->segments, empty);
+        }
+        pthread_mutex_unlock(&log->indexLock);
+    }
+    else {
+        segment = log->unloaded - 1;
+        char* path = History_segmentPath(log->dir, segment);
+        fd = open(path, O_RDONLY);
+        free(path);
+    }
+    struct stat st;
+    uint64_t size = fd != -1 && fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    const char* base = History_map(fd, size);
+    HistoryEntryArray entries;
+    HistoryEntryArray_init(&entries);
+    TextArray texts;
+    TextArray_init(&texts);
+    size_t tombstonesBefore = log->deleted.N;
+    uint64_t valid = History_walk(base, size, &entries, &texts, &log->deleted);
+    if (opening) {
+        if (valid < size && ftruncate(fd, (off_t)valid) == -1) {
+            fprintf(stderr, "Error %i cutting off a torn record in %s\n", errno, log->dir);
+        }
+        pthread_mutex_lock(&history->lock);
+        log->fd = fd;
+        log->segment = segment;
+        log->size = valid;
+        pthread_mutex_unlock(&history->lock);
+    }
+    else if (fd != -1) {
+        close(fd);
+    }
+    // Leave out messages deleted by a tombstone here or in a newer segment
+    uint64_t records = entries.N;
+    uint64_t tombstones = log->deleted.N - tombstonesBefore;
+    if (log->deleted.N > 0) {
+        qsort(log->deleted.data, log->deleted.N, sizeof(uint64_t), History_compareTimestamps); // data is NULL until there's one
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.N; i++) {
+        if (!History_isDeleted(&log->deleted, entries.data[i].timestamp)) {
+            entries.data[kept] = entries.data[i];
+            texts.data[kept++] = texts.data[i];
+        }
+    }
+    entries.N = texts.N = kept;
+    HistoryEntryArray_shrink(&entries);
+    pthread_mutex_lock(&log->indexLock);
+    struct HistorySegment* seg = &log->segments.data[segment];
+    HistoryEntryArray_free(&seg->entries);
+    seg->entries = entries; // Only ever changed by this thread, so still safe to read here
+    pthread_mutex_unlock(&log->indexLock);
+    log->unloaded = segment;
+    int last = segment == 0 || (opening && fd == -1); // (No use carrying on without somewhere to append)
+    if (deliver && (kept > 0 || last)) {
+        TimestampArray refs;
+        TimestampArray_init(&refs);
+        for (size_t i = 0; i < kept; i++) {
+            TimestampArray_push(&refs, ((uint64_t)segment << 32) | i);
+        }
+        struct HistoryBatch batch = {refs.data, seg->entries.data, texts.data, kept, last};
+        history->loadedFn(history->ctx, log, &batch);
+        TimestampArray_free(&refs);
+    }
+    if (base != NULL) {
+        munmap((void*)base, size);
+    }
+    TextArray_free(&texts);
+    pthread_mutex_lock(&history->lock);
+    log->records += records;
+    log->tombstones += tombstones;
+    if (last) {
+        TimestampArray_free(&log->deleted);
+        log->loaded = 1;
+        log->compact = log->compact || HistoryLog_dueForCompaction(log);
+    }
+    HistoryLog_release(log);
+    pthread_mutex_unlock(&history->lock);
+}
+
+/**
+ * @brief Load and compact logs as they need it, a segment or a
+ * compaction at a time, taking turns between them
+ */
+static void* History_workLoop(void* args) {
+    struct History* history = (struct History*)args;
+    pthread_mutex_lock(&history->lock);
+    while (!history->stopping) {
+        struct HistoryLog* log = NULL;
+        size_t N = history->logs.N;
+        for (size_t i = 0; i < N && log == NULL; i++) {
+            struct HistoryLog* candidate = history->logs.data[(history->turn + i) % N];
+            if (!candidate->busy && (!candidate->loaded || candidate->compact)) {
+                log = candidate;
+                history->turn = (history->turn + i + 1) % N;
+            }
+        }
+        if (log == NULL) {
+            pthread_cond_wait(&history->workDue, &history->lock);
+            continue;
+        }
+        log->busy = 1; // Keeps the flusher off it, and it open
+        int load = !log->loaded;
+        if (!load) {
+            log->compact = 0;
+        }
+        pthread_mutex_unlock(&history->lock);
+        if (load) {
+            HistoryLog_loadNext(log, 1);
+        }
+        else {
+            HistoryLog_compactBusy(log);
+        }
+        pthread_mutex_lock(&history->lock);
+    }
+    pthread_mutex_unlock(&history->lock);
+    return NULL;
+}
+
+void HistoryLog_compact(struct HistoryLog* log) {
+    struct History* history = log->history;
+    pthread_mutex_lock(&history->lock);
+    while (log->busy || !log->loaded) {
+        pthread_cond_wait(&history->idle, &history->lock);
+    }
+    log->compact = 0;
+    log->busy = 1;
+    pthread_mutex_unlock(&history->lock);
+    HistoryLog_compactBusy(log);
+}
+
+struct History* History_init(const char* dir, History_LoadedFn loadedFn, void* ctx) {
+    if (History_mkdirs(dir) == -1) {
+        return NULL;
+    }
+    struct History* history = (struct History*)malloc(sizeof(struct History));
+    history->dir = strdup(dir);
+    history->segmentSize = HISTORY_SEGMENT_SIZE;
+    pthread_mutex_init(&history->lock, NULL);
+    pthread_cond_init(&history->changed, NULL);
+    pthread_cond_init(&history->idle, NULL);
+    pthread_cond_init(&history->workDue, NULL);
+    HistoryLogArray_init(&history->logs);
+    HistoryLogArray_init(&history->flushing);
+    history->dirty = 0;
+    history->stopping = 0;
+    history->turn = 0;
+    history->loadedFn = loadedFn;
+    history->ctx = ctx;
+    if (pthread_create(&history->flusher, NULL, History_flushLoop, (void*)history) != 0) {
+        HistoryLogArray_free(&history->logs);
+        HistoryLogArray_free(&history->flushing);
+        free(history->dir);
+        free(history);
+        return NULL;
+    }
+    if (pthread_create(&history->worker, NULL, History_workLoop, (void*)history) != 0) {
+        pthread_mutex_lock(&history->lock);
+        history->stopping = 1;
+        pthread_cond_signal(&history->changed);
+        pthread_mutex_unlock(&history->lock);
+        pthread_join(history->flusher, NULL);
+        HistoryLogArray_free(&history->logs);
+        HistoryLogArray_free(&history->flushing);
+        free(history->dir);
+        free(history);
+        return NULL;
+    }
+    return history;
+}
+
+void History_free(struct History* history) {
+    pthread_mutex_lock(&history->lock);
+    history->stopping = 1;
+    pthread_cond_signal(&history->changed);
+    pthread_cond_signal(&history->workDue);
+    pthread_mutex_unlock(&history->lock);
+    pthread_join(history->worker, NULL);
+    pthread_join(history->flusher, NULL);
+    while (history->logs.N > 0) {
+        // Shouldn't happen, but don't leak them
+        HistoryLog_close(history->logs.data[0]);
+    }
+    HistoryLogArray_free(&history->logs);
+    HistoryLogArray_free(&history->flushing);
+    pthread_mutex_destroy(&history->lock);
+    pthread_cond_destroy(&history->changed);
+    pthread_cond_destroy(&history->idle);
+    pthread_cond_destroy(&history->workDue);
+    free(history->dir);
+    free(history);
+}
+
+struct HistoryLog* History_open(struct History* history, const char* peer, uint64_t owner) {
+    char* dir = History_peerDir(history, peer);
+    if (History_mkdirs(dir) == -1) {
+        free(dir);
+        return NULL;
+    }
+    // Two logs appending to the same segments would write over each
+    // other's records, so whoever has it open first keeps it.  flock()
+    // locks belong to the open file, so this also keeps out a second
+    // open in this process
+    char* path = (char*)malloc(strlen(dir) + 8);
+    sprintf(path, "%s/lock", dir);
+    int lockFd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (lockFd == -1 || flock(lockFd, LOCK_EX | LOCK_NB) == -1) {
+        if (lockFd != -1) {
+            close(lockFd);
+        }
+        free(dir);
+        return NULL;
+    }
+    struct HistoryLog* log = (struct HistoryLog*)malloc(sizeof(struct HistoryLog));
+    log->history = history;
+    log->dir = dir;
+    log->lockFd = lockFd;
+    log->owner = owner;
+    log->fd = -1;
+    log->segment = 0;
+    log->size = 0;
+    ArrayListBuf_init(&log->pending);
+    ArrayListBuf_init(&log->writing);
+    log->busy = 0;
+    log->loaded = 0;
+    log->unloaded = 0;
+    TimestampArray_init(&log->deleted);
+    log->records = 0;
+    log->tombstones = 0;
+    log->compact = 0;
+    pthread_mutex_init(&log->indexLock, NULL);
+    HistorySegmentArray_init(&log->segments);
+    pthread_mutex_lock(&history->lock);
+    HistoryLogArray_push(&history->logs, log);
+    pthread_cond_signal(&history->workDue);
+    pthread_mutex_unlock(&history->lock);
+    return log;
+}
+
+struct Message* HistoryLog_read(struct HistoryLog* log, uint64_t ref) {
+    uint32_t segment = (uint32_t)(ref >> 32);
+    uint32_t i = (uint32_t)ref;
+    struct Message* msg = NULL;
+    struct HistoryRecord record;
+    pthread_mutex_lock(&log->indexLock);
+    if (segment < log->segments.N && i < log->segments.data[segment].entries.N) {
+        struct HistorySegment* seg = &log->segments.data[segment];
+        struct HistoryEntry entry = seg->entries.data[i];
+        if (entry.offset != HISTORY_GONE && seg->fd == -1) {
+            char* path = History_segmentPath(log->dir, segment);
+            seg->fd = open(path, O_RDONLY);
+            free(path);
+        }
+        if (entry.offset != HISTORY_GONE && seg->fd != -1
+            && pread(seg->fd, &record, sizeof(record), (off_t)entry.offset) == sizeof(record)
+            && record.len == entry.len && record.timestamp == entry.timestamp) {
+            msg = Message_alloc(record.id, record.len);
+            if (msg != NULL && (pread(seg->fd, Message_text(msg), record.len, (off_t)(entry.offset + sizeof(record))) != (ssize_t)record.len
+                || record.check != History_checksum(&record, Message_text(msg)))) {
+                Message_free(msg);
+                msg = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&log->indexLock);
+    if (msg != NULL) {
+        msg->timestamp = record.timestamp;
+        msg->flags |= record.flags & MESSAGE_OUTGOING;
+    }
+    return msg;
+}
+
+static struct Message* HistoryLog_readArchived(void* ctx, uint64_t ref) {
+    return HistoryLog_read((struct HistoryLog*)ctx, ref);
+}
+
+static int HistoryLog_header(void* ctx, uint64_t ref, uint64_t* timestamp, uint16_t* id, uint16_t* flags) {
+    struct HistoryLog* log = (struct HistoryLog*)ctx;
+    uint32_t segment = (uint32_t)(ref >> 32);
+    uint32_t i = (uint32_t)ref;
+    int res = -1;
+    *timestamp = 0;
+    *id = 0;
+    *flags = 0;
+    pthread_mutex_lock(&log->indexLock);
+    if (segment < log->segments.N && i < log->segments.data[segment].entries.N) {
+        const struct HistoryEntry* entry = &log->segments.data[segment].entries.data[i];
+        // A message that's been compacted away keeps its place in time
+        *timestamp = entry->timestamp;
+        *id = entry->id;
+        *flags = entry->flags;
+        res = entry->offset == HISTORY_GONE ? -1 : 0;
+    }
+    pthread_mutex_unlock(&log->indexLock);
+    return res;
+}
+
+static const struct TimelineArchive historyArchive = {HistoryLog_readArchived, HistoryLog_header};
+
+void HistoryLog_attach(struct HistoryLog* log, struct Timeline* tl) {
+    Timeline_setArchive(tl, &historyArchive, log);
+}
+
+/**
+ * @brief Add a record to a log's pending ones, checksummed and padded
+ */
+static void HistoryLog_queue(struct HistoryLog* log, struct HistoryRecord* record, const char* text) {
+    record->reserved = 0;
+    record->check = History_checksum(record, text);
+    static const char zeros[HISTORY_ALIGN] = {0};
+    struct History* history = log->history;
+    pthread_mutex_lock(&history->lock);
+    ArrayListBuf_push(&log->pending, (const char*)record, sizeof(*record));
+    ArrayListBuf_push(&log->pending, text, record->len);
+    ArrayListBuf_push(&log->pending, zeros, History_padded(record->len) - record->len);
+    if (record->flags & MESSAGE_DELETED) {
+        log->tombstones++;
+        if (!log->compact && HistoryLog_dueForCompaction(log)) {
+            log->compact = 1;
+            pthread_cond_signal(&history->workDue);
+        }
+    }
+    else {
+        log->records++;
+    }
+    if (!history->dirty) {
+        history->dirty = 1;
+        pthread_cond_signal(&history->changed);
+    }
+    pthread_mutex_unlock(&history->lock);
+}
+
+void HistoryLog_append(struct HistoryLog* log, const struct Message* msg) {
+    struct HistoryRecord record;
+    record.len = msg->len;
+    record.timestamp = msg->timestamp;
+    record.id = msg->id;
+    record.flags = msg->flags & MESSAGE_OUTGOING;
+    HistoryLog_queue(log, &record, Message_text((struct Message*)msg));
+}
+
+void HistoryLog_delete(struct HistoryLog* log, uint64_t timestamp) {
+    struct HistoryRecord record;
+    record.len = 0;
+    record.timestamp = timestamp;
+    record.id = 0;
+    record.flags = MESSAGE_DELETED;
+    HistoryLog_queue(log, &record, "");
+}
+
+void HistoryLog_close(struct HistoryLog* log) {
+    struct History* history = log->history;
+    pthread_mutex_lock(&history->lock);
+    for (size_t i = 0; i < history->logs.N; i++) {
+        if (history->logs.data[i] == log) {
+            HistoryLogArray_remove(&history->logs, i);
+            break;
+        }
+    }
+    while (log->busy) {
+        pthread_cond_wait(&history->idle, &history->lock);
+    }
+    pthread_mutex_unlock(&history->lock);
+    // The flusher and worker can't see the log any more, so finish it
+    // off here (checking the end of the last segment first, if the
+    // worker never got to it)
+    if (log->fd == -1) {
+        HistoryLog_loadNext(log, 0);
+    }
+    HistoryLog_write(log, &log->pending);
+    if (log->fd != -1) {
+        close(log->fd);
+    }
+    for (size_t i = 0; i < log->segments.N; i++) {
+        if (log->segments.data[i].fd != -1) {
+            close(log->segments.data[i].fd);
+        }
+        HistoryEntryArray_free(&log->segments.data[i].entries);
+    }
+    HistorySegmentArray_free(&log->segments);
+    pthread_mutex_destroy(&log->indexLock);
+    TimestampArray_free(&log->deleted);
+    ArrayListBuf_free(&log->pending);
+    ArrayListBuf_free(&log->writing);
+    close(log->lockFd); // Only now that nothing more will be written
+    free(log->dir);
+    free(log);
+}
@@ -0,0 +1,249 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "arraylist.h"
+#include "message.h"
+#include "timeline.h"
+
+#define HISTORY_SEGMENT_SIZE (16 << 20) // Bytes a segment grows to before the next one is started
+#define HISTORY_COMMIT_MS 20 // How long appends are gathered up before they're written and synced together
+#define HISTORY_COMPACT_MIN 256 // Tombstones a log has before it's worth compacting...
+#define HISTORY_COMPACT_RATIO 4 // ...and only once there's at least 1 for every this many messages
+
+/**
+ * What's written to disk in front of every message's text.  The text
+ * follows, padded out so the next header is 8 byte aligned.  Headers
+ * are in host byte order; history never leaves the machine.
+ *
+ * Deleting a message appends a tombstone: a record with no text,
+ * flagged MESSAGE_DELETED, with the deleted message's timestamp.
+ * Loading skips messages that have one.
+ */
+struct HistoryRecord {
+    uint32_t check; // Checksum of the rest of the header and the text, to spot torn writes
+    uint32_t len; // Length of the text
+    uint64_t timestamp; // Message's timestamp
+    uint16_t id; // Message's id
+    uint16_t flags; // MESSAGE_OUTGOING if I sent it, MESSAGE_DELETED for a tombstone
+    uint32_t reserved;
+};
+
+#define HISTORY_GONE UINT64_MAX // Offset of a message compaction has taken out
+
+/**
+ * Where to find a message in a segment that's been loaded, and what a
+ * timeline needs to know about it without reading it
+ */
+struct HistoryEntry {
+    uint64_t offset; // Of its record in the segment, or HISTORY_GONE
+    uint64_t timestamp;
+    uint16_t id;
+    uint16_t flags; // MESSAGE_OUTGOING if I sent it
+    uint32_t len; // Length of its text
+};
+
+ARRAYLIST_DEFINE(HistoryEntryArray, struct HistoryEntry)
+ARRAYLIST_DEFINE(TimestampArray, uint64_t)
+
+/**
+ * Index of one segment's messages (but not those already deleted when
+ * it was loaded), in the order they're in the file.  A message is
+ * referred to by its segment's number in the top 32 bits and its place
+ * in entries in the bottom ones.
+ */
+struct HistorySegment {
+    HistoryEntryArray entries;
+    int fd; // Opened once a message is read back from it (-1 until then)
+};
+
+ARRAYLIST_DEFINE(HistorySegmentArray, struct HistorySegment)
+
+struct History;
+
+/**
+ * The history kept for one peer: a directory of numbered segment
+ * files that are only ever appended to.  Appends are copied into
+ * pending and written out by the History's flusher thread.  Once
+ * enough of the records are deleted messages and their tombstones, the
+ * History's worker thread rewrites the segments without them.
+ *
+ * Opening a log reads nothing; the worker thread loads it a segment at
+ * a time, newest first, indexing where each message is and handing
+ * them over in batches (see History_LoadedFn), and their text is only
+ * read back when a timeline asks for it (see HistoryLog_attach()).
+ */
+struct HistoryLog {
+    struct History* history;
+    char* dir; // Directory the segments live in
+    int lockFd; // Holds the directory's lock file locked while the log is open
+    uint64_t owner; // Whatever History_open() was given
+    int fd; // Segment being appended to (-1 until the worker has checked its end)
+    uint32_t segment; // Number of that segment
+    uint64_t size; // Bytes in that segment
+    struct ArrayListBuf pending; // Records waiting to be written (guarded by history->lock)
+    struct ArrayListBuf writing; // Records being written by the flusher
+    int busy; // Whether the flusher or worker is using this log (guarded by history->lock)
+    int loaded; // Whether every segment has been loaded (guarded by history->lock)
+    uint32_t unloaded; // Segments that are still to be loaded (worker only)
+    TimestampArray deleted; // Timestamps of tombstones met so far in loading, sorted (worker only)
+    uint64_t records; // Messages in the segments loaded, and appended since, deleted or not (guarded by history->lock)
+    uint64_t tombstones; // Tombstones in the same (guarded by history->lock)
+    int compact; // Whether the log is waiting to be compacted (guarded by history->lock)
+    pthread_mutex_t indexLock; // Guards segments, and reading messages back
+    HistorySegmentArray segments; // Index of each segment that's been loaded, by number
+};
+
+ARRAYLIST_DEFINE(HistoryLogArray, struct HistoryLog*)
+
+/**
+ * Messages the worker has just loaded from one segment of a log
+ */
+struct HistoryBatch {
+    const uint64_t* refs; // References for HistoryLog_read() and timelines
+    const struct HistoryEntry* entries; // Timestamp, id and flags of each
+    const char* const* texts; // Text of each (only valid during the call)
+    size_t N;
+    int last; // Whether it's the last batch, with the oldest messages
+};
+
+/**
+ * @brief Take a batch of messages as they're loaded, on the worker
+ * thread.  Batches come newest first, and the messages in each oldest
+ * first; every message in a batch is older than those in the last one,
+ * and than anything appended since the log was opened.  The log can't
+ * be closed until this returns
+ *
+ * @param ctx Whatever was passed to History_init()
+ * @param log Log they're from
+ * @param batch Messages
+ */
+typedef void (*History_LoadedFn)(void* ctx, struct HistoryLog* log, const struct HistoryBatch* batch);
+
+/**
+ * Every peer's history, under one directory.  A single flusher thread
+ * does all the writing: whatever was appended while it waited goes out
+ * in one write and one fdatasync() per log (group commit), so appending
+ * never waits on the disk.  A separate worker thread loads logs as
+ * they're opened and takes deleted messages back out of them, so that
+ * neither opening nor deleting waits on the disk either.  It does one
+ * segment at a time, taking turns between logs, so a big history
+ * doesn't hold up anyone else's.
+ */
+struct History {
+    char* dir;
+    uint64_t segmentSize; // Size at which a new segment is started
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // Something was appended, or the flusher should stop
+    pthread_cond_t idle; // The flusher or worker finished with some logs
+    pthread_cond_t workDue; // Some log should be loaded or compacted, or the worker should stop
+    HistoryLogArray logs; // Open logs (guarded by lock)
+    HistoryLogArray flushing; // Logs being written (flusher only)
+    int dirty; // Whether any log has pending records (guarded by lock)
+    int stopping; // (guarded by lock)
+    size_t turn; // Where in logs the worker looks for work next (guarded by lock)
+    History_LoadedFn loadedFn;
+    void* ctx; // Passed to loadedFn
+    pthread_t flusher;
+    pthread_t worker;
+};
+
+/**
+ * @brief Keep history under a directory (created if need be) and start
+ * the flusher and worker threads.  Nothing is read until a log is opened
+ *
+ * @param dir Directory
+ * @param loadedFn Given the messages in each log as they're loaded
+ * @param ctx Passed to loadedFn
+ * @return struct History*, or NULL if the directory can't be created
+ */
+struct History* History_init(const char* dir, History_LoadedFn loadedFn, void* ctx);
+
+/**
+ * @brief Write out whatever's pending, stop the threads and free the
+ * history.  Every log should have been closed already
+ *
+ * @param history
+ */
+void History_free(struct History* history);
+
+/**
+ * @brief Open a peer's history for appending.  Only the directory is
+ * touched here; the worker then loads the messages already in it, in
+ * the background (see History_LoadedFn), cutting off a record left half
+ * written by a crash before anything is appended.  Deleted messages
+ * aren't loaded.  A peer's history can only be open once at a time, in
+ * this process or any other, as peers can give the same name
+ *
+ * @param history
+ * @param peer Name of the peer
+ * @param owner Whatever the caller wants to know the log by (as log->owner)
+ * @return struct HistoryLog*, or NULL if it couldn't be opened, or is
+ * already open
+ */
+struct HistoryLog* History_open(struct History* history, const char* peer, uint64_t owner);
+
+/**
+ * @brief Read a loaded message back in.  Safe to call from any thread
+ *
+ * @param log
+ * @param ref Reference from a batch
+ * @return struct Message*, or NULL if it's been compacted away or can't be read
+ */
+struct Message* HistoryLog_read(struct HistoryLog* log, uint64_t ref);
+
+/**
+ * @brief Have a timeline read archived messages back from a log, so
+ * that references from its batches can be put straight in it (see
+ * Timeline_prependArchived()).  The log has to stay open as long as
+ * the timeline has any
+ *
+ * @param log
+ * @param tl
+ */
+void HistoryLog_attach(struct HistoryLog* log, struct Timeline* tl);
+
+/**
+ * @brief Queue a message to be added to a log.  Never touches the disk;
+ * the message is durable once the flusher's next commit has synced.
+ * Safe to call from any thread
+ *
+ * @param log
+ * @param msg
+ */
+void HistoryLog_append(struct HistoryLog* log, const struct Message* msg);
+
+/**
+ * @brief Queue a tombstone for a message to be added to a log, so that
+ * it isn't loaded again.  Never touches the disk, and schedules the
+ * log to be compacted once it has enough tombstones.  Safe to call
+ * from any thread
+ *
+ * @param log
+ * @param timestamp Timestamp of the deleted message
+ */
+void HistoryLog_delete(struct HistoryLog* log, uint64_t timestamp);
+
+/**
+ * @brief Rewrite a log's segments without its deleted messages and
+ * their tombstones, now, rather than waiting for the worker (but once
+ * it's been loaded).  The segment being appended to is finished off
+ * first so that it can be compacted too.  Each segment is replaced with a rename, so a crash
+ * part way through leaves every segment either old or compacted, and
+ * loads the same messages either way
+ *
+ * @param log
+ */
+void HistoryLog_compact(struct HistoryLog* log);
+
+/**
+ * @brief Write out and sync whatever's pending on a log, then close
+ * and free it, waiting for the worker to be done with it (and calling
+ * History_LoadedFn no more)
+ *
+ * @param log
+ */
+void HistoryLog_close(struct HistoryLog* log);
+
+#endif
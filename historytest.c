@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "history.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+void freeMessages(MessageArray* messages) {
+    for (size_t i = 0; i < messages->N; i++) {
+        Message_free(messages->data[i]);
+    }
+    MessageArray_clear(messages);
+}
+
+/**
+ * What's been loaded from the log last opened with openLog()
+ */
+struct Loaded {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    MessageArray messages; // Copies of what was loaded, oldest first
+    TimestampArray refs; // Their references
+    size_t batches;
+    int last; // Whether the last batch has come
+};
+
+struct Loaded loaded = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/**
+ * Copies each batch of messages, in front of the ones before it
+ */
+void collect(void* ctx, struct HistoryLog* log, const struct HistoryBatch* batch) {
+    struct Loaded* got = (struct Loaded*)ctx;
+    pthread_mutex_lock(&got->lock);
+    for (size_t i = 0; i < batch->N; i++) {
+        const struct HistoryEntry* entry = &batch->entries[i];
+        struct Message* msg = Message_init(entry->id, batch->texts[i], entry->len);
+        msg->timestamp = entry->timestamp;
+        msg->flags |= entry->flags;
+        MessageArray_insert(&got->messages, i, msg);
+        TimestampArray_insert(&got->refs, i, batch->refs[i]);
+    }
+    got->batches++;
+    got->last = batch->last;
+    pthread_cond_broadcast(&got->changed);
+    pthread_mutex_unlock(&got->lock);
+}
+
+/**
+ * @brief Open a log and wait for it to be loaded
+ */
+struct HistoryLog* openLog(struct History* history, const char* peer) {
+    freeMessages(&loaded.messages);
+    TimestampArray_clear(&loaded.refs);
+    loaded.batches = 0;
+    loaded.last = 0;
+    struct HistoryLog* log = History_open(history, peer, 0);
+    pthread_mutex_lock(&loaded.lock);
+    while (log != NULL && !loaded.last) {
+        pthread_cond_wait(&loaded.changed, &loaded.lock);
+    }
+    pthread_mutex_unlock(&loaded.lock);
+    return log;
+}
+
+int main() {
+    char dir[] = "/tmp/historytestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        return 1;
+    }
+    struct History* history = History_init(dir, collect, &loaded);
+    check(history != NULL, "init");
+    struct HistoryLog* log = openLog(history, "alice");
+    check(log != NULL && loaded.messages.N == 0 && loaded.batches == 1, "a new peer has no history");
+    char text[200];
+    for (int i = 0; i < 100; i++) {
+        // Some short, some long enough to live on the heap
+        sprintf(text, "message %i%s", i, i % 10 == 0 ? " which is long enough that it doesn't fit inside the struct" : "");
+        struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)strlen(text));
+        msg->timestamp = 1000 + i;
+        if (i % 2) {
+            msg->flags |= MESSAGE_OUTGOING;
+        }
+        HistoryLog_append(log, msg);
+        Message_free(msg);
+    }
+    HistoryLog_close(log);
+
+    log = openLog(history, "alice");
+    int ok = log != NULL && loaded.messages.N == 100;
+    int read = ok;
+    for (size_t i = 0; ok && i < loaded.messages.N; i++) {
+        struct Message* msg = loaded.messages.data[i];
+        sprintf(text, "message %i%s", (int)i, i % 10 == 0 ? " which is long enough that it doesn't fit inside the struct" : "");
+        ok = msg->id == i && msg->timestamp == 1000 + i && strcmp(Message_text(msg), text) == 0 && msg->len == strlen(text)
+            && (msg->flags & MESSAGE_OUTGOING) == (i % 2 ? MESSAGE_OUTGOING : 0);
+        struct Message* back = HistoryLog_read(log, loaded.refs.data[i]);
+        read = read && back != NULL && back->id == msg->id && back->timestamp == msg->timestamp && back->flags == msg->flags
+            && back->len == msg->len && strcmp(Message_text(back), text) == 0;
+        Message_free(back);
+    }
+    check(ok, "messages come back as they went in");
+    check(read, "and can be read back by reference");
+
+    struct History* other = History_init(dir, collect, &loaded);
+    check(History_open(history, "alice", 1) == NULL && History_open(other, "alice", 1) == NULL,
+        "a peer's history is only open once, so two chats with the same name can't write over each other");
+    struct HistoryLog* bob = openLog(other, "../bob/x");
+    check(bob != NULL && loaded.messages.N == 0, "peers are kept apart, whatever they're called");
+    HistoryLog_close(bob);
+    History_free(other);
+
+    // Group commit: a burst of appends goes out shortly afterwards without closing
+    for (int i = 0; i < 1000; i++) {
+        struct Message* msg = Message_init(7, "burst", 5);
+        HistoryLog_append(log, msg);
+        Message_free(msg);
+    }
+    usleep(5*HISTORY_COMMIT_MS*1000);
+    char path[100];
+    sprintf(path, "%s/alice/00000000.log", dir);
+    struct stat st;
+    stat(path, &st);
+    check(history->dirty == 0 && log->pending.N == 0 && log->size == (uint64_t)st.st_size && st.st_size > 1000*32, "appends are written without closing");
+
+    // A record half written when the process died
+    int fd = open(path, O_WRONLY | O_APPEND);
+    char torn[20] = {1, 2, 3};
+    if (write(fd, torn, sizeof(torn)) != sizeof(torn)) {
+        check(0, "write torn record");
+    }
+    close(fd);
+    HistoryLog_close(log);
+    log = openLog(history, "alice");
+    stat(path, &st);
+    check(loaded.messages.N == 1100 && log->size == (uint64_t)st.st_size, "a torn record is cut off");
+
+    // Segments roll over, and are read back in order
+    history->segmentSize = 4096;
+    for (int i = 0; i < 500; i++) {
+        sprintf(text, "rolled %i", i);
+        struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)strlen(text));
+        HistoryLog_append(log, msg);
+        Message_free(msg);
+    }
+    HistoryLog_close(log);
+    log = openLog(history, "alice");
+    ok = log != NULL && log->segment > 0 && loaded.messages.N == 1600 && loaded.batches == log->segment + 1;
+    for (int i = 0; ok && i < 500; i++) {
+        sprintf(text, "rolled %i", i);
+        ok = strcmp(Message_text(loaded.messages.data[1100 + i]), text) == 0;
+    }
+    check(ok, "segments roll over, and are loaded a batch each, newest first");
+    HistoryLog_close(log);
+    History_free(history);
+
+    // Deletes are kept as tombstones, and compaction takes both out
+    history = History_init(dir, collect, &loaded);
+    history->segmentSize = 4096;
+    log = openLog(history, "dave");
+    for (int i = 0; i < 1000; i++) {
+        sprintf(text, "dave %i", i);
+        struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)strlen(text));
+        msg->timestamp = 5000 + i;
+        HistoryLog_append(log, msg);
+        Message_free(msg);
+    }
+    HistoryLog_delete(log, 5000 + 3);
+    HistoryLog_close(log);
+    log = openLog(history, "dave");
+    check(loaded.messages.N == 999 && loaded.messages.data[3]->timestamp == 5000 + 4 && log->tombstones == 1 && log->records == 1000 && !log->compact,
+        "deleted messages stay deleted");
+    // What a chat would have in its timeline
+    struct Timeline tl;
+    Timeline_init(&tl);
+    HistoryLog_attach(log, &tl);
+    Timeline_prependArchived(&tl, loaded.refs.data, loaded.refs.N);
+    for (int i = 0; i < 1000; i += 3) {
+        HistoryLog_delete(log, 5000 + i);
+    }
+    usleep(5*HISTORY_COMMIT_MS*1000);
+    HistoryLog_compact(log); // Waits for the compactor if it's already started
+    uint32_t sealed = log->segment;
+    uint64_t bytes = 0;
+    for (uint32_t segment = 0; segment < sealed; segment++) {
+        sprintf(path, "%s/dave/%08u.log", dir, segment);
+        if (stat(path, &st) == 0) {
+            bytes += (uint64_t)st.st_size;
+        }
+    }
+    check(log->tombstones == 0 && log->records == 666 && bytes == 666*(sizeof(struct HistoryRecord) + 8), "compaction takes out deleted messages and tombstones");
+    ok = Timeline_size(&tl) == 999;
+    for (size_t i = 0; ok && i < Timeline_size(&tl); i++) {
+        uint64_t timestamp;
+        uint16_t id, flags;
+        Timeline_header(&tl, i, &timestamp, &id, &flags);
+        int j = (int)(timestamp - 5000);
+        struct Message* msg = Timeline_get(&tl, i);
+        sprintf(text, "dave %i", j);
+        ok = j % 3 == 0 ? (flags & MESSAGE_DELETED) && (msg->flags & MESSAGE_DELETED)
+            : !(flags & MESSAGE_DELETED) && msg->timestamp == timestamp && strcmp(Message_text(msg), text) == 0;
+    }
+    check(ok, "a timeline still reads what's left from where it's moved to");
+    Timeline_free(&tl);
+    struct Message* msg = Message_init(1000, "after", 5);
+    msg->timestamp = 7000;
+    HistoryLog_append(log, msg);
+    Message_free(msg);
+    HistoryLog_close(log);
+    log = openLog(history, "dave");
+    ok = loaded.messages.N == 667 && loaded.messages.data[666]->timestamp == 7000;
+    for (int i = 0, j = 0; ok && i < 1000; i++) {
+        if (i % 3 != 0) {
+            ok = loaded.messages.data[j++]->timestamp == (uint64_t)(5000 + i);
+        }
+    }
+    check(ok, "what's left loads as before");
+    HistoryLog_close(log);
+    History_free(history);
+
+    // Opening a peer doesn't depend on anyone else's history, or on its own
+    history = History_init(dir, collect, &loaded);
+    for (int p = 0; p < 50; p++) {
+        sprintf(text, "peer%i", p);
+        log = openLog(history, text);
+        for (int i = 0; i < (p == 0 ? 200000 : 2000); i++) {
+            struct Message* msg = Message_init((uint16_t)i, "padding out the history", 23);
+            HistoryLog_append(log, msg);
+            Message_free(msg);
+        }
+        HistoryLog_close(log);
+    }
+    struct timespec start, opened, done;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    log = History_open(history, "carol", 0);
+    clock_gettime(CLOCK_MONOTONIC, &opened);
+    double fresh = (opened.tv_sec - start.tv_sec)*1e3 + (opened.tv_nsec - start.tv_nsec)/1e6;
+    HistoryLog_close(log);
+    freeMessages(&loaded.messages);
+    TimestampArray_clear(&loaded.refs);
+    loaded.last = 0;
+    // (Time spent by this thread, so the worker getting going doesn't count)
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    log = History_open(history, "peer0", 0);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &opened);
+    double full = (opened.tv_sec - start.tv_sec)*1e3 + (opened.tv_nsec - start.tv_nsec)/1e6;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&loaded.lock);
+    while (!loaded.last) {
+        pthread_cond_wait(&loaded.changed, &loaded.lock);
+    }
+    pthread_mutex_unlock(&loaded.lock);
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    double load = (done.tv_sec - start.tv_sec)*1e3 + (done.tv_nsec - start.tv_nsec)/1e6;
+    check(loaded.messages.N == 200000, "load a peer with 200000 messages among 300000");
+    check(full < 1 && full < load/10, "opening it doesn't wait for them");
+    printf("      open with no history %.3f ms, with 200000 messages %.3f ms (loaded in %.1f ms)\n", fresh, full, load);
+    HistoryLog_close(log);
+    History_free(history);
+
+    freeMessages(&loaded.messages);
+    MessageArray_free(&loaded.messages);
+    TimestampArray_free(&loaded.refs);
+    char command[100];
+    sprintf(command, "rm -r %s", dir);
+    if (system(command) != 0) {
+        printf("couldn't remove %s\n", dir);
+    }
+    return failures;
+}
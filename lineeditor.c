@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lineeditor.h"
+
+void LineEditor_init(struct LineEditor* ed) {
+    ArrayListBuf_init(&ed->line);
+    ArrayListBuf_init(&ed->draft);
+    StringArray_init(&ed->history);
+    ed->cursor = 0;
+    ed->historyPos = 0;
+    ed->dirty = 0;
+}
+
+void LineEditor_free(struct LineEditor* ed) {
+    for (size_t i = 0; i < ed->history.N; i++) {
+        free(ed->history.data[i]);
+    }
+    StringArray_free(&ed->history);
+    ArrayListBuf_free(&ed->line);
+    ArrayListBuf_free(&ed->draft);
+}
+
+/**
+ * @brief Note that the line may have changed from some offset on
+ */
+static void LineEditor_touch(struct LineEditor* ed, size_t from) {
+    if (from < ed->dirty) {
+        ed->dirty = from;
+    }
+}
+
+void LineEditor_insert(struct LineEditor* ed, const char* text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    struct ArrayListBuf* line = &ed->line;
+    ArrayListBuf_reserve(line, line->N + len + 1);
+    memmove(line->buff + ed->cursor + len, line->buff + ed->cursor, line->N - ed->cursor);
+    memcpy(line->buff + ed->cursor, text, len);
+    line->N += len;
+    LineEditor_touch(ed, ed->cursor);
+    ed->cursor += len;
+}
+
+void LineEditor_backspace(struct LineEditor* ed) {
+    if (ed->cursor > 0) {
+        ed->cursor--;
+        LineEditor_delete(ed);
+    }
+}
+
+void LineEditor_delete(struct LineEditor* ed) {
+    struct ArrayListBuf* line = &ed->line;
+    if (ed->cursor < line->N) {
+        memmove(line->buff + ed->cursor, line->buff + ed->cursor + 1, line->N - ed->cursor - 1);
+        line->N--;
+        LineEditor_touch(ed, ed->cursor);
+    }
+}
+
+void LineEditor_move(struct LineEditor* ed, long delta) {
+    if (delta < 0 && (size_t)(-delta) > ed->cursor) {
+        ed->cursor = 0;
+    }
+    else {
+        LineEditor_moveTo(ed, ed->cursor + delta);
+    }
+}
+
+void LineEditor_moveTo(struct LineEditor* ed, size_t pos) {
+    ed->cursor = pos < ed->line.N ? pos : ed->line.N;
+}
+
+/**
+ * @brief Replace the whole line with some text, cursor at the end
+ */
+static void LineEditor_set(struct LineEditor* ed, const char* text, size_t len) {
+    ArrayListBuf_clear(&ed->line);
+    if (len > 0) {
+        ArrayListBuf_push(&ed->line, text, len);
+    }
+    ed->cursor = len;
+    LineEditor_touch(ed, 0);
+}
+
+void LineEditor_history(struct LineEditor* ed, int direction) {
+    if (direction < 0 && ed->historyPos > 0) {
+        if (ed->historyPos == ed->history.N) {
+            ArrayListBuf_clear(&ed->draft);
+            ArrayListBuf_push(&ed->draft, ed->line.buff, ed->line.N);
+        }
+        ed->historyPos--;
+        char* text = ed->history.data[ed->historyPos];
+        LineEditor_set(ed, text, strlen(text));
+    }
+    else if (direction > 0 && ed->historyPos < ed->history.N) {
+        ed->historyPos++;
+        if (ed->historyPos == ed->history.N) {
+            LineEditor_set(ed, ed->draft.buff, ed->draft.N);
+        }
+        else {
+            char* text = ed->history.data[ed->historyPos];
+            LineEditor_set(ed, text, strlen(text));
+        }
+    }
+}
+
+void LineEditor_clear(struct LineEditor* ed) {
+    LineEditor_set(ed, "", 0);
+}
+
+char* LineEditor_commit(struct LineEditor* ed) {
+    char* text = ArrayListBuf_cstr(&ed->line);
+    size_t N = ed->history.N;
+    if (ed->line.N > 0 && (N == 0 || strcmp(ed->history.data[N-1], text) != 0)) {
+        if (N == LINEEDITOR_HISTORY) {
+            free(StringArray_remove(&ed->history, 0));
+        }
+        StringArray_push(&ed->history, strdup(text));
+    }
+    ed->historyPos = ed->history.N;
+    // The caller gets the line's storage; the new line starts out empty
+    ed->line.N = 0;
+    ed->cursor = 0;
+    LineEditor_touch(ed, 0);
+    return text;
+}
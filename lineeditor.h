@@ -0,0 +1,95 @@
+#ifndef LINEEDITOR_H
+#define LINEEDITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arraylist.h"
+
+#define LINEEDITOR_HISTORY 100 // Most lines remembered
+
+ARRAYLIST_DEFINE(StringArray, char*)
+
+/**
+ * The line the user is typing, a cursor into it, and the lines they
+ * typed before.  Nothing here draws anything: instead, every edit
+ * records the first offset whose character may have changed (dirty),
+ * so that whoever shows the line only has to redraw from there on.
+ */
+struct LineEditor {
+    struct ArrayListBuf line; // Line being edited
+    size_t cursor; // Offset the next character is inserted at
+    size_t dirty; // Everything before this offset is unchanged since LineEditor_clean()
+    StringArray history; // Lines committed so far, oldest first (dynamically allocated)
+    size_t historyPos; // Line of history being shown (history.N for the new line)
+    struct ArrayListBuf draft; // The new line, put aside while browsing history
+};
+
+void LineEditor_init(struct LineEditor* ed);
+void LineEditor_free(struct LineEditor* ed);
+
+/**
+ * @brief Insert text at the cursor and move the cursor past it.  A
+ * whole paste goes in with a single call, moving the rest of the line
+ * only once
+ * 
+ * @param ed Editor
+ * @param text Text to insert
+ * @param len Length of the text
+ */
+void LineEditor_insert(struct LineEditor* ed, const char* text, size_t len);
+
+/**
+ * @brief Delete the character before the cursor (backspace)
+ */
+void LineEditor_backspace(struct LineEditor* ed);
+
+/**
+ * @brief Delete the character under the cursor (delete)
+ */
+void LineEditor_delete(struct LineEditor* ed);
+
+/**
+ * @brief Move the cursor, stopping at either end of the line
+ * 
+ * @param ed Editor
+ * @param delta Characters to move right (negative for left)
+ */
+void LineEditor_move(struct LineEditor* ed, long delta);
+
+/**
+ * @brief Move the cursor to an offset, stopping at the end of the line
+ */
+void LineEditor_moveTo(struct LineEditor* ed, size_t pos);
+
+/**
+ * @brief Replace the line with an older (-1) or newer (+1) one from
+ * the history.  Going past the newest line brings back what was being
+ * typed before browsing
+ * 
+ * @param ed Editor
+ * @param direction -1 or +1
+ */
+void LineEditor_history(struct LineEditor* ed, int direction);
+
+/**
+ * @brief Empty the line
+ */
+void LineEditor_clear(struct LineEditor* ed);
+
+/**
+ * @brief Finish the line: remember it in the history (unless it's
+ * empty or repeats the last one) and start a new, empty line
+ * 
+ * @param ed Editor
+ * @return char* The finished line, valid until the next edit
+ */
+char* LineEditor_commit(struct LineEditor* ed);
+
+/**
+ * @brief Note that the line has been drawn as it is now
+ */
+static inline void LineEditor_clean(struct LineEditor* ed) {
+    ed->dirty = SIZE_MAX;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lineeditor.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+int lineIs(struct LineEditor* ed, char* text) {
+    return ed->line.N == strlen(text) && strncmp(ed->line.buff, text, ed->line.N) == 0;
+}
+
+int main() {
+    struct LineEditor ed;
+    LineEditor_init(&ed);
+    LineEditor_insert(&ed, "send hi", 7);
+    check(lineIs(&ed, "send hi") && ed.cursor == 7 && ed.dirty == 0, "insert");
+
+    LineEditor_clean(&ed);
+    LineEditor_insert(&ed, "!", 1);
+    check(lineIs(&ed, "send hi!") && ed.dirty == 7, "typing at the end only dirties the new character");
+
+    LineEditor_clean(&ed);
+    LineEditor_move(&ed, -3);
+    check(ed.cursor == 5 && ed.dirty == SIZE_MAX, "moving left doesn't dirty anything");
+    LineEditor_insert(&ed, "oh ", 3);
+    check(lineIs(&ed, "send oh hi!") && ed.cursor == 8 && ed.dirty == 5, "insert in the middle");
+
+    LineEditor_backspace(&ed);
+    LineEditor_moveTo(&ed, 0);
+    LineEditor_delete(&ed);
+    check(lineIs(&ed, "end ohhi!") && ed.cursor == 0, "backspace and delete");
+    LineEditor_backspace(&ed);
+    LineEditor_move(&ed, 100);
+    LineEditor_delete(&ed);
+    check(lineIs(&ed, "end ohhi!") && ed.cursor == 9, "deleting past either end does nothing");
+
+    char* line = LineEditor_commit(&ed);
+    check(strcmp(line, "end ohhi!") == 0 && ed.line.N == 0 && ed.cursor == 0, "commit");
+    LineEditor_insert(&ed, "second", 6);
+    LineEditor_commit(&ed);
+    LineEditor_commit(&ed);
+    LineEditor_insert(&ed, "second", 6);
+    LineEditor_commit(&ed);
+    check(ed.history.N == 2, "empty and repeated lines aren't remembered");
+
+    LineEditor_insert(&ed, "draft", 5);
+    LineEditor_history(&ed, -1);
+    check(lineIs(&ed, "second") && ed.cursor == 6, "history back");
+    LineEditor_history(&ed, -1);
+    LineEditor_history(&ed, -1);
+    check(lineIs(&ed, "end ohhi!"), "history stops at the oldest line");
+    LineEditor_history(&ed, 1);
+    LineEditor_history(&ed, 1);
+    check(lineIs(&ed, "draft"), "history forward brings the draft back");
+
+    for (int i = 0; i < LINEEDITOR_HISTORY + 10; i++) {
+        char text[20];
+        LineEditor_clear(&ed);
+        LineEditor_insert(&ed, text, sprintf(text, "line %d", i));
+        LineEditor_commit(&ed);
+    }
+    check(ed.history.N == LINEEDITOR_HISTORY && strcmp(ed.history.data[0], "line 10") == 0, "history is bounded");
+
+    // A 100KB paste, typed one character at a time into the middle of
+    // a line, then pasted in one go
+    size_t len = 100*1024;
+    char* paste = (char*)malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        paste[i] = 'a' + i%26;
+    }
+    LineEditor_insert(&ed, "send []", 7);
+    LineEditor_move(&ed, -1);
+    clock_t start = clock();
+    for (size_t i = 0; i < len; i++) {
+        LineEditor_insert(&ed, paste + i, 1);
+    }
+    double typed = (double)(clock() - start)/CLOCKS_PER_SEC;
+    int ok = ed.line.N == len + 7 && memcmp(ed.line.buff + 6, paste, len) == 0 && ed.line.buff[len + 6] == ']';
+    LineEditor_clear(&ed);
+    LineEditor_insert(&ed, "send []", 7);
+    LineEditor_move(&ed, -1);
+    start = clock();
+    LineEditor_insert(&ed, paste, len);
+    double pasted = (double)(clock() - start)/CLOCKS_PER_SEC;
+    ok = ok && ed.line.N == len + 7 && memcmp(ed.line.buff + 6, paste, len) == 0 && ed.line.buff[len + 6] == ']';
+    check(ok, "100KB paste");
+    printf("      typed %.2f ms, pasted %.3f ms\n", typed*1000, pasted*1000);
+    free(paste);
+
+    LineEditor_free(&ed);
+    return failures;
+}
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "message.h"
+
+#define SLAB_SIZE (1 << 20) // Messages are carved out of 1MB slabs, aligned to their size
+#define SLAB_SLOTS (SLAB_SIZE/MESSAGE_SIZE - 1) // The first line holds the slab's header
+#define CACHE_BATCH 32 // Slots a thread takes from, or gives back to, the shared pool at once
+
+_Static_assert(sizeof(struct Message) == MESSAGE_SIZE, "struct Message should fill exactly one cache line");
+
+/**
+ * Messages are all the same size, so rather than paying malloc's
+ * per chunk header (which would push a 64 byte message over one line),
+ * they come out of cache line aligned slabs with a free list threaded
+ * through the unused slots.  Slabs are mapped straight from the system
+ * and aligned to their own size, so a slot's slab is found from its
+ * address, and a slab that has had every slot given back is unmapped
+ * (one is kept spare, so that a chat filling and emptying around a slab
+ * boundary doesn't keep allocating one).  Each thread keeps a few free
+ * slots of its own and only takes the pool's lock to move a batch of
+ * them in or out.
+ */
+struct FreeSlot {
+    struct FreeSlot* next;
+};
+
+struct Slab {
+    struct Slab* prev; // Neighbours among the slabs with free slots
+    struct Slab* next;
+    struct FreeSlot* freeList; // Slots given back
+    uint32_t carved; // Slots handed out at least once (the rest haven't been touched)
+    uint32_t live; // Slots out of the pool: in messages, or in a thread's cache
+};
+_Static_assert(sizeof(struct Slab) <= MESSAGE_SIZE, "a slab's header should fit in its first line");
+
+static struct {
+    pthread_mutex_t lock;
+    struct Slab* available; // Slabs with slots free or not yet carved
+    struct Slab* spare; // An empty slab kept back from being freed (also in available)
+    size_t slabs;
+} pool = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0};
+
+/**
+ * Free slots belonging to one thread, which it allocates from and frees
+ * into without locking
+ */
+struct SlotCache {
+    struct FreeSlot* slots;
+    size_t N;
+    int registered; // Whether it's flushed back to the pool when the thread exits
+};
+
+static _Thread_local struct SlotCache cache;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Map a new slab, aligned to SLAB_SIZE
+ *
+ * @return struct Slab*, or NULL if there's no memory for one
+ */
+static struct Slab* Message_mapSlab() {
+    // Twice the size, then the unaligned ends are given back
+    char* mapped = (char*)mmap(NULL, 2*SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    char* slab = (char*)(((uintptr_t)mapped + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (slab > mapped) {
+        munmap(mapped, slab - mapped);
+    }
+    munmap(slab + SLAB_SIZE, mapped + SLAB_SIZE - slab);
+    return (struct Slab*)slab; // Zeroed by mmap
+}
+
+static struct Slab* Message_slabOf(void* slot) {
+    return (struct Slab*)((uintptr_t)slot & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static int Message_slabAvailable(struct Slab* slab) {
+    return slab->freeList != NULL || slab->carved < SLAB_SLOTS;
+}
+
+static void Message_unlinkSlab(struct Slab* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        pool.available = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
+
+static void Message_linkSlab(struct Slab* slab) {
+    slab->prev = NULL;
+    slab->next = pool.available;
+    if (pool.available != NULL) {
+        pool.available->prev = slab;
+    }
+    pool.available = slab;
+}
+
+/**
+ * @brief Take up to CACHE_BATCH slots from the pool into the calling
+ * thread's cache (NOTE: Caller must hold pool.lock)
+ */
+static void Message_refill(struct SlotCache* c) {
+    while (c->N < CACHE_BATCH) {
+        struct Slab* slab = pool.available;
+        if (slab == NULL) {
+            slab = Message_mapSlab();
+            if (slab == NULL) {
+                return; // Whatever made it into the cache is still good
+            }
+            pool.slabs++;
+            Message_linkSlab(slab);
+        }
+        if (slab == pool.spare) {
+            pool.spare = NULL; // In use again
+        }
+        struct FreeSlot* slot;
+        if (slab->freeList != NULL) {
+            slot = slab->freeList;
+            slab->freeList = slot->next;
+        }
+        else {
+            slot = (struct FreeSlot*)((char*)slab + MESSAGE_SIZE*(1 + slab->carved++));
+        }
+        slab->live++;
+        if (!Message_slabAvailable(slab)) {
+            Message_unlinkSlab(slab);
+        }
+        slot->next = c->slots;
+        c->slots = slot;
+        c->N++;
+    }
+}
+
+/**
+ * @brief Give n slots from the front of a thread's cache back to their
+ * slabs, freeing any slab left empty (NOTE: Caller must hold pool.lock)
+ */
+static void Message_drain(struct SlotCache* c, size_t n) {
+    for (; n > 0 && c->slots != NULL; n--) {
+        struct FreeSlot* slot = c->slots;
+        c->slots = slot->next;
+        c->N--;
+        struct Slab* slab = Message_slabOf(slot);
+        if (!Message_slabAvailable(slab)) {
+            Message_linkSlab(slab); // Full until now
+        }
+        slot->next = slab->freeList;
+        slab->freeList = slot;
+        if (--slab->live > 0) {
+            continue;
+        }
+        if (pool.spare == NULL) {
+            pool.spare = slab;
+            continue;
+        }
+        Message_unlinkSlab(slab);
+        munmap(slab, SLAB_SIZE);
+        pool.slabs--;
+    }
+}
+
+static void Message_flushCache(void* args) {
+    struct SlotCache* c = (struct SlotCache*)args;
+    pthread_mutex_lock(&pool.lock);
+    Message_drain(c, c->N);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void Message_createCacheKey() {
+    pthread_key_create(&cacheKey, Message_flushCache);
+}
+
+/**
+ * @brief Have the calling thread's cache flushed back to the pool when it exits
+ */
+static void Message_registerCache() {
+    if (!cache.registered) {
+        pthread_once(&cacheKeyOnce, Message_createCacheKey);
+        pthread_setspecific(cacheKey, &cache);
+        cache.registered = 1;
+    }
+}
+
+static struct Message* Message_allocSlot() {
+    if (cache.N == 0) {
+        Message_registerCache();
+        pthread_mutex_lock(&pool.lock);
+        Message_refill(&cache);
+        pthread_mutex_unlock(&pool.lock);
+        if (cache.N == 0) {
+            return NULL;
+        }
+    }
+    struct FreeSlot* slot = cache.slots;
+    cache.slots = slot->next;
+    cache.N--;
+    return (struct Message*)slot;
+}
+
+static void Message_freeSlot(struct Message* msg) {
+    struct FreeSlot* slot = (struct FreeSlot*)msg;
+    Message_registerCache();
+    slot->next = cache.slots;
+    cache.slots = slot;
+    cache.N++;
+    if (cache.N >= 2*CACHE_BATCH) {
+        // Keep a batch to allocate from, give the rest back
+        pthread_mutex_lock(&pool.lock);
+        Message_drain(&cache, CACHE_BATCH);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+size_t Message_slabs() {
+    pthread_mutex_lock(&pool.lock);
+    size_t slabs = pool.slabs;
+    pthread_mutex_unlock(&pool.lock);
+    return slabs;
+}
+
+struct Message* Message_alloc(uint16_t id, uint32_t len) {
+    struct Message* msg = Message_allocSlot();
+    if (msg == NULL) {
+        return NULL;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    msg->timestamp = (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+    msg->len = len;
+    msg->id = id;
+    msg->flags = 0;
+    if ((uint64_t)len + 1 > MESSAGE_INLINE_SIZE) {
+        msg->flags |= MESSAGE_HEAP_TEXT;
+        msg->text.heap.text = (char*)malloc((uint64_t)len + 1);
+        if (msg->text.heap.text == NULL) {
+            Message_freeSlot(msg);
+            return NULL;
+        }
+        msg->text.heap.breaks = NULL;
+        msg->text.heap.rows = 0;
+        msg->text.heap.width = 0;
+        msg->text.heap.prefix = 0;
+    }
+    Message_text(msg)[len] = '\0';
+    return msg;
+}
+
+struct Message* Message_init(uint16_t id, const char* text, uint32_t len) {
+    struct Message* msg = Message_alloc(id, len);
+    if (msg == NULL) {
+        return NULL;
+    }
+    memcpy(Message_text(msg), text, len);
+    return msg;
+}
+
+void Message_free(struct Message* msg) {
+    if (msg->flags & MESSAGE_HEAP_TEXT) {
+        free(msg->text.heap.text);
+        free(msg->text.heap.breaks);
+    }
+    Message_freeSlot(msg);
+}
@@ -0,0 +1,85 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "arraylist.h"
+
+#define MESSAGE_SIZE 64 // One cache line
+#define MESSAGE_INLINE_SIZE 48 // Bytes of text (including '\0') stored inside the struct
+
+enum MessageFlags {
+    MESSAGE_HEAP_TEXT = 1, // Text didn't fit inline and lives in its own allocation
+    MESSAGE_OUTGOING = 2, // I sent this message (otherwise it came from the other person)
+    MESSAGE_REFERENCED = 4, // Looked at since the clock hand last passed (see struct Timeline)
+    MESSAGE_DELETED = 8 // Stands in for a message that was deleted (a tombstone)
+};
+
+/**
+ * A chat message.  Short messages (the common case) keep their text
+ * inline, so the whole message is a single 64 byte allocation; longer
+ * messages fall back to a separate heap buffer.  Always go through
+ * Message_text() rather than touching the union directly.
+ *
+ * Long messages also cache how they wrap onto the screen (see
+ * ChatView_layout()); short ones are cheap enough to wrap every time.
+ */
+struct Message {
+    uint64_t timestamp; // Nanoseconds since the epoch at which the message was created (see addMessage())
+    uint32_t len; // Length of the text, not counting the null terminator
+    uint16_t id;
+    uint16_t flags;
+    union {
+        struct {
+            char* text;
+            uint32_t* breaks; // Where each wrapped row after the first starts
+            uint32_t rows; // Number of wrapped rows
+            uint16_t width; // Width the rows were wrapped at (0 if not wrapped yet)
+            uint16_t prefix; // Length of the "name id: " prefix they were wrapped with
+        } heap;
+        char small[MESSAGE_INLINE_SIZE];
+    } text;
+};
+
+/**
+ * @brief Allocate a message with room for len bytes of text plus a null
+ * terminator.  The terminator is written; the text itself is left for
+ * the caller to fill in (e.g. straight from a socket)
+ *
+ * @param id Message id
+ * @param len Length of the text
+ * @return struct Message*, or NULL if there's no memory for it
+ */
+struct Message* Message_alloc(uint16_t id, uint32_t len);
+
+/**
+ * @brief Allocate a message holding a copy of some text
+ *
+ * @param id Message id
+ * @param text Text to copy
+ * @param len Length of the text
+ * @return struct Message*, or NULL if there's no memory for it
+ */
+struct Message* Message_init(uint16_t id, const char* text, uint32_t len);
+
+/**
+ * @brief Free a message and its text
+ *
+ * @param msg
+ */
+void Message_free(struct Message* msg);
+
+/**
+ * @brief Number of slabs messages are being carved out of right now
+ * (each SLAB_SIZE bytes).  Slabs are freed once every message in them
+ * is, so this falls as well as rises
+ */
+size_t Message_slabs();
+
+ARRAYLIST_DEFINE(MessageArray, struct Message*)
+
+static inline char* Message_text(struct Message* msg) {
+    return (msg->flags & MESSAGE_HEAP_TEXT) ? msg->text.heap.text : msg->text.small;
+}
+
+#endif
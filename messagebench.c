@@ -0,0 +1,118 @@
+// Purpose: Compare the memory footprint and allocation rate of
+// inline (small string optimized) message storage against the
+// old layout of a Message struct plus a separately malloc'd text buffer
+//
+// Usage: ./messagebench [number of messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "message.h"
+
+#define DEFAULT_N 10000000
+
+// The layout every message used before inline text storage
+struct OldMessage {
+    uint16_t id;
+    time_t timestamp;
+    char* text;
+};
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+long maxRSSKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * @brief Build N short messages with the old two allocation layout
+ * and report allocations and RSS, then free them all
+ */
+void benchOld(long N) {
+    long rssBefore = maxRSSKB();
+    struct OldMessage** messages = (struct OldMessage**)malloc(sizeof(struct OldMessage*)*N);
+    char text[64];
+    long allocations = 0;
+    double start = now();
+    for (long i = 0; i < N; i++) {
+        int len = sprintf(text, "hey, message number %ld", i);
+        struct OldMessage* msg = (struct OldMessage*)malloc(sizeof(struct OldMessage));
+        msg->text = (char*)malloc(len + 1);
+        strcpy(msg->text, text);
+        msg->id = (uint16_t)i;
+        msg->timestamp = time(NULL);
+        messages[i] = msg;
+        allocations += 2;
+    }
+    double elapsed = now() - start;
+    long rss = maxRSSKB() - rssBefore;
+    for (long i = 0; i < N; i++) {
+        free(messages[i]->text);
+        free(messages[i]);
+    }
+    free(messages);
+    printf("old    : %8.3f s  %5.2f allocs/msg  %7.1f M allocs/s  %8ld KB RSS  %6.1f B/msg\n",
+        elapsed, (double)allocations/N, allocations/elapsed/1e6, rss, rss*1024.0/N);
+}
+
+/**
+ * @brief Build N short messages with inline text storage
+ * and report allocations and RSS, then free them all
+ */
+void benchInline(long N) {
+    long rssBefore = maxRSSKB();
+    struct Message** messages = (struct Message**)malloc(sizeof(struct Message*)*N);
+    char text[64];
+    long allocations = 0;
+    double start = now();
+    for (long i = 0; i < N; i++) {
+        int len = sprintf(text, "hey, message number %ld", i);
+        messages[i] = Message_init((uint16_t)i, text, len);
+        allocations += (messages[i]->flags & MESSAGE_HEAP_TEXT) ? 2 : 1;
+    }
+    double elapsed = now() - start;
+    long rss = maxRSSKB() - rssBefore;
+    for (long i = 0; i < N; i++) {
+        Message_free(messages[i]);
+    }
+    free(messages);
+    printf("inline : %8.3f s  %5.2f allocs/msg  %7.1f M allocs/s  %8ld KB RSS  %6.1f B/msg\n",
+        elapsed, (double)allocations/N, allocations/elapsed/1e6, rss, rss*1024.0/N);
+}
+
+/**
+ * @brief Run a benchmark in a child process so that each one
+ * gets its own RSS high water mark
+ */
+void runIsolated(void (*bench)(long), long N) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        bench(N);
+        fflush(stdout);
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char** argv) {
+    long N = DEFAULT_N;
+    if (argc > 1) {
+        N = atol(argv[1]);
+    }
+    printf("%ld short messages, sizeof(struct Message) = %zu\n", N, sizeof(struct Message));
+    runIsolated(benchOld, N);
+    runIsolated(benchInline, N);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "message.h"
+
+#define MESSAGES 200000 // About 12MB of slabs
+#define THREADS 4
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+long residentKB() {
+    long size = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident*(sysconf(_SC_PAGESIZE)/1024);
+}
+
+struct Message* messages[MESSAGES];
+
+/**
+ * Frees its share of the messages, which were allocated on another thread
+ */
+void* freeShare(void* args) {
+    long share = (long)args;
+    for (long i = share; i < MESSAGES; i += THREADS) {
+        Message_free(messages[i]);
+    }
+    return NULL;
+}
+
+void* allocShare(void* args) {
+    long share = (long)args;
+    for (long i = share; i < MESSAGES; i += THREADS) {
+        messages[i] = Message_init((uint16_t)i, "hello", 5);
+    }
+    return NULL;
+}
+
+int main() {
+    struct Message* msg = Message_init(7, "short", 5);
+    check(msg != NULL && msg->id == 7 && strcmp(Message_text(msg), "short") == 0 && !(msg->flags & MESSAGE_HEAP_TEXT),
+        "short text is inline");
+    check(((uintptr_t)msg % MESSAGE_SIZE) == 0, "messages are cache line aligned");
+    char text[200];
+    memset(text, 'x', sizeof(text));
+    struct Message* longMsg = Message_init(8, text, sizeof(text));
+    check(longMsg != NULL && (longMsg->flags & MESSAGE_HEAP_TEXT) && memcmp(Message_text(longMsg), text, sizeof(text)) == 0
+        && Message_text(longMsg)[sizeof(text)] == '\0', "long text goes on the heap");
+    Message_free(msg);
+    Message_free(longMsg);
+
+    memset(messages, 0, sizeof(messages)); // So it's in before it's measured
+    long before = residentKB();
+    for (long i = 0; i < MESSAGES; i++) {
+        messages[i] = Message_init((uint16_t)i, "hello", 5);
+    }
+    size_t most = Message_slabs();
+    long peak = residentKB();
+    int same = 1;
+    for (long i = 0; i < MESSAGES; i++) {
+        same = same && messages[i]->id == (uint16_t)i && strcmp(Message_text(messages[i]), "hello") == 0;
+    }
+    check(same, "messages don't overlap");
+    check(most >= (size_t)MESSAGES*MESSAGE_SIZE/(1 << 20), "slabs are added as messages are");
+    for (long i = 0; i < MESSAGES; i++) {
+        Message_free(messages[i]);
+    }
+    check(Message_slabs() <= 2, "and freed once they're empty (but for a spare, and the one this thread's cache of slots is from)");
+    check(residentKB() - before < (peak - before)/4, "so memory goes back to the system");
+
+    // Allocated on some threads, freed on others, then all of them exit
+    pthread_t threads[THREADS];
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, allocShare, (void*)i);
+    }
+    for (long i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    same = 1;
+    for (long i = 0; i < MESSAGES; i++) {
+        same = same && messages[i] != NULL && messages[i]->id == (uint16_t)i;
+    }
+    check(same, "threads allocate side by side");
+    for (long i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, freeShare, (void*)((i + 1) % THREADS));
+    }
+    for (long i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    check(Message_slabs() <= 2, "messages freed on other threads still empty their slabs");
+    return failures;
+}
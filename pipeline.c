@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pipeline.h"
+
+static double Pipeline_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/**
+ * @brief Take each buffer in turn once the stage before is done with it,
+ * and hand it on to the next
+ */
+static void Pipeline_stage(struct PipelineStage* stage) {
+    struct Pipeline* pipeline = stage->pipeline;
+    size_t next = (stage->index + 1) % pipeline->N;
+    for (size_t i = 0; ; i = (i + 1) % pipeline->buffersN) {
+        struct PipelineBuffer* buffer = &pipeline->buffers[i];
+        double start = Pipeline_now();
+        pthread_mutex_lock(&pipeline->lock);
+        while (buffer->stage != stage->index && !pipeline->failed) {
+            pthread_cond_wait(&pipeline->passed, &pipeline->lock);
+        }
+        int failed = pipeline->failed;
+        pthread_mutex_unlock(&pipeline->lock);
+        double got = Pipeline_now();
+        stage->waiting += got - start;
+        if (failed) {
+            break; // Another stage gave up
+        }
+        int res = 0;
+        if (stage->index == 0) {
+            buffer->len = 0;
+            res = stage->fn(stage->ctx, buffer);
+            buffer->end = buffer->len == 0;
+        }
+        else if (!buffer->end) {
+            res = stage->fn(stage->ctx, buffer);
+        }
+        if (!buffer->end) {
+            stage->busy += Pipeline_now() - got;
+            stage->buffers++;
+            stage->bytes += buffer->len;
+        }
+        int end = buffer->end;
+        pthread_mutex_lock(&pipeline->lock);
+        if (res == -1) {
+            pipeline->failed = 1;
+        }
+        else {
+            buffer->stage = next;
+        }
+        pthread_cond_broadcast(&pipeline->passed);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (res == -1 || end) {
+            break;
+        }
+    }
+}
+
+static void* Pipeline_thread(void* args) {
+    Pipeline_stage((struct PipelineStage*)args);
+    return NULL;
+}
+
+struct Pipeline* Pipeline_init(size_t buffers, size_t capacity) {
+    if (buffers == 0) {
+        buffers = 1;
+    }
+    struct Pipeline* pipeline = (struct Pipeline*)malloc(sizeof(struct Pipeline));
+    pipeline->N = 0;
+    pipeline->buffersN = buffers;
+    pipeline->buffers = (struct PipelineBuffer*)calloc(buffers, sizeof(struct PipelineBuffer));
+    for (size_t i = 0; i < buffers; i++) {
+        pipeline->buffers[i].data = (char*)malloc(capacity);
+        pipeline->buffers[i].capacity = capacity;
+    }
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->passed, NULL);
+    pipeline->failed = 0;
+    pipeline->elapsed = 0;
+    return pipeline;
+}
+
+void Pipeline_free(struct Pipeline* pipeline) {
+    for (size_t i = 0; i < pipeline->buffersN; i++) {
+        free(pipeline->buffers[i].data);
+    }
+    free(pipeline->buffers);
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->passed);
+    free(pipeline);
+}
+
+int Pipeline_addStage(struct Pipeline* pipeline, const char* name, Pipeline_StageFn fn, void* ctx) {
+    if (pipeline->N == PIPELINE_MAX_STAGES) {
+        return -1;
+    }
+    struct PipelineStage* stage = &pipeline->stages[pipeline->N];
+    memset(stage, 0, sizeof(struct PipelineStage));
+    stage->name = name;
+    stage->fn = fn;
+    stage->ctx = ctx;
+    stage->pipeline = pipeline;
+    stage->index = pipeline->N++;
+    return 0;
+}
+
+int Pipeline_run(struct Pipeline* pipeline) {
+    if (pipeline->N == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < pipeline->buffersN; i++) {
+        pipeline->buffers[i].len = 0;
+        pipeline->buffers[i].end = 0;
+        pipeline->buffers[i].stage = 0;
+    }
+    for (size_t i = 0; i < pipeline->N; i++) {
+        struct PipelineStage* stage = &pipeline->stages[i];
+        stage->buffers = 0;
+        stage->bytes = 0;
+        stage->busy = 0;
+        stage->waiting = 0;
+    }
+    pipeline->failed = 0;
+    double start = Pipeline_now();
+    size_t started = 0;
+    for (; started < pipeline->N - 1; started++) {
+        struct PipelineStage* stage = &pipeline->stages[started];
+        if (pthread_create(&stage->thread, NULL, Pipeline_thread, stage) != 0) {
+            break;
+        }
+    }
+    if (started == pipeline->N - 1) {
+        Pipeline_stage(&pipeline->stages[pipeline->N - 1]);
+    }
+    else {
+        // Have the ones that did start give up
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->failed = 1;
+        pthread_cond_broadcast(&pipeline->passed);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(pipeline->stages[i].thread, NULL);
+    }
+    pipeline->elapsed = Pipeline_now() - start;
+    return pipeline->failed ? -1 : 0;
+}
+
+double Pipeline_utilization(const struct Pipeline* pipeline, size_t stage) {
+    if (pipeline->elapsed <= 0) {
+        return 0;
+    }
+    double utilization = pipeline->stages[stage].busy/pipeline->elapsed;
+    return utilization > 1 ? 1 : utilization;
+}
+
+void Pipeline_report(const struct Pipeline* pipeline, char* out, size_t size) {
+    size_t n = 0;
+    out[0] = '\0';
+    for (size_t i = 0; i < pipeline->N && n < size; i++) {
+        int written = snprintf(out + n, size - n, "%s%s %.0f%%", i > 0 ? ", " : "",
+            pipeline->stages[i].name, 100*Pipeline_utilization(pipeline, i));
+        if (written < 0) {
+            break;
+        }
+        n += written;
+    }
+}
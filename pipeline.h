@@ -0,0 +1,109 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define PIPELINE_MAX_STAGES 4
+
+struct PipelineBuffer {
+    char* data;
+    size_t len; // Bytes in data
+    size_t capacity; // Most bytes data can hold
+    int end; // Set once the first stage has nothing more to put in it
+    size_t stage; // Index of the stage that has it, or is next to (guarded by the pipeline's lock)
+};
+
+/**
+ * Called on a stage's thread with each buffer in turn.  The first stage
+ * fills buffer->data and sets buffer->len, leaving it 0 once there's
+ * nothing more; the others handle buffer->len bytes, and may change
+ * them in place (up to buffer->capacity).  Return 0 to pass the buffer
+ * on, or -1 to stop the whole pipeline (on failure, or to cancel it)
+ */
+typedef int (*Pipeline_StageFn)(void* ctx, struct PipelineBuffer* buffer);
+
+struct PipelineStage {
+    const char* name; // As shown with its utilization
+    Pipeline_StageFn fn;
+    void* ctx; // Passed to fn
+    struct Pipeline* pipeline;
+    size_t index;
+    pthread_t thread;
+    uint64_t buffers; // Buffers handled in the last run
+    uint64_t bytes; // Bytes passed on in the last run
+    double busy; // Seconds spent in fn in the last run
+    double waiting; // Seconds spent waiting for the stage before it (or, for the first, for a free buffer)
+};
+
+/**
+ * Stages that each run on a thread of their own, handing a ring of
+ * buffers along from one to the next, so that one stage can be reading
+ * into a buffer while the next works on the one before it and the last
+ * sends the one before that.  With two buffers that's double buffering,
+ * with three triple buffering; each buffer goes through every stage in
+ * order, and the buffers go round in order, so bytes come out of the
+ * last stage in the order they went into the first.
+ */
+struct Pipeline {
+    struct PipelineStage stages[PIPELINE_MAX_STAGES];
+    size_t N; // Number of stages
+    struct PipelineBuffer* buffers;
+    size_t buffersN;
+    pthread_mutex_t lock;
+    pthread_cond_t passed; // Broadcast when a buffer moves on to the next stage, or a stage fails (with lock held)
+    int failed; // (guarded by lock)
+    double elapsed; // Seconds the last run took
+};
+
+/**
+ * @brief Set up a pipeline with no stages yet
+ *
+ * @param buffers Number of buffers going round (2 or more for the stages to overlap)
+ * @param capacity Bytes in each buffer
+ * @return struct Pipeline*
+ */
+struct Pipeline* Pipeline_init(size_t buffers, size_t capacity);
+
+void Pipeline_free(struct Pipeline* pipeline);
+
+/**
+ * @brief Add a stage after the ones added so far
+ *
+ * @param name Stage's name (not copied)
+ * @param fn Called with each buffer
+ * @param ctx Passed to fn
+ * @return int 0 on success, -1 if it already has PIPELINE_MAX_STAGES
+ */
+int Pipeline_addStage(struct Pipeline* pipeline, const char* name, Pipeline_StageFn fn, void* ctx);
+
+/**
+ * @brief Run every stage until the first one has nothing more, or one
+ * fails.  The last stage runs on the calling thread, the rest on
+ * threads of their own, which are done with by the time it returns
+ *
+ * @return int 0 once everything has been through every stage, -1 if a
+ * stage failed (or its thread couldn't be started)
+ */
+int Pipeline_run(struct Pipeline* pipeline);
+
+/**
+ * @brief How much of the last run a stage spent working, rather than
+ * waiting on the stages either side of it
+ *
+ * @param stage Index of the stage
+ * @return double Between 0 and 1
+ */
+double Pipeline_utilization(const struct Pipeline* pipeline, size_t stage);
+
+/**
+ * @brief Describe how busy each stage was in the last run, e.g.
+ * "read 40%, hash 95%, send 60%"
+ *
+ * @param out Where to write it (always terminated)
+ * @param size Size of out
+ */
+void Pipeline_report(const struct Pipeline* pipeline, char* out, size_t size);
+
+#endif
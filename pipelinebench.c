@@ -0,0 +1,161 @@
+// Purpose: Compare reading, hashing and sending a file one part after
+// another on a single thread, as sendFile() used to, against the same
+// three steps as a pipeline, and show how busy each stage was.  The
+// disk and network can be made slower per part, to stand in for a real
+// disk and link (the file here is read from the page cache, and sent
+// down a socket pair)
+//
+// Usage: ./pipelinebench [megabytes] [disk us per part] [network us per part] [buffers]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "pipeline.h"
+#include "filestore.h"
+
+#define DEFAULT_MEGABYTES 64
+#define DEFAULT_DISK_US 200
+#define DEFAULT_NETWORK_US 200
+#define DEFAULT_BUFFERS 3
+#define PART (64*1024) // As FILE_CHUNK
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+void sleepUs(long us) {
+    if (us > 0) {
+        struct timespec ts = {us/1000000, (us % 1000000)*1000L};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * The file being sent, and where to
+ */
+struct Send {
+    FILE* file;
+    int fd; // Socket to send down
+    long diskUs;
+    long networkUs;
+    struct Sha256 sha;
+};
+
+int readPart(void* ctx, struct PipelineBuffer* buffer) {
+    struct Send* send = (struct Send*)ctx;
+    buffer->len = fread(buffer->data, 1, buffer->capacity, send->file);
+    if (buffer->len > 0) {
+        sleepUs(send->diskUs);
+    }
+    return 0;
+}
+
+int hashPart(void* ctx, struct PipelineBuffer* buffer) {
+    struct Send* send = (struct Send*)ctx;
+    Sha256_update(&send->sha, buffer->data, buffer->len);
+    return 0;
+}
+
+int sendPart(void* ctx, struct PipelineBuffer* buffer) {
+    struct Send* send = (struct Send*)ctx;
+    for (size_t sent = 0; sent < buffer->len; ) {
+        ssize_t n = write(send->fd, buffer->data + sent, buffer->len - sent);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    sleepUs(send->networkUs);
+    return 0;
+}
+
+/**
+ * @brief Read everything sent down the other end of the socket pair, as the peer would
+ */
+void* drain(void* args) {
+    int fd = *(int*)args;
+    char buf[PART];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    return NULL;
+}
+
+void report(const char* what, long megabytes, double elapsed) {
+    printf("%-24s %8.3f s, %8.1f MB/s\n", what, elapsed, megabytes/elapsed);
+}
+
+int main(int argc, char** argv) {
+    long megabytes = argc > 1 ? atol(argv[1]) : DEFAULT_MEGABYTES;
+    struct Send send;
+    send.diskUs = argc > 2 ? atol(argv[2]) : DEFAULT_DISK_US;
+    send.networkUs = argc > 3 ? atol(argv[3]) : DEFAULT_NETWORK_US;
+    size_t buffers = argc > 4 ? (size_t)atol(argv[4]) : DEFAULT_BUFFERS;
+    printf("%ld MB in %d KB parts, %ld us of disk and %ld us of network per part\n",
+        megabytes, PART/1024, send.diskUs, send.networkUs);
+
+    char path[] = "/tmp/pipelinebenchXXXXXX";
+    int fileFd = mkstemp(path);
+    char* part = (char*)malloc(PART);
+    for (long i = 0; i < megabytes*1024*1024/PART; i++) {
+        for (int j = 0; j < PART; j++) {
+            part[j] = (char)rand();
+        }
+        if (write(fileFd, part, PART) != PART) {
+            perror("write");
+            return 1;
+        }
+    }
+    close(fileFd);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drain, &fds[1]);
+    send.fd = fds[0];
+
+    // One thread, one part at a time
+    struct PipelineBuffer buffer = {part, 0, PART, 0, 0};
+    send.file = fopen(path, "rb");
+    Sha256_init(&send.sha);
+    double start = now();
+    while (readPart(&send, &buffer) == 0 && buffer.len > 0) {
+        hashPart(&send, &buffer);
+        sendPart(&send, &buffer);
+    }
+    report("serial", megabytes, now() - start);
+    fclose(send.file);
+
+    send.file = fopen(path, "rb");
+    Sha256_init(&send.sha);
+    struct Pipeline* pipeline = Pipeline_init(buffers, PART);
+    Pipeline_addStage(pipeline, "read", readPart, &send);
+    Pipeline_addStage(pipeline, "hash", hashPart, &send);
+    Pipeline_addStage(pipeline, "send", sendPart, &send);
+    Pipeline_run(pipeline);
+    char what[64];
+    snprintf(what, sizeof(what), "pipeline, %zu buffers", buffers);
+    report(what, megabytes, pipeline->elapsed);
+    for (size_t i = 0; i < pipeline->N; i++) {
+        struct PipelineStage* stage = &pipeline->stages[i];
+        printf("%-24s %-4s %3.0f%% busy, %8.3f s waiting\n", "", stage->name,
+            100*Pipeline_utilization(pipeline, i), stage->waiting);
+    }
+    Pipeline_free(pipeline);
+    fclose(send.file);
+
+    close(fds[0]);
+    pthread_join(drainer, NULL);
+    close(fds[1]);
+    unlink(path);
+    free(part);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pipeline.h"
+
+#define BYTES 1000000
+#define CAPACITY 4096
+#define CHUNKS 20
+#define CHUNK_MS 5
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+void sleepMs(long ms) {
+    struct timespec ts = {ms/1000, (ms % 1000)*1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * Bytes going through the stages below: numbered on the way in, each
+ * one added to in the middle, and checked on the way out
+ */
+struct Stream {
+    size_t read;
+    size_t written;
+    int wrong; // Whether a byte came out that shouldn't have
+    long sleepMs; // How long each stage takes with a buffer
+    size_t failAt; // Have the middle stage fail at this many bytes (0 not to)
+    size_t transformed;
+    int calledAfterFailure;
+};
+
+int produce(void* ctx, struct PipelineBuffer* buffer) {
+    struct Stream* stream = (struct Stream*)ctx;
+    size_t n = BYTES - stream->read < buffer->capacity ? BYTES - stream->read : buffer->capacity;
+    for (size_t i = 0; i < n; i++) {
+        buffer->data[i] = (char)(stream->read + i);
+    }
+    stream->read += n;
+    buffer->len = n;
+    sleepMs(stream->sleepMs);
+    return 0;
+}
+
+int transform(void* ctx, struct PipelineBuffer* buffer) {
+    struct Stream* stream = (struct Stream*)ctx;
+    if (stream->failAt > 0 && stream->transformed >= stream->failAt) {
+        return -1;
+    }
+    for (size_t i = 0; i < buffer->len; i++) {
+        buffer->data[i]++;
+    }
+    stream->transformed += buffer->len;
+    sleepMs(stream->sleepMs);
+    return 0;
+}
+
+int consume(void* ctx, struct PipelineBuffer* buffer) {
+    struct Stream* stream = (struct Stream*)ctx;
+    if (stream->failAt > 0 && stream->written >= stream->failAt) {
+        stream->calledAfterFailure = 1;
+    }
+    for (size_t i = 0; i < buffer->len; i++) {
+        if (buffer->data[i] != (char)(stream->written + i + 1)) {
+            stream->wrong = 1;
+        }
+    }
+    stream->written += buffer->len;
+    sleepMs(stream->sleepMs);
+    return 0;
+}
+
+/**
+ * @brief Run the three stages over a stream, with the given number of buffers
+ */
+struct Pipeline* runStream(struct Stream* stream, size_t buffers, size_t capacity, int* res) {
+    struct Pipeline* pipeline = Pipeline_init(buffers, capacity);
+    Pipeline_addStage(pipeline, "read", produce, stream);
+    Pipeline_addStage(pipeline, "add", transform, stream);
+    Pipeline_addStage(pipeline, "write", consume, stream);
+    *res = Pipeline_run(pipeline);
+    return pipeline;
+}
+
+int main() {
+    struct Stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int res;
+    struct Pipeline* pipeline = runStream(&stream, 3, CAPACITY, &res);
+    check(res == 0, "run");
+    check(stream.written == BYTES && !stream.wrong, "every byte comes out, transformed and in order");
+    check(pipeline->stages[2].buffers == (BYTES + CAPACITY - 1)/CAPACITY && pipeline->stages[2].bytes == BYTES,
+        "stages count what went through them");
+    char report[128];
+    Pipeline_report(pipeline, report, sizeof(report));
+    check(strncmp(report, "read ", 5) == 0 && strstr(report, ", add ") != NULL && strstr(report, ", write ") != NULL,
+        "report names every stage");
+    check(Pipeline_addStage(pipeline, "fourth", consume, &stream) == 0 && Pipeline_addStage(pipeline, "fifth", consume, &stream) == -1,
+        "stages are limited");
+    Pipeline_free(pipeline);
+
+    memset(&stream, 0, sizeof(stream));
+    pipeline = runStream(&stream, 1, CAPACITY, &res);
+    check(res == 0 && stream.written == BYTES && !stream.wrong, "a single buffer works too, one stage at a time");
+    Pipeline_free(pipeline);
+
+    // Stages that each take a while with a buffer, as a disk and a network would
+    memset(&stream, 0, sizeof(stream));
+    stream.sleepMs = CHUNK_MS;
+    pipeline = runStream(&stream, 3, BYTES/CHUNKS, &res);
+    double serial = 3.0*CHUNKS*CHUNK_MS/1000;
+    check(res == 0 && pipeline->elapsed < 0.6*serial, "stages overlap");
+    int busy = 1;
+    for (size_t i = 0; i < pipeline->N; i++) {
+        busy = busy && Pipeline_utilization(pipeline, i) > 0.5 && Pipeline_utilization(pipeline, i) <= 1;
+    }
+    check(busy, "so each is busy most of the time");
+    Pipeline_free(pipeline);
+
+    memset(&stream, 0, sizeof(stream));
+    stream.failAt = BYTES/2;
+    pipeline = runStream(&stream, 3, CAPACITY, &res);
+    check(res == -1, "a stage failing stops the run");
+    check(stream.written < BYTES/2 + CAPACITY && !stream.calledAfterFailure && !stream.wrong, "and nothing after it goes through");
+    check(stream.read < BYTES, "nor is more read than the buffers hold");
+    Pipeline_free(pipeline);
+    return failures;
+}
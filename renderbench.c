@@ -0,0 +1,201 @@
+// Purpose: Measure what it costs the terminal and the CPU to show
+// one new chat message, comparing a full wclear-and-repaint of the
+// chat window (one curses call per character) against scrolling the
+// new message in with a ChatView, what caching a long message's
+// line-wrap layout saves each time it's redrawn, and what scrolling
+// back through a very long history costs
+//
+// Usage: ./renderbench [number of messages] [messages of history]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ncurses.h>
+#include "chatview.h"
+#include "message.h"
+
+#define DEFAULT_MESSAGES 5000
+#define TERM_W 80
+#define TERM_H 24
+#define CHAT_H 20
+#define CHAT_W 70
+
+#define LONG_LEN 100000 // Length of the message in the layout test
+#define DEFAULT_HISTORY 1000000 // Messages in the scrollback test
+
+char** lines;
+int* lengths;
+struct Message** messages; // The text of each line, without the prefix
+struct Timeline timeline; // Shares its messages with messages[], so it's never freed with Timeline_free()
+struct ChatView view;
+
+void formatPrefix(void* ctx, struct Message* msg, struct ArrayListBuf* prefix) {
+    ArrayListBuf_appendf(prefix, "Anonymous %i: ", msg->id);
+}
+
+/**
+ * @brief The old printLineToChat(): one mvwprintw per character
+ */
+void printLineToChat(WINDOW* win, char* str, int len, int* row) {
+    int col = 0;
+    for (int i = 0; i < len; i++) {
+        mvwprintw(win, *row, col, "%c", str[i]);
+        col++;
+        if (col == CHAT_W) {
+            col = 0;
+            (*row)--;
+        }
+    }
+}
+
+/**
+ * @brief The old reprintChatWindow(): clear, then reformat and
+ * print every visible message
+ */
+void fullRepaint(WINDOW* win, int newest) {
+    wclear(win);
+    int row = CHAT_H - 1;
+    for (int i = newest; i >= 0 && row >= 0; i--) {
+        char* str = (char*)malloc(lengths[i] + 100);
+        sprintf(str, "%s", lines[i]);
+        printLineToChat(win, str, strlen(str), &row);
+        free(str);
+        row--;
+    }
+    wrefresh(win);
+}
+
+void incremental(WINDOW* win, int newest) {
+    Timeline_push(&timeline, messages[newest]);
+    ChatView_update(&view, &timeline);
+    wrefresh(win);
+}
+
+/**
+ * @brief Page back through the history from the newest message,
+ * wrapping around once the oldest is reached
+ */
+void pageUp(WINDOW* win, int i) {
+    if (view.bottom == 0 && !view.following) {
+        ChatView_follow(&view);
+    }
+    ChatView_scroll(&view, &timeline, CHAT_H - 1);
+    ChatView_redraw(&view, &timeline);
+    wrefresh(win);
+}
+
+/**
+ * @brief Jump to a message somewhere in the history
+ */
+void jump(WINDOW* win, int i) {
+    ChatView_scrollTo(&view, &timeline, ((size_t)i*7919) % Timeline_size(&timeline));
+    ChatView_redraw(&view, &timeline);
+    wrefresh(win);
+}
+
+/**
+ * @brief Show N messages one at a time on a fresh virtual terminal
+ * whose output goes to a temporary file, and report bytes and CPU
+ * time per message
+ */
+void run(char* name, void (*show)(WINDOW*, int), int N) {
+    FILE* out = tmpfile();
+    FILE* in = fopen("/dev/null", "r");
+    SCREEN* screen = newterm("xterm", out, in);
+    set_term(screen);
+    resizeterm(TERM_H, TERM_W);
+    WINDOW* win = newwin(CHAT_H, CHAT_W, 0, 0);
+    scrollok(win, TRUE);
+    idlok(win, TRUE);
+    ChatView_init(&view, win, CHAT_H, CHAT_W, formatPrefix, NULL);
+    if (show == incremental) {
+        MessageArray_clear(&timeline.messages);
+    }
+    else {
+        ChatView_redraw(&view, &timeline);
+    }
+    wrefresh(win);
+    fflush(out);
+    long startBytes = ftell(out);
+    clock_t start = clock();
+    for (int i = 0; i < N; i++) {
+        show(win, i);
+    }
+    double cpu = (double)(clock() - start)/CLOCKS_PER_SEC;
+    fflush(out);
+    long bytes = ftell(out) - startBytes;
+    ChatView_free(&view);
+    delwin(win);
+    endwin();
+    delscreen(screen);
+    fclose(out);
+    fclose(in);
+    printf("%-12s %10.1f terminal bytes/op   %8.1f us CPU/op\n", name, (double)bytes/N, cpu*1e6/N);
+}
+
+int main(int argc, char** argv) {
+    int N = DEFAULT_MESSAGES;
+    if (argc > 1) {
+        N = atoi(argv[1]);
+    }
+    int history = DEFAULT_HISTORY;
+    if (argc > 2) {
+        history = atoi(argv[2]);
+    }
+    lines = (char**)malloc(sizeof(char*)*N);
+    lengths = (int*)malloc(sizeof(int)*N);
+    messages = (struct Message**)malloc(sizeof(struct Message*)*N);
+    for (int i = 0; i < N; i++) {
+        lines[i] = (char*)malloc(200);
+        int prefixLen = sprintf(lines[i], "Anonymous %i: ", i%65536);
+        char* text = lines[i] + prefixLen;
+        if (i%5 == 4) {
+            sprintf(text, "this one is long enough that it has to wrap onto a second row of the chat window");
+        }
+        else {
+            sprintf(text, "hey, message number %i", i);
+        }
+        lengths[i] = prefixLen + strlen(text);
+        messages[i] = Message_init(i%65536, text, strlen(text));
+    }
+    Timeline_init(&timeline);
+    printf("%d messages, %dx%d chat window\n", N, CHAT_W, CHAT_H);
+    run("full repaint", fullRepaint, N);
+    run("incremental", incremental, N);
+
+
+    // How long it takes to find out how a long message wraps, which
+    // redrawing needs for every message on screen
+    char* text = (char*)malloc(LONG_LEN + 1);
+    for (int i = 0; i < LONG_LEN; i++) {
+        text[i] = i%7 == 6 ? ' ' : 'a' + i%26;
+    }
+    text[LONG_LEN] = '\0';
+    struct Message* msg = Message_init(0, text, LONG_LEN);
+    struct LineLayout layout;
+    ChatView_init(&view, NULL, CHAT_H, CHAT_W, formatPrefix, NULL);
+    for (int cached = 0; cached < 2; cached++) {
+        clock_t start = clock();
+        for (int i = 0; i < N; i++) {
+            if (!cached) {
+                msg->text.heap.width = 0; // Throw away the layout
+            }
+            ChatView_layout(&view, msg, &layout);
+        }
+        double cpu = (double)(clock() - start)/CLOCKS_PER_SEC;
+        printf("%-12s %10u rows          %8.3f us CPU/layout of a %d byte message\n", cached ? "cached" : "rewrap", layout.rows, cpu*1e6/N, LONG_LEN);
+    }
+    ChatView_free(&view);
+
+    // Scrolling around a long history should cost the same as a short one
+    MessageArray_clear(&timeline.messages);
+    for (int i = 0; i < history; i++) {
+        Timeline_push(&timeline, messages[i%N]);
+    }
+    printf("%d messages of history\n", history);
+    run("page up", pageUp, N);
+    run("jump to id", jump, N);
+    MessageArray_free(&timeline.messages);
+    return 0;
+}
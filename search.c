@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include "search.h"
+
+#define SEARCH_QUERY_TERMS 16 // Words of a query beyond this many are ignored
+
+/**
+ * @brief Pull the next word out of some text
+ *
+ * @param p Where to start looking; moved past the word
+ * @param end End of the text
+ * @param term The word, lowercased, cut off at SEARCH_TERM_MAX bytes and null terminated
+ * @return int 1 if there was a word, 0 if the text ran out
+ */
+static int SearchIndex_nextTerm(const char** p, const char* end, char* term) {
+    const unsigned char* s = (const unsigned char*)*p;
+    const unsigned char* e = (const unsigned char*)end;
+    #define WORD_BYTE(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || ((c) >= '0' && (c) <= '9') || (c) >= 0x80)
+    while (s < e && !WORD_BYTE(*s)) {
+        s++;
+    }
+    size_t len = 0;
+    while (s < e && WORD_BYTE(*s)) {
+        if (len < SEARCH_TERM_MAX) {
+            term[len++] = (*s >= 'A' && *s <= 'Z') ? (char)(*s - 'A' + 'a') : (char)*s;
+        }
+        s++;
+    }
+    #undef WORD_BYTE
+    term[len] = '\0';
+    *p = (const char*)s;
+    return len > 0;
+}
+
+struct SearchIndex* SearchIndex_init() {
+    struct SearchIndex* index = (struct SearchIndex*)malloc(sizeof(struct SearchIndex));
+    pthread_mutex_init(&index->lock, NULL);
+    index->terms = HashMap_init();
+    PostingListArray_init(&index->lists);
+    SearchDocArray_init(&index->older);
+    SearchDocArray_init(&index->docs);
+    index->postings = 0;
+    return index;
+}
+
+void SearchIndex_free(struct SearchIndex* index) {
+    for (size_t i = 0; i < index->lists.N; i++) {
+        PostingArray_free(&index->lists.data[i]->older);
+        PostingArray_free(&index->lists.data[i]->docs);
+        free(index->lists.data[i]);
+    }
+    PostingListArray_free(&index->lists);
+    HashMap_free(index->terms);
+    SearchDocArray_free(&index->older);
+    SearchDocArray_free(&index->docs);
+    pthread_mutex_destroy(&index->lock);
+    free(index);
+}
+
+/**
+ * @brief Number a message and list it under each of its words
+ *
+ * @param older Whether it goes before everything added so far, rather than after
+ */
+static void SearchIndex_insert(struct SearchIndex* index, const struct SearchDoc* entry, const char* text, uint32_t len, int older) {
+    const char* p = text;
+    const char* end = p + len;
+    char term[SEARCH_TERM_MAX + 1];
+    pthread_mutex_lock(&index->lock);
+    SearchDocArray* docs = older ? &index->older : &index->docs;
+    uint32_t doc = older ? SEARCH_NEWER - 1 - (uint32_t)docs->N : SEARCH_NEWER + (uint32_t)docs->N;
+    SearchDocArray_push(docs, *entry);
+    while (SearchIndex_nextTerm(&p, end, term)) {
+        struct PostingList* list = (struct PostingList*)HashMap_get(index->terms, term);
+        if (list == NULL) {
+            list = (struct PostingList*)malloc(sizeof(struct PostingList));
+            strcpy(list->term, term);
+            PostingArray_init(&list->older);
+            PostingArray_init(&list->docs);
+            PostingListArray_push(&index->lists, list);
+            HashMap_put(index->terms, list->term, list); // The list owns the key
+        }
+        // A word that comes up twice in a message is only listed once
+        PostingArray* postings = older ? &list->older : &list->docs;
+        if (postings->N == 0 || postings->data[postings->N-1] != doc) {
+            PostingArray_push(postings, doc);
+            index->postings++;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+void SearchIndex_add(struct SearchIndex* index, uint32_t chat, const struct Message* msg) {
+    struct SearchDoc entry = {msg->timestamp, chat, msg->id, (uint16_t)(msg->flags & MESSAGE_OUTGOING)};
+    SearchIndex_insert(index, &entry, Message_text((struct Message*)msg), msg->len, 0);
+}
+
+void SearchIndex_addOlder(struct SearchIndex* index, const struct SearchDoc* doc, const char* text, uint32_t len) {
+    SearchIndex_insert(index, doc, text, len, 1);
+}
+
+/**
+ * @brief Number of the message at some position in a posting list, as
+ * though its older and newer halves were one increasing array
+ */
+static uint32_t SearchIndex_at(const struct PostingList* list, size_t i) {
+    size_t older = list->older.N;
+    return i < older ? list->older.data[older - 1 - i] : list->docs.data[i - older];
+}
+
+static size_t SearchIndex_length(const struct PostingList* list) {
+    return list->older.N + list->docs.N;
+}
+
+static const struct SearchDoc* SearchIndex_doc(const struct SearchIndex* index, uint32_t doc) {
+    return doc >= SEARCH_NEWER ? &index->docs.data[doc - SEARCH_NEWER] : &index->older.data[SEARCH_NEWER - 1 - doc];
+}
+
+/**
+ * @brief Find the last position before hi whose number is at most doc
+ *
+ * @return long The position, or -1 if every number before hi is bigger
+ */
+static long SearchIndex_floor(const struct PostingList* list, size_t hi, uint32_t doc) {
+    size_t lo = 0;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if (SearchIndex_at(list, mid) <= doc) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return (long)lo - 1;
+}
+
+size_t SearchIndex_query(struct SearchIndex* index, const char* query, size_t max, uint32_t* before, struct SearchDoc* results) {
+    const char* p = query;
+    const char* end = query + strlen(query);
+    char term[SEARCH_TERM_MAX + 1];
+    struct PostingList* lists[SEARCH_QUERY_TERMS];
+    size_t hi[SEARCH_QUERY_TERMS];
+    size_t k = 0;
+    size_t found = 0;
+    pthread_mutex_lock(&index->lock);
+    while (k < SEARCH_QUERY_TERMS && SearchIndex_nextTerm(&p, end, term)) {
+        lists[k] = (struct PostingList*)HashMap_get(index->terms, term);
+        if (lists[k] == NULL) {
+            // Nothing has this word, so nothing has all of them
+            pthread_mutex_unlock(&index->lock);
+            *before = 0;
+            return 0;
+        }
+        // Keep the rarest word first
+        for (size_t j = k; j > 0 && SearchIndex_length(lists[j]) < SearchIndex_length(lists[j-1]); j--) {
+            struct PostingList* swap = lists[j];
+            lists[j] = lists[j-1];
+            lists[j-1] = swap;
+        }
+        k++;
+    }
+    if (k == 0 || *before == 0) {
+        pthread_mutex_unlock(&index->lock);
+        *before = 0;
+        return 0;
+    }
+    for (size_t j = 0; j < k; j++) {
+        hi[j] = SearchIndex_length(lists[j]);
+    }
+    // Walk the rarest list from the newest end (or from where the last
+    // call left off); every other list only gets searched below where
+    // the last lookup in it landed
+    const struct PostingList* rarest = lists[0];
+    size_t i = (size_t)(SearchIndex_floor(rarest, SearchIndex_length(rarest), *before - 1) + 1);
+    for (; i > 0 && found < max; i--) {
+        uint32_t doc = SearchIndex_at(rarest, i-1);
+        int all = 1;
+        for (size_t j = 1; j < k && all; j++) {
+            long at = SearchIndex_floor(lists[j], hi[j], doc);
+            if (at < 0) {
+                i = 1; // This list has nothing older, so no more matches
+                all = 0;
+            }
+            else {
+                hi[j] = (size_t)at + 1;
+                all = SearchIndex_at(lists[j], (size_t)at) == doc;
+            }
+        }
+        if (all) {
+            results[found++] = *SearchIndex_doc(index, doc);
+            *before = doc;
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+    if (found < max) {
+        *before = 0; // That was all of them
+    }
+    return found;
+}
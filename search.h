@@ -0,0 +1,106 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "arraylist.h"
+#include "hashmap.h"
+#include "message.h"
+
+#define SEARCH_TERM_MAX 32 // Longer words are indexed (and looked up) by their first this many bytes
+
+/**
+ * A message that's been indexed.  Messages are numbered in the order
+ * they're added, and posting lists hold those numbers: from
+ * SEARCH_NEWER up for messages as they come, and from just below it
+ * down for older ones added after them (history read back from disk)
+ */
+struct SearchDoc {
+    uint64_t timestamp; // Message's timestamp (unique within its chat)
+    uint32_t chat; // Number of the chat it's in (see struct Chat)
+    uint16_t id; // Message id
+    uint16_t flags; // MESSAGE_OUTGOING if I sent it
+};
+
+ARRAYLIST_DEFINE(SearchDocArray, struct SearchDoc)
+ARRAYLIST_DEFINE(PostingArray, uint32_t)
+
+#define SEARCH_NEWER 0x80000000u // Number of the first message added by SearchIndex_add()
+
+/**
+ * Every message that contains a term, by number: older ones in
+ * decreasing order, then the rest in increasing order, so both only
+ * ever grow at the end
+ */
+struct PostingList {
+    char term[SEARCH_TERM_MAX + 1];
+    PostingArray older; // Added by SearchIndex_addOlder()
+    PostingArray docs; // Added by SearchIndex_add()
+};
+
+ARRAYLIST_DEFINE(PostingListArray, struct PostingList*)
+
+/**
+ * Inverted index over every chat's messages.  Words are runs of letters
+ * and digits (and any non-ASCII bytes), lowercased.  Messages are only
+ * ever added; a message that's since been deleted or whose chat has
+ * closed is still found, so whoever makes sense of the results
+ * should check it's still there.
+ */
+struct SearchIndex {
+    pthread_mutex_t lock;
+    struct HashMap* terms; // Term -> struct PostingList*
+    PostingListArray lists; // Every posting list, to free them
+    SearchDocArray older; // Messages added by SearchIndex_addOlder(), numbered down from SEARCH_NEWER - 1
+    SearchDocArray docs; // Messages added by SearchIndex_add(), numbered up from SEARCH_NEWER
+    uint64_t postings; // Total entries across all posting lists
+};
+
+#define SEARCH_NEWEST UINT32_MAX // Where a query starts from (see SearchIndex_query())
+
+struct SearchIndex* SearchIndex_init();
+void SearchIndex_free(struct SearchIndex* index);
+
+/**
+ * @brief Add a message to the index.  Costs time in proportion to its
+ * length, however big the index is.  Safe to call from any thread
+ *
+ * @param index
+ * @param chat Number of the chat it's in
+ * @param msg Message
+ */
+void SearchIndex_add(struct SearchIndex* index, uint32_t chat, const struct Message* msg);
+
+/**
+ * @brief Add a message that's older than any added so far (e.g. history
+ * read back from disk, newest first), so that it's found after them.
+ * Otherwise as SearchIndex_add()
+ *
+ * @param index
+ * @param doc Message's chat, timestamp, id and flags
+ * @param text Its text
+ * @param len Length of text
+ */
+void SearchIndex_addOlder(struct SearchIndex* index, const struct SearchDoc* doc, const char* text, uint32_t len);
+
+/**
+ * @brief Find messages containing every word of a query, most recently
+ * added first (and then those added as older, the last added last).  Starts from the rarest word's list, looking the rest
+ * up by binary search, and stops as soon as enough results are found.
+ * The results are copies, and the index's lock is let go before it
+ * returns, so they can be looked up under other locks; to get more
+ * (e.g. after turning some down as deleted), call again with the same
+ * cursor.  Safe to call from any thread
+ *
+ * @param index
+ * @param query Words to look for
+ * @param max Most results wanted
+ * @param before Cursor: only messages added before this one are looked
+ * at (SEARCH_NEWEST to start from the newest).  Moved past the results,
+ * or set to 0 once there are no more
+ * @param results Where to copy the matches (room for max)
+ * @return size_t Number of matches copied
+ */
+size_t SearchIndex_query(struct SearchIndex* index, const char* query, size_t max, uint32_t* before, struct SearchDoc* results);
+
+#endif
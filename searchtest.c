@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "search.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+struct Found {
+    uint16_t ids[64];
+    size_t N;
+    int rejectOdd; // Turn down messages with odd ids
+};
+
+/**
+ * @brief Query a page at a time, as searchChats() does, until max are
+ * accepted or there are no more
+ */
+size_t search(struct SearchIndex* index, const char* query, size_t max, struct Found* found) {
+    found->N = 0;
+    uint32_t cursor = SEARCH_NEWEST;
+    struct SearchDoc docs[64];
+    while (found->N < max) {
+        size_t n = SearchIndex_query(index, query, max - found->N, &cursor, docs);
+        if (n == 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!found->rejectOdd || docs[i].id % 2 == 0) {
+                found->ids[found->N++] = docs[i].id;
+            }
+        }
+    }
+    return found->N;
+}
+
+void add(struct SearchIndex* index, uint32_t chat, uint16_t id, const char* text) {
+    struct Message* msg = Message_init(id, text, (uint32_t)strlen(text));
+    SearchIndex_add(index, chat, msg);
+    Message_free(msg);
+}
+
+int main(int argc, char** argv) {
+    struct SearchIndex* index = SearchIndex_init();
+    struct Found found = {{0}, 0, 0};
+    add(index, 1, 0, "Hello there, General Kenobi");
+    add(index, 2, 1, "hello hello HELLO");
+    add(index, 1, 2, "general purpose lunch order");
+    add(index, 2, 3, "Lunch? Hello!");
+
+    check(search(index, "hello", 10, &found) == 3 && found.ids[0] == 3 && found.ids[1] == 1 && found.ids[2] == 0, "one word, newest first, any case");
+    check(index->postings == 11, "a word repeated in a message is listed once");
+    check(search(index, "HELLO lunch", 10, &found) == 1 && found.ids[0] == 3, "every word has to be there");
+    check(search(index, "general,kenobi", 10, &found) == 1 && found.ids[0] == 0, "punctuation separates words");
+    check(search(index, "hello zebra", 10, &found) == 0, "a word nothing has");
+    check(search(index, "  ", 10, &found) == 0, "no words");
+    check(search(index, "hello", 2, &found) == 2 && found.ids[1] == 1, "stops at max");
+    found.rejectOdd = 1;
+    check(search(index, "hello", 10, &found) == 1 && found.ids[0] == 0, "results can be turned down");
+    found.rejectOdd = 0;
+    uint32_t cursor = SEARCH_NEWEST;
+    struct SearchDoc doc;
+    int paged = SearchIndex_query(index, "hello", 1, &cursor, &doc) == 1 && doc.id == 3;
+    paged = paged && SearchIndex_query(index, "hello", 1, &cursor, &doc) == 1 && doc.id == 1;
+    paged = paged && SearchIndex_query(index, "hello", 1, &cursor, &doc) == 1 && doc.id == 0;
+    check(paged && SearchIndex_query(index, "hello", 1, &cursor, &doc) == 0, "a cursor carries on where the last page left off");
+    struct SearchDoc older = {0, 3, 100, 0};
+    SearchIndex_addOlder(index, &older, "hello from history", 18);
+    older.id = 101;
+    SearchIndex_addOlder(index, &older, "older hello still", 17);
+    check(search(index, "hello", 10, &found) == 5 && found.ids[2] == 0 && found.ids[3] == 100 && found.ids[4] == 101,
+        "older messages come after the rest, however late they're added");
+    check(search(index, "hello history", 10, &found) == 1 && found.ids[0] == 100, "and are found by every word too");
+    check(search(index, "hello", 4, &found) == 4 && found.ids[3] == 100, "stops at max across both");
+    char longWord[100];
+    memset(longWord, 'x', 99);
+    longWord[99] = '\0';
+    add(index, 1, 4, longWord);
+    check(search(index, longWord, 10, &found) == 1 && found.ids[0] == 4, "long words");
+    SearchIndex_free(index);
+
+    // Lots of messages, words drawn from a skewed vocabulary so some are
+    // in nearly every message and some in almost none
+    size_t N = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    size_t vocab = 50000;
+    index = SearchIndex_init();
+    srand(1);
+    char text[256];
+    clock_t start = clock();
+    for (size_t i = 0; i < N; i++) {
+        size_t len = 0;
+        for (int w = 0; w < 6; w++) {
+            size_t r = (size_t)rand() % vocab;
+            size_t word = r*r/vocab*(size_t)rand()/RAND_MAX; // Small numbers far more often
+            len += (size_t)sprintf(text + len, "w%zu ", word);
+        }
+        struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)len);
+        SearchIndex_add(index, (uint32_t)(i % 100), msg);
+        Message_free(msg);
+    }
+    double build = (double)(clock() - start)/CLOCKS_PER_SEC;
+    printf("      indexed %zu messages (%llu postings) in %.1f s, %.2f us each\n",
+        N, (unsigned long long)index->postings, build, build*1e6/N);
+    const char* queries[] = {"w0", "w0 w1", "w1 w2 w3", "w30000", "w0 w30000", "w40000 w45000", "w7 w49999"};
+    int fast = 1;
+    for (size_t q = 0; q < sizeof(queries)/sizeof(queries[0]); q++) {
+        int reps = 100;
+        size_t results = 0;
+        start = clock();
+        for (int r = 0; r < reps; r++) {
+            results = search(index, queries[q], 20, &found);
+        }
+        double ms = (double)(clock() - start)/CLOCKS_PER_SEC*1000/reps;
+        printf("      \"%s\": %zu results in %.3f ms\n", queries[q], results, ms);
+        fast = fast && ms < 10;
+    }
+    check(fast, "queries take milliseconds");
+    SearchIndex_free(index);
+    return failures;
+}
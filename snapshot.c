@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+/**
+ * @brief FNV-1a
+ */
+static uint32_t Snapshot_checksum(const char* data, size_t len) {
+    uint32_t h = 2166136261u;
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i])*16777619u;
+    }
+    return h;
+}
+
+void Snapshot_begin(struct ArrayListBuf* b, const char* myname, uint32_t visible) {
+    struct SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.chats = 0; // Counted up by Snapshot_addChat()
+    header.visible = visible;
+    header.nameLen = (uint32_t)strlen(myname);
+    ArrayListBuf_clear(b);
+    ArrayListBuf_push(b, (const char*)&header, sizeof(header));
+    ArrayListBuf_push(b, myname, header.nameLen);
+}
+
+void Snapshot_addChat(struct ArrayListBuf* b, const char* address, const char* name, uint16_t outCounter, uint32_t messages) {
+    struct SnapshotChatHeader chat;
+    size_t addressLen = strlen(address), nameLen = strlen(name);
+    chat.addressLen = (uint16_t)(addressLen < UINT16_MAX ? addressLen : UINT16_MAX);
+    chat.nameLen = (uint16_t)(nameLen < UINT16_MAX ? nameLen : UINT16_MAX);
+    chat.outCounter = outCounter;
+    chat.reserved = 0;
+    chat.messages = messages;
+    ArrayListBuf_push(b, (const char*)&chat, sizeof(chat));
+    ArrayListBuf_push(b, address, chat.addressLen);
+    ArrayListBuf_push(b, name, chat.nameLen);
+    struct SnapshotHeader* header = (struct SnapshotHeader*)b->buff;
+    header->chats++;
+}
+
+void Snapshot_addMessage(struct ArrayListBuf* b, const struct Message* msg) {
+    struct SnapshotMessage record;
+    record.timestamp = msg->timestamp;
+    record.len = msg->len;
+    record.id = msg->id;
+    record.flags = msg->flags & MESSAGE_OUTGOING;
+    ArrayListBuf_push(b, (const char*)&record, sizeof(record));
+    ArrayListBuf_push(b, Message_text((struct Message*)msg), msg->len);
+}
+
+int Snapshot_write(struct ArrayListBuf* b, const char* path) {
+    uint32_t check = Snapshot_checksum(b->buff, b->N);
+    ArrayListBuf_push(b, (const char*)&check, sizeof(check));
+    char* tmpPath = (char*)malloc(strlen(path) + 5);
+    sprintf(tmpPath, "%s.tmp", path);
+    int res = -1;
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1) {
+        const char* p = b->buff;
+        size_t left = b->N;
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1) {
+                break;
+            }
+            p += n;
+            left -= (size_t)n;
+        }
+        if (left == 0 && fdatasync(fd) == 0) {
+            res = 0;
+        }
+        close(fd);
+    }
+    if (res == 0 && rename(tmpPath, path) == -1) {
+        res = -1;
+    }
+    if (res == -1) {
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+    b->N -= sizeof(check); // Leave the buffer as it was
+    return res;
+}
+
+/**
+ * @brief Take len bytes from the front of what's left to read, or
+ * return NULL if there aren't that many
+ */
+static const char* Snapshot_take(const char** p, const char* end, size_t len) {
+    if ((size_t)(end - *p) < len) {
+        return NULL;
+    }
+    const char* at = *p;
+    *p += len;
+    return at;
+}
+
+static char* Snapshot_string(const char* s, size_t len) {
+    char* copy = (char*)malloc(len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/**
+ * @brief Parse a snapshot whose checksum has been checked
+ */
+static int Snapshot_parse(const char* p, const char* end, struct Snapshot* snapshot) {
+    struct SnapshotHeader header;
+    const char* at = Snapshot_take(&p, end, sizeof(header));
+    if (at == NULL) {
+        return -1;
+    }
+    memcpy(&header, at, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION
+        || (at = Snapshot_take(&p, end, header.nameLen)) == NULL) {
+        return -1;
+    }
+    snapshot->myname = Snapshot_string(at, header.nameLen);
+    snapshot->visible = header.visible < header.chats ? header.visible : SNAPSHOT_NONE;
+    for (uint32_t c = 0; c < header.chats; c++) {
+        struct SnapshotChatHeader chatHeader;
+        if ((at = Snapshot_take(&p, end, sizeof(chatHeader))) == NULL) {
+            return -1;
+        }
+        memcpy(&chatHeader, at, sizeof(chatHeader));
+        const char* address = Snapshot_take(&p, end, chatHeader.addressLen);
+        const char* name = Snapshot_take(&p, end, chatHeader.nameLen);
+        if (address == NULL || name == NULL) {
+            return -1;
+        }
+        struct SnapshotChat chat;
+        chat.address = Snapshot_string(address, chatHeader.addressLen);
+        chat.name = Snapshot_string(name, chatHeader.nameLen);
+        chat.outCounter = chatHeader.outCounter;
+        MessageArray_init(&chat.messages);
+        SnapshotChatArray_push(&snapshot->chats, chat); // Pushed now so that Snapshot_free() finds it if the rest is bad
+        MessageArray* messages = &snapshot->chats.data[snapshot->chats.N - 1].messages;
+        MessageArray_reserve(messages, chatHeader.messages);
+        for (uint32_t i = 0; i < chatHeader.messages; i++) {
+            struct SnapshotMessage record;
+            if ((at = Snapshot_take(&p, end, sizeof(record))) == NULL) {
+                return -1;
+            }
+            memcpy(&record, at, sizeof(record));
+            const char* text = Snapshot_take(&p, end, record.len);
+            if (text == NULL) {
+                return -1;
+            }
+            struct Message* msg = Message_init(record.id, text, record.len);
+            if (msg == NULL) {
+                continue;
+            }
+            msg->timestamp = record.timestamp;
+            msg->flags |= record.flags & MESSAGE_OUTGOING;
+            MessageArray_push(messages, msg);
+        }
+    }
+    return p == end ? 0 : -1;
+}
+
+int Snapshot_read(const char* path, struct Snapshot* snapshot) {
+    snapshot->myname = NULL;
+    snapshot->visible = SNAPSHOT_NONE;
+    SnapshotChatArray_init(&snapshot->chats);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    char* data = NULL;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > (off_t)sizeof(uint32_t)) {
+        size = (size_t)st.st_size;
+        data = (char*)malloc(size);
+        size_t got = 0;
+        while (got < size) {
+            ssize_t n = read(fd, data + got, size - got);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += (size_t)n;
+        }
+        if (got < size) {
+            size = 0;
+        }
+    }
+    close(fd);
+    int res = -1;
+    if (size > 0) {
+        uint32_t check;
+        size -= sizeof(check);
+        memcpy(&check, data + size, sizeof(check));
+        if (check == Snapshot_checksum(data, size)) {
+            res = Snapshot_parse(data, data + size, snapshot);
+        }
+    }
+    free(data);
+    if (res == -1) {
+        Snapshot_free(snapshot);
+    }
+    return res;
+}
+
+void Snapshot_free(struct Snapshot* snapshot) {
+    for (size_t c = 0; c < snapshot->chats.N; c++) {
+        struct SnapshotChat* chat = &snapshot->chats.data[c];
+        for (size_t i = 0; i < chat->messages.N; i++) {
+            Message_free(chat->messages.data[i]);
+        }
+        MessageArray_free(&chat->messages);
+        free(chat->address);
+        free(chat->name);
+    }
+    SnapshotChatArray_free(&snapshot->chats);
+    free(snapshot->myname);
+    snapshot->myname = NULL;
+}
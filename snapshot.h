@@ -0,0 +1,127 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "arraylist.h"
+#include "message.h"
+
+#define SNAPSHOT_MAGIC "CHATSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_NONE UINT32_MAX // No chat was visible
+
+/**
+ * A session snapshot is everything needed to pick up where a session
+ * left off: my name, and for every peer I connected to its address,
+ * name, id counter and most recent messages.  The file is laid out as
+ *
+ *     struct SnapshotHeader, my name
+ *     for each chat: struct SnapshotChatHeader, address, name,
+ *         and for each message: struct SnapshotMessage, text
+ *     FNV-1a checksum of everything before it (uint32_t)
+ *
+ * with nothing padded and everything in host byte order; a snapshot
+ * never leaves the machine.  It's always replaced whole with a rename,
+ * and one that doesn't check out is ignored.
+ */
+struct SnapshotHeader {
+    char magic[8]; // SNAPSHOT_MAGIC
+    uint32_t version; // SNAPSHOT_VERSION
+    uint32_t chats; // Number of chats that follow
+    uint32_t visible; // Index of the visible chat among them, or SNAPSHOT_NONE
+    uint32_t nameLen; // Length of my name
+};
+
+struct SnapshotChatHeader {
+    uint16_t addressLen; // Length of "host port"
+    uint16_t nameLen; // Length of the peer's name
+    uint16_t outCounter; // Messages I'd sent the peer
+    uint16_t reserved;
+    uint32_t messages; // Number of messages that follow
+};
+
+struct SnapshotMessage {
+    uint64_t timestamp;
+    uint32_t len; // Length of the text
+    uint16_t id;
+    uint16_t flags; // MESSAGE_OUTGOING if I sent it
+};
+
+/**
+ * One chat read back from a snapshot
+ */
+struct SnapshotChat {
+    char* address; // "host port" (dynamically allocated)
+    char* name; // Peer's name (dynamically allocated)
+    uint16_t outCounter;
+    MessageArray messages; // Oldest first (owned)
+};
+
+ARRAYLIST_DEFINE(SnapshotChatArray, struct SnapshotChat)
+
+struct Snapshot {
+    char* myname; // Dynamically allocated
+    uint32_t visible; // Index into chats, or SNAPSHOT_NONE
+    SnapshotChatArray chats;
+};
+
+/**
+ * @brief Start writing a snapshot into a buffer.  Chats and their
+ * messages are added with Snapshot_addChat() and Snapshot_addMessage(),
+ * so a snapshot can be built straight from live state without copying
+ * it anywhere else first
+ *
+ * @param b Buffer (cleared first)
+ * @param myname My name
+ * @param visible Index of the visible chat among those to be added, or SNAPSHOT_NONE
+ */
+void Snapshot_begin(struct ArrayListBuf* b, const char* myname, uint32_t visible);
+
+/**
+ * @brief Add a chat to a snapshot being written.  Exactly messages
+ * calls to Snapshot_addMessage() must follow
+ *
+ * @param b Buffer
+ * @param address "host port" to reconnect to
+ * @param name Peer's name
+ * @param outCounter Messages I'd sent the peer
+ * @param messages Number of messages that will be added
+ */
+void Snapshot_addChat(struct ArrayListBuf* b, const char* address, const char* name, uint16_t outCounter, uint32_t messages);
+
+/**
+ * @brief Add a message to the chat last added to a snapshot being written
+ *
+ * @param b Buffer
+ * @param msg Message
+ */
+void Snapshot_addMessage(struct ArrayListBuf* b, const struct Message* msg);
+
+/**
+ * @brief Finish a snapshot off with its checksum and write it to a
+ * file, replacing whatever was there all at once (written to path.tmp,
+ * synced, then renamed)
+ *
+ * @param b Buffer, as left by the Snapshot_add functions
+ * @param path File
+ * @return int 0 on success, -1 if it couldn't be written (the old snapshot is left alone)
+ */
+int Snapshot_write(struct ArrayListBuf* b, const char* path);
+
+/**
+ * @brief Read a snapshot back
+ *
+ * @param path File
+ * @param snapshot Filled in; free it with Snapshot_free() if this succeeds
+ * @return int 0 on success, or -1 if there's no snapshot or it's damaged
+ */
+int Snapshot_read(const char* path, struct Snapshot* snapshot);
+
+/**
+ * @brief Free what Snapshot_read() filled in, including any messages
+ * still left in its chats
+ *
+ * @param snapshot
+ */
+void Snapshot_free(struct Snapshot* snapshot);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "snapshot.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+/**
+ * @brief A snapshot of chats peers, each with messages messages, some
+ * of them too long to keep inline
+ */
+void build(struct ArrayListBuf* b, int chats, int messages) {
+    char address[50], name[50], text[200];
+    Snapshot_begin(b, "me", chats > 1 ? 1 : SNAPSHOT_NONE);
+    for (int c = 0; c < chats; c++) {
+        sprintf(address, "10.0.%i.%i 60000", c/256, c%256);
+        sprintf(name, "peer%i", c);
+        Snapshot_addChat(b, address, name, (uint16_t)(c + 7), (uint32_t)messages);
+        for (int i = 0; i < messages; i++) {
+            sprintf(text, "%i to %i%s", i, c, i % 5 == 0 ? ", which is long enough that it has to live on the heap" : "");
+            struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)strlen(text));
+            msg->timestamp = 1000 + i;
+            if (i % 2) {
+                msg->flags |= MESSAGE_OUTGOING;
+            }
+            Snapshot_addMessage(b, msg);
+            Message_free(msg);
+        }
+    }
+}
+
+/**
+ * @brief Whether a snapshot read back matches what build() put in
+ */
+int matches(struct Snapshot* snapshot, int chats, int messages) {
+    char address[50], name[50], text[200];
+    if (strcmp(snapshot->myname, "me") != 0 || snapshot->chats.N != (size_t)chats
+        || snapshot->visible != (chats > 1 ? 1 : SNAPSHOT_NONE)) {
+        return 0;
+    }
+    for (int c = 0; c < chats; c++) {
+        struct SnapshotChat* chat = &snapshot->chats.data[c];
+        sprintf(address, "10.0.%i.%i 60000", c/256, c%256);
+        sprintf(name, "peer%i", c);
+        if (strcmp(chat->address, address) != 0 || strcmp(chat->name, name) != 0
+            || chat->outCounter != c + 7 || chat->messages.N != (size_t)messages) {
+            return 0;
+        }
+        for (int i = 0; i < messages; i++) {
+            struct Message* msg = chat->messages.data[i];
+            sprintf(text, "%i to %i%s", i, c, i % 5 == 0 ? ", which is long enough that it has to live on the heap" : "");
+            if (strcmp(Message_text(msg), text) != 0 || msg->len != strlen(text) || msg->id != i
+                || msg->timestamp != (uint64_t)(1000 + i) || (msg->flags & MESSAGE_OUTGOING) != (i % 2 ? MESSAGE_OUTGOING : 0)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+int main() {
+    char dir[] = "/tmp/snapshottestXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        return 1;
+    }
+    char path[100];
+    sprintf(path, "%s/session", dir);
+    struct Snapshot snapshot;
+    check(Snapshot_read(path, &snapshot) == -1 && snapshot.chats.N == 0, "there's nothing to read at first");
+
+    struct ArrayListBuf b;
+    ArrayListBuf_init(&b);
+    build(&b, 0, 0);
+    check(Snapshot_write(&b, path) == 0 && Snapshot_read(path, &snapshot) == 0 && matches(&snapshot, 0, 0), "an empty session");
+    Snapshot_free(&snapshot);
+
+    build(&b, 3, 20);
+    size_t size = b.N;
+    check(Snapshot_write(&b, path) == 0 && b.N == size, "writing leaves the buffer as it was");
+    check(Snapshot_read(path, &snapshot) == 0 && matches(&snapshot, 3, 20), "chats and messages come back as they went in");
+    Snapshot_free(&snapshot);
+    char tmpPath[120];
+    sprintf(tmpPath, "%s.tmp", path);
+    check(access(tmpPath, F_OK) == -1, "nothing is left behind");
+
+    // Damage anywhere, or a file cut short, and the snapshot is ignored
+    int fd = open(path, O_WRONLY);
+    if (pwrite(fd, "x", 1, (off_t)(size/2)) != 1) {
+        check(0, "damage snapshot");
+    }
+    close(fd);
+    check(Snapshot_read(path, &snapshot) == -1 && snapshot.chats.N == 0 && snapshot.myname == NULL, "a damaged snapshot is ignored");
+    Snapshot_write(&b, path);
+    if (truncate(path, (off_t)(size - 10)) != 0) {
+        check(0, "truncate");
+    }
+    check(Snapshot_read(path, &snapshot) == -1, "so is one cut short");
+
+    // Hundreds of peers
+    int chats = 500, messages = 100;
+    build(&b, chats, messages);
+    clock_t start = clock();
+    Snapshot_write(&b, path);
+    double written = (double)(clock() - start)/CLOCKS_PER_SEC;
+    start = clock();
+    int ok = Snapshot_read(path, &snapshot) == 0;
+    double read = (double)(clock() - start)/CLOCKS_PER_SEC;
+    check(ok && matches(&snapshot, chats, messages), "500 peers with 100 messages each");
+    printf("      %zu KB, written in %.3f ms, read in %.3f ms\n", b.N/1024, written*1000, read*1000);
+    Snapshot_free(&snapshot);
+    ArrayListBuf_free(&b);
+
+    char command[100];
+    sprintf(command, "rm -r %s", dir);
+    if (system(command) != 0) {
+        printf("couldn't remove %s\n", dir);
+    }
+    return failures;
+}
@@ -0,0 +1,639 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "timeline.h"
+
+/**
+ * What a spilled message looks like in the spill file; the text follows
+ */
+struct SpillRecord {
+    uint64_t timestamp;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+};
+
+#define SPILL_FILE_SHIFT 58 // A spill offset's top bits say which file it's in
+
+/**
+ * Spill files are only ever appended to: space is handed out by bumping
+ * size, and written outside the lock.  Each is unlinked as soon as it's
+ * created, so it goes away with the process.  A file no longer being
+ * written stays open until no message is left in it (live is 0), since
+ * only then can nothing read from it.
+ */
+struct SpillFile {
+    int fd; // -1 if the slot is free
+    uint64_t size;
+    uint64_t live; // Bytes of messages still in it
+};
+
+static struct {
+    pthread_mutex_t lock; // Guards the files
+    struct SpillFile files[TIMELINE_SPILL_FILES];
+    _Atomic int current; // File being written (-1 until there's been a spill)
+    _Atomic uint64_t resident; // Bytes, across every timeline
+    _Atomic uint64_t spilled; // Messages, across every timeline
+} store = {PTHREAD_MUTEX_INITIALIZER, {[0 ... TIMELINE_SPILL_FILES - 1] = {-1, 0, 0}}, -1};
+
+_Static_assert(TIMELINE_SPILL_FILES <= (1 << (62 - SPILL_FILE_SHIFT)), "Spill files are numbered in the top bits of an offset");
+
+/**
+ * @brief Open a new spill file in a free slot and start writing it
+ * (NOTE: Caller must hold store.lock)
+ */
+static void Timeline_openSpillFile() {
+    int file = 0;
+    while (file < TIMELINE_SPILL_FILES && store.files[file].fd != -1) {
+        file++;
+    }
+    if (file == TIMELINE_SPILL_FILES) {
+        return; // Every slot is still being drained; keep writing this one
+    }
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/chatter-spill-XXXXXX", dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+        store.files[file].fd = fd;
+        store.files[file].size = 0;
+        store.files[file].live = 0;
+        atomic_store(&store.current, file);
+    }
+}
+
+/**
+ * @brief Let go of a message's copy in a spill file, replacing the file
+ * once enough of it is dead and closing it once it's empty
+ *
+ * @param file File
+ * @param bytes Size of the copy
+ */
+static void Timeline_unspill(int file, uint64_t bytes) {
+    pthread_mutex_lock(&store.lock);
+    struct SpillFile* f = &store.files[file];
+    f->live -= bytes;
+    uint64_t dead = f->size - f->live;
+    if (file == atomic_load(&store.current) && dead >= TIMELINE_SPILL_DEAD_MIN && dead*TIMELINE_SPILL_DEAD_RATIO >= f->size) {
+        Timeline_openSpillFile();
+    }
+    if (file != atomic_load(&store.current) && f->live == 0) {
+        close(f->fd);
+        f->fd = -1;
+        f->size = 0;
+    }
+    pthread_mutex_unlock(&store.lock);
+}
+
+static int Timeline_spillFile(uint64_t offset) {
+    return (int)(offset >> SPILL_FILE_SHIFT);
+}
+
+static uint64_t Timeline_spillOffset(uint64_t offset) {
+    return offset & ((1ULL << SPILL_FILE_SHIFT) - 1);
+}
+
+/**
+ * @brief Read the record a spilled message starts with
+ *
+ * @return int 0 if it was read, -1 if not
+ */
+static int Timeline_readRecord(uint64_t offset, struct SpillRecord* record) {
+    int fd = store.files[Timeline_spillFile(offset)].fd;
+    return pread(fd, record, sizeof(*record), (off_t)Timeline_spillOffset(offset)) == sizeof(*record) ? 0 : -1;
+}
+
+/**
+ * What Timeline_get() gives back for a tombstone
+ */
+static struct Message tombstone = {0, 0, 0, MESSAGE_DELETED, {.small = ""}};
+
+/**
+ * @brief Memory a message takes up while it's resident
+ */
+static uint64_t Timeline_bytes(const struct Message* msg) {
+    uint64_t bytes = MESSAGE_SIZE;
+    if (msg->flags & MESSAGE_HEAP_TEXT) {
+        bytes += (uint64_t)msg->len + 1;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Spill file offset of a spilled message, archive reference of
+ * an archived one, or timestamp of a tombstone
+ */
+static uint64_t Timeline_untag(const struct Timeline* tl, size_t i) {
+    return (uintptr_t)tl->messages.data[i] >> 2;
+}
+
+static int Timeline_isResident(const struct Timeline* tl, size_t i) {
+    return ((uintptr_t)tl->messages.data[i] & 3) == 0;
+}
+
+static struct Message* Timeline_tag(uint64_t value, uintptr_t tag) {
+    return (struct Message*)(uintptr_t)((value << 2) | tag);
+}
+
+void Timeline_init(struct Timeline* tl) {
+    MessageArray_init(&tl->messages);
+    tl->residentBytes = 0;
+    tl->spilled = 0;
+    tl->deleted = 0;
+    tl->archived = 0;
+    tl->hand = 0;
+    tl->archive = NULL;
+    tl->archiveCtx = NULL;
+    tl->homes = NULL;
+    tl->homesN = 0;
+    tl->homesCap = 0;
+    memset(tl->spillBytes, 0, sizeof(tl->spillBytes));
+    tl->drainAt = 0;
+}
+
+void Timeline_free(struct Timeline* tl) {
+    for (size_t i = 0; i < tl->messages.N; i++) {
+        if (Timeline_isResident(tl, i)) {
+            Message_free(tl->messages.data[i]);
+        }
+    }
+    for (int file = 0; file < TIMELINE_SPILL_FILES; file++) {
+        if (tl->spillBytes[file] > 0) {
+            Timeline_unspill(file, tl->spillBytes[file]);
+        }
+    }
+    atomic_fetch_sub(&store.resident, tl->residentBytes);
+    atomic_fetch_sub(&store.spilled, tl->spilled);
+    MessageArray_free(&tl->messages);
+    free(tl->homes);
+    Timeline_init(tl);
+}
+
+/**
+ * @brief Bytes a message's copy takes up in the spill file
+ */
+static uint64_t Timeline_spillBytes(uint32_t len) {
+    return sizeof(struct SpillRecord) + len;
+}
+
+/**
+ * @brief Where in homes a message would go if there were no collisions
+ */
+static size_t Timeline_homeHash(const struct Timeline* tl, const struct Message* msg) {
+    return (size_t)(((uintptr_t)msg >> 6)*0x9E3779B97F4A7C15ULL) & (tl->homesCap - 1); // Messages are 64 byte aligned
+}
+
+/**
+ * @brief Slot in homes a message is in, or the free one it would go in
+ */
+static size_t Timeline_findHome(const struct Timeline* tl, const struct Message* msg) {
+    size_t i = Timeline_homeHash(tl, msg);
+    while (tl->homes[i].msg != NULL && tl->homes[i].msg != msg) {
+        i = (i + 1) & (tl->homesCap - 1);
+    }
+    return i;
+}
+
+/**
+ * @brief Let go of the copy on disk of a message that's in memory
+ * (a copy in the archive is kept for good, so only spilled ones matter)
+ */
+static void Timeline_dropHome(struct Timeline* tl, const struct Message* msg, struct Message* slot) {
+    if (((uintptr_t)slot & 3) == TIMELINE_SPILLED) {
+        int file = Timeline_spillFile((uintptr_t)slot >> 2);
+        uint64_t bytes = Timeline_spillBytes(msg->len);
+        tl->spillBytes[file] -= bytes;
+        Timeline_unspill(file, bytes);
+    }
+}
+
+/**
+ * @brief Remember where a message that's been read back in came from
+ *
+ * @param tl
+ * @param msg Message, now in memory
+ * @param slot Its slot before it was read in
+ */
+static void Timeline_setHome(struct Timeline* tl, struct Message* msg, struct Message* slot) {
+    if ((tl->homesN + 1)*2 > tl->homesCap) {
+        // Kept at most half full
+        size_t cap = tl->homesCap > 0 ? tl->homesCap*2 : 64;
+        struct TimelineHome* homes = (struct TimelineHome*)calloc(cap, sizeof(struct TimelineHome));
+        if (homes == NULL) {
+            Timeline_dropHome(tl, msg, slot); // It'll just be written again
+            return;
+        }
+        struct TimelineHome* old = tl->homes;
+        size_t oldCap = tl->homesCap;
+        tl->homes = homes;
+        tl->homesCap = cap;
+        for (size_t i = 0; i < oldCap; i++) {
+            if (old[i].msg != NULL) {
+                tl->homes[Timeline_findHome(tl, old[i].msg)] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t i = Timeline_findHome(tl, msg);
+    tl->homes[i].msg = msg;
+    tl->homes[i].slot = slot;
+    tl->homesN++;
+}
+
+/**
+ * @brief Forget where a message in memory came from
+ *
+ * @return struct Message* Its slot before it was read in, or NULL if it wasn't
+ */
+static struct Message* Timeline_takeHome(struct Timeline* tl, const struct Message* msg) {
+    if (tl->homesN == 0) {
+        return NULL;
+    }
+    size_t i = Timeline_findHome(tl, msg);
+    if (tl->homes[i].msg == NULL) {
+        return NULL;
+    }
+    struct Message* slot = tl->homes[i].slot;
+    tl->homesN--;
+    // Shift back whatever follows in the run that would no longer be found
+    size_t hole = i;
+    for (size_t j = (i + 1) & (tl->homesCap - 1); tl->homes[j].msg != NULL; j = (j + 1) & (tl->homesCap - 1)) {
+        size_t want = Timeline_homeHash(tl, tl->homes[j].msg);
+        if (((j - want) & (tl->homesCap - 1)) >= ((j - hole) & (tl->homesCap - 1))) {
+            tl->homes[hole] = tl->homes[j];
+            hole = j;
+        }
+    }
+    tl->homes[hole].msg = NULL;
+    return slot;
+}
+
+/**
+ * @brief Take a message out of memory, leaving something else in its slot
+ */
+static void Timeline_release(struct Timeline* tl, size_t i, struct Message* slot) {
+    struct Message* msg = tl->messages.data[i];
+    uint64_t bytes = Timeline_bytes(msg);
+    tl->residentBytes -= bytes;
+    atomic_fetch_sub(&store.resident, bytes);
+    Message_free(msg);
+    tl->messages.data[i] = slot;
+}
+
+/**
+ * @brief Write a message to the spill file
+ *
+ * @return int 0 if it was written, -1 if not (it then stays in memory)
+ */
+static int Timeline_spill(struct Timeline* tl, size_t i) {
+    struct Message* msg = tl->messages.data[i];
+    struct SpillRecord record = {msg->timestamp, msg->len, msg->id, (uint16_t)(msg->flags & MESSAGE_OUTGOING)};
+    uint64_t bytes = Timeline_spillBytes(msg->len);
+    pthread_mutex_lock(&store.lock);
+    if (atomic_load(&store.current) == -1) {
+        Timeline_openSpillFile();
+    }
+    int file = atomic_load(&store.current);
+    if (file == -1) {
+        pthread_mutex_unlock(&store.lock);
+        return -1;
+    }
+    struct SpillFile* f = &store.files[file];
+    uint64_t offset = f->size;
+    f->size += bytes;
+    f->live += bytes;
+    pthread_mutex_unlock(&store.lock);
+    tl->spillBytes[file] += bytes;
+    if (pwrite(f->fd, &record, sizeof(record), (off_t)offset) != sizeof(record)
+        || pwrite(f->fd, Message_text(msg), msg->len, (off_t)(offset + sizeof(record))) != (ssize_t)msg->len) {
+        tl->spillBytes[file] -= bytes;
+        Timeline_unspill(file, bytes);
+        return -1;
+    }
+    tl->spilled++;
+    atomic_fetch_add(&store.spilled, 1);
+    Timeline_release(tl, i, Timeline_tag((uint64_t)file << SPILL_FILE_SHIFT | offset, TIMELINE_SPILLED));
+    return 0;
+}
+
+/**
+ * @brief Put a message that isn't being looked at back on disk: where
+ * it was read from if it's still there, or else into the spill file
+ *
+ * @return int 0 if it's out of memory, -1 if not
+ */
+static int Timeline_putAway(struct Timeline* tl, size_t i) {
+    struct Message* msg = tl->messages.data[i];
+    struct Message* slot = Timeline_takeHome(tl, msg);
+    if (slot != NULL) {
+        if (((uintptr_t)slot & 3) == TIMELINE_ARCHIVED) {
+            tl->archived++;
+            Timeline_release(tl, i, slot);
+            return 0;
+        }
+        if (Timeline_spillFile((uintptr_t)slot >> 2) == atomic_load(&store.current)) {
+            tl->spilled++;
+            atomic_fetch_add(&store.spilled, 1);
+            Timeline_release(tl, i, slot);
+            return 0;
+        }
+        Timeline_dropHome(tl, msg, slot); // Its file is being drained
+    }
+    return Timeline_spill(tl, i);
+}
+
+struct Message* Timeline_get(struct Timeline* tl, size_t i) {
+    if (Timeline_isDeleted(tl, i)) {
+        return &tombstone;
+    }
+    struct Message* slot = tl->messages.data[i];
+    if (Timeline_isArchived(tl, i)) {
+        struct Message* msg = tl->archive->read(tl->archiveCtx, Timeline_untag(tl, i));
+        if (msg == NULL) {
+            return &tombstone; // Unreadable; left in the archive
+        }
+        uint64_t bytes = Timeline_bytes(msg);
+        tl->residentBytes += bytes;
+        tl->archived--;
+        atomic_fetch_add(&store.resident, bytes);
+        tl->messages.data[i] = msg;
+        Timeline_setHome(tl, msg, slot);
+    }
+    if (Timeline_isSpilled(tl, i)) {
+        uint64_t offset = Timeline_untag(tl, i);
+        struct SpillRecord record;
+        struct Message* msg;
+        int found = Timeline_readRecord(offset, &record) == 0;
+        if (found) {
+            msg = Message_alloc(record.id, record.len);
+            if (msg == NULL) {
+                return &tombstone; // Left on disk until there's memory for it
+            }
+            int fd = store.files[Timeline_spillFile(offset)].fd;
+            off_t text = (off_t)(Timeline_spillOffset(offset) + sizeof(record));
+            if (pread(fd, Message_text(msg), record.len, text) != (ssize_t)record.len) {
+                memset(Message_text(msg), '?', record.len);
+            }
+            msg->timestamp = record.timestamp;
+            msg->flags |= record.flags;
+        }
+        else {
+            msg = Message_init(0, "(lost)", 6); // Shouldn't happen
+            if (msg == NULL) {
+                return &tombstone;
+            }
+        }
+        uint64_t bytes = Timeline_bytes(msg);
+        tl->residentBytes += bytes;
+        tl->spilled--;
+        atomic_fetch_add(&store.resident, bytes);
+        atomic_fetch_sub(&store.spilled, 1);
+        tl->messages.data[i] = msg;
+        if (found) {
+            Timeline_setHome(tl, msg, slot);
+        }
+    }
+    struct Message* msg = tl->messages.data[i];
+    msg->flags |= MESSAGE_REFERENCED;
+    return msg;
+}
+
+void Timeline_header(struct Timeline* tl, size_t i, uint64_t* timestamp, uint16_t* id, uint16_t* flags) {
+    struct SpillRecord record = {0, 0, 0, 0};
+    if (Timeline_isDeleted(tl, i)) {
+        record.timestamp = Timeline_untag(tl, i);
+        record.flags = MESSAGE_DELETED;
+    }
+    else if (Timeline_isSpilled(tl, i)) {
+        if (Timeline_readRecord(Timeline_untag(tl, i), &record) == -1) {
+            memset(&record, 0, sizeof(record));
+        }
+    }
+    else if (Timeline_isArchived(tl, i)) {
+        if (tl->archive->header(tl->archiveCtx, Timeline_untag(tl, i), &record.timestamp, &record.id, &record.flags) == -1) {
+            record.flags = MESSAGE_DELETED;
+        }
+    }
+    else {
+        struct Message* msg = tl->messages.data[i];
+        record.timestamp = msg->timestamp;
+        record.id = msg->id;
+        record.flags = msg->flags;
+    }
+    *timestamp = record.timestamp;
+    *id = record.id;
+    *flags = record.flags;
+}
+
+void Timeline_push(struct Timeline* tl, struct Message* msg) {
+    msg->flags |= MESSAGE_REFERENCED; // New messages get a sweep's grace
+    uint64_t bytes = Timeline_bytes(msg);
+    tl->residentBytes += bytes;
+    atomic_fetch_add(&store.resident, bytes);
+    MessageArray_push(&tl->messages, msg);
+}
+
+void Timeline_prepend(struct Timeline* tl, MessageArray* front) {
+    size_t count = front->N;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t bytes = Timeline_bytes(front->data[i]);
+        tl->residentBytes += bytes;
+        atomic_fetch_add(&store.resident, bytes);
+    }
+    MessageArray_reserve(front, count + tl->messages.N);
+    memcpy(front->data + count, tl->messages.data, tl->messages.N*sizeof(struct Message*));
+    front->N = count + tl->messages.N;
+    // Swap the arrays so the timeline has the combined one
+    MessageArray old = tl->messages;
+    tl->messages = *front;
+    *front = old;
+    MessageArray_clear(front);
+    tl->hand += count;
+}
+
+void Timeline_setArchive(struct Timeline* tl, const struct TimelineArchive* archive, void* ctx) {
+    tl->archive = archive;
+    tl->archiveCtx = ctx;
+}
+
+void Timeline_prependArchived(struct Timeline* tl, const uint64_t* refs, size_t count) {
+    size_t N = tl->messages.N;
+    MessageArray_reserve(&tl->messages, count + N);
+    memmove(tl->messages.data + count, tl->messages.data, N*sizeof(struct Message*));
+    for (size_t i = 0; i < count; i++) {
+        tl->messages.data[i] = Timeline_tag(refs[i], TIMELINE_ARCHIVED);
+    }
+    tl->messages.N = count + N;
+    tl->archived += count;
+    tl->hand += count;
+}
+
+void Timeline_delete(struct Timeline* tl, size_t i) {
+    uint64_t timestamp;
+    if (Timeline_isSpilled(tl, i)) {
+        struct SpillRecord record;
+        uint64_t offset = Timeline_untag(tl, i);
+        if (Timeline_readRecord(offset, &record) == 0) {
+            int file = Timeline_spillFile(offset);
+            tl->spillBytes[file] -= Timeline_spillBytes(record.len);
+            Timeline_unspill(file, Timeline_spillBytes(record.len));
+        }
+        else {
+            record.timestamp = 0; // Shouldn't happen
+        }
+        timestamp = record.timestamp;
+        tl->spilled--;
+        atomic_fetch_sub(&store.spilled, 1);
+    }
+    else if (Timeline_isArchived(tl, i)) {
+        uint16_t id, flags;
+        Timeline_header(tl, i, &timestamp, &id, &flags);
+        tl->archived--; // The archive is told separately
+    }
+    else {
+        struct Message* msg = tl->messages.data[i];
+        struct Message* slot = Timeline_takeHome(tl, msg);
+        if (slot != NULL) {
+            Timeline_dropHome(tl, msg, slot);
+        }
+        timestamp = msg->timestamp;
+        Timeline_release(tl, i, NULL);
+    }
+    tl->messages.data[i] = Timeline_tag(timestamp, TIMELINE_TOMBSTONE);
+    tl->deleted++;
+}
+
+size_t Timeline_compact(struct Timeline* tl, Timeline_RemovedFn removed, void* ctx) {
+    if (removed != NULL) {
+        for (size_t i = tl->messages.N; i > 0; i--) {
+            if (Timeline_isDeleted(tl, i-1)) {
+                removed(ctx, i-1);
+            }
+        }
+    }
+    size_t kept = 0;
+    size_t hand = tl->hand;
+    for (size_t i = 0; i < tl->messages.N; i++) {
+        if (!Timeline_isDeleted(tl, i)) {
+            tl->messages.data[kept++] = tl->messages.data[i];
+        }
+        else if (i < tl->hand) {
+            hand--;
+        }
+    }
+    size_t count = tl->messages.N - kept;
+    tl->messages.N = kept;
+    tl->hand = hand;
+    tl->deleted = 0;
+    return count;
+}
+
+uint64_t Timeline_evict(struct Timeline* tl, uint64_t bytes) {
+    uint64_t start = tl->residentBytes;
+    size_t N = tl->messages.N;
+    // Two sweeps are enough to clear every flag and then spill
+    for (size_t steps = 0; steps < 2*N && start - tl->residentBytes < bytes && tl->spilled + tl->deleted + tl->archived < N; steps++) {
+        if (tl->hand >= N) {
+            tl->hand = 0;
+        }
+        if (Timeline_isResident(tl, tl->hand)) {
+            struct Message* msg = tl->messages.data[tl->hand];
+            if (msg->flags & MESSAGE_REFERENCED) {
+                msg->flags &= ~MESSAGE_REFERENCED; // Second chance
+            }
+            else if (Timeline_putAway(tl, tl->hand) == -1) {
+                break; // Can't write the spill file; keep everything
+            }
+        }
+        tl->hand++;
+    }
+    return start - tl->residentBytes;
+}
+
+/**
+ * @brief Bytes of a timeline's messages in spill files being drained
+ */
+static uint64_t Timeline_drainingBytes(const struct Timeline* tl, int current) {
+    uint64_t bytes = 0;
+    for (int file = 0; file < TIMELINE_SPILL_FILES; file++) {
+        if (file != current) {
+            bytes += tl->spillBytes[file];
+        }
+    }
+    return bytes;
+}
+
+size_t Timeline_drain(struct Timeline* tl, size_t max) {
+    int current = atomic_load(&store.current);
+    size_t moved = 0;
+    size_t N = tl->messages.N;
+    for (size_t steps = 0; steps < N && moved < max && Timeline_drainingBytes(tl, current) > 0; steps++) {
+        if (tl->drainAt >= N) {
+            tl->drainAt = 0;
+        }
+        size_t i = tl->drainAt++;
+        if (Timeline_isSpilled(tl, i) && Timeline_spillFile(Timeline_untag(tl, i)) != current) {
+            // Read it in and straight back out, into the current file
+            struct Message* msg = Timeline_get(tl, i);
+            if (msg != &tombstone) {
+                msg->flags &= ~MESSAGE_REFERENCED; // Not really looked at
+                Timeline_putAway(tl, i);
+                moved++;
+            }
+        }
+        else if (Timeline_isResident(tl, i) && tl->homesN > 0) {
+            // In memory anyway, so it can just be written again when it's evicted
+            struct Message* msg = tl->messages.data[i];
+            struct TimelineHome* home = &tl->homes[Timeline_findHome(tl, msg)];
+            if (home->msg != NULL && ((uintptr_t)home->slot & 3) == TIMELINE_SPILLED
+                && Timeline_spillFile((uintptr_t)home->slot >> 2) != current) {
+                Timeline_dropHome(tl, msg, Timeline_takeHome(tl, msg));
+            }
+        }
+    }
+    return moved;
+}
+
+int Timeline_spillDraining() {
+    int draining = 0;
+    pthread_mutex_lock(&store.lock);
+    for (int file = 0; file < TIMELINE_SPILL_FILES; file++) {
+        if (store.files[file].fd != -1 && file != atomic_load(&store.current)) {
+            draining = 1;
+        }
+    }
+    pthread_mutex_unlock(&store.lock);
+    return draining;
+}
+
+uint64_t Timeline_totalResident() {
+    return atomic_load(&store.resident);
+}
+
+uint64_t Timeline_totalSpilled() {
+    return atomic_load(&store.spilled);
+}
+
+uint64_t Timeline_spillFileBytes() {
+    uint64_t bytes = 0;
+    pthread_mutex_lock(&store.lock);
+    for (int file = 0; file < TIMELINE_SPILL_FILES; file++) {
+        bytes += store.files[file].size;
+    }
+    pthread_mutex_unlock(&store.lock);
+    return bytes;
+}
+
+uint64_t Timeline_spillDeadBytes() {
+    uint64_t bytes = 0;
+    pthread_mutex_lock(&store.lock);
+    for (int file = 0; file < TIMELINE_SPILL_FILES; file++) {
+        bytes += store.files[file].size - store.files[file].live;
+    }
+    pthread_mutex_unlock(&store.lock);
+    return bytes;
+}
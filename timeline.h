@@ -0,0 +1,283 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+#include "arraylist.h"
+#include "message.h"
+
+#define TIMELINE_COMPACT_MIN 64 // Tombstones a timeline has before it's worth compacting...
+#define TIMELINE_COMPACT_RATIO 4 // ...and only once at least 1 in this many messages is one
+#define TIMELINE_SPILL_FILES 4 // Spill files that can be open at once (the one being written, and older ones being drained)
+#define TIMELINE_SPILL_DEAD_MIN (1 << 20) // Bytes of deleted messages the spill file has before it's worth replacing...
+#define TIMELINE_SPILL_DEAD_RATIO 2 // ...and only once at least 1 in this many of its bytes are
+
+/**
+ * Somewhere a timeline's older messages can be read back from when
+ * they're wanted, by the references it gave out (which fit in 62 bits)
+ */
+struct TimelineArchive {
+    struct Message* (*read)(void* ctx, uint64_t ref); // Read a message in (NULL if it can't be; it then reads as deleted)
+    int (*header)(void* ctx, uint64_t ref, uint64_t* timestamp, uint16_t* id, uint16_t* flags); // Without reading it in; -1 if it's gone
+};
+
+/**
+ * Where a message that was read back in goes when it's evicted again
+ */
+struct TimelineHome {
+    struct Message* msg; // NULL if the slot is free
+    struct Message* slot; // Tagged spill offset or archive reference it was read from
+};
+
+/**
+ * A chat's messages, oldest first, only some of which are kept in
+ * memory.  The rest are spilled: written to a spill file shared by the
+ * whole process and their slot in the array replaced by their offset in
+ * it, tagged in the low two bits (messages are 64 byte aligned, so a
+ * real pointer never has them set).  Timeline_get() brings spilled
+ * messages back in transparently, so callers only ever see ordinary
+ * messages.
+ *
+ * Deleting a message frees it straight away but leaves a tombstone in
+ * its slot (its timestamp, tagged the same way), so deletes don't move
+ * the rest of the array and indices stay put.  Tombstones read as an
+ * empty message flagged MESSAGE_DELETED.  Timeline_compact() clears
+ * them out all at once, later, once there are enough of them.
+ *
+ * Which messages to spill is decided with the clock algorithm: every
+ * message gets MESSAGE_REFERENCED when it's added or looked at, and the
+ * hand sweeps from oldest to newest, clearing that flag and spilling
+ * messages that didn't have it.  Timelines are in time order, so the
+ * hand finds old, unread history first.
+ *
+ * Older messages can also be left where they're kept for good (a
+ * peer's history log) and only listed: their slots hold a reference
+ * the archive gave out, tagged TIMELINE_ARCHIVED, and they're read in
+ * the first time Timeline_get() is asked for them.
+ *
+ * Messages never change once they're in, so one that's read back keeps
+ * its copy on disk: the timeline remembers the offset or reference it
+ * came from, and evicting it again just puts that back in its slot.
+ * The spill file is only appended to, so deleted messages leave dead
+ * space in it.  Once enough of it is dead a new file is started, and
+ * the live messages left in the old one are moved across a few at a
+ * time (see Timeline_drain()); the old file is closed when the last one
+ * leaves it.
+ *
+ * Not thread safe; the caller provides the locking (the chat's lock).
+ */
+struct Timeline {
+    MessageArray messages; // Message*, or a tagged spill offset, tombstone or archive reference
+    uint64_t residentBytes; // Memory held by messages that aren't spilled
+    size_t spilled; // Number of messages that are spilled
+    size_t deleted; // Number of tombstones
+    size_t archived; // Number of messages that haven't been read in from the archive
+    size_t hand; // Clock hand
+    struct TimelineHome* homes; // Messages in memory that are still on disk too (open addressing, by message)
+    size_t homesN, homesCap; // Messages in homes, and its size (a power of 2, or 0)
+    uint64_t spillBytes[TIMELINE_SPILL_FILES]; // Bytes of each spill file holding its messages
+    size_t drainAt; // Where Timeline_drain() got up to
+    const struct TimelineArchive* archive; // Where archived messages are read from (NULL if none)
+    void* archiveCtx; // Passed to the archive's functions
+};
+
+void Timeline_init(struct Timeline* tl);
+
+/**
+ * @brief Free every message still in memory, and the array
+ *
+ * @param tl
+ */
+void Timeline_free(struct Timeline* tl);
+
+static inline size_t Timeline_size(const struct Timeline* tl) {
+    return tl->messages.N;
+}
+
+#define TIMELINE_SPILLED 1 // Tag on a spill file offset
+#define TIMELINE_ARCHIVED 2 // Tag on an archive's reference to a message
+#define TIMELINE_TOMBSTONE 3 // Tag on a deleted message's timestamp
+
+static inline int Timeline_isSpilled(const struct Timeline* tl, size_t i) {
+    return ((uintptr_t)tl->messages.data[i] & 3) == TIMELINE_SPILLED;
+}
+
+static inline int Timeline_isDeleted(const struct Timeline* tl, size_t i) {
+    return ((uintptr_t)tl->messages.data[i] & 3) == TIMELINE_TOMBSTONE;
+}
+
+static inline int Timeline_isArchived(const struct Timeline* tl, size_t i) {
+    return ((uintptr_t)tl->messages.data[i] & 3) == TIMELINE_ARCHIVED;
+}
+
+/**
+ * @brief Skip forward over a run of tombstones
+ *
+ * @param tl
+ * @param i Index to start at
+ * @return size_t First index at or after i that isn't a tombstone (the size if there's none)
+ */
+static inline size_t Timeline_skipDeleted(const struct Timeline* tl, size_t i) {
+    while (i < tl->messages.N && Timeline_isDeleted(tl, i)) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief Skip back over a run of tombstones
+ *
+ * @param tl
+ * @param end Index just after where to start
+ * @return size_t One past the last index before end that isn't a tombstone (0 if there's none)
+ */
+static inline size_t Timeline_skipDeletedBack(const struct Timeline* tl, size_t end) {
+    while (end > 0 && Timeline_isDeleted(tl, end - 1)) {
+        end--;
+    }
+    return end;
+}
+
+/**
+ * @brief Whether there are enough tombstones to be worth compacting
+ */
+static inline int Timeline_needsCompaction(const struct Timeline* tl) {
+    return tl->deleted >= TIMELINE_COMPACT_MIN && tl->deleted*TIMELINE_COMPACT_RATIO >= tl->messages.N;
+}
+
+/**
+ * @brief Get a message, reading it back from the spill file or the
+ * archive first if it's not in memory.  The message stays valid until the next
+ * Timeline_evict(), Timeline_drain() or Timeline_delete().  A tombstone comes back as an
+ * empty message flagged MESSAGE_DELETED, which mustn't be changed
+ *
+ * @param tl
+ * @param i Index
+ * @return struct Message*
+ */
+struct Message* Timeline_get(struct Timeline* tl, size_t i);
+
+/**
+ * @brief Get the fields that identify a message, without bringing it
+ * back into memory if it's spilled or archived
+ *
+ * @param tl
+ * @param i Index
+ * @param timestamp Set to the message's timestamp
+ * @param id Set to the message's id
+ * @param flags Set to the message's flags (only MESSAGE_OUTGOING if spilled or archived, MESSAGE_DELETED for a tombstone)
+ */
+void Timeline_header(struct Timeline* tl, size_t i, uint64_t* timestamp, uint16_t* id, uint16_t* flags);
+
+/**
+ * @brief Add a message to the end, which the timeline then owns
+ *
+ * @param tl
+ * @param msg
+ */
+void Timeline_push(struct Timeline* tl, struct Message* msg);
+
+/**
+ * @brief Put messages in front of the ones already there (e.g. older
+ * history loaded from disk), which the timeline then owns
+ *
+ * @param tl
+ * @param front Messages, oldest first (left empty)
+ */
+void Timeline_prepend(struct Timeline* tl, MessageArray* front);
+
+/**
+ * @brief Set where archived messages are read from.  Must be set before
+ * any are put in, and not changed after
+ *
+ * @param tl
+ * @param archive Archive's functions (not copied)
+ * @param ctx Passed to them
+ */
+void Timeline_setArchive(struct Timeline* tl, const struct TimelineArchive* archive, void* ctx);
+
+/**
+ * @brief Put messages that are still in the archive in front of the
+ * ones already there, by reference, without reading any of them in
+ *
+ * @param tl
+ * @param refs References from the archive, oldest first
+ * @param count Number of references
+ */
+void Timeline_prependArchived(struct Timeline* tl, const uint64_t* refs, size_t count);
+
+/**
+ * @brief Delete a message, leaving a tombstone with its timestamp in
+ * its place.  Takes the same time however long the timeline is
+ *
+ * @param tl
+ * @param i Index (not already a tombstone)
+ */
+void Timeline_delete(struct Timeline* tl, size_t i);
+
+/**
+ * @brief Let whoever's compacting know a tombstone is being taken out
+ *
+ * @param ctx Whatever was passed to Timeline_compact()
+ * @param index Index the tombstone had.  Called newest first, so
+ * earlier indices are still as they were
+ */
+typedef void (*Timeline_RemovedFn)(void* ctx, size_t index);
+
+/**
+ * @brief Take every tombstone out of the timeline, in one pass
+ *
+ * @param tl
+ * @param removed Called for each tombstone taken out (may be NULL)
+ * @param ctx Passed to removed
+ * @return size_t Number of tombstones taken out
+ */
+size_t Timeline_compact(struct Timeline* tl, Timeline_RemovedFn removed, void* ctx);
+
+/**
+ * @brief Spill messages until some amount of memory is freed, or every
+ * message has been spilled.  Messages that were read back from disk
+ * aren't written again, but go back to where they were read from
+ *
+ * @param tl
+ * @param bytes Memory to free
+ * @return uint64_t Memory actually freed
+ */
+uint64_t Timeline_evict(struct Timeline* tl, uint64_t bytes);
+
+/**
+ * @brief Move some of the messages that are in spill files being
+ * replaced into the current one, so the old files can be closed
+ *
+ * @param tl
+ * @param max Most messages to move
+ * @return size_t Messages moved
+ */
+size_t Timeline_drain(struct Timeline* tl, size_t max);
+
+/**
+ * @brief Whether there are spill files being replaced, which
+ * Timeline_drain() should be called on every timeline to empty
+ */
+int Timeline_spillDraining();
+
+/**
+ * @brief Memory held by messages in memory, across every timeline
+ */
+uint64_t Timeline_totalResident();
+
+/**
+ * @brief Number of messages spilled, across every timeline
+ */
+uint64_t Timeline_totalSpilled();
+
+/**
+ * @brief Size of the spill files
+ */
+uint64_t Timeline_spillFileBytes();
+
+/**
+ * @brief Bytes of the spill files no message uses any more
+ */
+uint64_t Timeline_spillDeadBytes();
+
+#endif
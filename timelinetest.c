@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timeline.h"
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+/**
+ * @brief Text of message i; every third one is too long to keep inline
+ */
+int textOf(size_t i, char* text) {
+    if (i % 3 == 0) {
+        return sprintf(text, "message %zu is long enough that its text has to live in its own allocation", i);
+    }
+    return sprintf(text, "message %zu", i);
+}
+
+/**
+ * @brief Whether every message reads back as it went in
+ */
+int intact(struct Timeline* tl, size_t first, size_t N) {
+    char text[200];
+    for (size_t i = 0; i < N; i++) {
+        struct Message* msg = Timeline_get(tl, i);
+        int len = textOf(first + i, text);
+        if (msg->len != (uint32_t)len || strcmp(Message_text(msg), text) != 0
+            || msg->timestamp != first + i || msg->id != (uint16_t)(first + i)
+            || ((msg->flags & MESSAGE_OUTGOING) != 0) != ((first + i) % 2)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+struct Message* makeMessage(size_t i) {
+    char text[200];
+    int len = textOf(i, text);
+    struct Message* msg = Message_init((uint16_t)i, text, (uint32_t)len);
+    msg->timestamp = i;
+    if (i % 2) {
+        msg->flags |= MESSAGE_OUTGOING;
+    }
+    return msg;
+}
+
+/**
+ * An archive that makes message i up when it's read, and counts reads
+ */
+struct Archive {
+    size_t reads;
+    size_t gone; // Reference that reads as gone
+};
+
+struct Message* archiveRead(void* ctx, uint64_t ref) {
+    struct Archive* archive = (struct Archive*)ctx;
+    archive->reads++;
+    return ref == archive->gone ? NULL : makeMessage((size_t)ref);
+}
+
+int archiveHeader(void* ctx, uint64_t ref, uint64_t* timestamp, uint16_t* id, uint16_t* flags) {
+    struct Archive* archive = (struct Archive*)ctx;
+    *timestamp = ref;
+    *id = (uint16_t)ref;
+    *flags = ref % 2 ? MESSAGE_OUTGOING : 0;
+    return ref == archive->gone ? -1 : 0;
+}
+
+const struct TimelineArchive fakeArchive = {archiveRead, archiveHeader};
+
+void fill(struct Timeline* tl, size_t first, size_t N) {
+    for (size_t i = first; i < first + N; i++) {
+        Timeline_push(tl, makeMessage(i));
+    }
+}
+
+int main() {
+    size_t N = 3000;
+    struct Timeline tl;
+    Timeline_init(&tl);
+    fill(&tl, 0, N);
+    uint64_t full = tl.residentBytes;
+    check(full > N*MESSAGE_SIZE && Timeline_totalResident() == full, "memory is counted");
+
+    uint64_t freed = Timeline_evict(&tl, full/2);
+    check(freed >= full/2 && tl.residentBytes == full - freed && tl.spilled > 0, "eviction frees what's asked");
+    check(Timeline_isSpilled(&tl, 0) && !Timeline_isSpilled(&tl, N-1), "the oldest go first");
+    check(Timeline_totalSpilled() == tl.spilled && Timeline_spillFileBytes() > 0, "spilled messages are counted");
+
+    uint64_t timestamp;
+    uint16_t id, flags;
+    Timeline_header(&tl, 1, &timestamp, &id, &flags);
+    check(Timeline_isSpilled(&tl, 1) && timestamp == 1 && id == 1 && flags == MESSAGE_OUTGOING, "headers are read without bringing messages back");
+
+    size_t spilled = tl.spilled;
+    int ok;
+    struct Message* msg = Timeline_get(&tl, 0);
+    check(!Timeline_isSpilled(&tl, 0) && tl.spilled == spilled - 1 && msg->timestamp == 0, "getting a message brings it back");
+
+    // The sweep that spilled the others cleared their flags, but the
+    // message just looked at gets passed over once more
+    tl.hand = 0;
+    Timeline_evict(&tl, 1);
+    check(tl.spilled == spilled && !Timeline_isSpilled(&tl, 0), "looked at messages get a second chance");
+    Timeline_evict(&tl, full);
+    check(tl.spilled == N && tl.residentBytes == 0, "everything can be spilled");
+    check(intact(&tl, 0, N) && tl.spilled == 0 && tl.residentBytes == full, "messages come back as they went in");
+
+    uint64_t fileBytes = Timeline_spillFileBytes();
+    Timeline_evict(&tl, full);
+    Timeline_evict(&tl, full);
+    check(tl.spilled == N && Timeline_spillFileBytes() == fileBytes && Timeline_spillDeadBytes() == 0 && intact(&tl, 0, N),
+        "and go back where they were without being written again");
+    Timeline_evict(&tl, full);
+    Timeline_evict(&tl, full);
+    Timeline_delete(&tl, 5);
+    Timeline_header(&tl, 5, &timestamp, &id, &flags);
+    check(Timeline_size(&tl) == N && tl.spilled == N - 1 && tl.deleted == 1 && Timeline_isDeleted(&tl, 5)
+        && timestamp == 5 && flags == MESSAGE_DELETED, "a spilled message can be deleted, leaving its timestamp");
+    Timeline_get(&tl, N - 1); // Back into memory
+    Timeline_delete(&tl, N - 1);
+    check(tl.residentBytes == 0 && Timeline_get(&tl, N - 1)->flags == MESSAGE_DELETED
+        && Timeline_get(&tl, N - 1)->len == 0, "a message in memory can be deleted, and reads back empty");
+    check(!Timeline_needsCompaction(&tl), "a few tombstones aren't worth compacting");
+    for (size_t i = 10; i < N; i += 3) {
+        Timeline_delete(&tl, i);
+    }
+    check(Timeline_needsCompaction(&tl), "a lot are");
+    check(Timeline_skipDeleted(&tl, 10) == 11 && Timeline_skipDeleted(&tl, 11) == 11 && Timeline_skipDeleted(&tl, N - 1) == N
+        && Timeline_skipDeletedBack(&tl, 11) == 10 && Timeline_skipDeletedBack(&tl, 6) == 5, "runs of tombstones can be skipped");
+    size_t deleted = tl.deleted;
+    tl.hand = 12;
+    size_t removed = Timeline_compact(&tl, NULL, NULL);
+    ok = removed == deleted && tl.deleted == 0 && Timeline_size(&tl) == N - deleted && tl.hand == 10;
+    for (size_t i = 0, j = 0; ok && j < N; j++) {
+        if (j != 5 && j != N - 1 && !(j >= 10 && (j - 10) % 3 == 0)) {
+            Timeline_header(&tl, i++, &timestamp, &id, &flags);
+            ok = timestamp == j && id == (uint16_t)j;
+        }
+    }
+    check(ok, "compacting takes out just the tombstones");
+    Timeline_free(&tl);
+    check(Timeline_totalResident() == 0 && Timeline_totalSpilled() == 0, "freeing gives the memory back");
+
+    // Older messages put in front of newer ones, some of them spilled
+    Timeline_init(&tl);
+    fill(&tl, 100, 100);
+    Timeline_evict(&tl, tl.residentBytes/2);
+    MessageArray front;
+    MessageArray_init(&front);
+    for (size_t i = 0; i < 100; i++) {
+        MessageArray_push(&front, makeMessage(i));
+    }
+    Timeline_prepend(&tl, &front);
+    check(front.N == 0 && Timeline_size(&tl) == 200 && intact(&tl, 0, 200), "prepending keeps the order");
+    MessageArray_free(&front);
+    Timeline_free(&tl);
+    check(Timeline_totalResident() == 0, "nothing is left over");
+
+    // Older messages that are only read in once they're looked at
+    struct Archive archive = {0, 50};
+    Timeline_init(&tl);
+    Timeline_setArchive(&tl, &fakeArchive, &archive);
+    fill(&tl, 100, 100);
+    uint64_t refs[100];
+    for (size_t i = 0; i < 100; i++) {
+        refs[i] = i;
+    }
+    uint64_t before = tl.residentBytes;
+    Timeline_prependArchived(&tl, refs + 60, 40);
+    Timeline_prependArchived(&tl, refs, 60);
+    Timeline_header(&tl, 7, &timestamp, &id, &flags);
+    check(Timeline_size(&tl) == 200 && tl.archived == 100 && tl.residentBytes == before && archive.reads == 0
+        && timestamp == 7 && id == 7 && flags == MESSAGE_OUTGOING, "archived messages are listed without being read");
+    Timeline_header(&tl, 50, &timestamp, &id, &flags);
+    check(flags == MESSAGE_DELETED && Timeline_get(&tl, 50)->flags == MESSAGE_DELETED && Timeline_isArchived(&tl, 50),
+        "one that's gone from the archive reads as deleted");
+    archive.gone = 1000;
+    check(intact(&tl, 0, 200) && archive.reads == 101 && tl.archived == 0 && tl.residentBytes > before, "and read in when they're got");
+    Timeline_evict(&tl, tl.residentBytes);
+    check(tl.archived == 100 && intact(&tl, 0, 200) && archive.reads == 201,
+        "then go back to the archive rather than being spilled");
+    Timeline_free(&tl);
+    Timeline_init(&tl);
+    Timeline_setArchive(&tl, &fakeArchive, &archive);
+    Timeline_prependArchived(&tl, refs, 10);
+    Timeline_delete(&tl, 3);
+    check(tl.archived == 9 && tl.deleted == 1 && Timeline_evict(&tl, 1) == 0, "deleting one doesn't read it, and eviction leaves them be");
+    Timeline_free(&tl);
+    check(Timeline_totalResident() == 0, "nothing is left over");
+
+    // Deleting spilled messages leaves dead space, until there's enough
+    // to be worth a new file
+    struct Timeline other;
+    Timeline_init(&other);
+    fill(&other, 0, 100);
+    Timeline_evict(&other, other.residentBytes);
+    Timeline_evict(&other, other.residentBytes);
+    Timeline_init(&tl);
+    size_t big = 0;
+    while (Timeline_spillFileBytes() < 4*TIMELINE_SPILL_DEAD_MIN) {
+        fill(&tl, big, 1000);
+        big += 1000;
+        Timeline_evict(&tl, tl.residentBytes);
+        Timeline_evict(&tl, tl.residentBytes);
+    }
+    fileBytes = Timeline_spillFileBytes();
+    uint64_t dead = Timeline_spillDeadBytes();
+    Timeline_delete(&tl, 0);
+    check(Timeline_spillDeadBytes() > dead && Timeline_spillFileBytes() == fileBytes && !Timeline_spillDraining(),
+        "deleting a spilled message leaves dead space");
+    for (size_t i = 1; i < big; i++) {
+        Timeline_delete(&tl, i);
+    }
+    check(Timeline_spillDraining(), "enough of it starts a new file");
+    check(Timeline_drain(&other, 1000) == 100 && !Timeline_spillDraining() && other.spilled == 100 && Timeline_spillFileBytes() < fileBytes,
+        "and the old one is closed once the messages left in it are moved out");
+    check(intact(&other, 0, 100), "which read back as they went in");
+    Timeline_free(&tl);
+    Timeline_free(&other);
+    check(Timeline_totalResident() == 0 && Timeline_totalSpilled() == 0, "nothing is left over");
+    return failures;
+}
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include "transfer.h"
+
+/**
+ * @brief The transfer a thread should run next: the oldest one queued
+ * whose key isn't busy with another, or one cancelled before it started,
+ * which only has to be cleaned up (NOTE: Caller must hold queue->lock)
+ *
+ * @return struct Transfer*, or NULL if there's nothing that can run yet
+ */
+static struct Transfer* TransferQueue_next(struct TransferQueue* queue) {
+    for (size_t i = 0; i < queue->transfers.N; i++) {
+        struct Transfer* transfer = queue->transfers.data[i];
+        if (transfer->state != TRANSFER_QUEUED) {
+            continue;
+        }
+        if (atomic_load(&transfer->cancelled)) {
+            return transfer;
+        }
+        int busy = 0;
+        for (size_t j = 0; j < queue->transfers.N && !busy; j++) {
+            struct Transfer* other = queue->transfers.data[j];
+            busy = other->key == transfer->key && other->state == TRANSFER_RUNNING;
+        }
+        if (!busy) {
+            return transfer;
+        }
+    }
+    return NULL;
+}
+
+static void TransferQueue_changed(struct TransferQueue* queue) {
+    if (queue->changed != NULL) {
+        queue->changed(queue->ctx);
+    }
+}
+
+static void* TransferQueue_work(void* args) {
+    struct TransferQueue* queue = (struct TransferQueue*)args;
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        struct Transfer* transfer = TransferQueue_next(queue);
+        if (transfer == NULL) {
+            // Only once everything's done, so that stopping never leaves a transfer behind
+            if (queue->stopping && queue->transfers.N == 0) {
+                break;
+            }
+            pthread_cond_wait(&queue->ready, &queue->lock);
+            continue;
+        }
+        transfer->state = TRANSFER_RUNNING;
+        clock_gettime(CLOCK_MONOTONIC, &transfer->started);
+        pthread_mutex_unlock(&queue->lock);
+        TransferQueue_changed(queue);
+        queue->run(queue->ctx, transfer);
+        pthread_mutex_lock(&queue->lock);
+        for (size_t i = 0; i < queue->transfers.N; i++) {
+            if (queue->transfers.data[i] == transfer) {
+                TransferArray_remove(&queue->transfers, i);
+                break;
+            }
+        }
+        // Its key is free for the next transfer with it
+        pthread_cond_broadcast(&queue->ready);
+        pthread_mutex_unlock(&queue->lock);
+        free(transfer->name);
+        free(transfer);
+        TransferQueue_changed(queue);
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+struct TransferQueue* TransferQueue_init(size_t concurrency, TransferQueue_RunFn run, TransferQueue_ChangedFn changed, void* ctx) {
+    if (concurrency == 0) {
+        concurrency = 1;
+    }
+    struct TransferQueue* queue = (struct TransferQueue*)malloc(sizeof(struct TransferQueue));
+    queue->run = run;
+    queue->changed = changed;
+    queue->ctx = ctx;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    TransferArray_init(&queue->transfers);
+    queue->nextId = 1;
+    queue->stopping = 0;
+    queue->size = 0;
+    queue->threads = (pthread_t*)malloc(concurrency*sizeof(pthread_t));
+    while (queue->size < concurrency && pthread_create(&queue->threads[queue->size], NULL, TransferQueue_work, queue) == 0) {
+        queue->size++;
+    }
+    if (queue->size < concurrency) {
+        TransferQueue_free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void TransferQueue_free(struct TransferQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+    for (size_t i = 0; i < queue->size; i++) {
+        pthread_join(queue->threads[i], NULL);
+    }
+    TransferArray_free(&queue->transfers);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->ready);
+    free(queue->threads);
+    free(queue);
+}
+
+uint32_t TransferQueue_add(struct TransferQueue* queue, void* key, const char* name, uint64_t total, void* item) {
+    struct Transfer* transfer = (struct Transfer*)malloc(sizeof(struct Transfer));
+    transfer->key = key;
+    transfer->item = item;
+    transfer->name = strdup(name);
+    transfer->state = TRANSFER_QUEUED;
+    atomic_init(&transfer->done, 0);
+    atomic_init(&transfer->total, total);
+    atomic_init(&transfer->cancelled, 0);
+    atomic_init(&transfer->note, NULL);
+    memset(&transfer->started, 0, sizeof(transfer->started));
+    pthread_mutex_lock(&queue->lock);
+    transfer->id = queue->nextId++;
+    uint32_t id = transfer->id;
+    TransferArray_push(&queue->transfers, transfer);
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+    TransferQueue_changed(queue);
+    return id;
+}
+
+int TransferQueue_cancel(struct TransferQueue* queue, uint32_t id) {
+    int res = -1;
+    pthread_mutex_lock(&queue->lock);
+    for (size_t i = 0; i < queue->transfers.N; i++) {
+        struct Transfer* transfer = queue->transfers.data[i];
+        if (transfer->id == id) {
+            atomic_store(&transfer->cancelled, 1);
+            // If it's still queued, it can be cleaned up now
+            pthread_cond_broadcast(&queue->ready);
+            res = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    if (res == 0) {
+        TransferQueue_changed(queue);
+    }
+    return res;
+}
+
+void TransferQueue_cancelAll(struct TransferQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    for (size_t i = 0; i < queue->transfers.N; i++) {
+        atomic_store(&queue->transfers.data[i]->cancelled, 1);
+    }
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void TransferQueue_note(struct TransferQueue* queue, struct Transfer* transfer, const char* note) {
+    pthread_mutex_lock(&queue->lock);
+    atomic_store(&transfer->note, note);
+    if (note == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &transfer->started);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    TransferQueue_changed(queue);
+}
+
+size_t TransferQueue_each(struct TransferQueue* queue, TransferQueue_EachFn fn, void* ctx) {
+    pthread_mutex_lock(&queue->lock);
+    size_t N = queue->transfers.N;
+    for (size_t i = 0; i < N; i++) {
+        fn(ctx, queue->transfers.data[i]);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return N;
+}
+
+void Transfer_rate(const struct Transfer* transfer, double* bytesPerSecond, double* secondsLeft) {
+    *bytesPerSecond = 0;
+    *secondsLeft = -1;
+    if (transfer->state != TRANSFER_RUNNING) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - transfer->started.tv_sec) + (now.tv_nsec - transfer->started.tv_nsec)*1e-9;
+    uint64_t done = atomic_load(&transfer->done), total = atomic_load(&transfer->total);
+    if (elapsed > 0) {
+        *bytesPerSecond = done/elapsed;
+    }
+    if (*bytesPerSecond > 0 && total >= done) {
+        *secondsLeft = (total - done)/(*bytesPerSecond);
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "arraylist.h"
+
+enum TransferState {
+    TRANSFER_QUEUED = 0, // Waiting for a thread, or for the transfer ahead of it with the same key
+    TRANSFER_RUNNING = 1
+};
+
+/**
+ * Something long running (sending a file, say) done in the background,
+ * with its progress there for anyone to show
+ */
+struct Transfer {
+    uint32_t id; // Unique for the life of the queue, so it can be cancelled by it
+    void* key; // Transfers with the same key run one at a time, in the order they were added (e.g. a chat)
+    void* item; // Passed to run along with the transfer (owned by whoever added it)
+    char* name; // What's being transferred, as shown with its progress (dynamically allocated)
+    int state; // TransferState (guarded by the queue's lock)
+    atomic_uint_fast64_t done; // Bytes so far
+    atomic_uint_fast64_t total; // Bytes in all (0 if that isn't known)
+    atomic_int cancelled; // Set to have run stop as soon as it can
+    _Atomic(const char*) note; // What it's doing while it isn't moving bytes, e.g. "hashing" (a string constant, or NULL)
+    struct timespec started; // When it started running, or last stopped having a note (CLOCK_MONOTONIC, guarded by the queue's lock)
+};
+ARRAYLIST_DEFINE(TransferArray, struct Transfer*)
+
+/**
+ * Called on one of the queue's threads to carry a transfer out, updating
+ * transfer->done as it goes and giving up early once transfer->cancelled
+ * is set.  It's called for every transfer added, even one cancelled
+ * before it started, so that item can always be freed there; that one
+ * may run alongside another with the same key, so it should do nothing
+ * but clean up
+ */
+typedef void (*TransferQueue_RunFn)(void* ctx, struct Transfer* transfer);
+
+/**
+ * Called whenever a transfer is added, starts or finishes (e.g. to have
+ * the list shown again), without the queue's lock held
+ */
+typedef void (*TransferQueue_ChangedFn)(void* ctx);
+
+/**
+ * Called with each transfer in turn, with the queue's lock held
+ */
+typedef void (*TransferQueue_EachFn)(void* ctx, const struct Transfer* transfer);
+
+/**
+ * Transfers waiting for, or running on, a fixed number of threads.  So
+ * many files can be queued at once without starting a thread for each,
+ * and the ones with a key in common (going to the same peer) go one
+ * after the other while ones with different keys run side by side.
+ */
+struct TransferQueue {
+    TransferQueue_RunFn run;
+    TransferQueue_ChangedFn changed; // May be NULL
+    void* ctx; // Passed to run and changed
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // Signalled when a transfer is added or one finishes (with lock held)
+    TransferArray transfers; // Queued and running, oldest first (guarded by lock)
+    uint32_t nextId; // (guarded by lock)
+    int stopping; // (guarded by lock)
+    size_t size; // Number of threads, which is the most transfers that run at once
+    pthread_t* threads;
+};
+
+/**
+ * @brief Start the threads that run transfers
+ *
+ * @param concurrency Most transfers running at once (at least 1)
+ * @param run Carries each transfer out
+ * @param changed Told whenever the transfers change (NULL not to be)
+ * @param ctx Passed to run and changed
+ * @return struct TransferQueue*, or NULL if the threads couldn't be started
+ */
+struct TransferQueue* TransferQueue_init(size_t concurrency, TransferQueue_RunFn run, TransferQueue_ChangedFn changed, void* ctx);
+
+/**
+ * @brief Wait for every transfer to finish, then free the queue.  Cancel
+ * them first (see TransferQueue_cancelAll()) not to wait out whole files
+ */
+void TransferQueue_free(struct TransferQueue* queue);
+
+/**
+ * @brief Queue something to be transferred
+ *
+ * @param key Transfers with the same key run one at a time
+ * @param name What's being transferred (copied)
+ * @param total Bytes in all, if known (0 otherwise)
+ * @param item Passed to run
+ * @return uint32_t The transfer's id
+ */
+uint32_t TransferQueue_add(struct TransferQueue* queue, void* key, const char* name, uint64_t total, void* item);
+
+/**
+ * @brief Have a transfer stop as soon as it can.  One that hasn't started
+ * yet is run straight away (so that its item is cleaned up) with
+ * cancelled already set
+ *
+ * @param id Transfer's id
+ * @return int 0 if there was such a transfer, -1 if it's finished or never existed
+ */
+int TransferQueue_cancel(struct TransferQueue* queue, uint32_t id);
+
+/**
+ * @brief Cancel every transfer queued or running
+ */
+void TransferQueue_cancelAll(struct TransferQueue* queue);
+
+/**
+ * @brief Say what a running transfer is doing before it gets to moving
+ * bytes (hashing a file, say), or clear that with NULL once it does.
+ * Clearing it starts the transfer's rate over, so the time spent
+ * getting ready doesn't drag its throughput down
+ *
+ * @param transfer Transfer being run
+ * @param note A string constant, or NULL
+ */
+void TransferQueue_note(struct TransferQueue* queue, struct Transfer* transfer, const char* note);
+
+/**
+ * @brief Look at every transfer queued or running, oldest first.  fn is
+ * called with the queue's lock held, so it mustn't call back into the queue
+ *
+ * @return size_t Number of transfers
+ */
+size_t TransferQueue_each(struct TransferQueue* queue, TransferQueue_EachFn fn, void* ctx);
+
+/**
+ * @brief How fast a transfer is going, on average since it started (see
+ * TransferQueue_note()), and how long it has left at that rate.  Caller
+ * must hold the queue's lock, as TransferQueue_each()'s fn does, or be
+ * the one running the transfer
+ *
+ * @param transfer Transfer
+ * @param bytesPerSecond Set to its throughput (0 if it hasn't started)
+ * @param secondsLeft Set to the time it has left (-1 if that can't be told yet)
+ */
+void Transfer_rate(const struct Transfer* transfer, double* bytesPerSecond, double* secondsLeft);
+
+#endif
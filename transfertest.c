@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "transfer.h"
+
+#define TRANSFERS 12
+#define KEYS 4
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+void sleepMs(long ms) {
+    struct timespec ts = {ms/1000, (ms % 1000)*1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * What one of the transfers below does: counts itself in and out of
+ * running, and optionally holds on until told to go or cancelled
+ */
+struct Job {
+    int key;
+    int order; // Position among the jobs with the same key
+    atomic_int* hold; // Keep running while this is set (NULL not to)
+    atomic_int ran;
+    atomic_int sawCancelled;
+};
+
+atomic_int running; // Jobs running right now
+atomic_int mostRunning;
+atomic_int keyRunning[KEYS];
+atomic_int keyOverlapped;
+atomic_int keyNext[KEYS]; // Order of the next job expected to run on each key
+atomic_int outOfOrder;
+
+void runJob(void* ctx, struct Transfer* transfer) {
+    (void)ctx;
+    struct Job* job = (struct Job*)transfer->item;
+    atomic_fetch_add(&job->ran, 1);
+    if (atomic_load(&transfer->cancelled)) {
+        atomic_store(&job->sawCancelled, 1);
+        return; // Just cleaning up
+    }
+    int now = atomic_fetch_add(&running, 1) + 1;
+    int most = atomic_load(&mostRunning);
+    while (now > most && !atomic_compare_exchange_weak(&mostRunning, &most, now)) {
+    }
+    if (atomic_fetch_add(&keyRunning[job->key], 1) != 0) {
+        atomic_store(&keyOverlapped, 1);
+    }
+    if (atomic_fetch_add(&keyNext[job->key], 1) != job->order) {
+        atomic_store(&outOfOrder, 1);
+    }
+    for (int i = 0; i < 10; i++) {
+        atomic_fetch_add(&transfer->done, 10);
+        sleepMs(2);
+    }
+    while (job->hold != NULL && atomic_load(job->hold) && !atomic_load(&transfer->cancelled)) {
+        sleepMs(1);
+    }
+    atomic_store(&job->sawCancelled, atomic_load(&transfer->cancelled));
+    atomic_fetch_sub(&keyRunning[job->key], 1);
+    atomic_fetch_sub(&running, 1);
+}
+
+int states[2];
+atomic_int changes;
+
+void countChange(void* ctx) {
+    (void)ctx;
+    atomic_fetch_add(&changes, 1);
+}
+
+void countStates(void* ctx, const struct Transfer* transfer) {
+    (void)ctx;
+    states[transfer->state]++;
+}
+
+int main() {
+    struct Job jobs[TRANSFERS];
+    memset(jobs, 0, sizeof(jobs));
+    struct TransferQueue* queue = TransferQueue_init(2, runJob, countChange, NULL);
+    check(queue != NULL && queue->size == 2, "init");
+    int perKey[KEYS] = {0};
+    for (int i = 0; i < TRANSFERS; i++) {
+        jobs[i].key = i % KEYS;
+        jobs[i].order = perKey[jobs[i].key]++;
+        TransferQueue_add(queue, &keyRunning[jobs[i].key], "job", 100, &jobs[i]);
+    }
+    TransferQueue_free(queue); // Waits for everything queued
+    int once = 1;
+    for (int i = 0; i < TRANSFERS; i++) {
+        once = once && atomic_load(&jobs[i].ran) == 1;
+    }
+    check(once, "every transfer added runs exactly once");
+    check(atomic_load(&mostRunning) == 2, "as many run at once as there are threads, and no more");
+    check(!atomic_load(&keyOverlapped), "transfers with the same key never run at once");
+    check(!atomic_load(&outOfOrder), "and run in the order they were added");
+    check(atomic_load(&changes) == 3*TRANSFERS, "every add, start and finish is told");
+
+    // Cancelling one running, and one queued behind it with the same key
+    queue = TransferQueue_init(3, runJob, NULL, NULL);
+    memset(jobs, 0, sizeof(jobs));
+    memset(keyNext, 0, sizeof(keyNext));
+    atomic_int hold = 1;
+    jobs[0].hold = &hold;
+    jobs[1].order = 1;
+    uint32_t first = TransferQueue_add(queue, &keyRunning[0], "first", 100, &jobs[0]);
+    uint32_t second = TransferQueue_add(queue, &keyRunning[0], "second", 100, &jobs[1]);
+    check(first != second, "transfers get different ids");
+    sleepMs(50);
+    memset(states, 0, sizeof(states));
+    check(TransferQueue_each(queue, countStates, NULL) == 2 && states[TRANSFER_RUNNING] == 1 && states[TRANSFER_QUEUED] == 1,
+        "one runs while the other waits for its key");
+    struct Transfer* shown = queue->transfers.data[0];
+    double rate, left;
+    pthread_mutex_lock(&queue->lock);
+    Transfer_rate(shown, &rate, &left);
+    pthread_mutex_unlock(&queue->lock);
+    check(rate > 0 && left >= 0, "a running transfer has a rate and time left");
+    check(TransferQueue_cancel(queue, second) == 0, "cancel a queued transfer");
+    sleepMs(50);
+    check(atomic_load(&jobs[1].ran) == 1 && atomic_load(&jobs[1].sawCancelled), "it's run at once, cancelled, to be cleaned up");
+    check(atomic_load(&jobs[0].ran) == 1 && !atomic_load(&jobs[0].sawCancelled), "while the one ahead of it carries on");
+    check(TransferQueue_cancel(queue, first) == 0, "cancel a running transfer");
+    sleepMs(50);
+    check(atomic_load(&jobs[0].sawCancelled) && TransferQueue_each(queue, countStates, NULL) == 0, "it stops");
+    check(TransferQueue_cancel(queue, first) == -1, "a finished transfer can't be cancelled");
+
+    jobs[2].key = 1;
+    jobs[2].hold = &hold;
+    jobs[3].key = 2;
+    jobs[3].hold = &hold;
+    TransferQueue_add(queue, &keyRunning[1], "third", 0, &jobs[2]);
+    TransferQueue_add(queue, &keyRunning[2], "fourth", 0, &jobs[3]);
+    sleepMs(20);
+    TransferQueue_cancelAll(queue);
+    TransferQueue_free(queue);
+    check(atomic_load(&jobs[2].sawCancelled) && atomic_load(&jobs[3].sawCancelled), "cancelling everything stops everything");
+    return failures;
+}
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "workerpool.h"
+
+#define WORKERPOOL_EVENTS 64 // Most readiness events taken from epoll at once
+
+static void WorkerQueue_init(struct WorkerQueue* queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->items = NULL;
+    queue->head = 0;
+    queue->N = 0;
+    queue->capacity = 0;
+}
+
+static void WorkerQueue_free(struct WorkerQueue* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+}
+
+static void WorkerQueue_push(struct WorkerQueue* queue, void* item) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->N == queue->capacity) {
+        // Unwrap into a bigger buffer
+        size_t capacity = queue->capacity > 0 ? 2*queue->capacity : 16;
+        void** items = (void**)malloc(capacity*sizeof(void*));
+        for (size_t i = 0; i < queue->N; i++) {
+            items[i] = queue->items[(queue->head + i) % queue->capacity];
+        }
+        free(queue->items);
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+    queue->items[(queue->head + queue->N) % queue->capacity] = item;
+    queue->N++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Take an item from the front (the owner) or the back (a thief)
+ *
+ * @return int 1 if there was one, 0 if the queue was empty
+ */
+static int WorkerQueue_take(struct WorkerQueue* queue, int back, void** item) {
+    pthread_mutex_lock(&queue->lock);
+    int found = queue->N > 0;
+    if (found) {
+        if (back) {
+            *item = queue->items[(queue->head + queue->N - 1) % queue->capacity];
+        }
+        else {
+            *item = queue->items[queue->head];
+            queue->head = (queue->head + 1) % queue->capacity;
+        }
+        queue->N--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static void* WorkerPool_work(void* args) {
+    struct Worker* worker = (struct Worker*)args;
+    struct WorkerPool* pool = worker->pool;
+    size_t self = (size_t)(worker - pool->workers);
+    while (1) {
+        void* item;
+        int found = WorkerQueue_take(&worker->queue, 0, &item), stolen = 0;
+        // Nothing of my own; look through everyone else's, starting with my neighbour
+        for (size_t i = 1; !found && i < pool->size; i++) {
+            found = stolen = WorkerQueue_take(&pool->workers[(self + i) % pool->size].queue, 1, &item);
+        }
+        if (found) {
+            atomic_fetch_sub(&pool->pending, 1);
+            pool->run(pool->ctx, item);
+            atomic_fetch_add(&worker->ran, 1);
+            if (stolen) {
+                atomic_fetch_add(&worker->stolen, 1);
+            }
+            continue;
+        }
+        // Sleep until something's queued.  Submitters count an item as
+        // pending before signalling under idleLock, so a wakeup can't be lost
+        pthread_mutex_lock(&pool->idleLock);
+        while (atomic_load(&pool->pending) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->idle, &pool->idleLock);
+        }
+        int stop = pool->stopping && atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->idleLock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Wait for descriptors to become readable and queue their items
+ */
+static void* WorkerPool_notify(void* args) {
+    struct WorkerPool* pool = (struct WorkerPool*)args;
+    struct epoll_event events[WORKERPOOL_EVENTS];
+    while (1) {
+        int n = epoll_wait(pool->epollFd, events, WORKERPOOL_EVENTS, -1);
+        if (n == -1 && errno != EINTR) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == pool) {
+                return NULL; // Stopping (the self-pipe)
+            }
+            WorkerPool_submit(pool, events[i].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Have the workers finish what's queued, then free everything
+ * (the notifier mustn't be running)
+ */
+static void WorkerPool_stop(struct WorkerPool* pool) {
+    pthread_mutex_lock(&pool->idleLock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->idleLock);
+    for (size_t i = 0; i < pool->size; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        WorkerQueue_free(&pool->workers[i].queue);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (pool->stopFds[i] != -1) {
+            close(pool->stopFds[i]);
+        }
+    }
+    if (pool->epollFd != -1) {
+        close(pool->epollFd);
+    }
+    pthread_mutex_destroy(&pool->idleLock);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->workers);
+    free(pool);
+}
+
+struct WorkerPool* WorkerPool_init(size_t workers, WorkerPool_RunFn run, void* ctx) {
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (size_t)cores : 1;
+    }
+    struct WorkerPool* pool = (struct WorkerPool*)malloc(sizeof(struct WorkerPool));
+    pool->run = run;
+    pool->ctx = ctx;
+    pool->size = 0;
+    pool->workers = (struct Worker*)malloc(workers*sizeof(struct Worker));
+    atomic_store(&pool->next, 0);
+    atomic_store(&pool->pending, 0);
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pool->stopping = 0;
+    pool->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    pool->stopFds[0] = pool->stopFds[1] = -1;
+    struct epoll_event stop;
+    stop.events = EPOLLIN;
+    stop.data.ptr = pool;
+    int ok = pool->epollFd != -1 && pipe(pool->stopFds) == 0
+        && epoll_ctl(pool->epollFd, EPOLL_CTL_ADD, pool->stopFds[0], &stop) == 0;
+    for (size_t i = 0; ok && i < workers; i++) {
+        struct Worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        WorkerQueue_init(&worker->queue);
+        atomic_store(&worker->ran, 0);
+        atomic_store(&worker->stolen, 0);
+        ok = pthread_create(&worker->thread, NULL, WorkerPool_work, worker) == 0;
+        if (ok) {
+            pool->size++;
+        }
+        else {
+            WorkerQueue_free(&worker->queue);
+        }
+    }
+    // Only once every worker is up, since the notifier hands work to any of them
+    if (!ok || pthread_create(&pool->notifier, NULL, WorkerPool_notify, pool) != 0) {
+        WorkerPool_stop(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void WorkerPool_free(struct WorkerPool* pool) {
+    char stop = 1;
+    if (write(pool->stopFds[1], &stop, 1) == 1) {
+        pthread_join(pool->notifier, NULL);
+    }
+    WorkerPool_stop(pool);
+}
+
+void WorkerPool_submit(struct WorkerPool* pool, void* item) {
+    size_t i = atomic_fetch_add(&pool->next, 1) % pool->size;
+    WorkerQueue_push(&pool->workers[i].queue, item);
+    atomic_fetch_add(&pool->pending, 1);
+    pthread_mutex_lock(&pool->idleLock);
+    pthread_cond_signal(&pool->idle);
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+static int WorkerPool_control(struct WorkerPool* pool, int op, int fd, void* item) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.ptr = item;
+    return epoll_ctl(pool->epollFd, op, fd, &event) == 0 ? 0 : -1;
+}
+
+int WorkerPool_watch(struct WorkerPool* pool, int fd, void* item) {
+    return WorkerPool_control(pool, EPOLL_CTL_ADD, fd, item);
+}
+
+int WorkerPool_rearm(struct WorkerPool* pool, int fd, void* item) {
+    return WorkerPool_control(pool, EPOLL_CTL_MOD, fd, item);
+}
+
+int WorkerPool_unwatch(struct WorkerPool* pool, int fd) {
+    return WorkerPool_control(pool, EPOLL_CTL_DEL, fd, NULL);
+}
@@ -0,0 +1,108 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Called on a worker thread with an item that was submitted, or whose
+ * file descriptor became readable
+ */
+typedef void (*WorkerPool_RunFn)(void* ctx, void* item);
+
+/**
+ * One worker's queue of items to run.  The worker takes from the front;
+ * workers with nothing to do take from the back of the others'.
+ */
+struct WorkerQueue {
+    pthread_mutex_t lock;
+    void** items; // Ring buffer
+    size_t head; // Index of the front item
+    size_t N;
+    size_t capacity;
+};
+
+struct Worker {
+    struct WorkerPool* pool;
+    pthread_t thread;
+    struct WorkerQueue queue;
+    atomic_uint_fast64_t ran; // Items run
+    atomic_uint_fast64_t stolen; // Of those, how many were taken from another worker's queue
+};
+
+/**
+ * A fixed number of worker threads, fed by a readiness notifier, in
+ * place of a thread per connection.  File descriptors are watched with
+ * epoll, one shot: when one becomes readable its item is queued on a
+ * worker, and the descriptor isn't watched again until the worker is
+ * done and calls WorkerPool_rearm().  So only one worker ever has a
+ * given item at a time, and things read from a descriptor are handled
+ * in the order they arrived.  A worker that runs out of work takes it
+ * from the others (work stealing), so whichever queue a burst of ready
+ * connections landed on, every worker shares it.
+ */
+struct WorkerPool {
+    WorkerPool_RunFn run;
+    void* ctx; // Passed to run
+    size_t size; // Number of workers
+    struct Worker* workers;
+    atomic_size_t next; // Worker to queue the next item on (round robin)
+    atomic_size_t pending; // Items queued and not yet taken
+    pthread_mutex_t idleLock;
+    pthread_cond_t idle; // Signalled when an item is queued (with idleLock held)
+    int stopping; // (guarded by idleLock)
+    int epollFd;
+    int stopFds[2]; // Self-pipe for stopping the notifier
+    pthread_t notifier;
+};
+
+/**
+ * @brief Start a pool of workers and its notifier
+ *
+ * @param workers Number of worker threads (0 for one per core)
+ * @param run Called with each item
+ * @param ctx Passed to run
+ * @return struct WorkerPool*, or NULL if the threads couldn't be started
+ */
+struct WorkerPool* WorkerPool_init(size_t workers, WorkerPool_RunFn run, void* ctx);
+
+/**
+ * @brief Stop the notifier, let the workers finish what's queued, and
+ * free the pool.  Descriptors still being watched are left open
+ */
+void WorkerPool_free(struct WorkerPool* pool);
+
+/**
+ * @brief Queue an item to be run on a worker
+ */
+void WorkerPool_submit(struct WorkerPool* pool, void* item);
+
+/**
+ * @brief Have an item run whenever a file descriptor is readable (or
+ * hung up).  Each time, the descriptor then has to be rearmed
+ *
+ * @param fd File descriptor, not watched already
+ * @param item Item to run
+ * @return int 0 on success, -1 on failure
+ */
+int WorkerPool_watch(struct WorkerPool* pool, int fd, void* item);
+
+/**
+ * @brief Watch a descriptor again, once its item has read all it's
+ * going to for now.  If it's still readable, the item is run again
+ * straight away
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int WorkerPool_rearm(struct WorkerPool* pool, int fd, void* item);
+
+/**
+ * @brief Stop watching a descriptor (e.g. before closing it)
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int WorkerPool_unwatch(struct WorkerPool* pool, int fd);
+
+#endif
@@ -0,0 +1,165 @@
+// Purpose: Compare a thread per connection against the worker pool, for
+// setting connections up and for reading frames that arrive across all
+// of them
+//
+// Usage: ./workerpoolbench [connections] [frames] [workers]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "workerpool.h"
+
+#define DEFAULT_CONNECTIONS 1000
+#define DEFAULT_FRAMES 200000
+#define FRAME_SIZE 64 // About a short chat message with its header
+#define STACK_SIZE (64*1024) // What each receive thread was given
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/**
+ * One connection: the benchmark writes into fds[1], and a receive
+ * thread or a worker reads from fds[0]
+ */
+struct Connection {
+    int fds[2];
+    struct WorkerPool* pool;
+};
+
+atomic_long received; // Bytes read across every connection
+
+void* receiveThread(void* args) {
+    struct Connection* c = (struct Connection*)args;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(c->fds[0], buf, sizeof(buf))) > 0) {
+        atomic_fetch_add(&received, n);
+    }
+    return NULL;
+}
+
+void receiveReady(void* ctx, void* item) {
+    (void)ctx;
+    struct Connection* c = (struct Connection*)item;
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(c->fds[0], buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        atomic_fetch_add(&received, n);
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        WorkerPool_rearm(c->pool, c->fds[0], c);
+    }
+}
+
+/**
+ * @brief Write frames across the connections in turn, and time how long
+ * it takes until every byte has been read
+ */
+double deliver(struct Connection* connections, long N, long frames) {
+    char frame[FRAME_SIZE];
+    memset(frame, 'x', sizeof(frame));
+    atomic_store(&received, 0);
+    double start = now();
+    for (long i = 0; i < frames; i++) {
+        if (write(connections[i % N].fds[1], frame, sizeof(frame)) != sizeof(frame)) {
+            perror("write");
+            return 0;
+        }
+    }
+    while (atomic_load(&received) < frames*FRAME_SIZE) {
+        sched_yield();
+    }
+    return now() - start;
+}
+
+struct Connection* openConnections(long N) {
+    struct Connection* connections = (struct Connection*)malloc(N*sizeof(struct Connection));
+    for (long i = 0; i < N; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, connections[i].fds) != 0) {
+            perror("socketpair (raise ulimit -n?)");
+            exit(1);
+        }
+    }
+    return connections;
+}
+
+void closeConnections(struct Connection* connections, long N) {
+    for (long i = 0; i < N; i++) {
+        close(connections[i].fds[1]); // Receive threads see the end and exit
+    }
+}
+
+void report(const char* what, long N, long frames, double setup, double reading, long threads) {
+    printf("%-24s %8.2f us per connection set up, %8.0f frames/s read, %6ld threads\n",
+        what, 1e6*setup/N, frames/reading, threads);
+}
+
+int main(int argc, char** argv) {
+    long N = argc > 1 ? atol(argv[1]) : DEFAULT_CONNECTIONS;
+    long frames = argc > 2 ? atol(argv[2]) : DEFAULT_FRAMES;
+    size_t workers = argc > 3 ? (size_t)atol(argv[3]) : 0;
+    printf("%ld connections, %ld frames of %d bytes spread across them\n", N, frames, FRAME_SIZE);
+
+    // A thread per connection, as setupNewChat() used to start
+    struct Connection* connections = openConnections(N);
+    pthread_t* threads = (pthread_t*)malloc(N*sizeof(pthread_t));
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, STACK_SIZE);
+    double start = now();
+    long started = 0;
+    for (; started < N; started++) {
+        if (pthread_create(&threads[started], &attr, receiveThread, &connections[started]) != 0) {
+            printf("(could only start %ld threads)\n", started);
+            break;
+        }
+    }
+    double setup = now() - start;
+    pthread_attr_destroy(&attr);
+    if (started == N) {
+        double reading = deliver(connections, N, frames);
+        report("thread per connection", N, frames, setup, reading, N);
+    }
+    closeConnections(connections, N);
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        close(connections[i].fds[0]);
+    }
+    free(threads);
+    free(connections);
+
+    // The worker pool
+    connections = openConnections(N);
+    struct WorkerPool* pool = WorkerPool_init(workers, receiveReady, NULL);
+    start = now();
+    for (long i = 0; i < N; i++) {
+        connections[i].pool = pool;
+        WorkerPool_watch(pool, connections[i].fds[0], &connections[i]);
+    }
+    setup = now() - start;
+    double reading = deliver(connections, N, frames);
+    char what[64];
+    snprintf(what, sizeof(what), "pool of %zu", pool->size);
+    report(what, N, frames, setup, reading, (long)pool->size + 1);
+    uint64_t ran = 0, stolen = 0;
+    for (size_t i = 0; i < pool->size; i++) {
+        ran += atomic_load(&pool->workers[i].ran);
+        stolen += atomic_load(&pool->workers[i].stolen);
+    }
+    printf("%-24s %llu runs, %llu of them stolen\n", "", (unsigned long long)ran, (unsigned long long)stolen);
+    WorkerPool_free(pool);
+    closeConnections(connections, N);
+    for (long i = 0; i < N; i++) {
+        close(connections[i].fds[0]);
+    }
+    free(connections);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "workerpool.h"
+
+#define ITEMS 10000
+#define PIPES 100
+#define BYTES 50 // Written down each pipe
+
+int failures = 0;
+
+void check(int condition, char* what) {
+    printf("%s: %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) {
+        failures++;
+    }
+}
+
+void sleepMs(long ms) {
+    struct timespec ts = {ms/1000, (ms % 1000)*1000000L};
+    nanosleep(&ts, NULL);
+}
+
+atomic_int runs[ITEMS];
+
+void countRun(void* ctx, void* item) {
+    (void)ctx;
+    atomic_fetch_add(&runs[(int*)item - (int*)runs], 1);
+    if ((int*)item == (int*)runs) {
+        sleepMs(50); // Holds its worker up, so the rest of that worker's queue is taken by others
+    }
+}
+
+/**
+ * A pipe being read from by the pool
+ */
+struct Reader {
+    struct WorkerPool* pool;
+    int fds[2];
+    atomic_int bytes; // Read so far
+    atomic_int inside; // Workers in readByte() with this one right now
+    atomic_int overlapped; // Whether two ever were at once
+};
+
+void readByte(void* ctx, void* item) {
+    (void)ctx;
+    struct Reader* reader = (struct Reader*)item;
+    if (atomic_fetch_add(&reader->inside, 1) != 0) {
+        atomic_store(&reader->overlapped, 1);
+    }
+    char c;
+    // One byte at a time, so each pipe is run many times over
+    if (read(reader->fds[0], &c, 1) == 1) {
+        atomic_fetch_add(&reader->bytes, 1);
+    }
+    atomic_fetch_sub(&reader->inside, 1);
+    WorkerPool_rearm(reader->pool, reader->fds[0], reader);
+}
+
+int main() {
+    struct WorkerPool* pool = WorkerPool_init(4, countRun, NULL);
+    check(pool != NULL && pool->size == 4, "init");
+    for (int i = 0; i < ITEMS; i++) {
+        WorkerPool_submit(pool, &runs[i]);
+    }
+    WorkerPool_free(pool); // Runs everything queued first
+    int once = 1;
+    for (int i = 0; i < ITEMS; i++) {
+        once = once && atomic_load(&runs[i]) == 1;
+    }
+    check(once, "every item submitted runs exactly once");
+
+    pool = WorkerPool_init(4, countRun, NULL);
+    for (int i = 0; i < ITEMS; i++) {
+        atomic_store(&runs[i], 0);
+    }
+    for (int i = 0; i < 100; i++) {
+        WorkerPool_submit(pool, &runs[i]);
+    }
+    sleepMs(20);
+    uint64_t stolen = 0;
+    for (size_t i = 0; i < pool->size; i++) {
+        stolen += atomic_load(&pool->workers[i].stolen);
+    }
+    check(stolen > 0, "idle workers take work queued on a busy one");
+    WorkerPool_free(pool);
+
+    pool = WorkerPool_init(0, readByte, NULL);
+    check(pool != NULL && pool->size == (size_t)sysconf(_SC_NPROCESSORS_ONLN), "one worker per core by default");
+    struct Reader* readers = (struct Reader*)calloc(PIPES, sizeof(struct Reader));
+    for (int i = 0; i < PIPES; i++) {
+        readers[i].pool = pool;
+        if (pipe(readers[i].fds) != 0 || WorkerPool_watch(pool, readers[i].fds[0], &readers[i]) != 0) {
+            check(0, "watch");
+        }
+    }
+    for (int b = 0; b < BYTES; b++) {
+        for (int i = 0; i < PIPES; i++) {
+            if (write(readers[i].fds[1], "x", 1) != 1) {
+                check(0, "write");
+            }
+        }
+    }
+    int all = 0;
+    for (int tries = 0; tries < 500 && !all; tries++) {
+        sleepMs(10);
+        all = 1;
+        for (int i = 0; i < PIPES; i++) {
+            all = all && atomic_load(&readers[i].bytes) == BYTES;
+        }
+    }
+    check(all, "everything written to watched descriptors is read");
+    int overlapped = 0;
+    for (int i = 0; i < PIPES; i++) {
+        overlapped = overlapped || atomic_load(&readers[i].overlapped);
+    }
+    check(!overlapped, "a descriptor is never handled by two workers at once");
+
+    for (int i = 0; i < PIPES; i++) {
+        WorkerPool_unwatch(pool, readers[i].fds[0]);
+    }
+    if (write(readers[0].fds[1], "x", 1) != 1) {
+        check(0, "write");
+    }
+    sleepMs(20);
+    check(atomic_load(&readers[0].bytes) == BYTES, "nor once it's no longer watched");
+    WorkerPool_free(pool);
+    for (int i = 0; i < PIPES; i++) {
+        close(readers[i].fds[0]);
+        close(readers[i].fds[1]);
+    }
+    free(readers);
+    return failures;
+}